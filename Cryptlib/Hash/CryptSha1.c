@@ -135,7 +135,11 @@ Sha1Update (
   //
   // OpenSSL SHA-1 Hash Update
   //
+#if defined (ENABLE_HASH_ACCEL)
+  return Sha1AccelUpdate (Sha1Context, Data, DataSize);
+#else
   return (BOOLEAN)(SHA1_Update ((SHA_CTX *)Sha1Context, Data, DataSize));
+#endif
 }
 
 /**
@@ -133,7 +133,11 @@ Sha256Update (
   //
   // OpenSSL SHA-256 Hash Update
   //
+#if defined (ENABLE_HASH_ACCEL)
+  return Sha256AccelUpdate (Sha256Context, Data, DataSize);
+#else
   return (BOOLEAN)(SHA256_Update ((SHA256_CTX *)Sha256Context, Data, DataSize));
+#endif
 }
 
 /**
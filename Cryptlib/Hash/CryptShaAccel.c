@@ -0,0 +1,684 @@
+/** @file
+  SHA-1 and SHA-256 block compression using CPU hash instructions.
+
+  The OpenSSL digests are built as portable C.  When the processor has
+  dedicated hash instructions (x86_64 SHA extensions, AArch64 SHA1/SHA2
+  cryptographic extensions), whole 64-byte blocks are compressed here and
+  only partial blocks and the final padding go through OpenSSL.  Support is
+  probed once at runtime; without it the OpenSSL C code is used unchanged.
+
+  When SHA_ACCEL_BLOCKS_ONLY is defined only the block functions are built,
+  so that the host benchmark can compile this file without the Cryptlib
+  headers.
+
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#if !defined (SHA_ACCEL_BLOCKS_ONLY)
+#include "InternalCryptLib.h"
+#include <openssl/sha.h>
+#endif
+
+#if defined (MDE_CPU_AARCH64)
+#include <arm_neon.h>
+#endif
+
+#define SHA_ACCEL_SHA1     0x1
+#define SHA_ACCEL_SHA256   0x2
+#define SHA_ACCEL_PROBED   0x80000000
+
+#define SHA_ACCEL_BLOCK_SIZE  64
+
+STATIC UINT32  mShaAccelCaps = 0;
+
+#if defined (MDE_CPU_X64) || defined (MDE_CPU_AARCH64)
+STATIC CONST UINT32  mSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+#endif
+
+#if defined (MDE_CPU_X64)
+
+//
+// The SHA extensions operate on 128-bit XMM registers.  The rest of
+// Cryptlib is built with -mno-sse, so vector code is only enabled for the
+// individual functions below through the target attribute, and no vector
+// value ever crosses a function boundary.
+//
+typedef INT32 SHA_V4SI __attribute__ ((vector_size (16)));
+
+#if defined (__clang__)
+#define SHA_SHUFFLE(A, B, I0, I1, I2, I3)  __builtin_shufflevector ((A), (B), I0, I1, I2, I3)
+#else
+#define SHA_SHUFFLE(A, B, I0, I1, I2, I3)  __builtin_shuffle ((A), (B), (SHA_V4SI) { I0, I1, I2, I3 })
+#endif
+
+#define SHA_BE32(P)  ((INT32)(((UINT32)(P)[0] << 24) | ((UINT32)(P)[1] << 16) | \
+                              ((UINT32)(P)[2] << 8) | (UINT32)(P)[3]))
+
+/**
+  Probe CPUID for the SHA extensions.
+
+  @return  A mask of SHA_ACCEL_* bits supported by the processor.
+
+**/
+STATIC
+UINT32
+ShaAccelProbe (
+  VOID
+  )
+{
+  UINT32  Eax;
+  UINT32  Ebx;
+  UINT32  Ecx;
+  UINT32  Edx;
+
+  __asm__ __volatile__ ("cpuid" : "=a" (Eax), "=b" (Ebx), "=c" (Ecx), "=d" (Edx) : "a" (0), "c" (0));
+  if (Eax < 7) {
+    return 0;
+  }
+
+  //
+  // SSSE3 (ECX bit 9) and SSE4.1 (ECX bit 19) are needed for the shuffles.
+  //
+  __asm__ __volatile__ ("cpuid" : "=a" (Eax), "=b" (Ebx), "=c" (Ecx), "=d" (Edx) : "a" (1), "c" (0));
+  if (((Ecx & (1U << 9)) == 0) || ((Ecx & (1U << 19)) == 0)) {
+    return 0;
+  }
+
+  //
+  // SHA (leaf 7, EBX bit 29) covers both SHA-1 and SHA-256.
+  //
+  __asm__ __volatile__ ("cpuid" : "=a" (Eax), "=b" (Ebx), "=c" (Ecx), "=d" (Edx) : "a" (7), "c" (0));
+  if ((Ebx & (1U << 29)) == 0) {
+    return 0;
+  }
+
+  return SHA_ACCEL_SHA1 | SHA_ACCEL_SHA256;
+}
+
+/**
+  Compress whole SHA-256 blocks with the SHA extensions.
+
+  @param[in, out]  State   SHA-256 chaining state H0..H7.
+  @param[in]       Data    Message blocks.
+  @param[in]       Blocks  Number of 64-byte blocks in Data.
+
+**/
+__attribute__ ((target ("sha,sse4.1")))
+STATIC
+VOID
+Sha256BlocksHw (
+  IN OUT  UINT32       *State,
+  IN      CONST UINT8  *Data,
+  IN      UINTN        Blocks
+  )
+{
+  SHA_V4SI  State0;
+  SHA_V4SI  State1;
+  SHA_V4SI  Tmp;
+  SHA_V4SI  AbefSave;
+  SHA_V4SI  CdghSave;
+  SHA_V4SI  K;
+  SHA_V4SI  Msg[4];
+  UINTN     Index;
+
+  //
+  // sha256rnds2 keeps the working variables as ABEF and CDGH.
+  //
+  Tmp    = (SHA_V4SI) { (INT32)State[0], (INT32)State[1], (INT32)State[2], (INT32)State[3] };
+  State1 = (SHA_V4SI) { (INT32)State[4], (INT32)State[5], (INT32)State[6], (INT32)State[7] };
+  State0 = (SHA_V4SI) { State1[1], State1[0], Tmp[1], Tmp[0] };
+  State1 = (SHA_V4SI) { State1[3], State1[2], Tmp[3], Tmp[2] };
+
+  while (Blocks-- > 0) {
+    AbefSave = State0;
+    CdghSave = State1;
+
+    for (Index = 0; Index < 4; Index++) {
+      Msg[Index] = (SHA_V4SI) {
+        SHA_BE32 (Data + 16 * Index), SHA_BE32 (Data + 16 * Index + 4),
+        SHA_BE32 (Data + 16 * Index + 8), SHA_BE32 (Data + 16 * Index + 12)
+      };
+    }
+
+    for (Index = 0; Index < 16; Index++) {
+      K = (SHA_V4SI) {
+        (INT32)mSha256K[4 * Index], (INT32)mSha256K[4 * Index + 1],
+        (INT32)mSha256K[4 * Index + 2], (INT32)mSha256K[4 * Index + 3]
+      };
+      Tmp    = Msg[Index % 4] + K;
+      State1 = __builtin_ia32_sha256rnds2 (State1, State0, Tmp);
+      Tmp    = SHA_SHUFFLE (Tmp, Tmp, 2, 3, 0, 0);
+      State0 = __builtin_ia32_sha256rnds2 (State0, State1, Tmp);
+
+      if (Index < 12) {
+        Tmp            = __builtin_ia32_sha256msg1 (Msg[Index % 4], Msg[(Index + 1) % 4]);
+        Tmp           += SHA_SHUFFLE (Msg[(Index + 2) % 4], Msg[(Index + 3) % 4], 1, 2, 3, 4);
+        Msg[Index % 4] = __builtin_ia32_sha256msg2 (Tmp, Msg[(Index + 3) % 4]);
+      }
+    }
+
+    State0 += AbefSave;
+    State1 += CdghSave;
+    Data   += SHA_ACCEL_BLOCK_SIZE;
+  }
+
+  State[0] = (UINT32)State0[3];
+  State[1] = (UINT32)State0[2];
+  State[2] = (UINT32)State1[3];
+  State[3] = (UINT32)State1[2];
+  State[4] = (UINT32)State0[1];
+  State[5] = (UINT32)State0[0];
+  State[6] = (UINT32)State1[1];
+  State[7] = (UINT32)State1[0];
+}
+
+/**
+  Compress whole SHA-1 blocks with the SHA extensions.
+
+  @param[in, out]  State   SHA-1 chaining state H0..H4.
+  @param[in]       Data    Message blocks.
+  @param[in]       Blocks  Number of 64-byte blocks in Data.
+
+**/
+__attribute__ ((target ("sha,sse4.1")))
+STATIC
+VOID
+Sha1BlocksHw (
+  IN OUT  UINT32       *State,
+  IN      CONST UINT8  *Data,
+  IN      UINTN        Blocks
+  )
+{
+  SHA_V4SI  Abcd;
+  SHA_V4SI  AbcdSave;
+  SHA_V4SI  E0;
+  SHA_V4SI  E0Save;
+  SHA_V4SI  E1;
+  SHA_V4SI  Prev;
+  SHA_V4SI  Msg[4];
+  UINTN     Index;
+
+  Abcd = (SHA_V4SI) { (INT32)State[3], (INT32)State[2], (INT32)State[1], (INT32)State[0] };
+  E0   = (SHA_V4SI) { 0, 0, 0, (INT32)State[4] };
+  Prev = Abcd;
+
+  while (Blocks-- > 0) {
+    AbcdSave = Abcd;
+    E0Save   = E0;
+
+    for (Index = 0; Index < 4; Index++) {
+      Msg[Index] = (SHA_V4SI) {
+        SHA_BE32 (Data + 16 * Index + 12), SHA_BE32 (Data + 16 * Index + 8),
+        SHA_BE32 (Data + 16 * Index + 4), SHA_BE32 (Data + 16 * Index)
+      };
+    }
+
+    E1 = E0 + Msg[0];
+    for (Index = 0; Index < 20; Index++) {
+      if (Index > 0) {
+        E1 = __builtin_ia32_sha1nexte (Prev, Msg[Index % 4]);
+      }
+
+      //
+      // The round function selector of sha1rnds4 must be an immediate.
+      //
+      Prev = Abcd;
+      switch (Index / 5) {
+        case 0:
+          Abcd = __builtin_ia32_sha1rnds4 (Abcd, E1, 0);
+          break;
+        case 1:
+          Abcd = __builtin_ia32_sha1rnds4 (Abcd, E1, 1);
+          break;
+        case 2:
+          Abcd = __builtin_ia32_sha1rnds4 (Abcd, E1, 2);
+          break;
+        default:
+          Abcd = __builtin_ia32_sha1rnds4 (Abcd, E1, 3);
+          break;
+      }
+
+      if (Index < 16) {
+        E1             = __builtin_ia32_sha1msg1 (Msg[Index % 4], Msg[(Index + 1) % 4]);
+        E1            ^= Msg[(Index + 2) % 4];
+        Msg[Index % 4] = __builtin_ia32_sha1msg2 (E1, Msg[(Index + 3) % 4]);
+      }
+    }
+
+    E0    = __builtin_ia32_sha1nexte (Prev, E0Save);
+    Abcd += AbcdSave;
+    Data += SHA_ACCEL_BLOCK_SIZE;
+  }
+
+  State[0] = (UINT32)Abcd[3];
+  State[1] = (UINT32)Abcd[2];
+  State[2] = (UINT32)Abcd[1];
+  State[3] = (UINT32)Abcd[0];
+  State[4] = (UINT32)E0[3];
+}
+
+#elif defined (MDE_CPU_AARCH64)
+
+#if defined (__clang__)
+#define SHA_ACCEL_TARGET  __attribute__ ((target ("crypto")))
+#else
+#define SHA_ACCEL_TARGET  __attribute__ ((target ("+crypto")))
+#endif
+
+/**
+  Probe ID_AA64ISAR0_EL1 for the SHA1 and SHA2 instructions.
+
+  @return  A mask of SHA_ACCEL_* bits supported by the processor.
+
+**/
+STATIC
+UINT32
+ShaAccelProbe (
+  VOID
+  )
+{
+  UINT64  Isar0;
+  UINT32  Caps;
+
+  __asm__ __volatile__ ("mrs %0, id_aa64isar0_el1" : "=r" (Isar0));
+
+  Caps = 0;
+  if (((Isar0 >> 8) & 0xf) != 0) {
+    Caps |= SHA_ACCEL_SHA1;
+  }
+
+  if (((Isar0 >> 12) & 0xf) != 0) {
+    Caps |= SHA_ACCEL_SHA256;
+  }
+
+  return Caps;
+}
+
+/**
+  Compress whole SHA-256 blocks with the ARMv8 SHA2 instructions.
+
+  @param[in, out]  State   SHA-256 chaining state H0..H7.
+  @param[in]       Data    Message blocks.
+  @param[in]       Blocks  Number of 64-byte blocks in Data.
+
+**/
+SHA_ACCEL_TARGET
+STATIC
+VOID
+Sha256BlocksHw (
+  IN OUT  UINT32       *State,
+  IN      CONST UINT8  *Data,
+  IN      UINTN        Blocks
+  )
+{
+  uint32x4_t  State0;
+  uint32x4_t  State1;
+  uint32x4_t  Save0;
+  uint32x4_t  Save1;
+  uint32x4_t  Tmp;
+  uint32x4_t  Abcd;
+  uint32x4_t  Msg[4];
+  UINTN       Index;
+
+  State0 = vld1q_u32 (State);
+  State1 = vld1q_u32 (State + 4);
+
+  while (Blocks-- > 0) {
+    Save0 = State0;
+    Save1 = State1;
+
+    for (Index = 0; Index < 4; Index++) {
+      Msg[Index] = vreinterpretq_u32_u8 (vrev32q_u8 (vld1q_u8 (Data + 16 * Index)));
+    }
+
+    for (Index = 0; Index < 16; Index++) {
+      Tmp    = vaddq_u32 (Msg[Index % 4], vld1q_u32 (&mSha256K[4 * Index]));
+      Abcd   = State0;
+      State0 = vsha256hq_u32 (State0, State1, Tmp);
+      State1 = vsha256h2q_u32 (State1, Abcd, Tmp);
+
+      if (Index < 12) {
+        Msg[Index % 4] = vsha256su1q_u32 (
+                           vsha256su0q_u32 (Msg[Index % 4], Msg[(Index + 1) % 4]),
+                           Msg[(Index + 2) % 4],
+                           Msg[(Index + 3) % 4]
+                           );
+      }
+    }
+
+    State0 = vaddq_u32 (State0, Save0);
+    State1 = vaddq_u32 (State1, Save1);
+    Data  += SHA_ACCEL_BLOCK_SIZE;
+  }
+
+  vst1q_u32 (State, State0);
+  vst1q_u32 (State + 4, State1);
+}
+
+/**
+  Compress whole SHA-1 blocks with the ARMv8 SHA1 instructions.
+
+  @param[in, out]  State   SHA-1 chaining state H0..H4.
+  @param[in]       Data    Message blocks.
+  @param[in]       Blocks  Number of 64-byte blocks in Data.
+
+**/
+SHA_ACCEL_TARGET
+STATIC
+VOID
+Sha1BlocksHw (
+  IN OUT  UINT32       *State,
+  IN      CONST UINT8  *Data,
+  IN      UINTN        Blocks
+  )
+{
+  STATIC CONST UINT32  K[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+  uint32x4_t           Abcd;
+  uint32x4_t           AbcdSave;
+  uint32x4_t           Tmp;
+  uint32x4_t           Msg[4];
+  UINT32               E0;
+  UINT32               E0Save;
+  UINT32               E1;
+  UINTN                Index;
+
+  Abcd = vld1q_u32 (State);
+  E0   = State[4];
+
+  while (Blocks-- > 0) {
+    AbcdSave = Abcd;
+    E0Save   = E0;
+
+    for (Index = 0; Index < 4; Index++) {
+      Msg[Index] = vreinterpretq_u32_u8 (vrev32q_u8 (vld1q_u8 (Data + 16 * Index)));
+    }
+
+    for (Index = 0; Index < 20; Index++) {
+      Tmp = vaddq_u32 (Msg[Index % 4], vdupq_n_u32 (K[Index / 5]));
+      E1  = vsha1h_u32 (vgetq_lane_u32 (Abcd, 0));
+      switch (Index / 5) {
+        case 0:
+          Abcd = vsha1cq_u32 (Abcd, E0, Tmp);
+          break;
+        case 2:
+          Abcd = vsha1mq_u32 (Abcd, E0, Tmp);
+          break;
+        default:
+          Abcd = vsha1pq_u32 (Abcd, E0, Tmp);
+          break;
+      }
+
+      E0 = E1;
+
+      if (Index < 16) {
+        Msg[Index % 4] = vsha1su1q_u32 (
+                           vsha1su0q_u32 (Msg[Index % 4], Msg[(Index + 1) % 4], Msg[(Index + 2) % 4]),
+                           Msg[(Index + 3) % 4]
+                           );
+      }
+    }
+
+    Abcd  = vaddq_u32 (Abcd, AbcdSave);
+    E0   += E0Save;
+    Data += SHA_ACCEL_BLOCK_SIZE;
+  }
+
+  vst1q_u32 (State, Abcd);
+  State[4] = E0;
+}
+
+#else
+
+STATIC
+UINT32
+ShaAccelProbe (
+  VOID
+  )
+{
+  return 0;
+}
+
+#endif
+
+/**
+  Return the hash instructions usable on this processor, probing only once.
+
+**/
+STATIC
+UINT32
+ShaAccelCaps (
+  VOID
+  )
+{
+  if ((mShaAccelCaps & SHA_ACCEL_PROBED) == 0) {
+    mShaAccelCaps = ShaAccelProbe () | SHA_ACCEL_PROBED;
+  }
+
+  return mShaAccelCaps;
+}
+
+/**
+  Compress whole SHA-256 blocks with CPU hash instructions, if present.
+
+  @param[in, out]  State   SHA-256 chaining state H0..H7.
+  @param[in]       Data    Message blocks.
+  @param[in]       Blocks  Number of 64-byte blocks in Data.
+
+  @retval TRUE   The blocks were compressed into State.
+  @retval FALSE  No hardware support; State is unchanged.
+
+**/
+BOOLEAN
+Sha256AccelBlocks (
+  IN OUT  UINT32       *State,
+  IN      CONST UINT8  *Data,
+  IN      UINTN        Blocks
+  )
+{
+  if ((ShaAccelCaps () & SHA_ACCEL_SHA256) == 0) {
+    return FALSE;
+  }
+
+#if defined (MDE_CPU_X64) || defined (MDE_CPU_AARCH64)
+  Sha256BlocksHw (State, Data, Blocks);
+#endif
+  return TRUE;
+}
+
+/**
+  Compress whole SHA-1 blocks with CPU hash instructions, if present.
+
+  @param[in, out]  State   SHA-1 chaining state H0..H4.
+  @param[in]       Data    Message blocks.
+  @param[in]       Blocks  Number of 64-byte blocks in Data.
+
+  @retval TRUE   The blocks were compressed into State.
+  @retval FALSE  No hardware support; State is unchanged.
+
+**/
+BOOLEAN
+Sha1AccelBlocks (
+  IN OUT  UINT32       *State,
+  IN      CONST UINT8  *Data,
+  IN      UINTN        Blocks
+  )
+{
+  if ((ShaAccelCaps () & SHA_ACCEL_SHA1) == 0) {
+    return FALSE;
+  }
+
+#if defined (MDE_CPU_X64) || defined (MDE_CPU_AARCH64)
+  Sha1BlocksHw (State, Data, Blocks);
+#endif
+  return TRUE;
+}
+
+#if !defined (SHA_ACCEL_BLOCKS_ONLY)
+
+/**
+  Account for Length bytes of compressed data in an OpenSSL bit count, the
+  same way OpenSSL's md32_common.h does.
+
+**/
+STATIC
+VOID
+ShaAccelAddLength (
+  IN OUT  SHA_LONG  *Nl,
+  IN OUT  SHA_LONG  *Nh,
+  IN      UINTN     Length
+  )
+{
+  SHA_LONG  Low;
+
+  Low = (*Nl + (((SHA_LONG)Length) << 3)) & 0xffffffffUL;
+  if (Low < *Nl) {
+    (*Nh)++;
+  }
+
+  *Nh += (SHA_LONG)((UINT64)Length >> 29);
+  *Nl  = Low;
+}
+
+/**
+  SHA256_Update() replacement which compresses whole blocks in hardware.
+
+  @param[in, out]  Context   OpenSSL SHA-256 context.
+  @param[in]       Data      Data to be hashed.
+  @param[in]       DataSize  Size of Data in bytes.
+
+  @retval TRUE   Data was added to the digest.
+  @retval FALSE  OpenSSL failed to update the context.
+
+**/
+BOOLEAN
+Sha256AccelUpdate (
+  IN OUT  VOID        *Context,
+  IN      CONST VOID  *Data,
+  IN      UINTN       DataSize
+  )
+{
+  SHA256_CTX   *Ctx;
+  CONST UINT8  *Bytes;
+  UINTN        Fill;
+  UINTN        Blocks;
+
+  Ctx   = (SHA256_CTX *)Context;
+  Bytes = (CONST UINT8 *)Data;
+
+  if ((DataSize < SHA_ACCEL_BLOCK_SIZE) ||
+      ((ShaAccelCaps () & SHA_ACCEL_SHA256) == 0))
+  {
+    return (BOOLEAN)(SHA256_Update (Ctx, Data, DataSize));
+  }
+
+  //
+  // Complete any block OpenSSL is still holding on to.
+  //
+  if (Ctx->num != 0) {
+    Fill = MIN (SHA_ACCEL_BLOCK_SIZE - (UINTN)Ctx->num, DataSize);
+    if (!SHA256_Update (Ctx, Bytes, Fill)) {
+      return FALSE;
+    }
+
+    Bytes    += Fill;
+    DataSize -= Fill;
+  }
+
+  Blocks = DataSize / SHA_ACCEL_BLOCK_SIZE;
+  if (Blocks > 0) {
+    Sha256AccelBlocks (Ctx->h, Bytes, Blocks);
+    ShaAccelAddLength (&Ctx->Nl, &Ctx->Nh, Blocks * SHA_ACCEL_BLOCK_SIZE);
+    Bytes    += Blocks * SHA_ACCEL_BLOCK_SIZE;
+    DataSize -= Blocks * SHA_ACCEL_BLOCK_SIZE;
+  }
+
+  if (DataSize == 0) {
+    return TRUE;
+  }
+
+  return (BOOLEAN)(SHA256_Update (Ctx, Bytes, DataSize));
+}
+
+/**
+  SHA1_Update() replacement which compresses whole blocks in hardware.
+
+  @param[in, out]  Context   OpenSSL SHA-1 context.
+  @param[in]       Data      Data to be hashed.
+  @param[in]       DataSize  Size of Data in bytes.
+
+  @retval TRUE   Data was added to the digest.
+  @retval FALSE  OpenSSL failed to update the context.
+
+**/
+BOOLEAN
+Sha1AccelUpdate (
+  IN OUT  VOID        *Context,
+  IN      CONST VOID  *Data,
+  IN      UINTN       DataSize
+  )
+{
+  SHA_CTX      *Ctx;
+  CONST UINT8  *Bytes;
+  UINTN        Fill;
+  UINTN        Blocks;
+  UINT32       State[5];
+
+  Ctx   = (SHA_CTX *)Context;
+  Bytes = (CONST UINT8 *)Data;
+
+  if ((DataSize < SHA_ACCEL_BLOCK_SIZE) ||
+      ((ShaAccelCaps () & SHA_ACCEL_SHA1) == 0))
+  {
+    return (BOOLEAN)(SHA1_Update (Ctx, Data, DataSize));
+  }
+
+  if (Ctx->num != 0) {
+    Fill = MIN (SHA_ACCEL_BLOCK_SIZE - (UINTN)Ctx->num, DataSize);
+    if (!SHA1_Update (Ctx, Bytes, Fill)) {
+      return FALSE;
+    }
+
+    Bytes    += Fill;
+    DataSize -= Fill;
+  }
+
+  Blocks = DataSize / SHA_ACCEL_BLOCK_SIZE;
+  if (Blocks > 0) {
+    //
+    // SHA_CTX keeps the state as five named words rather than an array.
+    //
+    State[0] = Ctx->h0;
+    State[1] = Ctx->h1;
+    State[2] = Ctx->h2;
+    State[3] = Ctx->h3;
+    State[4] = Ctx->h4;
+    Sha1AccelBlocks (State, Bytes, Blocks);
+    Ctx->h0 = State[0];
+    Ctx->h1 = State[1];
+    Ctx->h2 = State[2];
+    Ctx->h3 = State[3];
+    Ctx->h4 = State[4];
+
+    ShaAccelAddLength (&Ctx->Nl, &Ctx->Nh, Blocks * SHA_ACCEL_BLOCK_SIZE);
+    Bytes    += Blocks * SHA_ACCEL_BLOCK_SIZE;
+    DataSize -= Blocks * SHA_ACCEL_BLOCK_SIZE;
+  }
+
+  if (DataSize == 0) {
+    return TRUE;
+  }
+
+  return (BOOLEAN)(SHA1_Update (Ctx, Bytes, DataSize));
+}
+
+#endif
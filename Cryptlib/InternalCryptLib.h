@@ -65,4 +65,75 @@ WrapPkcs7Data (
   OUT UINTN        *WrapDataSize
   );
 
+/**
+  Verifies the signers' signatures over the content of already parsed PKCS#7
+  signed data, without verifying their certificate chains.
+
+  @param[in]  Pkcs7        Pointer to the parsed PKCS7 object.
+  @param[in]  InData       Pointer to the content to be verified.
+  @param[in]  DataLength   Length of InData in bytes.
+
+  @retval  TRUE  The signatures are valid.
+  @retval  FALSE The signatures are invalid, or there are none.
+
+**/
+BOOLEAN
+Pkcs7VerifySignerSignatures (
+  IN  VOID         *Pkcs7,
+  IN  CONST UINT8  *InData,
+  IN  UINTN        DataLength
+  );
+
+/**
+  Finds the first of a list of trusted certificates that the signers of
+  parsed PKCS#7 signed data chain to. See CryptPkcs7VerifyCommon.c.
+
+  @param[in]  Pkcs7         Pointer to the parsed PKCS7 object.
+  @param[in]  AnchorStore   Store built from TrustedX509s by
+                            Pkcs7NewAnchorStore(), or NULL.
+  @param[in]  TrustedX509s  Array of trusted/root X509 objects.
+  @param[in]  Count         Number of entries in TrustedX509s.
+  @param[out] Index         Index in TrustedX509s of the matching certificate.
+
+  @retval  TRUE  The signers chain to TrustedX509s[*Index].
+  @retval  FALSE They don't chain to any of TrustedX509s.
+
+**/
+BOOLEAN
+Pkcs7VerifyAnchors (
+  IN  VOID   *Pkcs7,
+  IN  VOID   *AnchorStore,
+  IN  VOID   **TrustedX509s,
+  IN  UINTN  Count,
+  OUT UINTN  *Index
+  );
+
+#if defined (ENABLE_HASH_ACCEL)
+
+/**
+  SHA256_Update() replacement which compresses whole blocks with CPU hash
+  instructions when available.  See Hash/CryptShaAccel.c.
+
+**/
+BOOLEAN
+Sha256AccelUpdate (
+  IN OUT  VOID        *Context,
+  IN      CONST VOID  *Data,
+  IN      UINTN       DataSize
+  );
+
+/**
+  SHA1_Update() replacement which compresses whole blocks with CPU hash
+  instructions when available.  See Hash/CryptShaAccel.c.
+
+**/
+BOOLEAN
+Sha1AccelUpdate (
+  IN OUT  VOID        *Context,
+  IN      CONST VOID  *Data,
+  IN      UINTN       DataSize
+  );
+
+#endif
+
 #endif
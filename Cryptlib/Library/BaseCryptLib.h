@@ -2549,6 +2549,73 @@ Pkcs7Verify (
   IN  UINTN        DataLength
   );
 
+/**
+  Verifies the validity of a PKCS#7 signed data as described in "PKCS #7:
+  Cryptographic Message Syntax Standard", against a trusted certificate that
+  has already been decoded. The input signed data could be wrapped in a
+  ContentInfo structure.
+
+  If P7Data, TrustedX509 or InData is NULL, then return FALSE.
+  If P7Length or DataLength overflow, then return FALSE.
+  If this interface is not supported, then return FALSE.
+
+  @param[in]  P7Data       Pointer to the PKCS#7 message to verify.
+  @param[in]  P7Length     Length of the PKCS#7 message in bytes.
+  @param[in]  TrustedX509  Pointer to a trusted/root X509 object, as returned by
+                           X509ConstructCertificate(), which is used for
+                           certificate chain verification. It is not freed.
+  @param[in]  InData       Pointer to the content to be verified.
+  @param[in]  DataLength   Length of InData in bytes.
+
+  @retval  TRUE  The specified PKCS#7 signed data is valid.
+  @retval  FALSE Invalid PKCS#7 signed data.
+  @retval  FALSE This interface is not supported.
+
+**/
+BOOLEAN
+EFIAPI
+Pkcs7VerifyX509 (
+  IN  CONST UINT8  *P7Data,
+  IN  UINTN        P7Length,
+  IN  VOID         *TrustedX509,
+  IN  CONST UINT8  *InData,
+  IN  UINTN        DataLength
+  );
+
+/**
+  Builds an X509 store of trusted certificates, set up for Authenticode
+  chain verification, which can be kept and passed to
+  AuthenticodeVerifyAnchors() for any number of signatures.
+
+  If this interface is not supported, then return NULL.
+
+  @param[in]  TrustedX509s  Array of trusted/root X509 objects, as returned by
+                            X509ConstructCertificate(). NULL entries are
+                            skipped. They are not freed with the store.
+  @param[in]  Count         Number of entries in TrustedX509s.
+
+  @return  The store, to be freed with Pkcs7FreeAnchorStore(), or NULL.
+
+**/
+VOID *
+EFIAPI
+Pkcs7NewAnchorStore (
+  IN  VOID   **TrustedX509s,
+  IN  UINTN  Count
+  );
+
+/**
+  Releases a store built by Pkcs7NewAnchorStore().
+
+  @param[in]  AnchorStore  Pointer to the store to be freed, or NULL.
+
+**/
+VOID
+EFIAPI
+Pkcs7FreeAnchorStore (
+  IN  VOID  *AnchorStore
+  );
+
 /**
   This function receives a PKCS7 formatted signature, and then verifies that
   the specified Enhanced or Extended Key Usages (EKU's) are present in the end-entity
@@ -2655,6 +2722,122 @@ AuthenticodeVerify (
   IN  UINTN        HashSize
   );
 
+/**
+  Verifies the validity of a PE/COFF Authenticode Signature as described in "Windows
+  Authenticode Portable Executable Signature Format", against a trusted certificate
+  that has already been decoded with X509ConstructCertificate().
+
+  If AuthData is NULL, then return FALSE.
+  If TrustedX509 is NULL, then return FALSE.
+  If ImageHash is NULL, then return FALSE.
+  If this interface is not supported, then return FALSE.
+
+  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
+                           PE/COFF image to be verified.
+  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
+  @param[in]  TrustedX509  Pointer to a trusted/root X509 object, which is used for
+                           certificate chain verification. It is not freed.
+  @param[in]  ImageHash    Pointer to the original image file hash value. The procedure
+                           for calculating the image hash value is described in Authenticode
+                           specification.
+  @param[in]  HashSize     Size of Image hash value in bytes.
+
+  @retval  TRUE   The specified Authenticode Signature is valid.
+  @retval  FALSE  Invalid Authenticode Signature.
+  @retval  FALSE  This interface is not supported.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeVerifyX509 (
+  IN  CONST UINT8  *AuthData,
+  IN  UINTN        DataSize,
+  IN  VOID         *TrustedX509,
+  IN  CONST UINT8  *ImageHash,
+  IN  UINTN        HashSize
+  );
+
+/**
+  Parses a PE/COFF Authenticode Signature as described in "Windows Authenticode
+  Portable Executable Signature Format", and verifies that it is a signature of
+  the image with ImageHash and that its signers' signatures are good. Which
+  trusted certificates it chains to is left to AuthenticodeVerifyAnchors().
+
+  If AuthData is NULL, then return FALSE.
+  If ImageHash is NULL, then return FALSE.
+  If Context is NULL, then return FALSE.
+  If this interface is not supported, then return FALSE.
+
+  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
+                           PE/COFF image to be verified.
+  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
+  @param[in]  ImageHash    Pointer to the original image file hash value. The procedure
+                           for calculating the image hash value is described in Authenticode
+                           specification.
+  @param[in]  HashSize     Size of Image hash value in bytes.
+  @param[out] Context      The parsed signature, to be freed with AuthenticodeFree().
+
+  @retval  TRUE   The signature matches the image, and *Context is set.
+  @retval  FALSE  Invalid Authenticode Signature.
+  @retval  FALSE  This interface is not supported.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeParse (
+  IN  CONST UINT8  *AuthData,
+  IN  UINTN        DataSize,
+  IN  CONST UINT8  *ImageHash,
+  IN  UINTN        HashSize,
+  OUT VOID         **Context
+  );
+
+/**
+  Checks whether a signature parsed with AuthenticodeParse() chains to any of
+  a list of trusted certificates, and if so to which one first, as
+  AuthenticodeVerifyX509() would find trying each in turn.
+
+  If Context is NULL, then return FALSE.
+  If TrustedX509s is NULL, then return FALSE.
+  If Index is NULL, then return FALSE.
+  If this interface is not supported, then return FALSE.
+
+  @param[in]  Context       The signature, as returned by AuthenticodeParse().
+  @param[in]  AnchorStore   Store built from TrustedX509s and Count with
+                            Pkcs7NewAnchorStore(), or NULL to build one for
+                            this call.
+  @param[in]  TrustedX509s  Array of trusted/root X509 objects. NULL entries
+                            are skipped.
+  @param[in]  Count         Number of entries in TrustedX509s.
+  @param[out] Index         Index in TrustedX509s of the matching certificate.
+
+  @retval  TRUE   The signature chains to TrustedX509s[*Index].
+  @retval  FALSE  It doesn't chain to any of them.
+  @retval  FALSE  This interface is not supported.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeVerifyAnchors (
+  IN  VOID   *Context,
+  IN  VOID   *AnchorStore,
+  IN  VOID   **TrustedX509s,
+  IN  UINTN  Count,
+  OUT UINTN  *Index
+  );
+
+/**
+  Releases a signature parsed with AuthenticodeParse().
+
+  @param[in]  Context  The signature to be freed, or NULL.
+
+**/
+VOID
+EFIAPI
+AuthenticodeFree (
+  IN  VOID  *Context
+  );
+
 /**
   Verifies the validity of a RFC3161 Timestamp CounterSignature embedded in PE/COFF Authenticode
   signature.
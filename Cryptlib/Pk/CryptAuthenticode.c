@@ -6,8 +6,8 @@
   This external input must be validated carefully to avoid security issue like
   buffer overflow, integer overflow.
 
-  AuthenticodeVerify() will get PE/COFF Authenticode and will do basic check for
-  data structure.
+  AuthenticodeVerify() and AuthenticodeParse() will get PE/COFF Authenticode and
+  will do basic check for data structure.
 
 Copyright (c) 2011 - 2020, Intel Corporation. All rights reserved.<BR>
 SPDX-License-Identifier: BSD-2-Clause-Patent
@@ -28,80 +28,39 @@ GLOBAL_REMOVE_IF_UNREFERENCED const UINT8  mSpcIndirectOidValue[] = {
 };
 
 /**
-  Verifies the validity of a PE/COFF Authenticode Signature as described in "Windows
-  Authenticode Portable Executable Signature Format".
-
-  If AuthData is NULL, then return FALSE.
-  If ImageHash is NULL, then return FALSE.
-
-  Caution: This function may receive untrusted input.
-  PE/COFF Authenticode is external input, so this function will do basic check for
-  Authenticode data structure.
+  Checks that parsed PKCS#7 signed data is an Authenticode signature of an
+  image with the given hash, and finds the SpcIndirectDataContent its signers
+  signed.
 
-  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
-                           PE/COFF image to be verified.
-  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
-  @param[in]  TrustedCert  Pointer to a trusted/root certificate encoded in DER, which
-                           is used for certificate chain verification.
-  @param[in]  CertSize     Size of the trusted certificate in bytes.
-  @param[in]  ImageHash    Pointer to the original image file hash value. The procedure
-                           for calculating the image hash value is described in Authenticode
-                           specification.
+  @param[in]  Pkcs7        Pointer to the parsed PKCS7 object.
+  @param[in]  ImageHash    Pointer to the original image file hash value.
   @param[in]  HashSize     Size of Image hash value in bytes.
+  @param[out] Content      SpcIndirectDataContent, inside Pkcs7.
+  @param[out] ContentSize  Size of Content in bytes.
 
-  @retval  TRUE   The specified Authenticode Signature is valid.
-  @retval  FALSE  Invalid Authenticode Signature.
+  @retval  TRUE   It is an Authenticode signature of the image.
+  @retval  FALSE  It isn't.
 
 **/
+STATIC
 BOOLEAN
-EFIAPI
-AuthenticodeVerify (
-  IN  CONST UINT8  *AuthData,
-  IN  UINTN        DataSize,
-  IN  CONST UINT8  *TrustedCert,
-  IN  UINTN        CertSize,
+AuthenticodeCheckContent (
+  IN  PKCS7        *Pkcs7,
   IN  CONST UINT8  *ImageHash,
-  IN  UINTN        HashSize
+  IN  UINTN        HashSize,
+  OUT UINT8        **Content,
+  OUT UINTN        *ContentSize
   )
 {
-  BOOLEAN      Status;
-  PKCS7        *Pkcs7;
-  CONST UINT8  *Temp;
-  CONST UINT8  *OrigAuthData;
   UINT8        *SpcIndirectDataContent;
   UINT8        Asn1Byte;
-  UINTN        ContentSize;
   CONST UINT8  *SpcIndirectDataOid;
 
-  //
-  // Check input parameters.
-  //
-  if ((AuthData == NULL) || (TrustedCert == NULL) || (ImageHash == NULL)) {
-    return FALSE;
-  }
-
-  if ((DataSize > INT_MAX) || (CertSize > INT_MAX) || (HashSize > INT_MAX)) {
-    return FALSE;
-  }
-
-  Status       = FALSE;
-  Pkcs7        = NULL;
-  OrigAuthData = AuthData;
-
-  //
-  // Retrieve & Parse PKCS#7 Data (DER encoding) from Authenticode Signature
-  //
-  Temp  = AuthData;
-  Pkcs7 = d2i_PKCS7 (NULL, &Temp, (int)DataSize);
-  if (Pkcs7 == NULL) {
-    goto _Exit;
-  }
-
   //
   // Check if it's PKCS#7 Signed Data (for Authenticode Scenario)
   //
   if (!PKCS7_type_is_signed (Pkcs7) || PKCS7_get_detached (Pkcs7)) {
-    goto _Exit;
+    return FALSE;
   }
 
   //
@@ -111,7 +70,7 @@ AuthenticodeVerify (
   //
   SpcIndirectDataOid = OBJ_get0_data (Pkcs7->d.sign->contents->type);
   if (SpcIndirectDataOid == NULL) {
-    goto _Exit;
+    return FALSE;
   }
 
   if ((OBJ_length (Pkcs7->d.sign->contents->type) != sizeof (mSpcIndirectOidValue)) ||
@@ -124,7 +83,7 @@ AuthenticodeVerify (
     //
     // Un-matched SPC_INDIRECT_DATA_OBJID.
     //
-    goto _Exit;
+    return FALSE;
   }
 
   SpcIndirectDataContent = (UINT8 *)(Pkcs7->d.sign->contents->d.other->value.asn1_string->data);
@@ -138,7 +97,7 @@ AuthenticodeVerify (
     //
     // Short Form of Length Encoding (Length < 128)
     //
-    ContentSize = (UINTN)(Asn1Byte & 0x7F);
+    *ContentSize = (UINTN)(Asn1Byte & 0x7F);
     //
     // Skip the SEQUENCE Tag;
     //
@@ -147,7 +106,7 @@ AuthenticodeVerify (
     //
     // Long Form of Length Encoding (128 <= Length < 255, Single Octet)
     //
-    ContentSize = (UINTN)(*(UINT8 *)(SpcIndirectDataContent + 2));
+    *ContentSize = (UINTN)(*(UINT8 *)(SpcIndirectDataContent + 2));
     //
     // Skip the SEQUENCE Tag;
     //
@@ -156,14 +115,14 @@ AuthenticodeVerify (
     //
     // Long Form of Length Encoding (Length > 255, Two Octet)
     //
-    ContentSize = (UINTN)(*(UINT8 *)(SpcIndirectDataContent + 2));
-    ContentSize = (ContentSize << 8) + (UINTN)(*(UINT8 *)(SpcIndirectDataContent + 3));
+    *ContentSize = (UINTN)(*(UINT8 *)(SpcIndirectDataContent + 2));
+    *ContentSize = (*ContentSize << 8) + (UINTN)(*(UINT8 *)(SpcIndirectDataContent + 3));
     //
     // Skip the SEQUENCE Tag;
     //
     SpcIndirectDataContent += 4;
   } else {
-    goto _Exit;
+    return FALSE;
   }
 
   //
@@ -171,17 +130,93 @@ AuthenticodeVerify (
   // defined in Authenticode
   // NOTE: Need to double-check HashLength here!
   //
-  if (CompareMem (SpcIndirectDataContent + ContentSize - HashSize, ImageHash, HashSize) != 0) {
+  if (CompareMem (SpcIndirectDataContent + *ContentSize - HashSize, ImageHash, HashSize) != 0) {
     //
     // Un-matched PE/COFF Hash Value
     //
+    return FALSE;
+  }
+
+  *Content = SpcIndirectDataContent;
+  return TRUE;
+}
+
+/**
+  Verifies the validity of a PE/COFF Authenticode Signature against either a
+  DER-encoded trusted certificate or an already decoded X509 object.
+
+  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
+                           PE/COFF image to be verified.
+  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
+  @param[in]  TrustedCert  Pointer to a trusted/root certificate encoded in DER, or NULL
+                           if TrustedX509 is used instead.
+  @param[in]  CertSize     Size of the trusted certificate in bytes.
+  @param[in]  TrustedX509  Pointer to a trusted/root X509 object, or NULL if
+                           TrustedCert is used instead.
+  @param[in]  ImageHash    Pointer to the original image file hash value.
+  @param[in]  HashSize     Size of Image hash value in bytes.
+
+  @retval  TRUE   The specified Authenticode Signature is valid.
+  @retval  FALSE  Invalid Authenticode Signature.
+
+**/
+STATIC
+BOOLEAN
+AuthenticodeVerifyCommon (
+  IN  CONST UINT8  *AuthData,
+  IN  UINTN        DataSize,
+  IN  CONST UINT8  *TrustedCert,
+  IN  UINTN        CertSize,
+  IN  VOID         *TrustedX509,
+  IN  CONST UINT8  *ImageHash,
+  IN  UINTN        HashSize
+  )
+{
+  BOOLEAN      Status;
+  PKCS7        *Pkcs7;
+  CONST UINT8  *Temp;
+  CONST UINT8  *OrigAuthData;
+  UINT8        *SpcIndirectDataContent;
+  UINTN        ContentSize;
+
+  //
+  // Check input parameters.
+  //
+  if ((AuthData == NULL) || ((TrustedCert == NULL) && (TrustedX509 == NULL)) ||
+      (ImageHash == NULL))
+  {
+    return FALSE;
+  }
+
+  if ((DataSize > INT_MAX) || (CertSize > INT_MAX) || (HashSize > INT_MAX)) {
+    return FALSE;
+  }
+
+  Status       = FALSE;
+  Pkcs7        = NULL;
+  OrigAuthData = AuthData;
+
+  //
+  // Retrieve & Parse PKCS#7 Data (DER encoding) from Authenticode Signature
+  //
+  Temp  = AuthData;
+  Pkcs7 = d2i_PKCS7 (NULL, &Temp, (int)DataSize);
+  if (Pkcs7 == NULL) {
+    goto _Exit;
+  }
+
+  if (!AuthenticodeCheckContent (Pkcs7, ImageHash, HashSize, &SpcIndirectDataContent, &ContentSize)) {
     goto _Exit;
   }
 
   //
   // Verifies the PKCS#7 Signed Data in PE/COFF Authenticode Signature
   //
-  Status = (BOOLEAN)Pkcs7Verify (OrigAuthData, DataSize, TrustedCert, CertSize, SpcIndirectDataContent, ContentSize);
+  if (TrustedX509 != NULL) {
+    Status = Pkcs7VerifyX509 (OrigAuthData, DataSize, TrustedX509, SpcIndirectDataContent, ContentSize);
+  } else {
+    Status = (BOOLEAN)Pkcs7Verify (OrigAuthData, DataSize, TrustedCert, CertSize, SpcIndirectDataContent, ContentSize);
+  }
 
 _Exit:
   //
@@ -191,3 +226,214 @@ _Exit:
 
   return Status;
 }
+
+/**
+  Verifies the validity of a PE/COFF Authenticode Signature as described in "Windows
+  Authenticode Portable Executable Signature Format".
+
+  If AuthData is NULL, then return FALSE.
+  If ImageHash is NULL, then return FALSE.
+
+  Caution: This function may receive untrusted input.
+  PE/COFF Authenticode is external input, so this function will do basic check for
+  Authenticode data structure.
+
+  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
+                           PE/COFF image to be verified.
+  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
+  @param[in]  TrustedCert  Pointer to a trusted/root certificate encoded in DER, which
+                           is used for certificate chain verification.
+  @param[in]  CertSize     Size of the trusted certificate in bytes.
+  @param[in]  ImageHash    Pointer to the original image file hash value. The procedure
+                           for calculating the image hash value is described in Authenticode
+                           specification.
+  @param[in]  HashSize     Size of Image hash value in bytes.
+
+  @retval  TRUE   The specified Authenticode Signature is valid.
+  @retval  FALSE  Invalid Authenticode Signature.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeVerify (
+  IN  CONST UINT8  *AuthData,
+  IN  UINTN        DataSize,
+  IN  CONST UINT8  *TrustedCert,
+  IN  UINTN        CertSize,
+  IN  CONST UINT8  *ImageHash,
+  IN  UINTN        HashSize
+  )
+{
+  if (TrustedCert == NULL) {
+    return FALSE;
+  }
+
+  return AuthenticodeVerifyCommon (AuthData, DataSize, TrustedCert, CertSize, NULL, ImageHash, HashSize);
+}
+
+/**
+  Verifies the validity of a PE/COFF Authenticode Signature as described in "Windows
+  Authenticode Portable Executable Signature Format", against a trusted certificate
+  that has already been decoded with X509ConstructCertificate(). This saves
+  decoding the same certificate again for every image it is checked against.
+
+  If AuthData is NULL, then return FALSE.
+  If TrustedX509 is NULL, then return FALSE.
+  If ImageHash is NULL, then return FALSE.
+
+  Caution: This function may receive untrusted input.
+  PE/COFF Authenticode is external input, so this function will do basic check for
+  Authenticode data structure.
+
+  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
+                           PE/COFF image to be verified.
+  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
+  @param[in]  TrustedX509  Pointer to a trusted/root X509 object, which is used for
+                           certificate chain verification. It is not freed.
+  @param[in]  ImageHash    Pointer to the original image file hash value. The procedure
+                           for calculating the image hash value is described in Authenticode
+                           specification.
+  @param[in]  HashSize     Size of Image hash value in bytes.
+
+  @retval  TRUE   The specified Authenticode Signature is valid.
+  @retval  FALSE  Invalid Authenticode Signature.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeVerifyX509 (
+  IN  CONST UINT8  *AuthData,
+  IN  UINTN        DataSize,
+  IN  VOID         *TrustedX509,
+  IN  CONST UINT8  *ImageHash,
+  IN  UINTN        HashSize
+  )
+{
+  if (TrustedX509 == NULL) {
+    return FALSE;
+  }
+
+  return AuthenticodeVerifyCommon (AuthData, DataSize, NULL, 0, TrustedX509, ImageHash, HashSize);
+}
+
+/**
+  Parses a PE/COFF Authenticode Signature and verifies everything about it
+  that doesn't depend on which certificates are trusted: that it is a
+  signature of the image with ImageHash, and that its signers' signatures
+  are good. Whether it chains to any of a set of trusted certificates can
+  then be asked as many times as needed with AuthenticodeVerifyAnchors(),
+  without parsing it or checking its signatures again.
+
+  If AuthData is NULL, then return FALSE.
+  If ImageHash is NULL, then return FALSE.
+  If Context is NULL, then return FALSE.
+
+  Caution: This function may receive untrusted input.
+  PE/COFF Authenticode is external input, so this function will do basic check for
+  Authenticode data structure.
+
+  @param[in]  AuthData     Pointer to the Authenticode Signature retrieved from signed
+                           PE/COFF image to be verified.
+  @param[in]  DataSize     Size of the Authenticode Signature in bytes.
+  @param[in]  ImageHash    Pointer to the original image file hash value. The procedure
+                           for calculating the image hash value is described in Authenticode
+                           specification.
+  @param[in]  HashSize     Size of Image hash value in bytes.
+  @param[out] Context      The parsed signature, to be freed with AuthenticodeFree().
+
+  @retval  TRUE   The signature matches the image, and *Context is set.
+  @retval  FALSE  Invalid Authenticode Signature.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeParse (
+  IN  CONST UINT8  *AuthData,
+  IN  UINTN        DataSize,
+  IN  CONST UINT8  *ImageHash,
+  IN  UINTN        HashSize,
+  OUT VOID         **Context
+  )
+{
+  PKCS7        *Pkcs7;
+  CONST UINT8  *Temp;
+  UINT8        *SpcIndirectDataContent;
+  UINTN        ContentSize;
+
+  if ((AuthData == NULL) || (ImageHash == NULL) || (Context == NULL)) {
+    return FALSE;
+  }
+
+  if ((DataSize > INT_MAX) || (HashSize > INT_MAX)) {
+    return FALSE;
+  }
+
+  Temp  = AuthData;
+  Pkcs7 = d2i_PKCS7 (NULL, &Temp, (int)DataSize);
+  if (Pkcs7 == NULL) {
+    return FALSE;
+  }
+
+  if (!AuthenticodeCheckContent (Pkcs7, ImageHash, HashSize, &SpcIndirectDataContent, &ContentSize) ||
+      !Pkcs7VerifySignerSignatures (Pkcs7, SpcIndirectDataContent, ContentSize))
+  {
+    PKCS7_free (Pkcs7);
+    return FALSE;
+  }
+
+  *Context = Pkcs7;
+  return TRUE;
+}
+
+/**
+  Checks whether a signature parsed with AuthenticodeParse() chains to any of
+  a list of trusted certificates, and if so which one. The result is the
+  same as calling AuthenticodeVerifyX509() with each of them in turn and
+  stopping at the first success, but the chains are only built against all
+  of them at once.
+
+  If Context is NULL, then return FALSE.
+  If TrustedX509s is NULL, then return FALSE.
+  If Index is NULL, then return FALSE.
+
+  @param[in]  Context       The signature, as returned by AuthenticodeParse().
+  @param[in]  AnchorStore   Store built from TrustedX509s and Count with
+                            Pkcs7NewAnchorStore(), or NULL to build one for
+                            this call.
+  @param[in]  TrustedX509s  Array of trusted/root X509 objects, as returned by
+                            X509ConstructCertificate(). NULL entries are skipped.
+  @param[in]  Count         Number of entries in TrustedX509s.
+  @param[out] Index         Index in TrustedX509s of the first certificate the
+                            signature chains to.
+
+  @retval  TRUE   The signature chains to TrustedX509s[*Index].
+  @retval  FALSE  It doesn't chain to any of them.
+
+**/
+BOOLEAN
+EFIAPI
+AuthenticodeVerifyAnchors (
+  IN  VOID   *Context,
+  IN  VOID   *AnchorStore,
+  IN  VOID   **TrustedX509s,
+  IN  UINTN  Count,
+  OUT UINTN  *Index
+  )
+{
+  return Pkcs7VerifyAnchors (Context, AnchorStore, TrustedX509s, Count, Index);
+}
+
+/**
+  Releases a signature parsed with AuthenticodeParse().
+
+  @param[in]  Context  The signature to be freed, or NULL.
+
+**/
+VOID
+EFIAPI
+AuthenticodeFree (
+  IN  VOID  *Context
+  )
+{
+  PKCS7_free ((PKCS7 *)Context);
+}
@@ -747,13 +747,126 @@ _Error:
   return Status;
 }
 
+/**
+  Registers the digest algorithms PKCS#7 signed data may use, which OpenSSL
+  has to know by name before it can verify a signature made with them.
+
+  @retval  TRUE   The digests are registered.
+  @retval  FALSE  Registration failed.
+
+**/
+STATIC
+BOOLEAN
+Pkcs7RegisterDigests (
+  VOID
+  )
+{
+  if (EVP_add_digest (EVP_sha256 ()) == 0) {
+    return FALSE;
+  }
+
+  if (EVP_add_digest (EVP_sha384 ()) == 0) {
+    return FALSE;
+  }
+
+  if (EVP_add_digest (EVP_sha512 ()) == 0) {
+    return FALSE;
+  }
+
+  if (EVP_add_digest_alias (SN_sha1WithRSAEncryption, SN_sha1WithRSA) == 0) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+  Builds an X509 store of trusted certificates, set up for Authenticode
+  chain verification. The store can be kept and used for any number of
+  signatures with Pkcs7VerifyAnchors().
+
+  @param[in]  TrustedX509s  Array of trusted/root X509 objects, as returned by
+                            X509ConstructCertificate(). NULL entries are
+                            skipped. The store takes its own reference to each,
+                            so they are not freed with it.
+  @param[in]  Count         Number of entries in TrustedX509s.
+
+  @return  The store, to be freed with Pkcs7FreeAnchorStore(), or NULL if
+           there wasn't enough memory for it.
+
+**/
+VOID *
+EFIAPI
+Pkcs7NewAnchorStore (
+  IN  VOID   **TrustedX509s,
+  IN  UINTN  Count
+  )
+{
+  X509_STORE  *CertStore;
+  UINTN       Index;
+
+  if ((TrustedX509s == NULL) && (Count != 0)) {
+    return NULL;
+  }
+
+  CertStore = X509_STORE_new ();
+  if (CertStore == NULL) {
+    return NULL;
+  }
+
+  for (Index = 0; Index < Count; Index++) {
+    if (TrustedX509s[Index] == NULL) {
+      continue;
+    }
+
+    if (!(X509_STORE_add_cert (CertStore, (X509 *)TrustedX509s[Index]))) {
+      X509_STORE_free (CertStore);
+      return NULL;
+    }
+  }
+
+  //
+  // Allow partial certificate chains, terminated by a non-self-signed but
+  // still trusted intermediate certificate. Also disable time checks.
+  //
+  X509_STORE_set_flags (
+    CertStore,
+    X509_V_FLAG_PARTIAL_CHAIN | X509_V_FLAG_NO_CHECK_TIME
+    );
+
+  //
+  // OpenSSL PKCS7 Verification by default checks for SMIME (email signing) and
+  // doesn't support the extended key usage for Authenticode Code Signing.
+  // Bypass the certificate purpose checking by enabling any purposes setting.
+  //
+  X509_STORE_set_purpose (CertStore, X509_PURPOSE_ANY);
+
+  return CertStore;
+}
+
+/**
+  Releases a store built by Pkcs7NewAnchorStore().
+
+  @param[in]  AnchorStore  Pointer to the store to be freed, or NULL.
+
+**/
+VOID
+EFIAPI
+Pkcs7FreeAnchorStore (
+  IN  VOID  *AnchorStore
+  )
+{
+  X509_STORE_free ((X509_STORE *)AnchorStore);
+}
+
 /**
   Verifies the validity of a PKCS#7 signed data as described in "PKCS #7:
-  Cryptographic Message Syntax Standard". The input signed data could be wrapped
-  in a ContentInfo structure.
+  Cryptographic Message Syntax Standard", against a trusted certificate that
+  has already been decoded. The input signed data could be wrapped in a
+  ContentInfo structure.
 
-  If P7Data, TrustedCert or InData is NULL, then return FALSE.
-  If P7Length, CertLength or DataLength overflow, then return FALSE.
+  If P7Data, TrustedX509 or InData is NULL, then return FALSE.
+  If P7Length or DataLength overflow, then return FALSE.
 
   Caution: This function may receive untrusted input.
   UEFI Authenticated Variable is external input, so this function will do basic
@@ -761,9 +874,9 @@ _Error:
 
   @param[in]  P7Data       Pointer to the PKCS#7 message to verify.
   @param[in]  P7Length     Length of the PKCS#7 message in bytes.
-  @param[in]  TrustedCert  Pointer to a trusted/root certificate encoded in DER, which
-                           is used for certificate chain verification.
-  @param[in]  CertLength   Length of the trusted certificate in bytes.
+  @param[in]  TrustedX509  Pointer to a trusted/root X509 object, as returned by
+                           X509ConstructCertificate(), which is used for
+                           certificate chain verification. It is not freed.
   @param[in]  InData       Pointer to the content to be verified.
   @param[in]  DataLength   Length of InData in bytes.
 
@@ -773,11 +886,10 @@ _Error:
 **/
 BOOLEAN
 EFIAPI
-Pkcs7Verify (
+Pkcs7VerifyX509 (
   IN  CONST UINT8  *P7Data,
   IN  UINTN        P7Length,
-  IN  CONST UINT8  *TrustedCert,
-  IN  UINTN        CertLength,
+  IN  VOID         *TrustedX509,
   IN  CONST UINT8  *InData,
   IN  UINTN        DataLength
   )
@@ -785,7 +897,6 @@ Pkcs7Verify (
   PKCS7        *Pkcs7;
   BIO          *DataBio;
   BOOLEAN      Status;
-  X509         *Cert;
   X509_STORE   *CertStore;
   UINT8        *SignedData;
   CONST UINT8  *Temp;
@@ -795,33 +906,20 @@ Pkcs7Verify (
   //
   // Check input parameters.
   //
-  if ((P7Data == NULL) || (TrustedCert == NULL) || (InData == NULL) ||
-      (P7Length > INT_MAX) || (CertLength > INT_MAX) || (DataLength > INT_MAX))
+  if ((P7Data == NULL) || (TrustedX509 == NULL) || (InData == NULL) ||
+      (P7Length > INT_MAX) || (DataLength > INT_MAX))
   {
     return FALSE;
   }
 
   Pkcs7     = NULL;
   DataBio   = NULL;
-  Cert      = NULL;
   CertStore = NULL;
 
   //
   // Register & Initialize necessary digest algorithms for PKCS#7 Handling
   //
-  if (EVP_add_digest (EVP_sha256 ()) == 0) {
-    return FALSE;
-  }
-
-  if (EVP_add_digest (EVP_sha384 ()) == 0) {
-    return FALSE;
-  }
-
-  if (EVP_add_digest (EVP_sha512 ()) == 0) {
-    return FALSE;
-  }
-
-  if (EVP_add_digest_alias (SN_sha1WithRSAEncryption, SN_sha1WithRSA) == 0) {
+  if (!Pkcs7RegisterDigests ()) {
     return FALSE;
   }
 
@@ -853,26 +951,14 @@ Pkcs7Verify (
   }
 
   //
-  // Read DER-encoded root certificate and Construct X509 Certificate
-  //
-  Temp = TrustedCert;
-  Cert = d2i_X509 (NULL, &Temp, (long)CertLength);
-  if (Cert == NULL) {
-    goto _Exit;
-  }
-
+  // Setup X509 Store for trusted certificate. The store takes its own
+  // reference, so the caller's X509 object outlives it.
   //
-  // Setup X509 Store for trusted certificate
-  //
-  CertStore = X509_STORE_new ();
+  CertStore = Pkcs7NewAnchorStore (&TrustedX509, 1);
   if (CertStore == NULL) {
     goto _Exit;
   }
 
-  if (!(X509_STORE_add_cert (CertStore, Cert))) {
-    goto _Exit;
-  }
-
   //
   // For generic PKCS#7 handling, InData may be NULL if the content is present
   // in PKCS#7 structure. So ignore NULL checking here.
@@ -882,22 +968,6 @@ Pkcs7Verify (
     goto _Exit;
   }
 
-  //
-  // Allow partial certificate chains, terminated by a non-self-signed but
-  // still trusted intermediate certificate. Also disable time checks.
-  //
-  X509_STORE_set_flags (
-    CertStore,
-    X509_V_FLAG_PARTIAL_CHAIN | X509_V_FLAG_NO_CHECK_TIME
-    );
-
-  //
-  // OpenSSL PKCS7 Verification by default checks for SMIME (email signing) and
-  // doesn't support the extended key usage for Authenticode Code Signing.
-  // Bypass the certificate purpose checking by enabling any purposes setting.
-  //
-  X509_STORE_set_purpose (CertStore, X509_PURPOSE_ANY);
-
   //
   // Verifies the PKCS#7 signedData structure
   //
@@ -908,7 +978,6 @@ _Exit:
   // Release Resources
   //
   BIO_free (DataBio);
-  X509_free (Cert);
   X509_STORE_free (CertStore);
   PKCS7_free (Pkcs7);
 
@@ -918,3 +987,374 @@ _Exit:
 
   return Status;
 }
+
+/**
+  Verifies the validity of a PKCS#7 signed data as described in "PKCS #7:
+  Cryptographic Message Syntax Standard". The input signed data could be wrapped
+  in a ContentInfo structure.
+
+  If P7Data, TrustedCert or InData is NULL, then return FALSE.
+  If P7Length, CertLength or DataLength overflow, then return FALSE.
+
+  Caution: This function may receive untrusted input.
+  UEFI Authenticated Variable is external input, so this function will do basic
+  check for PKCS#7 data structure.
+
+  @param[in]  P7Data       Pointer to the PKCS#7 message to verify.
+  @param[in]  P7Length     Length of the PKCS#7 message in bytes.
+  @param[in]  TrustedCert  Pointer to a trusted/root certificate encoded in DER, which
+                           is used for certificate chain verification.
+  @param[in]  CertLength   Length of the trusted certificate in bytes.
+  @param[in]  InData       Pointer to the content to be verified.
+  @param[in]  DataLength   Length of InData in bytes.
+
+  @retval  TRUE  The specified PKCS#7 signed data is valid.
+  @retval  FALSE Invalid PKCS#7 signed data.
+
+**/
+BOOLEAN
+EFIAPI
+Pkcs7Verify (
+  IN  CONST UINT8  *P7Data,
+  IN  UINTN        P7Length,
+  IN  CONST UINT8  *TrustedCert,
+  IN  UINTN        CertLength,
+  IN  CONST UINT8  *InData,
+  IN  UINTN        DataLength
+  )
+{
+  BOOLEAN      Status;
+  X509         *Cert;
+  CONST UINT8  *Temp;
+
+  //
+  // Check input parameters.
+  //
+  if ((P7Data == NULL) || (TrustedCert == NULL) || (InData == NULL) ||
+      (P7Length > INT_MAX) || (CertLength > INT_MAX) || (DataLength > INT_MAX))
+  {
+    return FALSE;
+  }
+
+  //
+  // Read DER-encoded root certificate and Construct X509 Certificate
+  //
+  Temp = TrustedCert;
+  Cert = d2i_X509 (NULL, &Temp, (long)CertLength);
+  if (Cert == NULL) {
+    return FALSE;
+  }
+
+  Status = Pkcs7VerifyX509 (P7Data, P7Length, Cert, InData, DataLength);
+
+  X509_free (Cert);
+
+  return Status;
+}
+
+/**
+  Verifies the signers' signatures over the content of already parsed PKCS#7
+  signed data, without verifying their certificate chains. This is the part
+  of PKCS7_verify() that doesn't depend on which certificates are trusted, so
+  it only has to be done once however many anchors the signature is checked
+  against with Pkcs7VerifyAnchors().
+
+  @param[in]  Pkcs7        Pointer to the parsed PKCS7 object.
+  @param[in]  InData       Pointer to the content to be verified.
+  @param[in]  DataLength   Length of InData in bytes.
+
+  @retval  TRUE  The signatures are valid.
+  @retval  FALSE The signatures are invalid, or there are none.
+
+**/
+BOOLEAN
+Pkcs7VerifySignerSignatures (
+  IN  VOID         *Pkcs7,
+  IN  CONST UINT8  *InData,
+  IN  UINTN        DataLength
+  )
+{
+  BIO      *DataBio;
+  BOOLEAN  Status;
+
+  if ((Pkcs7 == NULL) || (InData == NULL) || (DataLength > INT_MAX)) {
+    return FALSE;
+  }
+
+  if (!Pkcs7RegisterDigests ()) {
+    return FALSE;
+  }
+
+  DataBio = BIO_new_mem_buf (InData, (int)DataLength);
+  if (DataBio == NULL) {
+    return FALSE;
+  }
+
+  Status = (BOOLEAN)PKCS7_verify ((PKCS7 *)Pkcs7, NULL, NULL, DataBio, NULL, PKCS7_BINARY | PKCS7_NOVERIFY);
+
+  BIO_free (DataBio);
+
+  return Status;
+}
+
+/**
+  Verifies the certificate chain of every signer of parsed PKCS#7 signed data
+  against a store of trusted certificates, the way PKCS7_verify() does.
+
+  @param[in]  Pkcs7      Pointer to the parsed PKCS7 object.
+  @param[in]  Signers    The signers' certificates.
+  @param[in]  CertStore  The trusted certificates.
+  @param[in]  CertCtx    A verification context to use. After a successful
+                         return with a single signer, it still holds that
+                         signer's chain.
+
+  @retval  TRUE  Every signer chains to a certificate in CertStore.
+  @retval  FALSE At least one doesn't.
+
+**/
+STATIC
+BOOLEAN
+Pkcs7VerifySignerChains (
+  IN  PKCS7           *Pkcs7,
+  IN  STACK_OF (X509) *Signers,
+  IN  X509_STORE      *CertStore,
+  IN  X509_STORE_CTX  *CertCtx
+  )
+{
+  int  Index;
+
+  for (Index = 0; Index < sk_X509_num (Signers); Index++) {
+    if (!X509_STORE_CTX_init (CertCtx, CertStore, sk_X509_value (Signers, Index), Pkcs7->d.sign->cert)) {
+      return FALSE;
+    }
+
+    if (!X509_STORE_CTX_set_default (CertCtx, "smime_sign")) {
+      return FALSE;
+    }
+
+    X509_STORE_CTX_set0_crls (CertCtx, Pkcs7->d.sign->crl);
+    if (X509_verify_cert (CertCtx) <= 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Checks whether an anchor could possibly end a chain built from the
+  certificates in parsed PKCS#7 signed data: chains are extended by looking
+  issuers up by name, so it has to be one of them, or the issuer of one.
+
+  @param[in]  Pkcs7   Pointer to the parsed PKCS7 object.
+  @param[in]  Anchor  The trusted certificate.
+
+  @retval  TRUE  A chain could end at Anchor.
+  @retval  FALSE No chain can.
+
+**/
+STATIC
+BOOLEAN
+Pkcs7MayChainTo (
+  IN  PKCS7  *Pkcs7,
+  IN  X509   *Anchor
+  )
+{
+  X509  *Cert;
+  int   Index;
+
+  for (Index = 0; Index < sk_X509_num (Pkcs7->d.sign->cert); Index++) {
+    Cert = sk_X509_value (Pkcs7->d.sign->cert, Index);
+    if ((X509_cmp (Cert, Anchor) == 0) ||
+        (X509_NAME_cmp (X509_get_issuer_name (Cert), X509_get_subject_name (Anchor)) == 0))
+    {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Checks whether a certificate is one of those carried in parsed PKCS#7
+  signed data.
+
+  @param[in]  Pkcs7  Pointer to the parsed PKCS7 object.
+  @param[in]  Cert   The certificate.
+
+  @retval  TRUE  Pkcs7 carries Cert.
+  @retval  FALSE It doesn't.
+
+**/
+STATIC
+BOOLEAN
+Pkcs7HasCertificate (
+  IN  PKCS7  *Pkcs7,
+  IN  X509   *Cert
+  )
+{
+  int  Index;
+
+  for (Index = 0; Index < sk_X509_num (Pkcs7->d.sign->cert); Index++) {
+    if (X509_cmp (sk_X509_value (Pkcs7->d.sign->cert, Index), Cert) == 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+  Finds the first of a list of trusted certificates that the signers of
+  parsed PKCS#7 signed data chain to, as if each were checked on its own with
+  Pkcs7VerifyX509(). The signatures themselves must already have been checked
+  with Pkcs7VerifySignerSignatures().
+
+  The chains are built once, against a store holding every certificate. With
+  a single signer, that chain ends at an anchor which would also have been
+  found on its own, so only the anchors before it in the list that could end
+  a chain at all still need checking one at a time. If that build fails, all
+  of the anchors that could end a chain are checked one at a time.
+
+  @param[in]  Pkcs7         Pointer to the parsed PKCS7 object.
+  @param[in]  AnchorStore   Store built from the same TrustedX509s and Count by
+                            Pkcs7NewAnchorStore(), or NULL to build one here.
+  @param[in]  TrustedX509s  Array of trusted/root X509 objects. NULL entries
+                            are skipped.
+  @param[in]  Count         Number of entries in TrustedX509s.
+  @param[out] Index         Index in TrustedX509s of the matching certificate.
+
+  @retval  TRUE  The signers chain to TrustedX509s[*Index].
+  @retval  FALSE They don't chain to any of TrustedX509s.
+
+**/
+BOOLEAN
+Pkcs7VerifyAnchors (
+  IN  VOID   *Pkcs7,
+  IN  VOID   *AnchorStore,
+  IN  VOID   **TrustedX509s,
+  IN  UINTN  Count,
+  OUT UINTN  *Index
+  )
+{
+  PKCS7           *P7;
+  X509_STORE      *CertStore;
+  X509_STORE      *SingleStore;
+  X509_STORE_CTX  *CertCtx;
+  BOOLEAN         Status;
+  UINTN           Anchor;
+  UINTN           First;
+  int             FirstDepth;
+  int             Depth;
+
+  STACK_OF (X509)  *Signers;
+  STACK_OF (X509)  *Chain;
+
+  if ((Pkcs7 == NULL) || (TrustedX509s == NULL) || (Index == NULL)) {
+    return FALSE;
+  }
+
+  P7          = (PKCS7 *)Pkcs7;
+  CertStore   = (X509_STORE *)AnchorStore;
+  SingleStore = NULL;
+  CertCtx     = NULL;
+  Signers     = NULL;
+  Status      = FALSE;
+
+  if (!PKCS7_type_is_signed (P7)) {
+    return FALSE;
+  }
+
+  if (CertStore == NULL) {
+    CertStore = Pkcs7NewAnchorStore (TrustedX509s, Count);
+    if (CertStore == NULL) {
+      return FALSE;
+    }
+  }
+
+  Signers = PKCS7_get0_signers (P7, NULL, 0);
+  if (Signers == NULL) {
+    goto _Exit;
+  }
+
+  CertCtx = X509_STORE_CTX_new ();
+  if (CertCtx == NULL) {
+    goto _Exit;
+  }
+
+  //
+  // Find the first anchor in the chain just built. If everything below it
+  // came from the PKCS#7 data rather than the store, it would have been
+  // found on its own too. Issuers are looked up by name, so when the store
+  // holds several certificates with the same subject, the build can pick
+  // the wrong one and fail where one of the others would have succeeded;
+  // then every anchor is left to be tried on its own.
+  //
+  First = Count;
+  if (Pkcs7VerifySignerChains (P7, Signers, CertStore, CertCtx) &&
+      (sk_X509_num (Signers) == 1))
+  {
+    Chain      = X509_STORE_CTX_get0_chain (CertCtx);
+    FirstDepth = 0;
+    for (Anchor = 0; Anchor < Count && First == Count; Anchor++) {
+      if (TrustedX509s[Anchor] == NULL) {
+        continue;
+      }
+
+      for (Depth = 0; Depth < sk_X509_num (Chain); Depth++) {
+        if (X509_cmp (sk_X509_value (Chain, Depth), (X509 *)TrustedX509s[Anchor]) == 0) {
+          First      = Anchor;
+          FirstDepth = Depth;
+          break;
+        }
+      }
+    }
+
+    for (Depth = 0; Depth < FirstDepth; Depth++) {
+      if (!Pkcs7HasCertificate (P7, sk_X509_value (Chain, Depth))) {
+        First = Count;
+        break;
+      }
+    }
+  }
+
+  //
+  // Any anchor before that one which a chain could end at has to be tried on
+  // its own, as a separate check would have.
+  //
+  for (Anchor = 0; Anchor < First; Anchor++) {
+    if ((TrustedX509s[Anchor] == NULL) ||
+        !Pkcs7MayChainTo (P7, (X509 *)TrustedX509s[Anchor]))
+    {
+      continue;
+    }
+
+    SingleStore = Pkcs7NewAnchorStore (&TrustedX509s[Anchor], 1);
+    if (SingleStore == NULL) {
+      goto _Exit;
+    }
+
+    if (Pkcs7VerifySignerChains (P7, Signers, SingleStore, CertCtx)) {
+      First = Anchor;
+      break;
+    }
+
+    X509_STORE_free (SingleStore);
+    SingleStore = NULL;
+  }
+
+  if (First < Count) {
+    *Index = First;
+    Status = TRUE;
+  }
+
+_Exit:
+  X509_STORE_CTX_free (CertCtx);
+  X509_STORE_free (SingleStore);
+  sk_X509_free (Signers);
+  if (CertStore != AnchorStore) {
+    X509_STORE_free (CertStore);
+  }
+
+  return Status;
+}
@@ -1150,45 +1150,29 @@ static void delete_cert(void *key, UINT32 key_size,
 	}
 }
 
-static int match_hash(UINT8 * hash, UINT32 hash_size, int start,
-		      void *hash_list, UINT32 list_num)
-{
-	UINT8 *ptr;
-	UINTN i;
-
-	ptr = hash_list + sizeof(EFI_GUID);
-	for (i = start; i < list_num; i++) {
-		if (CompareMem(hash, ptr, hash_size) == 0)
-			return i;
-		ptr += hash_size + sizeof(EFI_GUID);
-	}
-
-	return -1;
-}
-
-static void mem_move(void *dest, void *src, UINTN size)
-{
-	UINT8 *d, *s;
-	UINTN i;
-
-	d = (UINT8 *) dest;
-	s = (UINT8 *) src;
-	for (i = 0; i < size; i++)
-		d[i] = s[i];
-}
-
-static void delete_hash_in_list(EFI_GUID Type, UINT8 * hash, UINT32 hash_size,
+/*
+ * Delete every hash of this type that's in MokDel from the hash lists in
+ * mok.  The digests to delete go in an index once, and then each list is
+ * compacted in a single pass, rather than rescanning and shifting it down
+ * for every digest.
+ */
+static EFI_STATUS delete_hashes(EFI_GUID Type, void *MokDel, UINTN MokDelSize,
 				MokListNode * mok, INTN mok_num)
 {
+	esl_index_t *del;
 	EFI_GUID type;
+	UINT32 hash_size;
 	UINT32 sig_size;
-	UINT32 list_num;
-	int i, del_ind;
-	void *start, *end;
-	UINT32 remain;
+	UINTN list_num, kept;
+	int i;
 
+	hash_size = sha_size(Type);
 	sig_size = hash_size + sizeof(EFI_GUID);
 
+	del = esl_index_new(MokDel, MokDelSize, &Type, hash_size);
+	if (!del)
+		return EFI_OUT_OF_RESOURCES;
+
 	for (i = 0; i < mok_num; i++) {
 		type = mok[i].Type; /* avoid -Werror=address-of-packed-member */
 		if ((!CompareGuid(&type, &Type)) ||
@@ -1196,52 +1180,22 @@ static void delete_hash_in_list(EFI_GUID Type, UINT8 * hash, UINT32 hash_size,
 			continue;
 
 		list_num = mok[i].MokSize / sig_size;
+		kept = esl_index_remove(del, mok[i].Mok, list_num, sig_size);
+		if (kept == list_num)
+			continue;
 
-		del_ind = match_hash(hash, hash_size, 0, mok[i].Mok, list_num);
-		while (del_ind >= 0) {
-			/* Remove the hash */
-			if (sig_size == mok[i].MokSize) {
-				mok[i].Mok = NULL;
-				mok[i].MokSize = 0;
-				break;
-			}
-
-			start = mok[i].Mok + del_ind * sig_size;
-			end = start + sig_size;
-			remain = mok[i].MokSize - (del_ind + 1) * sig_size;
-
-			mem_move(start, end, remain);
-			mok[i].MokSize -= sig_size;
-			list_num--;
-
-			del_ind = match_hash(hash, hash_size, del_ind,
-					     mok[i].Mok, list_num);
+		dprint(L"deleted %lu of %lu hashes from list %d\n",
+		       list_num - kept, list_num, i);
+		if (kept == 0) {
+			mok[i].Mok = NULL;
+			mok[i].MokSize = 0;
+		} else {
+			mok[i].MokSize = kept * sig_size;
 		}
 	}
-}
 
-static void delete_hash_list(EFI_GUID Type, void *hash_list, UINT32 list_size,
-			     MokListNode * mok, INTN mok_num)
-{
-	UINT32 hash_size;
-	UINT32 hash_num;
-	UINT32 sig_size;
-	UINT8 *hash;
-	UINT32 i;
-
-	hash_size = sha_size(Type);
-	sig_size = hash_size + sizeof(EFI_GUID);
-	if (list_size < sig_size)
-		return;
-
-	hash_num = list_size / sig_size;
-
-	hash = hash_list + sizeof(EFI_GUID);
-
-	for (i = 0; i < hash_num; i++) {
-		delete_hash_in_list(Type, hash, hash_size, mok, mok_num);
-		hash += sig_size;
-	}
+	esl_index_free(del);
+	return EFI_SUCCESS;
 }
 
 static EFI_STATUS delete_keys(void *MokDel, UINTN MokDelSize, BOOLEAN MokX)
@@ -1258,6 +1212,14 @@ static EFI_STATUS delete_keys(void *MokDel, UINTN MokDelSize, BOOLEAN MokX)
 	UINTN MokListDataSize = 0;
 	MokListNode *mok = NULL, *del_key = NULL;
 	INTN mok_num, del_num;
+	EFI_GUID *hash_types[] = {
+		&EFI_CERT_SHA224_GUID,
+		&EFI_CERT_SHA256_GUID,
+		&EFI_CERT_SHA384_GUID,
+		&EFI_CERT_SHA512_GUID,
+	};
+	const int n_hash_types = sizeof(hash_types) / sizeof(hash_types[0]);
+	BOOLEAN has_hashes = FALSE;
 	int i;
 
 	if (MokX) {
@@ -1368,10 +1330,32 @@ static EFI_STATUS delete_keys(void *MokDel, UINTN MokDelSize, BOOLEAN MokX)
 			delete_cert(del_key[i].Mok, del_key[i].MokSize,
 				    mok, mok_num);
 		} else if (is_sha2_hash(del_key[i].Type)) {
-			dprint(L"deleting hash %d (total %d):\n", i, mok_num);
-			dhexdumpat(del_key[i].Mok, del_key[i].MokSize, 0);
-			delete_hash_list(del_key[i].Type, del_key[i].Mok,
-					 del_key[i].MokSize, mok, mok_num);
+			has_hashes = TRUE;
+		}
+	}
+
+	/*
+	 * Hashes are deleted a whole type at a time, however many lists
+	 * of them MokDel has.
+	 */
+	for (i = 0; has_hashes && i < n_hash_types; i++) {
+		int j;
+
+		for (j = 0; j < del_num; j++) {
+			type = del_key[j].Type;
+			if (CompareGuid(&type, hash_types[i]))
+				break;
+		}
+		if (j == del_num)
+			continue;
+
+		dprint(L"deleting %g hashes from %a\n", hash_types[i],
+		       MokX ? "MokListX" : "MokList");
+		efi_status = delete_hashes(*hash_types[i], MokDel, MokDelSize,
+					   mok, mok_num);
+		if (EFI_ERROR(efi_status)) {
+			console_errorbox(L"Failed to delete hashes");
+			goto error;
 		}
 	}
 
@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-authenticode.c - time checking an image's Authenticode signature
+ * against a trusted certificate
+ *
+ * This runs Cryptlib's AuthenticodeVerify(), and the AuthenticodeParse()
+ * and AuthenticodeVerifyAnchors() pair verify.c uses for each signature
+ * database, on the signed images in test-data.  Each image is checked
+ * against the CA certificate that signed it, which it carries in its own
+ * signature.  The image digest is the one the signature vouches for;
+ * bench-generate-hash times computing it.
+ *
+ * Cryptlib's PKCS#7 code is built against the host's libcrypto, the same
+ * way test-pkcs7-anchors builds it, so the RSA and bignum work is the
+ * host's rather than the firmware's Cryptlib/OpenSSL build.
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "bench.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <openssl/objects.h>
+#include <openssl/pkcs7.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#ifndef STATIC
+#define STATIC static
+#endif
+#ifndef GLOBAL_REMOVE_IF_UNREFERENCED
+#define GLOBAL_REMOVE_IF_UNREFERENCED
+#endif
+#ifndef WriteUnaligned32
+#define WriteUnaligned32(p, v) (*(p) = (v))
+#endif
+
+/*
+ * The declarations InternalCryptLib.h would have provided, without the
+ * rest of the firmware headers it pulls in.
+ */
+#define __INTERNAL_CRYPT_LIB_H__
+BOOLEAN WrapPkcs7Data(CONST UINT8 *P7Data, UINTN P7Length, BOOLEAN *WrapFlag,
+		      UINT8 **WrapData, UINTN *WrapDataSize);
+BOOLEAN Pkcs7VerifySignerSignatures(VOID *Pkcs7, CONST UINT8 *InData,
+				    UINTN DataLength);
+BOOLEAN Pkcs7VerifyAnchors(VOID *Pkcs7, VOID *AnchorStore,
+			   VOID **TrustedX509s, UINTN Count, UINTN *Index);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-prototypes"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "Cryptlib/Pk/CryptPkcs7VerifyCommon.c"
+#include "Cryptlib/Pk/CryptAuthenticode.c"
+#pragma GCC diagnostic pop
+
+typedef struct {
+	UINT8 *sig;
+	UINTN sig_size;
+	UINT8 digest[SHA256_DIGEST_SIZE];
+	UINT8 *ca;
+	UINTN ca_size;
+	X509 *ca_x509;
+	VOID *store;
+	VOID *parsed;
+} auth_ctx_t;
+
+/*
+ * Find the digest the signature vouches for, and the self-signed
+ * certificate it carries.
+ */
+static int
+read_signature(auth_ctx_t *ctx)
+{
+	const unsigned char *p = ctx->sig;
+	STACK_OF(X509) *certs;
+	ASN1_STRING *content;
+	unsigned char *der;
+	PKCS7 *p7;
+	int len;
+
+	p7 = d2i_PKCS7(NULL, &p, (long)ctx->sig_size);
+	if (!p7 || !PKCS7_type_is_signed(p7))
+		goto err;
+
+	content = p7->d.sign->contents->d.other->value.asn1_string;
+	if (!content || content->length < SHA256_DIGEST_SIZE)
+		goto err;
+	CopyMem(ctx->digest,
+		content->data + content->length - SHA256_DIGEST_SIZE,
+		SHA256_DIGEST_SIZE);
+
+	certs = p7->d.sign->cert;
+	for (int i = 0; i < sk_X509_num(certs); i++) {
+		X509 *cert = sk_X509_value(certs, i);
+
+		if (X509_check_issued(cert, cert) != X509_V_OK)
+			continue;
+		ctx->ca_x509 = X509_dup(cert);
+		break;
+	}
+	if (!ctx->ca_x509)
+		goto err;
+
+	len = i2d_X509(ctx->ca_x509, NULL);
+	if (len <= 0)
+		goto err;
+	ctx->ca = der = AllocatePool(len);
+	if (!ctx->ca || i2d_X509(ctx->ca_x509, &der) != len)
+		goto err;
+	ctx->ca_size = len;
+
+	PKCS7_free(p7);
+	return 0;
+err:
+	PKCS7_free(p7);
+	return -1;
+}
+
+/*
+ * One signature checked against one certificate the way verify.c used
+ * to for every entry in db and MokList: decoding the certificate and
+ * the signature, and verifying both the signature and the chain.
+ */
+static int
+authenticode_verify(void *data)
+{
+	auth_ctx_t *ctx = data;
+
+	return AuthenticodeVerify(ctx->sig, ctx->sig_size, ctx->ca,
+				  ctx->ca_size, ctx->digest,
+				  SHA256_DIGEST_SIZE) ? 0 : -1;
+}
+
+/*
+ * Decoding the signature and checking the signer's signature over the
+ * content, which verify.c does once per signature.
+ */
+static int
+authenticode_parse(void *data)
+{
+	auth_ctx_t *ctx = data;
+	VOID *parsed = NULL;
+
+	if (!AuthenticodeParse(ctx->sig, ctx->sig_size, ctx->digest,
+			       SHA256_DIGEST_SIZE, &parsed))
+		return -1;
+	AuthenticodeFree(parsed);
+	return 0;
+}
+
+/*
+ * Checking the signer's chain against a database's prebuilt anchor
+ * store, which verify.c does once per signature and database.
+ */
+static int
+authenticode_verify_anchors(void *data)
+{
+	auth_ctx_t *ctx = data;
+	UINTN index = 1;
+
+	if (!AuthenticodeVerifyAnchors(ctx->parsed, ctx->store,
+				       (VOID **)&ctx->ca_x509, 1, &index) ||
+	    index != 0)
+		return -1;
+	return 0;
+}
+
+static int
+bench_image(const char *suite, const char *name)
+{
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+	WIN_CERTIFICATE_EFI_PKCS *sig;
+	auth_ctx_t ctx;
+	UINT8 *contents;
+	UINTN size;
+	int status = 0;
+
+	SetMem(&ctx, sizeof(ctx), 0);
+	SetMem(&context, sizeof(context), 0);
+	contents = bench_read_file(name, &size);
+	if (EFI_ERROR(read_header(contents, size, &context, true)) ||
+	    context.SecDir->Size < sizeof(*sig)) {
+		fprintf(stderr, "Could not parse \"%s\"\n", name);
+		status = 1;
+		goto out;
+	}
+
+	sig = (WIN_CERTIFICATE_EFI_PKCS *)(contents +
+					   context.SecDir->VirtualAddress);
+	ctx.sig = sig->CertData;
+	ctx.sig_size = sig->Hdr.dwLength - sizeof(sig->Hdr);
+	if (read_signature(&ctx) != 0) {
+		fprintf(stderr, "Could not read the signature on \"%s\"\n",
+			name);
+		status = 1;
+		goto out;
+	}
+
+	ctx.store = Pkcs7NewAnchorStore((VOID **)&ctx.ca_x509, 1);
+	if (!ctx.store ||
+	    !AuthenticodeParse(ctx.sig, ctx.sig_size, ctx.digest,
+			       SHA256_DIGEST_SIZE, &ctx.parsed)) {
+		fprintf(stderr, "Could not verify \"%s\"\n", name);
+		status = 1;
+		goto out;
+	}
+
+	bench(suite, "authenticode_verify", ctx.sig_size, authenticode_verify,
+	      &ctx);
+	bench(suite, "authenticode_parse", ctx.sig_size, authenticode_parse,
+	      &ctx);
+	bench(suite, "authenticode_verify_anchors", ctx.sig_size,
+	      authenticode_verify_anchors, &ctx);
+
+out:
+	if (ctx.parsed)
+		AuthenticodeFree(ctx.parsed);
+	if (ctx.store)
+		Pkcs7FreeAnchorStore(ctx.store);
+	X509_free(ctx.ca_x509);
+	if (ctx.ca)
+		FreePool(ctx.ca);
+	FreePool(contents);
+	return status;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	if (bench_image("authenticode_grub_0.76",
+			"test-data/grubx64.0.76.el7.efi") != 0)
+		status = 1;
+	if (bench_image("authenticode_grub_0.80",
+			"test-data/grubx64.0.80.el7.efi") != 0)
+		status = 1;
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
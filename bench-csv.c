@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-csv.c - time our csv parsers
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "bench.h"
+
+#include <stdio.h>
+
+#define N_ROWS 256
+#define ROW_SIZE 128
+#define N_COLUMNS 6
+
+/*
+ * Rows shaped like a .sbat section's, many more of them than a real one
+ * has so the per-row costs dominate.
+ */
+typedef struct {
+	char data[N_ROWS * ROW_SIZE];
+	size_t size;
+	char copy[N_ROWS * ROW_SIZE];
+	struct csv_arena arena;
+} csv_ctx_t;
+
+static void
+fill_csv(csv_ctx_t *ctx)
+{
+	char *pos = ctx->data;
+
+	for (unsigned int i = 0; i < N_ROWS; i++) {
+		pos += snprintf(pos, ROW_SIZE,
+				"component%u,%u,Vendor %u,package%u,1.%u,https://example.com/%u\n",
+				i, i % 7, i, i, i, i);
+	}
+	ctx->size = pos - ctx->data;
+}
+
+static int
+parse_list(void *data)
+{
+	csv_ctx_t *ctx = data;
+	list_t rows;
+	EFI_STATUS efi_status;
+
+	INIT_LIST_HEAD(&rows);
+	CopyMem(ctx->copy, ctx->data, ctx->size + 1);
+	efi_status = parse_csv_data(ctx->copy, ctx->copy + ctx->size,
+				    N_COLUMNS, &rows);
+	if (EFI_ERROR(efi_status) || list_size(&rows) != N_ROWS)
+		return -1;
+	free_csv_list(&rows);
+	return 0;
+}
+
+static int
+parse_rows(void *data)
+{
+	csv_ctx_t *ctx = data;
+	struct csv_arena arena = { NULL, 0 };
+	EFI_STATUS efi_status;
+	size_t n = 0;
+
+	CopyMem(ctx->copy, ctx->data, ctx->size + 1);
+	efi_status = parse_csv_rows(ctx->copy, ctx->copy + ctx->size,
+				    N_COLUMNS, N_COLUMNS * sizeof(char *),
+				    &arena, &n);
+	csv_arena_free(&arena);
+	return (EFI_ERROR(efi_status) || n != N_ROWS) ? -1 : 0;
+}
+
+/*
+ * The same, reusing one arena the way a caller parsing many documents
+ * could.
+ */
+static int
+parse_rows_reused(void *data)
+{
+	csv_ctx_t *ctx = data;
+	EFI_STATUS efi_status;
+	size_t n = 0;
+
+	CopyMem(ctx->copy, ctx->data, ctx->size + 1);
+	efi_status = parse_csv_rows(ctx->copy, ctx->copy + ctx->size,
+				    N_COLUMNS, N_COLUMNS * sizeof(char *),
+				    &ctx->arena, &n);
+	return (EFI_ERROR(efi_status) || n != N_ROWS) ? -1 : 0;
+}
+
+int
+main(void)
+{
+	static csv_ctx_t ctx;
+	int status = 0;
+
+	fill_csv(&ctx);
+
+	bench("csv", "parse_csv_data", ctx.size, parse_list, &ctx);
+	bench("csv", "parse_csv_rows", ctx.size, parse_rows, &ctx);
+	bench("csv", "parse_csv_rows_reused", ctx.size, parse_rows_reused,
+	      &ctx);
+
+	csv_arena_free(&ctx.arena);
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-esl-index.c - time db/dbx digest lookups, indexed and linear
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "bench.h"
+#include "mock-variables.h"
+
+#include <stdio.h>
+
+typedef struct {
+	EFI_SIGNATURE_LIST *esl;
+	UINTN eslsize;
+	esl_index_t *index;
+	UINT8 hit[SHA256_DIGEST_SIZE];
+	UINT8 miss[SHA256_DIGEST_SIZE];
+} lookup_ctx_t;
+
+/*
+ * The same walk check_db_hash_in_ram() does.
+ */
+static EFI_SIGNATURE_DATA *
+linear_find(EFI_SIGNATURE_LIST *CertList, UINTN dbsize, const UINT8 *digest)
+{
+	EFI_SIGNATURE_DATA *Cert;
+	UINTN CertCount, Index;
+
+	while ((dbsize > 0) && (dbsize >= CertList->SignatureListSize)) {
+		if (CertList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST))
+			break;
+		if (CompareGuid(&CertList->SignatureType, &EFI_CERT_SHA256_GUID) &&
+		    CertList->SignatureSize >= sizeof(EFI_GUID) + SHA256_DIGEST_SIZE) {
+			Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)CertList + sizeof(EFI_SIGNATURE_LIST) + CertList->SignatureHeaderSize);
+			CertCount = (CertList->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) - CertList->SignatureHeaderSize) / CertList->SignatureSize;
+			for (Index = 0; Index < CertCount; Index++) {
+				if (CompareMem(Cert->SignatureData, digest, SHA256_DIGEST_SIZE) == 0)
+					return Cert;
+				Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)Cert + CertList->SignatureSize);
+			}
+		}
+		dbsize -= CertList->SignatureListSize;
+		CertList = (EFI_SIGNATURE_LIST *)((UINT8 *)CertList + CertList->SignatureListSize);
+	}
+	return NULL;
+}
+
+static int
+index_build(void *data)
+{
+	lookup_ctx_t *ctx = data;
+	esl_index_t *index;
+
+	index = esl_index_new(ctx->esl, ctx->eslsize, &EFI_CERT_SHA256_GUID,
+			      SHA256_DIGEST_SIZE);
+	if (!index)
+		return -1;
+	esl_index_free(index);
+	return 0;
+}
+
+static int
+index_find_hit(void *data)
+{
+	lookup_ctx_t *ctx = data;
+
+	return esl_index_find(ctx->index, ctx->hit, NULL) ? 0 : -1;
+}
+
+static int
+index_find_miss(void *data)
+{
+	lookup_ctx_t *ctx = data;
+
+	return esl_index_find(ctx->index, ctx->miss, NULL) ? -1 : 0;
+}
+
+static int
+linear_find_hit(void *data)
+{
+	lookup_ctx_t *ctx = data;
+
+	return linear_find(ctx->esl, ctx->eslsize, ctx->hit) ? 0 : -1;
+}
+
+static int
+linear_find_miss(void *data)
+{
+	lookup_ctx_t *ctx = data;
+
+	return linear_find(ctx->esl, ctx->eslsize, ctx->miss) ? -1 : 0;
+}
+
+/*
+ * Time building the index and looking up a digest that's there (the
+ * last one, the linear scan's worst case) and one that isn't, which is
+ * what every dbx check of a good image does.
+ */
+static int
+bench_lookups(const char *suite, EFI_SIGNATURE_LIST *esl, UINTN eslsize)
+{
+	lookup_ctx_t ctx;
+	EFI_SIGNATURE_DATA *last;
+	int status = 0;
+
+	SetMem(&ctx, sizeof(ctx), 0);
+	ctx.esl = esl;
+	ctx.eslsize = eslsize;
+	ctx.index = esl_index_new(esl, eslsize, &EFI_CERT_SHA256_GUID,
+				  SHA256_DIGEST_SIZE);
+	if (!ctx.index || !ctx.index->n_entries)
+		return -1;
+
+	last = ctx.index->entries[ctx.index->n_entries - 1].sig;
+	CopyMem(ctx.hit, last->SignatureData, SHA256_DIGEST_SIZE);
+	SetMem(ctx.miss, sizeof(ctx.miss), 0xa5);
+
+	bench(suite, "index_build", 0, index_build, &ctx);
+	bench(suite, "index_find_hit", 0, index_find_hit, &ctx);
+	bench(suite, "index_find_miss", 0, index_find_miss, &ctx);
+	bench(suite, "linear_find_hit", 0, linear_find_hit, &ctx);
+	bench(suite, "linear_find_miss", 0, linear_find_miss, &ctx);
+
+	esl_index_free(ctx.index);
+	return status;
+}
+
+static int
+bench_dbx(void)
+{
+	const char *filters[] = { "dbx", NULL };
+	UINT8 *data = NULL;
+	UINTN size = 0;
+	EFI_STATUS efi_status;
+	int status;
+
+	mock_load_variables("test-data/efivars-1", filters, false);
+	efi_status = get_variable(L"dbx", &data, &size, EFI_SECURE_BOOT_DB_GUID);
+	if (EFI_ERROR(efi_status)) {
+		mock_reset_variables();
+		return -1;
+	}
+
+	status = bench_lookups("esl_dbx", (EFI_SIGNATURE_LIST *)data, size);
+
+	FreePool(data);
+	mock_reset_variables();
+	return status;
+}
+
+/*
+ * One list of n synthetic SHA-256 entries, the shape a large dbx or
+ * MokListX update has.
+ */
+static int
+bench_synthetic(const char *suite, UINTN n)
+{
+	EFI_SIGNATURE_LIST *esl;
+	EFI_SIGNATURE_DATA *sig;
+	UINT32 sig_size = sizeof(EFI_GUID) + SHA256_DIGEST_SIZE;
+	UINTN eslsize = sizeof(*esl) + n * sig_size;
+	UINT64 x = 0x9e3779b97f4a7c15ull;
+	int status;
+
+	esl = AllocateZeroPool(eslsize);
+	if (!esl)
+		return -1;
+	esl->SignatureType = EFI_CERT_SHA256_GUID;
+	esl->SignatureListSize = eslsize;
+	esl->SignatureSize = sig_size;
+
+	sig = (EFI_SIGNATURE_DATA *)(esl + 1);
+	for (UINTN i = 0; i < n; i++) {
+		for (UINTN j = 0; j < SHA256_DIGEST_SIZE; j++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			sig->SignatureData[j] = x & 0xff;
+		}
+		sig = (EFI_SIGNATURE_DATA *)((UINT8 *)sig + sig_size);
+	}
+
+	status = bench_lookups(suite, esl, eslsize);
+
+	FreePool(esl);
+	return status;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	if (bench_dbx() != 0)
+		status = 1;
+	if (bench_synthetic("esl_1000", 1000) != 0)
+		status = 1;
+	if (bench_synthetic("esl_10000", 10000) != 0)
+		status = 1;
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-generate-hash.c - time computing an image's Authenticode digests
+ *
+ * This runs pe-hash.c's generate_hash() and generate_hashes() on the
+ * images in test-data.  Cryptlib isn't available to the unit test
+ * harness, so its Sha*() functions are provided here by the host's
+ * libcrypto.  The figures are for the host's SHA code rather than the
+ * firmware's; "make bench-sha" compares the block functions themselves.
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "bench.h"
+
+#include <Library/BaseCryptLib.h>
+
+#include <stdio.h>
+#include <openssl/evp.h>
+
+/*
+ * Each Sha*() context just holds a libcrypto digest context.
+ */
+static UINTN
+md_context_size(void)
+{
+	return sizeof(EVP_MD_CTX *);
+}
+
+static BOOLEAN
+md_init(VOID *Context, const EVP_MD *md)
+{
+	EVP_MD_CTX *ctx;
+
+	if (!Context)
+		return FALSE;
+	ctx = EVP_MD_CTX_new();
+	if (!ctx)
+		return FALSE;
+	if (!EVP_DigestInit_ex(ctx, md, NULL)) {
+		EVP_MD_CTX_free(ctx);
+		return FALSE;
+	}
+	*(EVP_MD_CTX **)Context = ctx;
+	return TRUE;
+}
+
+static BOOLEAN
+md_update(VOID *Context, CONST VOID *Data, UINTN DataSize)
+{
+	if (!Context)
+		return FALSE;
+	return EVP_DigestUpdate(*(EVP_MD_CTX **)Context, Data, DataSize)
+		? TRUE : FALSE;
+}
+
+static BOOLEAN
+md_final(VOID *Context, UINT8 *HashValue)
+{
+	EVP_MD_CTX *ctx;
+	int rc;
+
+	if (!Context)
+		return FALSE;
+	ctx = *(EVP_MD_CTX **)Context;
+	rc = EVP_DigestFinal_ex(ctx, HashValue, NULL);
+	EVP_MD_CTX_free(ctx);
+	*(EVP_MD_CTX **)Context = NULL;
+	return rc ? TRUE : FALSE;
+}
+
+UINTN EFIAPI
+Sha1GetContextSize(VOID)
+{
+	return md_context_size();
+}
+
+BOOLEAN EFIAPI
+Sha1Init(VOID *Sha1Context)
+{
+	return md_init(Sha1Context, EVP_sha1());
+}
+
+BOOLEAN EFIAPI
+Sha1Update(VOID *Sha1Context, CONST VOID *Data, UINTN DataSize)
+{
+	return md_update(Sha1Context, Data, DataSize);
+}
+
+BOOLEAN EFIAPI
+Sha1Final(VOID *Sha1Context, UINT8 *HashValue)
+{
+	return md_final(Sha1Context, HashValue);
+}
+
+UINTN EFIAPI
+Sha256GetContextSize(VOID)
+{
+	return md_context_size();
+}
+
+BOOLEAN EFIAPI
+Sha256Init(VOID *Sha256Context)
+{
+	return md_init(Sha256Context, EVP_sha256());
+}
+
+BOOLEAN EFIAPI
+Sha256Update(VOID *Sha256Context, CONST VOID *Data, UINTN DataSize)
+{
+	return md_update(Sha256Context, Data, DataSize);
+}
+
+BOOLEAN EFIAPI
+Sha256Final(VOID *Sha256Context, UINT8 *HashValue)
+{
+	return md_final(Sha256Context, HashValue);
+}
+
+UINTN EFIAPI
+Sha384GetContextSize(VOID)
+{
+	return md_context_size();
+}
+
+BOOLEAN EFIAPI
+Sha384Init(VOID *Sha384Context)
+{
+	return md_init(Sha384Context, EVP_sha384());
+}
+
+BOOLEAN EFIAPI
+Sha384Update(VOID *Sha384Context, CONST VOID *Data, UINTN DataSize)
+{
+	return md_update(Sha384Context, Data, DataSize);
+}
+
+BOOLEAN EFIAPI
+Sha384Final(VOID *Sha384Context, UINT8 *HashValue)
+{
+	return md_final(Sha384Context, HashValue);
+}
+
+/*
+ * verify.c isn't linked in, and this is what it asks for when db and dbx
+ * have no SHA-1 or SHA-384 entries.
+ */
+UINT32
+authenticode_algorithms(void)
+{
+	return SHIM_HASH_SHA256;
+}
+
+typedef struct {
+	UINT8 *contents;
+	UINTN size;
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+} hash_ctx_t;
+
+static int
+hash_sha1_sha256(void *data)
+{
+	hash_ctx_t *ctx = data;
+	UINT8 sha256hash[SHA256_DIGEST_SIZE];
+	UINT8 sha1hash[SHA1_DIGEST_SIZE];
+
+	return EFI_ERROR(generate_hash((char *)ctx->contents, ctx->size,
+				       &ctx->context, sha256hash, sha1hash))
+		? -1 : 0;
+}
+
+static int
+hash_sha256(void *data)
+{
+	hash_ctx_t *ctx = data;
+	authenticode_digests_t digests;
+
+	return EFI_ERROR(generate_hashes((char *)ctx->contents, ctx->size,
+					 &ctx->context, SHIM_HASH_SHA256,
+					 &digests))
+		? -1 : 0;
+}
+
+static int
+bench_image(const char *suite, const char *name)
+{
+	hash_ctx_t ctx;
+	int status = 0;
+
+	SetMem(&ctx, sizeof(ctx), 0);
+	ctx.contents = bench_read_file(name, &ctx.size);
+	if (EFI_ERROR(read_header(ctx.contents, ctx.size, &ctx.context,
+				  true))) {
+		fprintf(stderr, "Could not parse \"%s\"\n", name);
+		FreePool(ctx.contents);
+		return 1;
+	}
+
+	bench(suite, "generate_hash", ctx.size, hash_sha1_sha256, &ctx);
+	bench(suite, "generate_hashes_sha256", ctx.size, hash_sha256, &ctx);
+
+	FreePool(ctx.contents);
+	return status;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	if (bench_image("hash_grub_0.76", "test-data/grubx64.0.76.el7.efi") != 0)
+		status = 1;
+	if (bench_image("hash_grub_0.80", "test-data/grubx64.0.80.el7.efi") != 0)
+		status = 1;
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
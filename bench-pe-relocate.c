@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-pe-relocate.c - time PE header parsing and relocation
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "bench.h"
+
+#include <stdio.h>
+
+typedef struct {
+	UINT8 *contents;
+	UINTN size;
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+	EFI_IMAGE_SECTION_HEADER *reloc_section;
+	char *buffer;
+} reloc_ctx_t;
+
+static int
+parse_header(void *data)
+{
+	reloc_ctx_t *ctx = data;
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+
+	return EFI_ERROR(read_header(ctx->contents, ctx->size, &context, true))
+		? -1 : 0;
+}
+
+/*
+ * Each run adds the same adjustment again, which is just as much work as
+ * the first time.
+ */
+static int
+relocate(void *data)
+{
+	reloc_ctx_t *ctx = data;
+
+	return EFI_ERROR(relocate_coff(&ctx->context, ctx->reloc_section,
+				       ctx->contents, ctx->buffer)) ? -1 : 0;
+}
+
+/*
+ * Lay the image out the way handle_image() does, so the fixups land
+ * where they would at load time.
+ */
+static int
+load_sections(reloc_ctx_t *ctx)
+{
+	EFI_IMAGE_SECTION_HEADER *Section = ctx->context.FirstSection;
+
+	ctx->buffer = AllocateZeroPool(ctx->context.ImageSize);
+	if (!ctx->buffer)
+		return -1;
+	CopyMem(ctx->buffer, ctx->contents, ctx->context.SizeOfHeaders);
+
+	for (int i = 0; i < ctx->context.NumberOfSections; i++, Section++) {
+		UINT32 size = MIN(Section->Misc.VirtualSize,
+				  Section->SizeOfRawData);
+
+		if (CompareMem(Section->Name, ".reloc\0\0", 8) == 0)
+			ctx->reloc_section = Section;
+		if (Section->Characteristics & EFI_IMAGE_SCN_CNT_UNINITIALIZED_DATA)
+			continue;
+		if (Section->VirtualAddress + size > ctx->context.ImageSize ||
+		    Section->PointerToRawData + size > ctx->size)
+			return -1;
+		CopyMem(ctx->buffer + Section->VirtualAddress,
+			ctx->contents + Section->PointerToRawData, size);
+	}
+
+	return ctx->reloc_section ? 0 : -1;
+}
+
+static int
+bench_image(const char *suite, const char *name)
+{
+	reloc_ctx_t ctx;
+	int status = 0;
+
+	SetMem(&ctx, sizeof(ctx), 0);
+	ctx.contents = bench_read_file(name, &ctx.size);
+
+	if (EFI_ERROR(read_header(ctx.contents, ctx.size, &ctx.context, true)) ||
+	    load_sections(&ctx) < 0) {
+		status = 1;
+		goto out;
+	}
+
+	bench(suite, "read_header", 0, parse_header, &ctx);
+	bench(suite, "relocate_coff", ctx.context.ImageSize, relocate, &ctx);
+
+out:
+	if (ctx.buffer)
+		FreePool(ctx.buffer);
+	FreePool(ctx.contents);
+	return status;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	if (bench_image("pe_grub_0.76", "test-data/grubx64.0.76.el7.efi") != 0)
+		status = 1;
+	if (bench_image("pe_grub_0.80", "test-data/grubx64.0.80.el7.efi") != 0)
+		status = 1;
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-sbat.c - time SBAT parsing and verification
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#include "sbat_var_defs.h"
+#endif
+#include "shim.h"
+#include "bench.h"
+#include "generated_sbat_var_defs.h"
+
+#include <stdio.h>
+
+list_t sbat_var;
+
+BOOLEAN
+secure_mode() {
+	return 1;
+}
+
+/*
+ * A .sbat section like the ones distribution grub builds carry, and an
+ * SbatLevel with a few years of revocations in it.
+ */
+static const char sbat_section[] =
+	"sbat,1,SBAT Version,sbat,1,https://github.com/rhboot/shim/blob/main/SBAT.md\n"
+	"grub,4,Free Software Foundation,grub,2.06,https://www.gnu.org/software/grub/\n"
+	"grub.rh,2,Red Hat,grub2,2.06-61.el9,mailto:secalert@redhat.com\n"
+	"grub.peimage,2,Canonical,grub2,2.06,https://salsa.debian.org/grub-team/grub/-/blob/master/debian/patches/secure-boot/efi-use-peimage-shim.patch\n";
+
+static const char sbat_level[] =
+	"sbat,1,2024010900\n"
+	"shim,4\n"
+	"grub,3\n"
+	"grub.debian,4\n"
+	"grub.ubuntu,2\n"
+	"grub.peimage,2\n";
+
+typedef struct {
+	/* what entries and level_list point into */
+	char section[sizeof(sbat_section)];
+	char level[sizeof(sbat_level)];
+	/* scratch copies for the parsing benchmarks */
+	char section_copy[sizeof(sbat_section)];
+	char level_copy[sizeof(sbat_level)];
+	list_t level_list;
+	struct sbat_var_table table;
+	size_t n;
+	struct sbat_section_entry **entries;
+} sbat_ctx_t;
+
+static int
+parse_section(void *data)
+{
+	sbat_ctx_t *ctx = data;
+	struct sbat_section_entry **entries = NULL;
+	size_t n = 0;
+
+	/* parsing tokenizes in place, so start from a clean copy */
+	CopyMem(ctx->section_copy, sbat_section, sizeof(sbat_section));
+	if (EFI_ERROR(parse_sbat_section(ctx->section_copy,
+					 sizeof(sbat_section) - 1,
+					 &n, &entries)))
+		return -1;
+	cleanup_sbat_section_entries(n, entries);
+	return 0;
+}
+
+static int
+parse_level(void *data)
+{
+	sbat_ctx_t *ctx = data;
+	list_t entries;
+
+	INIT_LIST_HEAD(&entries);
+	CopyMem(ctx->level_copy, sbat_level, sizeof(sbat_level));
+	if (EFI_ERROR(parse_sbat_var_data(&entries, (UINT8 *)ctx->level_copy,
+					  sizeof(sbat_level))))
+		return -1;
+	cleanup_sbat_var(&entries);
+	return 0;
+}
+
+static int
+verify(void *data)
+{
+	sbat_ctx_t *ctx = data;
+
+	return EFI_ERROR(verify_sbat_helper(&ctx->level_list, ctx->n,
+					    ctx->entries)) ? -1 : 0;
+}
+
+static int
+verify_table(void *data)
+{
+	sbat_ctx_t *ctx = data;
+
+	return EFI_ERROR(verify_sbat_table(&ctx->table, ctx->n,
+					   ctx->entries)) ? -1 : 0;
+}
+
+int
+main(void)
+{
+	sbat_ctx_t ctx;
+	int status = 0;
+
+	SetMem(&ctx, sizeof(ctx), 0);
+	INIT_LIST_HEAD(&ctx.level_list);
+
+	CopyMem(ctx.section, sbat_section, sizeof(sbat_section));
+	CopyMem(ctx.level, sbat_level, sizeof(sbat_level));
+	if (EFI_ERROR(parse_sbat_section(ctx.section, sizeof(sbat_section) - 1,
+					 &ctx.n, &ctx.entries)) ||
+	    EFI_ERROR(parse_sbat_var_data(&ctx.level_list, (UINT8 *)ctx.level,
+					  sizeof(sbat_level))) ||
+	    EFI_ERROR(compile_sbat_var(&ctx.level_list, &ctx.table))) {
+		fprintf(stderr, "could not parse SBAT data\n");
+		return 1;
+	}
+
+	bench("sbat", "parse_sbat_section", sizeof(sbat_section) - 1,
+	      parse_section, &ctx);
+	bench("sbat", "parse_sbat_var_data", sizeof(sbat_level),
+	      parse_level, &ctx);
+	bench("sbat", "verify_sbat", 0, verify, &ctx);
+	bench("sbat", "verify_sbat_table", 0, verify_table, &ctx);
+
+	cleanup_sbat_var_table(&ctx.table);
+	cleanup_sbat_section_entries(ctx.n, ctx.entries);
+	cleanup_sbat_var(&ctx.level_list);
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
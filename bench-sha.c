@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench-sha.c - compare Cryptlib's hardware SHA-1/SHA-256 block functions
+ *		 against the portable C compression function
+ *
+ * Usage: bench-sha [-i iterations] FILE...
+ *
+ * Each file is hashed whole with both implementations; the digests must
+ * match, and the throughput of each is printed.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#define MDE_CPU_X64
+#elif defined(__aarch64__)
+#define MDE_CPU_AARCH64
+#endif
+
+typedef uint8_t UINT8;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uintptr_t UINTN;
+typedef unsigned char BOOLEAN;
+#define VOID void
+#define CONST const
+#define STATIC static
+#define IN
+#define OUT
+#define TRUE 1
+#define FALSE 0
+
+#define SHA_ACCEL_BLOCKS_ONLY
+#include "Cryptlib/Hash/CryptShaAccel.c"
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static uint32_t
+load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * Straightforward FIPS 180-4 compression, equivalent to what OpenSSL's
+ * sha256.c does when built without assembly.
+ */
+static void
+sha256_blocks_c(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	while (blocks--) {
+		for (i = 0; i < 16; i++)
+			w[i] = load_be32(data + 4 * i);
+		for (i = 16; i < 64; i++) {
+			uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+			uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+		for (i = 0; i < 64; i++) {
+			t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+			     ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+			     ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		data += 64;
+	}
+}
+
+static void
+sha1_blocks_c(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+	uint32_t w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	while (blocks--) {
+		for (i = 0; i < 16; i++)
+			w[i] = load_be32(data + 4 * i);
+		for (i = 16; i < 80; i++)
+			w[i] = ROTL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4];
+		for (i = 0; i < 80; i++) {
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			t = ROTL(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = ROTL(b, 30); b = a; a = t;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e;
+		data += 64;
+	}
+}
+
+static void
+sha256_blocks_hw(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+	Sha256AccelBlocks(state, data, blocks);
+}
+
+static void
+sha1_blocks_hw(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+	Sha1AccelBlocks(state, data, blocks);
+}
+
+typedef void (*blocks_fn)(uint32_t *state, const uint8_t *data, size_t blocks);
+
+struct algorithm {
+	const char *name;
+	unsigned int words;
+	uint32_t iv[8];
+	blocks_fn c;
+	blocks_fn hw;
+};
+
+static const struct algorithm algorithms[] = {
+	{ "sha256", 8,
+	  { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+	  sha256_blocks_c, sha256_blocks_hw },
+	{ "sha1", 5,
+	  { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 },
+	  sha1_blocks_c, sha1_blocks_hw },
+};
+
+/*
+ * Hash a whole buffer, including the final padding block(s).
+ */
+static void
+digest(const struct algorithm *alg, blocks_fn fn, const uint8_t *data,
+       size_t size, uint32_t *state)
+{
+	uint8_t tail[128] = { 0 };
+	size_t full = size / 64, rest = size % 64, tail_len;
+	uint64_t bits = (uint64_t)size * 8;
+	int i;
+
+	memcpy(state, alg->iv, alg->words * sizeof(uint32_t));
+	if (full)
+		fn(state, data, full);
+
+	memcpy(tail, data + full * 64, rest);
+	tail[rest] = 0x80;
+	tail_len = rest < 56 ? 64 : 128;
+	for (i = 0; i < 8; i++)
+		tail[tail_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+	fn(state, tail, tail_len / 64);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+time_digest(const struct algorithm *alg, blocks_fn fn, const uint8_t *data,
+	    size_t size, unsigned int iterations, uint32_t *state)
+{
+	uint64_t start = now_ns();
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++)
+		digest(alg, fn, data, size, state);
+	return now_ns() - start;
+}
+
+static uint64_t
+mb_per_sec(size_t size, unsigned int iterations, uint64_t ns)
+{
+	if (ns == 0)
+		ns = 1;
+	return (uint64_t)size * iterations * 1000ull / ns;
+}
+
+static void
+print_digest(const uint32_t *state, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i < words; i++)
+		printf("%08" PRIx32, state[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int iterations = 20;
+	bool have_hw;
+	uint32_t probe[8];
+	int ret = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "i:")) != -1) {
+		switch (c) {
+		case 'i':
+			iterations = strtoul(optarg, NULL, 0);
+			if (iterations == 0)
+				errx(1, "invalid iteration count \"%s\"", optarg);
+			break;
+		default:
+			errx(1, "usage: %s [-i iterations] FILE...", argv[0]);
+		}
+	}
+	if (optind >= argc)
+		errx(1, "usage: %s [-i iterations] FILE...", argv[0]);
+
+	memcpy(probe, algorithms[0].iv, sizeof(probe));
+	have_hw = Sha256AccelBlocks(probe, (const uint8_t *)probe, 0);
+	if (!have_hw)
+		printf("no SHA instructions on this CPU; timing the C path only\n");
+
+	for (int i = optind; i < argc; i++) {
+		struct stat sb;
+		uint8_t *data;
+		int fd;
+
+		fd = open(argv[i], O_RDONLY);
+		if (fd < 0)
+			err(1, "could not open \"%s\"", argv[i]);
+		if (fstat(fd, &sb) < 0)
+			err(1, "could not stat \"%s\"", argv[i]);
+		data = mmap(NULL, sb.st_size ? sb.st_size : 1, PROT_READ,
+			    MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			err(1, "could not map \"%s\"", argv[i]);
+		close(fd);
+
+		for (unsigned int a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++) {
+			const struct algorithm *alg = &algorithms[a];
+			uint32_t c_state[8], hw_state[8];
+			uint64_t c_ns, hw_ns, c_mbs, hw_mbs;
+
+			c_ns = time_digest(alg, alg->c, data, sb.st_size,
+					   iterations, c_state);
+			c_mbs = mb_per_sec(sb.st_size, iterations, c_ns);
+			printf("%s %s %jd bytes: c %" PRIu64 " MB/s",
+			       argv[i], alg->name, (intmax_t)sb.st_size, c_mbs);
+
+			if (have_hw) {
+				hw_ns = time_digest(alg, alg->hw, data,
+						    sb.st_size, iterations,
+						    hw_state);
+				hw_mbs = mb_per_sec(sb.st_size, iterations,
+						    hw_ns);
+				printf(" hw %" PRIu64 " MB/s (x%" PRIu64 ".%02" PRIu64 ")",
+				       hw_mbs, c_ns / (hw_ns ? hw_ns : 1),
+				       (c_ns * 100 / (hw_ns ? hw_ns : 1)) % 100);
+				if (memcmp(c_state, hw_state,
+					   alg->words * sizeof(uint32_t))) {
+					printf(" DIGEST MISMATCH");
+					ret = 1;
+				}
+			}
+			printf(" ");
+			print_digest(c_state, alg->words);
+			printf("\n");
+		}
+
+		munmap(data, sb.st_size ? sb.st_size : 1);
+	}
+
+	return ret;
+}
+
+// vim:fenc=utf-8:tw=75:noet
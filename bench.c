@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench.c - timing and reporting for the bench-* programs
+ *
+ * These are built like the test-* programs, against test.c and the
+ * mocks, but with normal inlining and no coverage instrumentation, and
+ * they print one JSON object per benchmark so results can be compared
+ * between releases.
+ */
+
+#include "shim.h"
+#include "bench.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifndef SHIM_BENCH_VERSION
+#define SHIM_BENCH_VERSION "unknown"
+#endif
+
+#define BENCH_MAX_ITERATIONS (1ull << 32)
+
+static UINT64
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ull + (UINT64)ts.tv_nsec;
+}
+
+static UINT64
+bench_min_ns(void)
+{
+	static UINT64 min_ns = 0;
+	const char *env;
+
+	if (min_ns)
+		return min_ns;
+
+	min_ns = 250;
+	env = getenv("SHIM_BENCH_MIN_MS");
+	if (env && strtoull(env, NULL, 0) > 0)
+		min_ns = strtoull(env, NULL, 0);
+	min_ns *= 1000000ull;
+	return min_ns;
+}
+
+int
+bench_run(const char *suite, const char *name, UINT64 bytes,
+	  bench_fn fn, void *ctx)
+{
+	UINT64 iterations = 1;
+	UINT64 start, ns;
+	double ns_per_op;
+	int rc;
+
+	/* once untimed, so the first timed run isn't paying for page faults */
+	rc = fn(ctx);
+	if (rc != 0)
+		return rc;
+
+	for (;;) {
+		start = bench_now_ns();
+		for (UINT64 i = 0; i < iterations; i++) {
+			rc = fn(ctx);
+			if (rc != 0)
+				return rc;
+		}
+		ns = bench_now_ns() - start;
+		if (ns >= bench_min_ns() || iterations >= BENCH_MAX_ITERATIONS)
+			break;
+		iterations *= 2;
+	}
+
+	ns_per_op = (double)ns / (double)iterations;
+	printf("{\"version\":\"%s\",\"suite\":\"%s\",\"name\":\"%s\","
+	       "\"iterations\":%llu,\"ns\":%llu,\"ns_per_op\":%.3f,"
+	       "\"ops_per_sec\":%.3f",
+	       SHIM_BENCH_VERSION, suite, name,
+	       (unsigned long long)iterations, (unsigned long long)ns,
+	       ns_per_op, ns_per_op > 0 ? 1000000000.0 / ns_per_op : 0.0);
+	if (bytes)
+		printf(",\"bytes_per_op\":%llu,\"ns_per_byte\":%.6f",
+		       (unsigned long long)bytes, ns_per_op / (double)bytes);
+	printf("}\n");
+	fflush(stdout);
+
+	return 0;
+}
+
+UINT8 *
+bench_read_file(const char *name, UINTN *sizep)
+{
+	struct stat statbuf;
+	UINT8 *buf;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f)
+		err(2, "Could not open \"%s\"", name);
+	if (fstat(fileno(f), &statbuf) < 0)
+		err(2, "Could not stat \"%s\"", name);
+	buf = AllocatePool(statbuf.st_size);
+	if (!buf)
+		err(2, "Could not allocate %ld bytes", (long)statbuf.st_size);
+	if (fread(buf, 1, statbuf.st_size, f) != (size_t)statbuf.st_size)
+		errx(2, "Could not read \"%s\"", name);
+	fclose(f);
+
+	*sizep = statbuf.st_size;
+	return buf;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -134,4 +134,118 @@ err_oom:
 	return efi_status;
 }
 
+EFI_STATUS
+csv_arena_reserve(struct csv_arena *arena, size_t size)
+{
+	UINT8 *new_buf;
+
+	if (size <= arena->size)
+		return EFI_SUCCESS;
+
+	new_buf = AllocateZeroPool(size);
+	if (!new_buf)
+		return EFI_OUT_OF_RESOURCES;
+	if (arena->buf) {
+		CopyMem(new_buf, arena->buf, arena->size);
+		FreePool(arena->buf);
+	}
+	arena->buf = new_buf;
+	arena->size = size;
+	return EFI_SUCCESS;
+}
+
+void
+csv_arena_free(struct csv_arena *arena)
+{
+	if (arena->buf)
+		FreePool(arena->buf);
+	arena->buf = NULL;
+	arena->size = 0;
+}
+
+static inline bool
+is_csv_row_delim(char c)
+{
+	return c == '\r' || c == '\n';
+}
+
+EFI_STATUS
+parse_csv_rows(char *data, char *data_end, size_t n_columns, size_t stride,
+	       struct csv_arena *arena, size_t *n_rows)
+{
+	EFI_STATUS efi_status;
+	char *line = data;
+	size_t n = 0;
+
+	if (!data || !data_end || data_end <= data || !n_columns ||
+	    stride < n_columns * sizeof(char *) || !arena || !n_rows) {
+		dprint(L"data:0x%lx end:0x%lx n_columns:%lu arena:0x%lx\n",
+		       data, data_end, n_columns, arena);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if (is_utf8_bom((CHAR8 *)line, data_end - line + 1))
+		line += UTF8_BOM_SIZE;
+
+	/*
+	 * Like parse_csv_data(), the byte at data_end always ends the data,
+	 * whatever it is.
+	 */
+	while (line <= data_end && *line) {
+		char **columns;
+		char *token, *pos;
+		size_t m_columns = 0;
+		bool delimited = false;
+
+		/* Skip the delimiter(s) of the previous line */
+		while (line < data_end && is_csv_row_delim(*line))
+			line++;
+		if (line == data_end) {
+			*line = '\0';
+			break;
+		}
+		/* A NUL right after a line break doesn't end the data */
+		if (*line == '\0') {
+			line++;
+			continue;
+		}
+
+		if (arena->size / stride <= n) {
+			efi_status = csv_arena_reserve(arena,
+					MAX(arena->size * 2, stride * 8));
+			if (EFI_ERROR(efi_status))
+				return efi_status;
+		}
+		columns = (char **)(arena->buf + n * stride);
+		ZeroMem(columns, stride);
+		n++;
+
+		/*
+		 * A column only counts once the line has had a comma in it,
+		 * and anything past n_columns is left alone.
+		 */
+		token = line;
+		for (pos = line; pos < data_end && *pos && !is_csv_row_delim(*pos); pos++) {
+			if (*pos != ',' || m_columns == n_columns)
+				continue;
+			*pos = '\0';
+			columns[m_columns++] = token;
+			token = pos + 1;
+			delimited = true;
+		}
+		if (delimited && m_columns < n_columns)
+			columns[m_columns++] = token;
+
+		if (pos == data_end || *pos == '\0') {
+			*pos = '\0';
+			break;
+		}
+		*pos = '\0';
+		line = pos + 1;
+	}
+
+	*n_rows = n;
+	return EFI_SUCCESS;
+}
+
 // vim:fenc=utf-8:tw=75:noet
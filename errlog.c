@@ -122,54 +122,135 @@ format_error_log(UINT8 *dest, size_t dest_sz)
 	return err_log_sz;
 }
 
-static UINT8 *debug_log = NULL;
+/*
+ * The debug log is kept as a list of chunks, each a page unless one
+ * message needed more, and messages are formatted straight into the
+ * last one.  Nothing written is ever moved until save_logs() copies it
+ * all out.  Each message is stored with its NUL, as save_logs() exports
+ * them.
+ */
+struct debug_log_chunk {
+	list_t list;
+	size_t used;
+	size_t size;
+	UINT8 data[];
+};
+
+#define DEBUG_LOG_CHUNK_SIZE \
+	(EFI_PAGE_SIZE - offsetof(struct debug_log_chunk, data))
+
+static LIST_HEAD(debug_log);
 static size_t debug_log_sz = 0;
-static size_t debug_log_alloc = 0;
+
+static struct debug_log_chunk *
+new_debug_log_chunk(size_t size)
+{
+	struct debug_log_chunk *chunk;
+
+	size = MAX(size, DEBUG_LOG_CHUNK_SIZE);
+	chunk = AllocatePool(offsetof(struct debug_log_chunk, data) + size);
+	if (!chunk)
+		return NULL;
+	chunk->used = 0;
+	chunk->size = size;
+	list_add_tail(&chunk->list, &debug_log);
+	return chunk;
+}
+
+/*
+ * Format into what's left of chunk, and return the length written, or
+ * -1 if it might not all have fit.  MS_VSPrint() truncates silently, so
+ * a message that exactly fills the space counts as not fitting.
+ */
+static ssize_t
+format_into_chunk(struct debug_log_chunk *chunk, const CHAR16 *fmt,
+		  ms_va_list args)
+{
+	size_t avail = chunk->size - chunk->used;
+	UINTN len;
+
+	if (avail < 2 * sizeof(CHAR16))
+		return -1;
+
+	len = MS_VSPrint((CHAR16 *)&chunk->data[chunk->used], avail, fmt, args);
+	if ((len + 2) * sizeof(CHAR16) > avail)
+		return -1;
+
+	chunk->used += (len + 1) * sizeof(CHAR16);
+	debug_log_sz += (len + 1) * sizeof(CHAR16);
+	return len;
+}
 
 UINTN EFIAPI
 log_debug_print(const CHAR16 *fmt, ...)
 {
-	ms_va_list args;
+	struct debug_log_chunk *chunk = NULL;
+	ms_va_list args, args2;
 	CHAR16 *buf;
 	size_t buf_sz;
-	UINTN ret = 0;
+	ssize_t len = -1;
 
 	ms_va_start(args, fmt);
+
+	if (!list_empty(&debug_log)) {
+		chunk = list_entry(debug_log.prev, struct debug_log_chunk, list);
+		ms_va_copy(args2, args);
+		len = format_into_chunk(chunk, fmt, args2);
+		ms_va_end(args2);
+	}
+	if (len < 0 && (!chunk || chunk->used > 0)) {
+		chunk = new_debug_log_chunk(0);
+		if (chunk) {
+			ms_va_copy(args2, args);
+			len = format_into_chunk(chunk, fmt, args2);
+			ms_va_end(args2);
+		}
+	}
+	if (len >= 0 || !chunk) {
+		ms_va_end(args);
+		return len >= 0 ? len : 0;
+	}
+
+	/*
+	 * Bigger than a whole chunk; give it one of its own.  The empty
+	 * one we just made still gets used by whatever comes next.
+	 */
 	buf = MS_VPoolPrint(fmt, args);
+	ms_va_end(args);
 	if (!buf)
 		return 0;
-	ms_va_end(args);
 
-	ret = StrLen(buf);
 	buf_sz = StrSize(buf);
-	if (debug_log_sz + buf_sz > debug_log_alloc) {
-		size_t new_alloc_sz = debug_log_alloc;
-		CHAR16 *new_debug_log;
-
-		new_alloc_sz += buf_sz;
-		new_alloc_sz = ALIGN_UP(new_alloc_sz, EFI_PAGE_SIZE);
-
-		new_debug_log = ReallocatePool(debug_log_alloc, new_alloc_sz, debug_log);
-		if (!new_debug_log)
-			return 0;
-		debug_log = (UINT8 *)new_debug_log;
-		debug_log_alloc = new_alloc_sz;
+	chunk = new_debug_log_chunk(buf_sz);
+	if (!chunk) {
+		FreePool(buf);
+		return 0;
 	}
-
-	CopyMem(&debug_log[debug_log_sz], buf, buf_sz);
+	list_del(&chunk->list);
+	list_add_tail(&chunk->list, debug_log.prev);
+	CopyMem(chunk->data, buf, buf_sz);
+	chunk->used = buf_sz;
 	debug_log_sz += buf_sz;
 	FreePool(buf);
-	return ret;
+	return buf_sz / sizeof(CHAR16) - 1;
 }
 
 static size_t
 format_debug_log(UINT8 *dest, size_t dest_sz)
 {
+	list_t *pos = NULL;
+	size_t off = 0;
+
 	if (!dest || dest_sz < debug_log_sz)
 		return debug_log_sz;
 
-	ZeroMem(dest, debug_log_sz);
-	CopyMem(dest, debug_log, debug_log_sz);
+	list_for_each(pos, &debug_log) {
+		struct debug_log_chunk *chunk;
+
+		chunk = list_entry(pos, struct debug_log_chunk, list);
+		CopyMem(&dest[off], chunk->data, chunk->used);
+		off += chunk->used;
+	}
 	return debug_log_sz;
 }
 
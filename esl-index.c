@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * esl-index.c - hash index of the digests in an EFI_SIGNATURE_LIST
+ *
+ * dbx and the built-in deny list hold hundreds of SHA-256 entries, and
+ * every image we load is checked against all of them.  Instead of
+ * comparing the digest against each EFI_SIGNATURE_DATA in turn, build
+ * a bucketed index the first time a list is consulted and look digests
+ * up in that.
+ */
+
+#include "shim.h"
+
+static UINTN
+esl_index_bucket(const esl_index_t *index, const UINT8 *digest)
+{
+	UINT32 key = 0;
+
+	for (UINTN i = 0; i < MIN(index->digest_size, sizeof(key)); i++)
+		key |= (UINT32)digest[i] << (8 * i);
+
+	return key & (index->n_buckets - 1);
+}
+
+/*
+ * Walk the lists the same way check_db_hash_in_ram() does, counting the
+ * signatures of the index's type and, if add is set, filling in
+ * index->entries with them.
+ */
+static UINTN
+esl_index_walk(esl_index_t *index, EFI_SIGNATURE_LIST *esl, UINTN eslsize,
+	       bool add)
+{
+	EFI_SIGNATURE_LIST *CertList = esl;
+	EFI_SIGNATURE_DATA *Cert;
+	UINTN dbsize = eslsize;
+	UINTN CertCount, n = 0;
+
+	while ((dbsize > 0) && (dbsize >= CertList->SignatureListSize)) {
+		if (CertList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST))
+			break;
+
+		if (CompareGuid(&CertList->SignatureType, &index->type) &&
+		    CertList->SignatureSize >= sizeof(EFI_GUID) + index->digest_size) {
+			CertCount = (CertList->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) -
+				     CertList->SignatureHeaderSize) / CertList->SignatureSize;
+			Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)CertList + sizeof(EFI_SIGNATURE_LIST) +
+						      CertList->SignatureHeaderSize);
+			for (UINTN i = 0; i < CertCount; i++) {
+				if (add) {
+					index->entries[n].sig = Cert;
+					index->entries[n].sig_size = CertList->SignatureSize;
+				}
+				n++;
+				Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)Cert + CertList->SignatureSize);
+			}
+		}
+
+		dbsize -= CertList->SignatureListSize;
+		CertList = (EFI_SIGNATURE_LIST *)((UINT8 *)CertList + CertList->SignatureListSize);
+	}
+
+	return n;
+}
+
+/*
+ * Index every signature of the given type in esl.  Signatures whose
+ * SignatureSize is too small to hold a digest of digest_size bytes are
+ * ignored.  Returns NULL if we can't allocate the index.
+ */
+esl_index_t *
+esl_index_new(EFI_SIGNATURE_LIST *esl, UINTN eslsize, const EFI_GUID *type,
+	      UINTN digest_size)
+{
+	esl_index_t probe = { .type = *type, .digest_size = digest_size };
+	esl_index_t *index;
+	UINTN n_entries, n_buckets = 1, allocsz;
+
+	if (!esl)
+		eslsize = 0;
+
+	n_entries = esl_index_walk(&probe, esl, eslsize, false);
+	while (n_buckets < n_entries && n_buckets < 0x10000)
+		n_buckets <<= 1;
+
+	allocsz = sizeof(*index) + n_buckets * sizeof(UINT32) +
+		  n_entries * sizeof(esl_index_entry_t);
+	index = AllocateZeroPool(allocsz);
+	if (!index)
+		return NULL;
+
+	index->type = *type;
+	index->digest_size = digest_size;
+	index->n_entries = n_entries;
+	index->n_buckets = n_buckets;
+	index->entries = (esl_index_entry_t *)(index + 1);
+	index->buckets = (UINT32 *)(index->entries + n_entries);
+
+	esl_index_walk(index, esl, eslsize, true);
+
+	/*
+	 * Push from the back, so each bucket's chain is in the same order
+	 * as the lists are; a lookup then finds the same entry a linear
+	 * scan would, which matters because that's what gets measured.
+	 */
+	for (UINTN i = n_entries; i > 0; i--) {
+		esl_index_entry_t *entry = &index->entries[i - 1];
+		UINTN bucket = esl_index_bucket(index, entry->sig->SignatureData);
+
+		entry->next = index->buckets[bucket];
+		index->buckets[bucket] = i;
+	}
+
+	return index;
+}
+
+/*
+ * Find the first signature whose data starts with digest.  Returns the
+ * EFI_SIGNATURE_DATA and, in *sig_size, the SignatureSize of its list.
+ */
+EFI_SIGNATURE_DATA *
+esl_index_find(esl_index_t *index, const UINT8 *digest, UINT32 *sig_size)
+{
+	UINT32 n;
+
+	if (!index || !index->n_entries)
+		return NULL;
+
+	n = index->buckets[esl_index_bucket(index, digest)];
+	while (n) {
+		esl_index_entry_t *entry = &index->entries[n - 1];
+
+		if (CompareMem(entry->sig->SignatureData, digest,
+			       index->digest_size) == 0) {
+			if (sig_size)
+				*sig_size = entry->sig_size;
+			return entry->sig;
+		}
+		n = entry->next;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remove every signature whose digest is in index from sigs, which holds
+ * n EFI_SIGNATURE_DATA of sig_size bytes each, keeping the rest in order.
+ * This is one pass over sigs, however many digests are being removed.
+ * Returns the number left.
+ */
+UINTN
+esl_index_remove(esl_index_t *index, UINT8 *sigs, UINTN n, UINTN sig_size)
+{
+	UINT8 *src = sigs, *dst = sigs;
+	UINTN kept = 0;
+
+	if (!index || !index->n_entries ||
+	    sig_size < sizeof(EFI_GUID) + index->digest_size)
+		return n;
+
+	for (UINTN i = 0; i < n; i++, src += sig_size) {
+		EFI_SIGNATURE_DATA *sig = (EFI_SIGNATURE_DATA *)src;
+
+		if (esl_index_find(index, sig->SignatureData, NULL))
+			continue;
+		if (dst != src)
+			CopyMem(dst, src, sig_size);
+		dst += sig_size;
+		kept++;
+	}
+
+	return kept;
+}
+
+void
+esl_index_free(esl_index_t *index)
+{
+	if (index)
+		FreePool(index);
+}
+
+// vim:fenc=utf-8:tw=75:noet
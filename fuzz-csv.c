@@ -48,15 +48,87 @@ fail:
 	return -1;
 }
 
+/*
+ * parse_csv_rows() has to find the same rows and columns as
+ * parse_csv_data(), and leave the data modified the same way.
+ */
+int
+test_csv_rows_fuzz(const uint8_t *data, size_t size, size_t n_columns)
+{
+	struct csv_arena arena = { NULL, 0 };
+	char *list_copy, *rows_copy;
+	list_t entry_list, *pos = NULL;
+	EFI_STATUS list_status, rows_status;
+	size_t n_rows = 0, i = 0, j;
+	int rc = -1;
+
+	INIT_LIST_HEAD(&entry_list);
+
+	list_copy = malloc(size + 1);
+	rows_copy = malloc(size + 1);
+	if (!list_copy || !rows_copy)
+		goto out;
+	memcpy(list_copy, data, size);
+	list_copy[size] = '\0';
+	memcpy(rows_copy, list_copy, size + 1);
+
+	list_status = parse_csv_data(list_copy, list_copy + size, n_columns,
+				     &entry_list);
+	rows_status = parse_csv_rows(rows_copy, rows_copy + size, n_columns,
+				     n_columns * sizeof(char *), &arena,
+				     &n_rows);
+	if (list_status != rows_status)
+		goto out;
+	if (EFI_ERROR(list_status)) {
+		rc = 0;
+		goto out;
+	}
+	if (n_rows != list_size(&entry_list))
+		goto out;
+
+	list_for_each(pos, &entry_list) {
+		struct csv_row *row = list_entry(pos, struct csv_row, list);
+		char **columns = (char **)(arena.buf + i * n_columns * sizeof(char *));
+
+		for (j = 0; j < n_columns; j++) {
+			if (j < row->n_columns) {
+				if (!columns[j] ||
+				    columns[j] - rows_copy != row->columns[j] - list_copy)
+					goto out;
+			} else if (columns[j]) {
+				goto out;
+			}
+		}
+		i++;
+	}
+
+	if (memcmp(list_copy, rows_copy, size + 1))
+		goto out;
+
+	rc = 0;
+out:
+	csv_arena_free(&arena);
+	free_csv_list(&entry_list);
+	free(rows_copy);
+	free(list_copy);
+	return rc;
+}
+
 int
 LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 {
 	int rc;
 	uint8_t *data_copy;
+	size_t n_columns[] = { 1, 2, 3, 6, 7 };
 
 	if (size < 1)
 		return 0;
 
+	for (size_t i = 0; i < sizeof(n_columns) / sizeof(n_columns[0]); i++) {
+		if (test_csv_rows_fuzz(data, size, n_columns[i]) < 0)
+			abort();
+	}
+
 	data_copy = malloc(size);
 	if (!data_copy)
 		return -1;
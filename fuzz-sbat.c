@@ -18,6 +18,153 @@ secure_mode() {
 	return 1;
 }
 
+/*
+ * What parse_sbat_section() and parse_sbat_var_data() accepted when they
+ * were built on parse_csv_data(): every row must have at least
+ * min_columns columns, and none of them may be empty.  Returns the
+ * number of rows, or -1.
+ */
+static ssize_t
+reference_parse(char *data, size_t size, size_t n_columns,
+		size_t min_columns, list_t *rows)
+{
+	list_t *pos = NULL;
+	ssize_t n = 0;
+
+	INIT_LIST_HEAD(rows);
+	if (EFI_ERROR(parse_csv_data(data, data + size - 1, n_columns, rows)))
+		return -1;
+
+	list_for_each(pos, rows) {
+		struct csv_row *row = list_entry(pos, struct csv_row, list);
+
+		if (row->n_columns < min_columns)
+			return -1;
+		for (size_t i = 0; i < row->n_columns; i++) {
+			if (!row->columns[i][0])
+				return -1;
+		}
+		n++;
+	}
+	return n;
+}
+
+static bool
+columns_match(struct csv_row *row, const CHAR8 **columns, size_t n_columns)
+{
+	for (size_t i = 0; i < n_columns; i++) {
+		if (i >= row->n_columns) {
+			if (columns[i])
+				return false;
+			continue;
+		}
+		if (!columns[i] || strcmp(row->columns[i], (char *)columns[i]))
+			return false;
+	}
+	return true;
+}
+
+static int
+compare_sbat_section(const uint8_t *data, size_t size)
+{
+	struct sbat_section_entry **entries = NULL;
+	char *reference_copy, *section_copy;
+	list_t rows, *pos = NULL;
+	EFI_STATUS status;
+	ssize_t reference_n;
+	size_t n = 0, i = 0;
+	int rc = -1;
+
+	INIT_LIST_HEAD(&rows);
+	reference_copy = malloc(size + 1);
+	section_copy = malloc(size + 1);
+	if (!reference_copy || !section_copy)
+		goto out;
+	memcpy(reference_copy, data, size);
+	reference_copy[size] = '\0';
+	memcpy(section_copy, reference_copy, size + 1);
+
+	reference_n = reference_parse(reference_copy, size + 1,
+				      SBAT_SECTION_COLUMNS,
+				      SBAT_SECTION_COLUMNS, &rows);
+	status = parse_sbat_section(section_copy, size + 1, &n, &entries);
+	if (reference_n < 0 || EFI_ERROR(status)) {
+		if ((reference_n < 0) == !!EFI_ERROR(status))
+			rc = 0;
+		goto out;
+	}
+	if ((size_t)reference_n != n)
+		goto out;
+
+	list_for_each(pos, &rows) {
+		struct csv_row *row = list_entry(pos, struct csv_row, list);
+
+		if (!columns_match(row, (const CHAR8 **)entries[i++],
+				   SBAT_SECTION_COLUMNS))
+			goto out;
+	}
+	rc = 0;
+out:
+	cleanup_sbat_section_entries(n, entries);
+	free_csv_list(&rows);
+	free(section_copy);
+	free(reference_copy);
+	return rc;
+}
+
+static int
+compare_sbat_var(const uint8_t *data, size_t size)
+{
+	char *reference_copy, *var_copy;
+	list_t rows, entries, *pos = NULL, *entry_pos;
+	EFI_STATUS status;
+	ssize_t reference_n;
+	int rc = -1;
+
+	INIT_LIST_HEAD(&rows);
+	INIT_LIST_HEAD(&entries);
+	reference_copy = malloc(size + 1);
+	var_copy = malloc(size + 1);
+	if (!reference_copy || !var_copy)
+		goto out;
+	memcpy(reference_copy, data, size);
+	reference_copy[size] = '\0';
+	memcpy(var_copy, reference_copy, size + 1);
+
+	reference_n = reference_parse(reference_copy, size + 1,
+				      SBAT_VAR_COLUMNS,
+				      SBAT_VAR_REQUIRED_COLUMNS, &rows);
+	status = parse_sbat_var_data(&entries, (UINT8 *)var_copy, size + 1);
+	/* the entries may not point into the caller's buffer */
+	memset(var_copy, 'x', size + 1);
+	if (reference_n < 0 || EFI_ERROR(status)) {
+		if ((reference_n < 0) == !!EFI_ERROR(status))
+			rc = 0;
+		goto out;
+	}
+	if ((size_t)reference_n != list_size(&entries))
+		goto out;
+
+	entry_pos = entries.next;
+	list_for_each(pos, &rows) {
+		struct csv_row *row = list_entry(pos, struct csv_row, list);
+		struct sbat_var_entry *entry;
+
+		entry = list_entry(entry_pos, struct sbat_var_entry, list);
+		if (!columns_match(row, (const CHAR8 **)entry,
+				   SBAT_VAR_COLUMNS))
+			goto out;
+		entry_pos = entry_pos->next;
+	}
+	rc = 0;
+out:
+	cleanup_sbat_var(&entries);
+	free_csv_list(&rows);
+	free(var_copy);
+	free(reference_copy);
+	return rc;
+}
+
 int
 LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 {
@@ -29,6 +176,10 @@ LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 	if (size < 1)
 		return 0;
 
+	if (compare_sbat_section(data, size) < 0 ||
+	    compare_sbat_var(data, size) < 0)
+		abort();
+
 	data_copy = malloc(size+1);
 	if (!data_copy)
 		return -1;
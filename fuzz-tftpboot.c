@@ -4,6 +4,7 @@
  */
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #ifndef SHIM_UNIT_TEST
 #define SHIM_UNIT_TEST
@@ -66,37 +67,79 @@ fuzzer_consume_bool(state_t *state, BOOLEAN *b)
  * mtftp_xfer() can access input bytes */
 static state_t *gstate = NULL;
 
+/*
+ * The TFTP server mtftp_xfer() pretends to be, set up from the fuzzing
+ * input: the file it serves, if any, whether it supports the tsize
+ * option, and the biggest block size it will agree to.  It counts what
+ * it sends, so we can check that we don't download the file more than
+ * we have to.
+ */
+typedef struct {
+	const uint8_t *file;
+	size_t file_size;
+	BOOLEAN tsize;
+	UINT16 max_blksize;
+	size_t bytes_sent;
+} tftp_server_t;
+
+static tftp_server_t server;
+
 static EFI_STATUS EFIAPI
 mtftp_xfer(struct _EFI_PXE_BASE_CODE_PROTOCOL *pxe,
            EFI_PXE_BASE_CODE_TFTP_OPCODE op, VOID *buf,
-           BOOLEAN overwrite UNUSED, UINT64 *bufsize, UINT64 *blocksize UNUSED,
+           BOOLEAN overwrite UNUSED, UINT64 *bufsize, UINT64 *blocksize,
            EFI_IP_ADDRESS *addr UNUSED, UINT8 *filename UNUSED,
            EFI_PXE_BASE_CODE_MTFTP_INFO *info UNUSED, BOOLEAN dontusebuf UNUSED)
 {
 	EFI_STATUS status;
-	size_t size;
 	unsigned int i;
 	EFI_PXE_BASE_CODE_TFTP_ERROR *error;
 	uint8_t c;
 
-	if (op != EFI_PXE_BASE_CODE_TFTP_READ_FILE) {
+	pxe->Mode->TftpErrorReceived = 0;
+	pxe->Mode->TftpError.ErrorCode = 0;
+
+	if (op != EFI_PXE_BASE_CODE_TFTP_READ_FILE &&
+	    op != EFI_PXE_BASE_CODE_TFTP_GET_FILE_SIZE) {
 		status = EFI_UNSUPPORTED;
 		goto out_err;
 	}
 
-	if (fuzzer_consume_len(gstate, &size)) {
+	if (blocksize && *blocksize > server.max_blksize) {
+		pxe->Mode->TftpError.ErrorCode = 8;
 		status = EFI_TFTP_ERROR;
 		goto out_err;
 	}
 
-	if (*bufsize < size) {
-		status = EFI_BUFFER_TOO_SMALL;
+	if (!server.file) {
+		status = EFI_TFTP_ERROR;
 		goto out_err;
 	}
 
-	fuzzer_consume_bytes(gstate, buf, size);
+	if (op == EFI_PXE_BASE_CODE_TFTP_GET_FILE_SIZE) {
+		/* without tsize, the server just starts sending the file */
+		if (!server.tsize)
+			return EFI_TFTP_ERROR;
+		*bufsize = server.file_size;
+		return EFI_SUCCESS;
+	}
 
-	*bufsize = size;
+	if (*bufsize < server.file_size) {
+		/*
+		 * With tsize, the firmware knows the buffer is too small
+		 * before it starts; without it, not until it fills up.
+		 */
+		if (server.tsize) {
+			*bufsize = server.file_size;
+		} else {
+			server.bytes_sent += *bufsize;
+		}
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	memcpy(buf, server.file, server.file_size);
+	server.bytes_sent += server.file_size;
+	*bufsize = server.file_size;
 	return EFI_SUCCESS;
 
 out_err:
@@ -111,6 +154,25 @@ out_err:
 	return status;
 }
 
+static int
+fuzzer_init_server(state_t *state, tftp_server_t *srv)
+{
+	memset(srv, 0, sizeof(*srv));
+
+	if (fuzzer_consume_bool(state, &srv->tsize) ||
+	    fuzzer_consume_bytes(state, &srv->max_blksize,
+				 sizeof(srv->max_blksize)))
+		return -1;
+
+	/* no file at all means "file not found" */
+	if (fuzzer_consume_len(state, &srv->file_size))
+		return 0;
+	srv->file = state->data;
+	state->data += srv->file_size;
+	state->len -= srv->file_size;
+	return 0;
+}
+
 static int
 fuzzer_init_mode(state_t *state, EFI_PXE_BASE_CODE_MODE *mode)
 {
@@ -183,9 +245,22 @@ fuzzer_main(state_t *state)
 	if (EFI_ERROR(status))
 		goto out;
 
+	if (fuzzer_init_server(state, &server))
+		goto out;
+
 	status = FetchNetbootimage(NULL, &sourcebuffer, &sourcesize, 0);
-	if (!EFI_ERROR(status))
+	if (!EFI_ERROR(status)) {
+		if (sourcesize != server.file_size ||
+		    memcmp(sourcebuffer, server.file, sourcesize) != 0)
+			abort();
+		/*
+		 * A server that tells us the file size only has to send
+		 * it once, whatever block sizes we had to try first.
+		 */
+		if (server.tsize && server.bytes_sent != server.file_size)
+			abort();
 		FreePool(sourcebuffer);
+	}
 
 out:
 	if (full_path) {
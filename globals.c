@@ -33,6 +33,13 @@ UINT8 ignore_db;
 UINT8 trust_mok_list;
 UINT8 mok_policy = 0;
 
+/*
+ * Bumped whenever the policy images are verified against changes in
+ * memory rather than in a variable: MoK state, the SBAT level, mok_policy
+ * and certificates added by addons.
+ */
+UINTN policy_generation = 0;
+
 UINT32 verbose = 0;
 
 EFI_PHYSICAL_ADDRESS mok_config_table = 0;
@@ -554,20 +554,43 @@ no_event:
 	return efi_status;
 }
 
-static EFI_STATUS
-receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
+/*
+ * The most body we ask the firmware for per Response() once we know
+ * where it's going.  Each Response() is a round trip through the HTTP
+ * driver and a wait for the event, so the bigger the better, as long as
+ * what just arrived is still in cache when we hash it.
+ */
+#define HTTP_RX_WINDOW_SIZE	IMAGE_STREAM_CHUNK_SIZE
+
+/*
+ * Receive the response to our GET into a newly allocated *buffer.  Only
+ * the first piece of the body, which arrives with the headers before we
+ * know how big the file is, goes through a bounce buffer; after that the
+ * firmware writes straight into *buffer.  If hash is set, the image's
+ * Authenticode regions are fed to it as they arrive, the way
+ * stream_image() does, and *layoutp is set if all of them were.
+ */
+EFI_STATUS
+receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size,
+		      image_stream_hash_fn hash, void *hash_ctx,
+		      authenticode_layout_t **layoutp)
 {
 	EFI_HTTP_TOKEN rx_token;
 	EFI_HTTP_MESSAGE rx_message;
 	EFI_HTTP_RESPONSE_DATA response;
 	EFI_HTTP_STATUS_CODE http_status;
 	BOOLEAN response_done;
-	UINTN i, downloaded;
+	UINTN i, downloaded = 0;
 	CHAR8 rx_buffer[9216];
 	EFI_STATUS efi_status;
 	EFI_STATUS event_status;
 	UINT64 new_buf_size;
 	BOOLEAN buf_size_set = false;
+	image_stream_t stream;
+	authenticode_layout_t *layout;
+
+	*layoutp = NULL;
+	image_stream_init(&stream, NULL, 0, NULL, NULL);
 
 	/* Initialize the rx message and buffer */
 	response.StatusCode = HTTP_STATUS_UNSUPPORTED_STATUS;
@@ -623,6 +646,7 @@ receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
 			new_buf_size = ascii_to_int(rx_message.Headers[i].FieldValue);
 			if (buf_size_set && new_buf_size != *buf_size) {
 				perror(L"Content-Length is invalid\n");
+				efi_status = EFI_PROTOCOL_ERROR;
 				goto error;
 			}
 			*buf_size = new_buf_size;
@@ -632,6 +656,7 @@ receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
 
 	if (*buf_size == 0) {
 		perror(L"Failed to get Content-Length\n");
+		efi_status = EFI_NOT_FOUND;
 		goto error;
 	}
 
@@ -644,6 +669,7 @@ receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
 	*buffer = AllocatePool(*buf_size);
 	if (!*buffer) {
 		perror(L"Failed to allocate new rx buffer\n");
+		efi_status = EFI_OUT_OF_RESOURCES;
 		goto error;
 	}
 
@@ -651,7 +677,12 @@ receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
 
 	CopyMem(*buffer, rx_buffer, downloaded);
 
-	/* Retreive the rest of the message */
+	image_stream_init(&stream, *buffer, *buf_size, hash, hash_ctx);
+	efi_status = image_stream_update(&stream, downloaded);
+	if (EFI_ERROR(efi_status))
+		goto error;
+
+	/* Retreive the rest of the message right where it belongs */
 	while (downloaded < *buf_size) {
 		if (rx_message.Headers) {
 			FreePool(rx_message.Headers);
@@ -659,8 +690,9 @@ receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
 		rx_message.Headers = NULL;
 		rx_message.HeaderCount = 0;
 		rx_message.Data.Response = NULL;
-		rx_message.BodyLength = sizeof(rx_buffer);
-		rx_message.Body = rx_buffer;
+		rx_message.BodyLength = MIN(*buf_size - downloaded,
+					    HTTP_RX_WINDOW_SIZE);
+		rx_message.Body = *buffer + downloaded;
 
 		rx_token.Status = EFI_NOT_READY;
 		response_done = FALSE;
@@ -685,12 +717,17 @@ receive_http_response(EFI_HTTP_PROTOCOL *http, VOID **buffer, UINT64 *buf_size)
 			goto error;
 		}
 
-		CopyMem(*buffer + downloaded, rx_buffer, rx_message.BodyLength);
-
 		downloaded += rx_message.BodyLength;
+
+		efi_status = image_stream_update(&stream, downloaded);
+		if (EFI_ERROR(efi_status))
+			goto error;
 	}
 
 error:
+	if (rx_message.Headers)
+		FreePool(rx_message.Headers);
+
 	event_status = BS->CloseEvent(rx_token.Event);
 	if (EFI_ERROR(event_status)) {
 		perror(L"Failed to close Event for HTTP response: %r\n",
@@ -698,8 +735,17 @@ error:
 	}
 
 no_event:
-	if (EFI_ERROR(efi_status) && *buffer)
-		FreePool(*buffer);
+	layout = image_stream_finish(&stream,
+				     EFI_ERROR(efi_status) ? 0 : downloaded);
+	if (EFI_ERROR(efi_status)) {
+		if (layout)
+			FreePool(layout);
+		if (*buffer)
+			FreePool(*buffer);
+		*buffer = NULL;
+	} else {
+		*layoutp = layout;
+	}
 
 	return efi_status;
 }
@@ -707,7 +753,9 @@ no_event:
 static EFI_STATUS
 http_fetch (EFI_HANDLE image, EFI_HANDLE device,
 	    CHAR8 *hostname, CHAR8 *uri, BOOLEAN is_ip6,
-	    VOID **buffer, UINT64 *buf_size)
+	    VOID **buffer, UINT64 *buf_size,
+	    image_stream_hash_fn hash, void *hash_ctx,
+	    authenticode_layout_t **layoutp)
 {
 	EFI_SERVICE_BINDING *service;
 	EFI_HANDLE http_handle;
@@ -754,7 +802,8 @@ http_fetch (EFI_HANDLE image, EFI_HANDLE device,
 		goto error;
 	}
 
-	efi_status = receive_http_response(http, buffer, buf_size);
+	efi_status = receive_http_response(http, buffer, buf_size,
+					   hash, hash_ctx, layoutp);
 	if (EFI_ERROR(efi_status)) {
 		perror(L"Failed to receive HTTP response: %r\n", efi_status);
 		goto error;
@@ -773,7 +822,8 @@ error:
 
 EFI_STATUS
 httpboot_fetch_buffer (EFI_HANDLE image, VOID **buffer, UINT64 *buf_size,
-		CHAR8 *name)
+		CHAR8 *name, image_stream_hash_fn hash, void *hash_ctx,
+		authenticode_layout_t **layoutp)
 {
 	EFI_STATUS efi_status;
 	EFI_HANDLE nic;
@@ -781,6 +831,7 @@ httpboot_fetch_buffer (EFI_HANDLE image, VOID **buffer, UINT64 *buf_size,
 	CHAR8 *next_uri = NULL;
 	CHAR8 *hostname = NULL;
 
+	*layoutp = NULL;
 	if (!uri)
 		return EFI_NOT_READY;
 
@@ -823,7 +874,7 @@ httpboot_fetch_buffer (EFI_HANDLE image, VOID **buffer, UINT64 *buf_size,
 
 	/* Use HTTP protocl to fetch the remote file */
 	efi_status = http_fetch (image, nic, hostname, next_uri, is_ip6,
-				 buffer, buf_size);
+				 buffer, buf_size, hash, hash_ctx, layoutp);
 	if (EFI_ERROR(efi_status)) {
 		perror(L"Failed to fetch image: %r\n", efi_status);
 		goto error;
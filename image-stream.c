@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * image-stream.c - which parts of a PE image make up its Authenticode
+ * hash, and reading an image from a file while hashing those parts.
+ *
+ * Reading the whole file and then walking it again to hash it means
+ * every byte gets pulled through the cache twice.  Instead, we read the
+ * file in large chunks, and once the headers have arrived we know which
+ * regions get hashed and in what order, so each chunk can be handed to
+ * the hash while it's still warm.
+ */
+
+#include "shim.h"
+
+#define check_size_line(data, datasize_in, hashbase, hashsize, l) ({	\
+	if ((unsigned long)hashbase >					\
+			(unsigned long)data + datasize_in) {		\
+		efi_status = EFI_INVALID_PARAMETER;			\
+		perror(L"image-stream.c:%d Invalid hash base 0x%016x\n", l,	\
+			hashbase);					\
+		goto done;						\
+	}								\
+	if ((unsigned long)hashbase + hashsize >			\
+			(unsigned long)data + datasize_in) {		\
+		efi_status = EFI_INVALID_PARAMETER;			\
+		perror(L"image-stream.c:%d Invalid hash size 0x%016x\n", l,	\
+			hashsize);					\
+		goto done;						\
+	}								\
+})
+#define check_size(d, ds, h, hs) check_size_line(d, ds, h, hs, __LINE__)
+
+static void
+add_region(authenticode_layout_t *layout, char *data, char *base,
+	   unsigned int size)
+{
+	authenticode_region_t *region;
+
+	if (size == 0)
+		return;
+
+	region = &layout->regions[layout->n_regions++];
+	region->offset = base - data;
+	region->size = size;
+}
+
+/*
+ * Work out the regions of the file that make up its Authenticode hash,
+ * in the order they're hashed.  The caller must FreePool() *layoutp.
+ */
+EFI_STATUS
+get_authenticode_layout(char *data, unsigned int datasize,
+			PE_COFF_LOADER_IMAGE_CONTEXT *context,
+			authenticode_layout_t **layoutp)
+{
+	authenticode_layout_t *layout = NULL;
+	char *hashbase;
+	unsigned int hashsize;
+	unsigned int SumOfBytesHashed, SumOfSectionBytes;
+	unsigned int index, pos;
+	EFI_IMAGE_SECTION_HEADER *Section;
+	EFI_IMAGE_SECTION_HEADER *SectionHeader = NULL;
+	EFI_STATUS efi_status = EFI_SUCCESS;
+	EFI_IMAGE_DOS_HEADER *DosHdr = (void *)data;
+	unsigned int PEHdr_offset = 0;
+
+	*layoutp = NULL;
+
+	if (datasize <= sizeof (*DosHdr) ||
+	    DosHdr->e_magic != EFI_IMAGE_DOS_SIGNATURE) {
+		perror(L"Invalid signature\n");
+		return EFI_INVALID_PARAMETER;
+	}
+	PEHdr_offset = DosHdr->e_lfanew;
+
+	/*
+	 * read_header() fills these in, but a context that didn't come
+	 * from it may not have them yet.
+	 */
+	if (context->NumberOfSections == 0 ||
+	    context->FirstSection == NULL) {
+		uint16_t opthdrsz;
+		uint64_t addr;
+		uint16_t nsections;
+		EFI_IMAGE_SECTION_HEADER *section0, *sectionN;
+
+		nsections = context->PEHdr->Pe32.FileHeader.NumberOfSections;
+		opthdrsz = context->PEHdr->Pe32.FileHeader.SizeOfOptionalHeader;
+
+		/* Validate section0 is within image */
+		addr = PEHdr_offset + sizeof(UINT32)
+			+ sizeof(EFI_IMAGE_FILE_HEADER)
+			+ opthdrsz;
+		section0 = ImageAddress(data, datasize, addr);
+		if (!section0) {
+			perror(L"Malformed file header.\n");
+			perror(L"Image address for Section Header 0 is 0x%016llx\n",
+			       addr);
+			perror(L"File size is 0x%016llx\n", datasize);
+			return EFI_INVALID_PARAMETER;
+		}
+
+		/* Validate sectionN is within image */
+		addr += (uint64_t)(intptr_t)&section0[nsections-1] -
+			(uint64_t)(intptr_t)section0;
+		sectionN = ImageAddress(data, datasize, addr);
+		if (!sectionN) {
+			perror(L"Malformed file header.\n");
+			perror(L"Image address for Section Header %d is 0x%016llx\n",
+			       nsections - 1, addr);
+			perror(L"File size is 0x%016llx\n", datasize);
+			return EFI_INVALID_PARAMETER;
+		}
+
+		context->NumberOfSections = nsections;
+		context->FirstSection = section0;
+	}
+
+	/*
+	 * Three header regions, one per section, and whatever follows the
+	 * last section.
+	 */
+	layout = AllocateZeroPool(sizeof(*layout) +
+				  (context->NumberOfSections + 4) *
+				  sizeof(authenticode_region_t));
+	if (!layout) {
+		perror(L"Unable to allocate Authenticode layout\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	/* Hash start to checksum */
+	hashbase = data;
+	hashsize = (char *)&context->PEHdr->Pe32.OptionalHeader.CheckSum -
+		hashbase;
+	check_size(data, datasize, hashbase, hashsize);
+	add_region(layout, data, hashbase, hashsize);
+
+	/* Hash post-checksum to start of certificate table */
+	hashbase = (char *)&context->PEHdr->Pe32.OptionalHeader.CheckSum +
+		sizeof (int);
+	hashsize = (char *)context->SecDir - hashbase;
+	check_size(data, datasize, hashbase, hashsize);
+	add_region(layout, data, hashbase, hashsize);
+
+	/* Hash end of certificate table to end of image header */
+	EFI_IMAGE_DATA_DIRECTORY *dd = context->SecDir + 1;
+	hashbase = (char *)dd;
+	hashsize = context->SizeOfHeaders - (unsigned long)((char *)dd - data);
+	if (hashsize > datasize) {
+		perror(L"Data Directory size %d is invalid\n", hashsize);
+		efi_status = EFI_INVALID_PARAMETER;
+		goto done;
+	}
+	check_size(data, datasize, hashbase, hashsize);
+	add_region(layout, data, hashbase, hashsize);
+
+	/* Sort sections */
+	SumOfBytesHashed = context->SizeOfHeaders;
+
+	/*
+	 * Allocate a new section table so we can sort them without
+	 * modifying the image.
+	 */
+	SectionHeader = AllocateZeroPool (sizeof (EFI_IMAGE_SECTION_HEADER)
+					  * context->NumberOfSections);
+	if (SectionHeader == NULL) {
+		perror(L"Unable to allocate section header\n");
+		efi_status = EFI_OUT_OF_RESOURCES;
+		goto done;
+	}
+
+	/*
+	 * Validate section locations and sizes, and sort the table into
+	 * our newly allocated header table
+	 */
+	SumOfSectionBytes = 0;
+	Section = context->FirstSection;
+	for (index = 0; index < context->NumberOfSections; index++) {
+		EFI_IMAGE_SECTION_HEADER *SectionPtr;
+		char *base;
+		size_t size;
+
+		efi_status = get_section_vma(index, data, datasize, context,
+					     &base, &size, &SectionPtr);
+		if (efi_status == EFI_NOT_FOUND)
+			break;
+		if (EFI_ERROR(efi_status)) {
+			perror(L"Malformed section header\n");
+			goto done;
+		}
+
+		/* Validate section size is within image. */
+		if (SectionPtr->SizeOfRawData >
+		    datasize - SumOfBytesHashed - SumOfSectionBytes) {
+			perror(L"Malformed section %d size\n", index);
+			efi_status = EFI_INVALID_PARAMETER;
+			goto done;
+		}
+		SumOfSectionBytes += SectionPtr->SizeOfRawData;
+
+		pos = index;
+		while ((pos > 0) && (Section->PointerToRawData < SectionHeader[pos - 1].PointerToRawData)) {
+			CopyMem (&SectionHeader[pos], &SectionHeader[pos - 1], sizeof (EFI_IMAGE_SECTION_HEADER));
+			pos--;
+		}
+		CopyMem (&SectionHeader[pos], Section, sizeof (EFI_IMAGE_SECTION_HEADER));
+		Section += 1;
+
+	}
+
+	/* Hash the sections */
+	for (index = 0; index < context->NumberOfSections; index++) {
+		Section = &SectionHeader[index];
+		if (Section->SizeOfRawData == 0) {
+			continue;
+		}
+
+		hashbase  = ImageAddress(data, datasize,
+					 Section->PointerToRawData);
+		if (!hashbase) {
+			perror(L"Malformed section header\n");
+			efi_status = EFI_INVALID_PARAMETER;
+			goto done;
+		}
+
+		/* Verify hashsize within image. */
+		if (Section->SizeOfRawData >
+		    datasize - Section->PointerToRawData) {
+			perror(L"Malformed section raw size %d\n", index);
+			efi_status = EFI_INVALID_PARAMETER;
+			goto done;
+		}
+		hashsize  = (unsigned int) Section->SizeOfRawData;
+		check_size(data, datasize, hashbase, hashsize);
+		add_region(layout, data, hashbase, hashsize);
+
+		SumOfBytesHashed += Section->SizeOfRawData;
+	}
+
+	/* Hash all remaining data up to SecDir if SecDir->Size is not 0 */
+	if (datasize > SumOfBytesHashed && context->SecDir->Size) {
+		hashbase = data + SumOfBytesHashed;
+		hashsize = datasize - context->SecDir->Size - SumOfBytesHashed;
+
+		if ((datasize - SumOfBytesHashed < context->SecDir->Size) ||
+		    (SumOfBytesHashed + hashsize != context->SecDir->VirtualAddress)) {
+			perror(L"Malformed binary after Attribute Certificate Table\n");
+			console_print(L"datasize: %u SumOfBytesHashed: %u SecDir->Size: %lu\n",
+				      datasize, SumOfBytesHashed, context->SecDir->Size);
+			console_print(L"hashsize: %u SecDir->VirtualAddress: 0x%08lx\n",
+				      hashsize, context->SecDir->VirtualAddress);
+			efi_status = EFI_INVALID_PARAMETER;
+			goto done;
+		}
+		check_size(data, datasize, hashbase, hashsize);
+		add_region(layout, data, hashbase, hashsize);
+
+		SumOfBytesHashed += hashsize;
+	}
+
+	/* Hash all remaining data. If SecDir->Size is > 0 this code should not
+	 * be entered.  If it is, there are still things to hash.  For a file
+	 * without a SecDir, we need to hash what remains, padded with zeros
+	 * to a multiple of 8 bytes. */
+	if (datasize > SumOfBytesHashed + context->SecDir->Size) {
+		hashbase = data + SumOfBytesHashed;
+		hashsize = datasize - SumOfBytesHashed;
+
+		check_size(data, datasize, hashbase, hashsize);
+		add_region(layout, data, hashbase, hashsize);
+
+		SumOfBytesHashed += hashsize;
+		layout->padding = ALIGN_VALUE(SumOfBytesHashed, 8) -
+				  SumOfBytesHashed;
+	}
+
+	*layoutp = layout;
+	layout = NULL;
+
+done:
+	if (SectionHeader)
+		FreePool(SectionHeader);
+	if (layout)
+		FreePool(layout);
+
+	return efi_status;
+}
+
+/*
+ * How much of the file read_header() needs to look at, or 0 if we
+ * haven't read enough to know yet.
+ */
+#define IMAGE_STREAM_NO_HEADERS	((UINTN)-1)
+
+static UINTN
+image_headers_size(char *data, UINTN loaded, UINTN datasize)
+{
+	EFI_IMAGE_DOS_HEADER *DosHdr = (void *)data;
+	EFI_IMAGE_OPTIONAL_HEADER_UNION *PEHdr;
+	UINTN end;
+
+	if (loaded < sizeof(*DosHdr))
+		return datasize < sizeof(*DosHdr) ? IMAGE_STREAM_NO_HEADERS : 0;
+	if (DosHdr->e_magic != EFI_IMAGE_DOS_SIGNATURE)
+		return IMAGE_STREAM_NO_HEADERS;
+
+	end = (UINTN)DosHdr->e_lfanew + sizeof(PEHdr->Pe32Plus);
+	if (end > datasize)
+		return IMAGE_STREAM_NO_HEADERS;
+	if (end > loaded)
+		return 0;
+
+	/* .Magic is the same offset in all cases */
+	PEHdr = (EFI_IMAGE_OPTIONAL_HEADER_UNION *)(data + DosHdr->e_lfanew);
+	if (PEHdr->Pe32.OptionalHeader.Magic == EFI_IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+		return MAX(end, PEHdr->Pe32Plus.OptionalHeader.SizeOfHeaders);
+	return MAX(end, PEHdr->Pe32.OptionalHeader.SizeOfHeaders);
+}
+
+/*
+ * Start hashing an image that will arrive in data, which is datasize
+ * bytes long.  If hash is NULL, or the image is too big to have an
+ * Authenticode layout, nothing gets hashed.
+ */
+void
+image_stream_init(image_stream_t *stream, char *data, UINTN datasize,
+		  image_stream_hash_fn hash, void *hash_ctx)
+{
+	ZeroMem(stream, sizeof(*stream));
+	stream->data = data;
+	stream->datasize = datasize;
+	stream->hash = hash;
+	stream->hash_ctx = hash_ctx;
+	stream->hashing = hash != NULL && datasize <= UINT32_MAX;
+}
+
+/*
+ * The first loaded bytes of the image are now in the buffer; hash
+ * whatever parts of the layout they complete.  Once the headers are in,
+ * this works out the layout; if it can't, hashing is quietly given up
+ * and image_stream_finish() will return NULL.
+ */
+EFI_STATUS
+image_stream_update(image_stream_t *stream, UINTN loaded)
+{
+	char *data = stream->data;
+	authenticode_layout_t *layout = stream->layout;
+
+	if (stream->hashing && !layout) {
+		PE_COFF_LOADER_IMAGE_CONTEXT context;
+		UINTN hdrsz = image_headers_size(data, loaded,
+						 stream->datasize);
+
+		if (hdrsz == IMAGE_STREAM_NO_HEADERS ||
+		    hdrsz > stream->datasize) {
+			stream->hashing = FALSE;
+			return EFI_SUCCESS;
+		}
+		if (hdrsz == 0 || hdrsz > loaded)
+			return EFI_SUCCESS;
+
+		ZeroMem(&context, sizeof(context));
+		if (EFI_ERROR(read_header(data, stream->datasize, &context,
+					  true)) ||
+		    EFI_ERROR(get_authenticode_layout(data, stream->datasize,
+						      &context, &layout))) {
+			stream->hashing = FALSE;
+			return EFI_SUCCESS;
+		}
+		stream->layout = layout;
+	}
+
+	while (layout && stream->region < layout->n_regions) {
+		authenticode_region_t *r = &layout->regions[stream->region];
+		UINTN start = r->offset + stream->region_done;
+		UINTN size;
+
+		if (start >= loaded)
+			break;
+
+		size = MIN(r->size - stream->region_done, loaded - start);
+		if (!stream->hash(stream->hash_ctx, data + start, size))
+			return EFI_OUT_OF_RESOURCES;
+
+		stream->region_done += size;
+		if (stream->region_done < r->size)
+			break;
+		stream->region += 1;
+		stream->region_done = 0;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * Stop hashing after loaded bytes have arrived.  Returns the layout,
+ * which the caller must FreePool(), if every region of it was hashed;
+ * otherwise NULL, and the caller should hash the buffer the usual way.
+ */
+authenticode_layout_t *
+image_stream_finish(image_stream_t *stream, UINTN loaded)
+{
+	authenticode_layout_t *layout = stream->layout;
+
+	stream->layout = NULL;
+	stream->hashing = FALSE;
+
+	/*
+	 * If the image was shorter than we were told, the layout was
+	 * worked out for the wrong size.
+	 */
+	if (layout && (loaded != stream->datasize ||
+		       stream->region != layout->n_regions)) {
+		FreePool(layout);
+		layout = NULL;
+	}
+
+	return layout;
+}
+
+/*
+ * Read *datasizep bytes of file into data, IMAGE_STREAM_CHUNK_SIZE at a
+ * time.  If hash is set, each region of the Authenticode layout is fed
+ * to it as soon as it has been read.  On return *datasizep is how much
+ * was actually read, and *layoutp is the layout if every region of it
+ * was hashed, or NULL if the image couldn't be hashed this way; in that
+ * case the caller should hash the buffer the usual way.
+ */
+EFI_STATUS
+stream_image(EFI_FILE_HANDLE file, char *data, UINTN *datasizep,
+	     image_stream_hash_fn hash, void *hash_ctx,
+	     authenticode_layout_t **layoutp)
+{
+	image_stream_t stream;
+	authenticode_layout_t *layout;
+	UINTN datasize = *datasizep;
+	UINTN loaded = 0;
+	EFI_STATUS efi_status;
+
+	*layoutp = NULL;
+	image_stream_init(&stream, data, datasize, hash, hash_ctx);
+
+	while (loaded < datasize) {
+		UINTN chunk = MIN(datasize - loaded, IMAGE_STREAM_CHUNK_SIZE);
+
+		efi_status = file->Read(file, &chunk, data + loaded);
+		if (EFI_ERROR(efi_status))
+			goto err;
+		if (chunk == 0)
+			break;
+		loaded += chunk;
+
+		efi_status = image_stream_update(&stream, loaded);
+		if (EFI_ERROR(efi_status))
+			goto err;
+	}
+
+	*datasizep = loaded;
+	*layoutp = image_stream_finish(&stream, loaded);
+	return EFI_SUCCESS;
+
+err:
+	layout = image_stream_finish(&stream, 0);
+	if (layout)
+		FreePool(layout);
+	return efi_status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * bench.h - timing helpers for the bench-* programs
+ */
+
+#ifndef SHIM_BENCH_H_
+#define SHIM_BENCH_H_
+
+/*
+ * One benchmark: fn is called with ctx repeatedly, doubling the
+ * iteration count until a run takes at least SHIM_BENCH_MIN_MS
+ * milliseconds (250 by default), and the result is printed to stdout as
+ * one line of JSON.  bytes is how much data each call processes, or 0 if
+ * per-byte figures don't make sense.  fn returns 0 on success; anything
+ * else stops the benchmark and is returned.
+ */
+typedef int (*bench_fn)(void *ctx);
+
+int bench_run(const char *suite, const char *name, UINT64 bytes,
+	      bench_fn fn, void *ctx);
+
+/*
+ * Read a whole file from the test data, or exit.
+ */
+UINT8 *bench_read_file(const char *name, UINTN *sizep);
+
+#define bench(suite, name, bytes, fn, ctx)                               \
+	({                                                                \
+		int rc_ = bench_run(suite, name, bytes, fn, ctx);         \
+		if (rc_ != 0) {                                           \
+			fprintf(stderr, "%s:%d:%s/%s failed: %d\n",      \
+				__func__, __LINE__, suite, name, rc_);    \
+			status = 1;                                       \
+		}                                                         \
+	})
+
+#endif /* !SHIM_BENCH_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,132 @@
+# SPDX-License-Identifier: BSD-2-Clause-Patent
+#
+# bench.mk - makefile to build and run local benchmark programs
+#
+# These use the same harness as the test-* programs, but are built with
+# normal inlining and without coverage instrumentation.  Each one prints
+# a line of JSON per benchmark, and "bench" collects them all in
+# $(BENCH_OUTPUT).
+#
+
+.SUFFIXES:
+
+include $(TOPDIR)/Make.defaults
+
+CC = gcc
+DEBUG_PRINTS ?= 0
+OPTIMIZATIONS=-O2 -ggdb
+CFLAGS_LTO =
+VERSION ?= unknown
+BENCH_OUTPUT ?= bench-results.json
+CFLAGS = $(OPTIMIZATIONS) -std=gnu11 \
+	 -isystem $(TOPDIR)/include/system \
+	 $(EFI_INCLUDES) \
+	 -Iinclude -iquote . \
+	 -isystem /usr/include \
+	 -isystem $(shell $(CC) $(ARCH_CFLAGS) -print-file-name=include) \
+	 $(ARCH_CFLAGS) \
+	 $(CFLAGS_LTO) \
+	 -fshort-wchar \
+	 -fno-builtin \
+	 -rdynamic \
+	 -gpubnames \
+	 -grecord-gcc-switches \
+	 $(if $(findstring clang,$(CC)),-Wno-unknown-warning-option) \
+	 $(DEFAULT_WARNFLAGS) \
+	 -Wsign-compare \
+	 -Wno-deprecated-declarations \
+	 $(if $(findstring gcc,$(CC)),-Wno-unused-but-set-variable) \
+	 -Wno-unused-variable \
+	 -Wno-pointer-sign \
+	 $(DEFAULT_WERRFLAGS) \
+	 -Werror=nonnull \
+	 $(shell $(CC) -Werror=nonnull-compare -E -x c /dev/null >/dev/null 2>&1 && echo -Werror=nonnull-compare) \
+	 $(ARCH_DEFINES) \
+	 -DEFI_FUNCTION_WRAPPER \
+	 -DGNU_EFI_USE_MS_ABI -DPAGE_SIZE=4096 \
+	 -DSHIM_UNIT_TEST \
+	 "-DSHIM_BENCH_VERSION=\"$(VERSION)\"" \
+	 "-DDEFAULT_DEBUG_PRINT_STATE=$(DEBUG_PRINTS)"
+
+# On some systems (e.g. Arch Linux), limits.h is in the "include-fixed" instead
+# of the "include" directory
+INCLUDE_FIXED = $(shell $(CC) $(ARCH_CFLAGS) -print-file-name=include-fixed)
+ifneq ($(strip $(INCLUDE_FIXED)),include-fixed)
+CFLAGS += -isystem $(INCLUDE_FIXED)
+endif
+
+# And on Debian also check the multi-arch include path
+MULTIARCH_ISYSTEM = $(if $(findstring gcc,$(CC)),$(shell $(CC) $(ARCH_CFLAGS) -print-multiarch))
+ifneq ($(strip $(MULTIARCH_ISYSTEM)),)
+CFLAGS += -isystem /usr/include/$(MULTIARCH_ISYSTEM)
+endif
+
+export CFLAGS_LTO
+
+libefi-test.a :
+	$(MAKE) -C gnu-efi \
+		COMPILER="$(COMPILER)" \
+		CC="$(CC)" \
+		ARCH=$(ARCH_GNUEFI) \
+		TOPDIR=$(TOPDIR)/gnu-efi \
+		CFLAGS_LTO="$(CFLAGS_LTO)" \
+		-f $(TOPDIR)/gnu-efi/Makefile \
+		clean lib
+	mv gnu-efi/$(ARCH)/lib/libefi.a $@
+	$(MAKE) -C gnu-efi \
+		COMPILER="$(COMPILER)" \
+		ARCH=$(ARCH_GNUEFI) \
+		TOPDIR=$(TOPDIR)/gnu-efi \
+		CFLAGS_LTO="$(CFLAGS_LTO)" \
+		-f $(TOPDIR)/gnu-efi/Makefile \
+		clean
+
+generated_sbat_var_defs.h :
+	$(MAKE) generated_sbat_var_defs.h
+
+bench-authenticode_FILES = pe-relocate.c globals.c
+bench-authenticode_LIBS = -lcrypto
+bench-authenticode :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID -idirafter Cryptlib
+
+bench-esl-index_FILES = lib/variables.c lib/guid.c mock-variables.c
+bench-esl-index :: CFLAGS+=-DHAVE_GET_VARIABLE -DHAVE_GET_VARIABLE_ATTR -DHAVE_SHIM_LOCK_GUID
+
+bench-generate-hash_FILES = pe-hash.c image-stream.c pe-relocate.c globals.c lib/sha256.c
+bench-generate-hash_LIBS = -lcrypto
+bench-generate-hash :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID -DHAVE_SHA256_SUM -idirafter Cryptlib
+
+bench-image-stream_FILES = pe-relocate.c globals.c
+bench-image-stream :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+bench-pe-relocate_FILES = globals.c
+bench-pe-relocate :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+bench-sbat_FILES = csv.c globals.c lib/variables.c lib/guid.c sbat_var.S mock-variables.c
+bench-sbat :: | generated_sbat_var_defs.h
+bench-sbat :: CFLAGS+=-DHAVE_GET_VARIABLE -DHAVE_GET_VARIABLE_ATTR -DHAVE_SHIM_LOCK_GUID
+
+# bench-sha is a standalone host tool built by the main Makefile
+benches := $(patsubst %.c,%,$(filter-out bench-sha.c,$(wildcard bench-*.c)))
+
+$(benches) :: bench-% : | libefi-test.a
+
+$(benches) :: bench-% : test.c bench.c bench-%.c $(bench-%_FILES)
+	$(CC) $(CFLAGS) -o $@ $(sort $^ $(wildcard $*.c) $(bench-$*_FILES)) libefi-test.a -lefivar $(bench-$*_LIBS)
+	./$@ > $@.json
+
+bench : $(benches)
+	cat $(patsubst %,%.json,$(benches)) > $(BENCH_OUTPUT)
+	$(MAKE) -f include/bench.mk bench-clean
+
+bench-clean :
+	@rm -vf libefi-test.a
+	@rm -vf $(patsubst %,%.json,$(benches))
+
+clean : bench-clean
+	@rm -vf $(benches) $(BENCH_OUTPUT)
+
+all : bench-clean bench
+
+.PHONY: $(benches) all bench bench-clean clean
+
+# vim:ft=make
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * esl-index.h - hash index of the digests in an EFI_SIGNATURE_LIST
+ */
+
+#ifndef SHIM_ESL_INDEX_H_
+#define SHIM_ESL_INDEX_H_
+
+typedef struct {
+	EFI_SIGNATURE_DATA *sig;
+	UINT32 sig_size;
+	UINT32 next;		/* entry number + 1 of the next in the bucket */
+} esl_index_entry_t;
+
+/*
+ * Every signature of one type (EFI_CERT_SHA256_GUID, ...) in a buffer of
+ * EFI_SIGNATURE_LISTs, bucketed by the leading bytes of the digest.  The
+ * entries point into the ESL buffer, so the index must be freed before
+ * it is.
+ */
+typedef struct {
+	EFI_GUID type;
+	UINTN digest_size;
+	UINTN n_entries;
+	UINTN n_buckets;	/* always a power of two */
+	UINT32 *buckets;	/* entry number + 1 of the first, or 0 */
+	esl_index_entry_t *entries;
+} esl_index_t;
+
+extern esl_index_t *esl_index_new(EFI_SIGNATURE_LIST *esl, UINTN eslsize,
+				  const EFI_GUID *type, UINTN digest_size);
+extern EFI_SIGNATURE_DATA *esl_index_find(esl_index_t *index,
+					  const UINT8 *digest,
+					  UINT32 *sig_size);
+extern UINTN esl_index_remove(esl_index_t *index, UINT8 *sigs, UINTN n,
+			      UINTN sig_size);
+extern void esl_index_free(esl_index_t *index);
+
+#endif /* !SHIM_ESL_INDEX_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -85,7 +85,7 @@ fuzz-pe-relocate_FILES = globals.c
 generated_sbat_var_defs.h :
 	$(MAKE) generated_sbat_var_defs.h
 
-fuzz-sbat_FILES = csv.c lib/variables.c lib/guid.c sbat_var.S mock-variables.c
+fuzz-sbat_FILES = csv.c globals.c lib/variables.c lib/guid.c sbat_var.S mock-variables.c
 fuzz-sbat :: | generated_sbat_var_defs.h
 fuzz-sbat :: CFLAGS+=-DHAVE_GET_VARIABLE -DHAVE_GET_VARIABLE_ATTR -DHAVE_SHIM_LOCK_GUID
 
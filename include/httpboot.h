@@ -12,6 +12,14 @@
 
 extern BOOLEAN find_httpboot(EFI_HANDLE device);
 extern EFI_STATUS httpboot_fetch_buffer(EFI_HANDLE image, VOID **buffer,
-					UINT64 *buf_size, CHAR8 *name);
+					UINT64 *buf_size, CHAR8 *name,
+					image_stream_hash_fn hash,
+					void *hash_ctx,
+					authenticode_layout_t **layoutp);
+extern EFI_STATUS receive_http_response(EFI_HTTP_PROTOCOL *http,
+					VOID **buffer, UINT64 *buf_size,
+					image_stream_hash_fn hash,
+					void *hash_ctx,
+					authenticode_layout_t **layoutp);
 
 #endif /* SHIM_HTTPBOOT_H */
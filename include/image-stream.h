@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * image-stream.h - the Authenticode layout of a PE image, and reading an
+ * image while hashing it
+ */
+
+#ifndef SHIM_IMAGE_STREAM_H_
+#define SHIM_IMAGE_STREAM_H_
+
+/*
+ * How much of the file we ask for per Read() call.  Big enough that
+ * firmware overhead per call doesn't matter, small enough that the
+ * chunk we just read is still in cache when we hash it.
+ */
+#define IMAGE_STREAM_CHUNK_SIZE	(1024 * 1024)
+
+typedef struct {
+	UINTN offset;
+	UINTN size;
+} authenticode_region_t;
+
+typedef struct {
+	UINTN n_regions;
+	/* zeros hashed after the last region */
+	UINTN padding;
+	authenticode_region_t regions[];
+} authenticode_layout_t;
+
+typedef BOOLEAN (*image_stream_hash_fn)(void *ctx, void *base, UINTN size);
+
+/*
+ * Hashing an image that's arriving in a buffer a piece at a time, from a
+ * file or off the network.
+ */
+typedef struct {
+	char *data;
+	UINTN datasize;
+	image_stream_hash_fn hash;
+	void *hash_ctx;
+	BOOLEAN hashing;
+	authenticode_layout_t *layout;
+	/* the region we're in, and how much of it has been hashed */
+	UINTN region;
+	UINTN region_done;
+} image_stream_t;
+
+EFI_STATUS
+get_authenticode_layout(char *data, unsigned int datasize,
+			PE_COFF_LOADER_IMAGE_CONTEXT *context,
+			authenticode_layout_t **layoutp);
+
+void
+image_stream_init(image_stream_t *stream, char *data, UINTN datasize,
+		  image_stream_hash_fn hash, void *hash_ctx);
+
+EFI_STATUS
+image_stream_update(image_stream_t *stream, UINTN loaded);
+
+authenticode_layout_t *
+image_stream_finish(image_stream_t *stream, UINTN loaded);
+
+EFI_STATUS
+stream_image(EFI_FILE_HANDLE file, char *data, UINTN *datasizep,
+	     image_stream_hash_fn hash, void *hash_ctx,
+	     authenticode_layout_t **layoutp);
+
+#endif /* !SHIM_IMAGE_STREAM_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -11,6 +11,27 @@ extern EFI_STATUS get_mem_attrs (uintptr_t addr, size_t size, uint64_t *attrs);
 extern EFI_STATUS update_mem_attrs(uintptr_t addr, uint64_t size,
 				   uint64_t set_attrs, uint64_t clear_attrs);
 
+/*
+ * Collects the attribute updates for one page-aligned range, such as a
+ * loaded image's sections, and applies them all at once with as few
+ * protocol calls as possible.  If the batch can't be allocated, or an
+ * update falls outside it, updates go to update_mem_attrs() directly.
+ */
+typedef struct {
+	uintptr_t addr;
+	UINTN n_pages;
+	UINT8 *pages;
+} mem_attrs_batch_t;
+
+extern void mem_attrs_batch_init(mem_attrs_batch_t *batch, uintptr_t addr,
+				 uint64_t size);
+extern EFI_STATUS mem_attrs_batch_update(mem_attrs_batch_t *batch,
+					 uintptr_t addr, uint64_t size,
+					 uint64_t set_attrs,
+					 uint64_t clear_attrs);
+extern EFI_STATUS mem_attrs_batch_apply(mem_attrs_batch_t *batch);
+extern void mem_attrs_batch_free(mem_attrs_batch_t *batch);
+
 extern void get_hsi_mem_info(void);
 extern char *decode_hsi_bits(UINTN hsi);
 extern void set_shim_nx_policy(void);
@@ -36,25 +36,60 @@ get_section_vma_by_name (char *name, size_t namesz,
 			 char **basep, size_t *sizep,
 			 EFI_IMAGE_SECTION_HEADER **sectionp);
 
+/*
+ * Which Authenticode digests generate_hashes() should compute, and which
+ * ones are valid in an authenticode_digests_t.
+ */
+#define SHIM_HASH_SHA1		0x1
+#define SHIM_HASH_SHA256	0x2
+#define SHIM_HASH_SHA384	0x4
+
+typedef struct {
+	UINT32 algorithms;
+	UINT8 sha1[SHA1_DIGEST_SIZE];
+	UINT8 sha256[SHA256_DIGEST_SIZE];
+	UINT8 sha384[SHA384_DIGEST_SIZE];
+} authenticode_digests_t;
+
 EFI_STATUS
 handle_image (void *data, unsigned int datasize,
 	      EFI_LOADED_IMAGE *li, EFI_HANDLE image_handle,
 	      EFI_IMAGE_ENTRY_POINT *entry_point,
 	      EFI_PHYSICAL_ADDRESS *alloc_address,
 	      UINTN *alloc_pages, unsigned int *alloc_alignment,
-	      bool parent_verified);
+	      bool parent_verified, authenticode_digests_t *precomputed);
 
 EFI_STATUS
-validate_cached_section(EFI_HANDLE parent_image_handle,
-			void *addr, UINTN size);
-void
-flush_cached_sections(EFI_HANDLE parent_image_handle);
+sha256_sum(void *addr, UINTN size, UINT8 *digest);
+
+EFI_STATUS
+generate_hashes (char *data, unsigned int datasize,
+		 PE_COFF_LOADER_IMAGE_CONTEXT *context,
+		 UINT32 algorithms, authenticode_digests_t *digests);
 
 EFI_STATUS
 generate_hash (char *data, unsigned int datasize,
 	       PE_COFF_LOADER_IMAGE_CONTEXT *context,
 	       UINT8 *sha256hash, UINT8 *sha1hash);
 
+BOOLEAN
+stream_hash_update (void *ctx, void *base, UINTN size);
+
+void *
+new_stream_hashes (void);
+
+void
+finish_stream_hashes (void *ctx, authenticode_layout_t *layout,
+		      authenticode_digests_t *digests);
+
+EFI_STATUS
+read_image_file (EFI_FILE_HANDLE file, UINTN filesize, void **datap,
+		 UINTN *datasizep, UINTN *pagesp,
+		 authenticode_digests_t *digests);
+
+void
+free_image_buffer (void *data, UINTN pages);
+
 EFI_STATUS
 relocate_coff (PE_COFF_LOADER_IMAGE_CONTEXT *context,
 	       EFI_IMAGE_SECTION_HEADER *Section,
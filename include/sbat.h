@@ -40,6 +40,7 @@
 
 #define SBATREVOCATIONFILE L"revocations_sbat.efi"
 #define SKUSIREVOCATIONFILE L"revocations_sku.efi"
+#define TRUSTBUNDLEFILE L"trust_bundle.efi"
 
 extern UINTN _sbat, _esbat;
 
@@ -58,6 +59,22 @@ extern list_t sbat_var;
 
 EFI_STATUS parse_sbat_var(list_t *entries, char *sbat_var_candidate);
 void cleanup_sbat_var(list_t *entries);
+
+struct sbat_var_table_entry {
+	const CHAR8 *component_name;
+	UINT16 component_generation;
+};
+/*
+ * The entries of an SbatLevel list, sorted by component_name.
+ */
+struct sbat_var_table {
+	size_t n;
+	struct sbat_var_table_entry *entries;
+};
+extern struct sbat_var_table sbat_var_table;
+
+EFI_STATUS compile_sbat_var(list_t *entries, struct sbat_var_table *table);
+void cleanup_sbat_var_table(struct sbat_var_table *table);
 EFI_STATUS set_sbat_uefi_variable_internal(void);
 EFI_STATUS set_sbat_uefi_variable(char *, char *);
 bool preserve_sbat_uefi_variable(UINT8 *sbat, UINTN sbatsize,
@@ -84,6 +101,8 @@ EFI_STATUS verify_sbat(size_t n, struct sbat_section_entry **entries);
 EFI_STATUS parse_sbat_var_data(list_t *entries, UINT8 *data, UINTN datasize);
 EFI_STATUS verify_sbat_helper(list_t *sbat_var, size_t n,
                               struct sbat_section_entry **entries);
+EFI_STATUS verify_sbat_table(struct sbat_var_table *table, size_t n,
+			     struct sbat_section_entry **entries);
 #endif /* !SHIM_UNIT_TEST */
 #endif /* !SBAT_H_ */
 // vim:fenc=utf-8:tw=75:noet
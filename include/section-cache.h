@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * section-cache.h - sections of verified images we'll trust if they're
+ * loaded again
+ */
+
+#ifndef SHIM_SECTION_CACHE_H_
+#define SHIM_SECTION_CACHE_H_
+
+EFI_STATUS
+cache_section(EFI_HANDLE parent_image_handle, UINT8 section_name[8],
+	      void *addr, UINTN size);
+EFI_STATUS
+validate_cached_section(EFI_HANDLE parent_image_handle,
+			void *addr, UINTN size);
+void
+flush_cached_sections(EFI_HANDLE parent_image_handle);
+
+#endif /* !SHIM_SECTION_CACHE_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -142,6 +142,40 @@ EFI_STATUS parse_csv_data(char *data, char *end, size_t n_columns,
                           list_t *list);
 void free_csv_list(list_t *list);
 
+/*
+ * Memory for the rows parse_csv_rows() finds, grown as needed.  Start
+ * with all zeros, or reserve space up front with csv_arena_reserve().
+ */
+struct csv_arena {
+	UINT8 *buf;		/* AllocatePool()ed, or NULL */
+	size_t size;		/* bytes at buf */
+};
+
+EFI_STATUS csv_arena_reserve(struct csv_arena *arena, size_t size);
+void csv_arena_free(struct csv_arena *arena);
+
+/**
+ * parse CSV data from data to end in one pass, without allocating per row.
+ * *data	points to the first byte of the data
+ * end		points to a NUL byte at the end of the data
+ * n_columns	number of columns per entry
+ * stride	bytes between the start of one row and the next in the arena
+ * arena	where the rows go
+ * n_rows	how many there were
+ *
+ * Row i's column pointers are written to arena->buf + i * stride, as an
+ * array of n_columns char *s, which is filled in exactly the way
+ * parse_csv_data() fills in a struct csv_row's columns.  Whatever else
+ * is in each stride bytes is left zeroed, so callers can lay rows out as
+ * the structure they actually want.  The data is modified just as
+ * parse_csv_data() modifies it, and the byte at end is never read past.
+ *
+ * On failure, the arena is still valid and must be freed by the caller.
+ */
+EFI_STATUS parse_csv_rows(char *data, char *end, size_t n_columns,
+			  size_t stride, struct csv_arena *arena,
+			  size_t *n_rows);
+
 #ifdef SHIM_UNIT_TEST
 void NONNULL(1, 3, 4)
 parse_csv_line(char * line, size_t max, size_t *n_columns, const char *columns[]);
@@ -430,6 +430,8 @@ void init_efi_system_table(void);
 void reset_efi_system_table(void);
 void print_traceback(int skip);
 
+extern void (*sha256_sum_hook)(void *addr, UINTN size);
+
 #define eassert(cond, fmt, ...)                                  \
 	({                                                       \
 		if (!(cond)) {                                   \
@@ -91,20 +91,38 @@ test-random.h:
 		echo "unsigned int random_bin_len = 8704;" ; \
 	) > test-random.h
 
-$(wildcard test-*.c) :: %.c : test-random.h
-$(patsubst %.c,%,$(wildcard test-*.c)) :: | test-random.h
-$(patsubst %.c,%.o,$(wildcard test-*.c)) : | test-random.h
+# test-pkcs7-anchors is a standalone host tool built by the main Makefile
+test_sources := $(filter-out test-pkcs7-anchors.c,$(wildcard test-*.c))
+
+$(test_sources) :: %.c : test-random.h
+$(patsubst %.c,%,$(test_sources)) :: | test-random.h
+$(patsubst %.c,%.o,$(test_sources)) : | test-random.h
+
+test-esl-index_FILES = lib/variables.c lib/guid.c mock-variables.c
+test-esl-index :: CFLAGS+=-DHAVE_GET_VARIABLE -DHAVE_GET_VARIABLE_ATTR -DHAVE_SHIM_LOCK_GUID
+
+test-errlog_FILES = hexdump.c globals.c lib/guid.c
+test-errlog :: CFLAGS+=-DHAVE_LOG_ERROR -DHAVE_SHIM_LOCK_GUID
+
+test-httpboot_FILES = image-stream.c pe-relocate.c globals.c lib/guid.c lib/string.c
+test-httpboot :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+test-image-stream_FILES = pe-relocate.c globals.c
+test-image-stream :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
 
 test-load-options_FILES = lib/guid.c
 test-load-options : CFLAGS+=-DHAVE_SHIM_LOCK_GUID
 
+test-memattrs_FILES = globals.c lib/guid.c
+test-memattrs :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
 test-mock-variables_FILES = mok.c globals.c tpm.c lib/guid.c lib/variables.c mock-variables.c
 test-mock-variables: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
 
 test-mok-mirror_FILES = mok.c globals.c tpm.c lib/guid.c lib/variables.c mock-variables.c
 test-mok-mirror: CFLAGS+=-DHAVE_START_IMAGE -DHAVE_SHIM_LOCK_GUID
 
-test-sbat_FILES = csv.c lib/variables.c lib/guid.c sbat_var.S mock-variables.c
+test-sbat_FILES = csv.c globals.c lib/variables.c lib/guid.c sbat_var.S mock-variables.c
 test-sbat :: CFLAGS+=-DHAVE_GET_VARIABLE -DHAVE_GET_VARIABLE_ATTR -DHAVE_SHIM_LOCK_GUID
 
 test-pe-relocate_FILES = globals.c
@@ -112,7 +130,19 @@ test-pe-relocate :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
 
 test-str_FILES = lib/string.c
 
-tests := $(patsubst %.c,%,$(wildcard test-*.c))
+test-tpm_FILES = lib/guid.c
+test-tpm :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+test-trust-bundle_FILES = pe-relocate.c globals.c lib/guid.c
+test-trust-bundle :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+test-variables_FILES = lib/variables.c lib/guid.c mock-variables.c
+test-variables :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+test-verify-buffer_FILES = pe-relocate.c globals.c lib/variables.c lib/guid.c mock-variables.c
+test-verify-buffer :: CFLAGS+=-DHAVE_SHIM_LOCK_GUID
+
+tests := $(patsubst %.c,%,$(test_sources))
 
 $(tests) :: test-% : | libefi-test.a
 
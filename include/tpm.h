@@ -9,6 +9,8 @@ EFI_STATUS tpm_log_event(EFI_PHYSICAL_ADDRESS buf, UINTN size, UINT8 pcr,
 			 const CHAR8 *description);
 EFI_STATUS fallback_should_prefer_reset(void);
 
+BOOLEAN tpm_wants_sha1(void);
+
 EFI_STATUS tpm_log_pe(EFI_PHYSICAL_ADDRESS buf, UINTN size,
 		      EFI_PHYSICAL_ADDRESS addr, EFI_DEVICE_PATH *path,
 		      UINT8 *sha1hash, UINT8 pcr);
@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * trust-bundle.h - revocations and certificates from verified images
+ */
+
+#ifndef SHIM_TRUST_BUNDLE_H_
+#define SHIM_TRUST_BUNDLE_H_
+
+EFI_STATUS
+apply_revocations(void *data, int datasize,
+		  PE_COFF_LOADER_IMAGE_CONTEXT *context);
+EFI_STATUS
+apply_cert_sections(void *data, int datasize,
+		    PE_COFF_LOADER_IMAGE_CONTEXT *context);
+EFI_STATUS
+apply_trust_bundle(void *data, int datasize, EFI_LOADED_IMAGE *li,
+		   PE_COFF_LOADER_IMAGE_CONTEXT *context);
+
+#endif /* !SHIM_TRUST_BUNDLE_H_ */
+// vim:fenc=utf-8:tw=75:noet
@@ -35,6 +35,8 @@ CreateTimeBasedPayload (
 			);
 EFI_STATUS
 SetSecureVariable(const CHAR16 * const var, UINT8 *Data, UINTN len, EFI_GUID owner, UINT32 options, int createtimebased);
+extern UINTN variable_write_generation;
+
 EFI_STATUS
 get_variable(const CHAR16 * const var, UINT8 **data, UINTN *len, EFI_GUID owner);
 EFI_STATUS
@@ -48,6 +50,8 @@ del_variable(CHAR16 *var, EFI_GUID owner);
 EFI_STATUS
 find_in_esl(UINT8 *Data, UINTN DataSize, UINT8 *key, UINTN keylen);
 EFI_STATUS
+find_type_in_esl(UINT8 *Data, UINTN DataSize, EFI_GUID *type);
+EFI_STATUS
 find_in_variable_esl(const CHAR16 * const var, EFI_GUID owner, UINT8 *key, UINTN keylen);
 
 #define EFI_OS_INDICATIONS_BOOT_TO_FW_UI 0x0000000000000001
@@ -56,10 +60,16 @@ UINT64
 GetOSIndications(void);
 EFI_STATUS
 SETOSIndicationsAndReboot(UINT64 indications);
+/*
+ * These answer from a snapshot taken the first time either is asked;
+ * invalidate_platform_state() makes the next call read them again.
+ */
 int
 variable_is_secureboot(void);
 int
 variable_is_setupmode(int default_return);
+void
+invalidate_platform_state(void);
 EFI_STATUS
 variable_enroll_hash(const CHAR16 * const var, EFI_GUID owner,
 		     UINT8 hash[SHA256_DIGEST_SIZE]);
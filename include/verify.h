@@ -10,15 +10,48 @@
  */
 #pragma once
 
+/*
+ * If *digests doesn't already hold the image's authenticode_algorithms()
+ * digests, they're computed here and returned in it; otherwise the ones
+ * already there are used.
+ */
 EFI_STATUS
 verify_buffer (char *data, int datasize,
 	       PE_COFF_LOADER_IMAGE_CONTEXT *context,
-	       UINT8 *sha256hash, UINT8 *sha1hash,
+	       authenticode_digests_t *digests,
 	       bool parent_verified);
 
+/*
+ * The denylist, allowlist and signature checks verify_buffer() does, or
+ * for an image whose parent was verified, just the denylist.  Its
+ * answers are cached in verify-buffer.c.
+ */
+EFI_STATUS
+verify_buffer_authenticode (char *data, int datasize,
+			    PE_COFF_LOADER_IMAGE_CONTEXT *context,
+			    authenticode_digests_t *digests,
+			    bool parent_verified);
+
+/*
+ * Set up OpenSSL if nothing has yet; everything in verify.c that parses
+ * a certificate or a signature calls this first.
+ */
 void
 init_openssl(void);
 
+/*
+ * SHIM_HASH_SHA256, plus SHIM_HASH_SHA1 if anything this boot will
+ * consume an image's SHA-1 digest.
+ */
+UINT32
+authenticode_algorithms(void);
+
+/*
+ * Release the cached copies of db, dbx, MokListRT and MokListX.
+ */
+void
+free_sigdb_cache(void);
+
 /*
  * Protocol v1 entry points.
  */
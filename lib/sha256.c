@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * sha256.c - SHA-256 of a single buffer, for shim, fallback and MokManager
+ */
+
+#include "shim.h"
+
+#include <Library/BaseCryptLib.h>
+
+EFI_STATUS
+sha256_sum(void *addr, UINTN size, UINT8 *digest)
+{
+	unsigned int sha256ctxsize;
+	void *sha256ctx = NULL;
+	EFI_STATUS efi_status = EFI_OUT_OF_RESOURCES;
+
+	sha256ctxsize = Sha256GetContextSize();
+	sha256ctx = AllocateZeroPool(sha256ctxsize);
+	if (sha256ctx == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	if (Sha256Init(sha256ctx) &&
+	    Sha256Update(sha256ctx, addr, size) &&
+	    Sha256Final(sha256ctx, digest))
+		efi_status = EFI_SUCCESS;
+
+	FreePool(sha256ctx);
+	return efi_status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -16,6 +16,13 @@ extern EFI_SYSTEM_TABLE *ST;
 extern EFI_BOOT_SERVICES *BS;
 extern EFI_RUNTIME_SERVICES *RT;
 
+/*
+ * Incremented every time shim writes a UEFI variable, so anything that
+ * caches variable contents (e.g. the signature databases in verify.c)
+ * knows to read them again.
+ */
+UINTN variable_write_generation = 0;
+
 EFI_STATUS
 fill_esl(const EFI_SIGNATURE_DATA *first_sig, const size_t howmany,
 	 const EFI_GUID *type, const UINT32 sig_size,
@@ -239,6 +246,8 @@ SetSecureVariable(const CHAR16 * const var, UINT8 *Data, UINTN len,
 			EFI_VARIABLE_BOOTSERVICE_ACCESS |
 			EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS |
 			options, DataSize, Cert);
+	variable_write_generation++;
+	invalidate_platform_state();
 	return efi_status;
 }
 
@@ -349,6 +358,9 @@ EFI_STATUS
 set_variable(CHAR16 *var, EFI_GUID owner, UINT32 attributes,
 	     UINTN datasize, void *data)
 {
+	variable_write_generation++;
+	if (CompareGuid(&owner, &GV_GUID))
+		invalidate_platform_state();
 	return RT->SetVariable(var, &owner, attributes, datasize, data);
 }
 
@@ -375,6 +387,24 @@ find_in_esl(UINT8 *Data, UINTN DataSize, UINT8 *key, UINTN keylen)
 	return EFI_NOT_FOUND;
 }
 
+/*
+ * Whether any of the lists holds signatures of the given type, whatever
+ * their size.
+ */
+EFI_STATUS
+find_type_in_esl(UINT8 *Data, UINTN DataSize, EFI_GUID *type)
+{
+	EFI_SIGNATURE_LIST *CertList;
+
+	certlist_for_each_certentry(CertList, Data, DataSize, DataSize) {
+		if (CertList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST))
+			break;
+		if (CompareGuid(&CertList->SignatureType, type))
+			return EFI_SUCCESS;
+	}
+	return EFI_NOT_FOUND;
+}
+
 EFI_STATUS
 find_in_variable_esl(const CHAR16 * const var, EFI_GUID owner, UINT8 *key,
 		     UINTN keylen)
@@ -394,37 +424,65 @@ find_in_variable_esl(const CHAR16 * const var, EFI_GUID owner, UINT8 *key,
 	return efi_status;
 }
 
-int
-variable_is_setupmode(int default_return)
+/*
+ * SecureBoot and SetupMode, which secure_mode() asks about every time
+ * an image is loaded or verified.  Only the firmware and writes to the
+ * platform's own keys change them, so they're read once and again only
+ * after shim has written a global or secure boot variable.
+ */
+static struct {
+	BOOLEAN valid;
+	UINT8 secure_boot;	/* 0 if SecureBoot doesn't exist */
+	BOOLEAN have_setup_mode;
+	UINT8 setup_mode;
+} platform_state;
+
+void
+invalidate_platform_state(void)
 {
-	/* set to 1 because we return true if SetupMode doesn't exist */
-	UINT8 SetupMode = default_return;
-	UINTN DataSize = sizeof(SetupMode);
+	platform_state.valid = FALSE;
+}
+
+static void
+load_platform_state(void)
+{
+	UINTN DataSize;
 	EFI_STATUS efi_status;
 
-	efi_status = RT->GetVariable(L"SetupMode", &GV_GUID, NULL,
-				     &DataSize, &SetupMode);
+	if (platform_state.valid)
+		return;
+
+	platform_state.secure_boot = 0;
+	DataSize = sizeof(platform_state.secure_boot);
+	efi_status = RT->GetVariable(L"SecureBoot", &GV_GUID, NULL, &DataSize,
+				     &platform_state.secure_boot);
 	if (EFI_ERROR(efi_status))
-		return default_return;
+		platform_state.secure_boot = 0;
+
+	platform_state.setup_mode = 0;
+	DataSize = sizeof(platform_state.setup_mode);
+	efi_status = RT->GetVariable(L"SetupMode", &GV_GUID, NULL, &DataSize,
+				     &platform_state.setup_mode);
+	platform_state.have_setup_mode = !EFI_ERROR(efi_status);
 
-	return SetupMode;
+	platform_state.valid = TRUE;
 }
 
 int
-variable_is_secureboot(void)
+variable_is_setupmode(int default_return)
 {
-	/* return false if variable doesn't exist */
-	UINT8 SecureBoot = 0;
-	UINTN DataSize;
-	EFI_STATUS efi_status;
+	load_platform_state();
+	if (!platform_state.have_setup_mode)
+		return default_return;
 
-	DataSize = sizeof(SecureBoot);
-	efi_status = RT->GetVariable(L"SecureBoot", &GV_GUID, NULL,
-				     &DataSize, &SecureBoot);
-	if (EFI_ERROR(efi_status))
-		return 0;
+	return platform_state.setup_mode;
+}
 
-	return SecureBoot;
+int
+variable_is_secureboot(void)
+{
+	load_platform_state();
+	return platform_state.secure_boot;
 }
 
 EFI_STATUS
@@ -453,10 +511,10 @@ variable_enroll_hash(const CHAR16 * const var, EFI_GUID owner,
 		efi_status = SetSecureVariable(var, sig, sizeof(sig), owner,
 					       EFI_VARIABLE_APPEND_WRITE, 0);
 	else
-		efi_status = RT->SetVariable((CHAR16 *)var, &owner,
-					     EFI_VARIABLE_NON_VOLATILE |
-					     EFI_VARIABLE_BOOTSERVICE_ACCESS |
-					     EFI_VARIABLE_APPEND_WRITE,
-					     sizeof(sig), sig);
+		efi_status = set_variable((CHAR16 *)var, owner,
+					  EFI_VARIABLE_NON_VOLATILE |
+					  EFI_VARIABLE_BOOTSERVICE_ACCESS |
+					  EFI_VARIABLE_APPEND_WRITE,
+					  sizeof(sig), sig);
 	return efi_status;
 }
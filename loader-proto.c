@@ -42,6 +42,8 @@ typedef struct {
 	void *buffer;
 	size_t size;
 	bool allocated_buffer;
+	UINTN pages;	/* nonzero if buffer is a page allocation */
+	authenticode_digests_t digests;
 } buffer_properties_t;
 
 static EFI_STATUS
@@ -69,6 +71,7 @@ try_load_from_sfs(EFI_DEVICE_PATH *dp, buffer_properties_t *bprop)
 	EFI_FILE_HANDLE root = NULL;
 	EFI_FILE_HANDLE file = NULL;
 	UINT64 tmpsz = 0;
+	UINTN readsz = 0;
 
 	bprop->buffer = NULL;
 
@@ -109,20 +112,23 @@ try_load_from_sfs(EFI_DEVICE_PATH *dp, buffer_properties_t *bprop)
 	if (EFI_ERROR(status))
 		goto out;
 
-	/* allocate buffer */
-	bprop->buffer = AllocatePool(bprop->size);
-	if (bprop->buffer == NULL) {
-		status = EFI_OUT_OF_RESOURCES;
+	/*
+	 * read file into pages handle_image() can load it in, hashing it
+	 * as it comes in
+	 */
+	status = read_image_file(file, bprop->size, &bprop->buffer, &readsz,
+				 &bprop->pages, &bprop->digests);
+	if (EFI_ERROR(status))
 		goto out;
-	}
 	bprop->allocated_buffer = true;
-
-	/* read file */
-	status = file->Read(file, &bprop->size, bprop->buffer);
+	bprop->size = readsz;
 
 out:
-	if (EFI_ERROR(status) && bprop->buffer)
-		FreePool(bprop->buffer);
+	if (EFI_ERROR(status) && bprop->buffer) {
+		free_image_buffer(bprop->buffer, bprop->pages);
+		bprop->buffer = NULL;
+		bprop->pages = 0;
+	}
 	if (file)
 		file->Close(file);
 	if (root)
@@ -138,6 +144,9 @@ try_load_from_lf2(EFI_DEVICE_PATH *dp, buffer_properties_t *bprop)
 	EFI_LOAD_FILE2_PROTOCOL *lf2 = NULL;
 
 	bprop->buffer = NULL;
+	bprop->pages = 0;
+	/* LoadFile() hands us the whole thing at once, so hash it later */
+	bprop->digests.algorithms = 0;
 
 	/* look for a handle with LF2 support from the input DP */
 	bprop->dp = dp;
@@ -313,17 +322,29 @@ shim_load_image(BOOLEAN BootPolicy, EFI_HANDLE ParentImageHandle,
 	if (EFI_ERROR(efi_status))
 		goto free_image;
 
+	/*
+	 * If we read the image into pages ourselves, it may be loaded
+	 * right where it is.
+	 */
+	if (bprop.buffer && bprop.allocated_buffer && bprop.pages) {
+		image->alloc_address = (EFI_PHYSICAL_ADDRESS)(uintptr_t)bprop.buffer;
+		image->alloc_pages = bprop.pages;
+	}
+
 	in_protocol = 1;
 	efi_status = handle_image(SourceBuffer, SourceSize, &image->li,
 				  *ImageHandle, &image->entry_point,
 				  &image->alloc_address, &image->alloc_pages,
-				  &image->alloc_alignment, parent_verified);
+				  &image->alloc_alignment, parent_verified,
+				  &bprop.digests);
 	in_protocol = 0;
 	if (EFI_ERROR(efi_status))
 		goto free_alloc;
 
-	if (bprop.buffer && bprop.allocated_buffer)
-		FreePool(bprop.buffer);
+	/* If it was loaded in place, the buffer is the loaded image now. */
+	if (bprop.buffer && bprop.allocated_buffer &&
+	    image->alloc_address != (EFI_PHYSICAL_ADDRESS)(uintptr_t)bprop.buffer)
+		free_image_buffer(bprop.buffer, bprop.pages);
 
 	return EFI_SUCCESS;
 
@@ -344,7 +365,7 @@ free_image:
 	FreePool(image);
 free_buffer:
 	if (bprop.buffer && bprop.allocated_buffer)
-		FreePool(bprop.buffer);
+		free_image_buffer(bprop.buffer, bprop.pages);
 	return efi_status;
 }
 
@@ -298,11 +298,17 @@ efi_update_mem_attrs(uintptr_t addr, uint64_t size,
 	if (!proto)
 		return EFI_UNSUPPORTED;
 
-	efi_status = efi_get_mem_attrs(addr, size, &before);
-	if (EFI_ERROR(efi_status))
-		dprint(L"efi_get_mem_attrs(0x%llx, 0x%llx, 0x%llx) -> 0x%lx\n",
-		       (unsigned long long)addr, (unsigned long long)size,
-		       &before, efi_status);
+	/*
+	 * The before and after attributes are only for the debug
+	 * message, and each costs the firmware a page table walk.
+	 */
+	if (verbose) {
+		efi_status = efi_get_mem_attrs(addr, size, &before);
+		if (EFI_ERROR(efi_status))
+			dprint(L"efi_get_mem_attrs(0x%llx, 0x%llx, 0x%llx) -> 0x%lx\n",
+			       (unsigned long long)addr, (unsigned long long)size,
+			       &before, efi_status);
+	}
 
 	if (!IS_PAGE_ALIGNED(physaddr) || !IS_PAGE_ALIGNED(size) || size == 0) {
 		perror(L"Invalid call %a(addr:0x%llx-0x%llx, size:0x%llx, +%a%a%a, -%a%a%a)\n",
@@ -345,11 +351,13 @@ efi_update_mem_attrs(uintptr_t addr, uint64_t size,
 	}
 	ret = efi_status;
 
-	efi_status = efi_get_mem_attrs(addr, size, &after);
-	if (EFI_ERROR(efi_status))
-		dprint(L"efi_get_mem_attrs(0x%llx, %llu, 0x%llx) -> 0x%lx\n",
-		       (unsigned long long)addr, (unsigned long long)size,
-		       &after, efi_status);
+	if (verbose) {
+		efi_status = efi_get_mem_attrs(addr, size, &after);
+		if (EFI_ERROR(efi_status))
+			dprint(L"efi_get_mem_attrs(0x%llx, %llu, 0x%llx) -> 0x%lx\n",
+			       (unsigned long long)addr, (unsigned long long)size,
+			       &after, efi_status);
+	}
 
 	dprint(L"set +%a%a%a -%a%a%a on 0x%llx-0x%llx before:%c%c%c after:%c%c%c\n",
 	       (set_attrs & MEM_ATTR_R) ? "r" : "",
@@ -385,6 +393,219 @@ update_mem_attrs(uintptr_t addr, uint64_t size,
 	return efi_status;
 }
 
+/*
+ * Each page in a batch is one byte: the EFI_MEMORY_RP/RO/XP bits the
+ * updates so far would set in the low bits, the ones they'd clear in
+ * the high bits, and whether anything has touched the page at all.
+ */
+#define BATCH_RP		0x01
+#define BATCH_RO		0x02
+#define BATCH_XP		0x04
+#define BATCH_CLEAR_SHIFT	4
+#define BATCH_TOUCHED		0x80
+
+static inline UINT8
+uefi_mem_attrs_to_batch_bits(uint64_t attrs)
+{
+	return ((attrs & EFI_MEMORY_RP) ? BATCH_RP : 0) |
+	       ((attrs & EFI_MEMORY_RO) ? BATCH_RO : 0) |
+	       ((attrs & EFI_MEMORY_XP) ? BATCH_XP : 0);
+}
+
+static inline uint64_t
+batch_bits_to_uefi_mem_attrs(UINT8 bits)
+{
+	return ((bits & BATCH_RP) ? EFI_MEMORY_RP : 0) |
+	       ((bits & BATCH_RO) ? EFI_MEMORY_RO : 0) |
+	       ((bits & BATCH_XP) ? EFI_MEMORY_XP : 0);
+}
+
+static inline UINT8
+batch_set_bits(UINT8 page)
+{
+	return page & (BATCH_RP | BATCH_RO | BATCH_XP);
+}
+
+static inline UINT8
+batch_clear_bits(UINT8 page)
+{
+	return (page >> BATCH_CLEAR_SHIFT) & (BATCH_RP | BATCH_RO | BATCH_XP);
+}
+
+void
+mem_attrs_batch_init(mem_attrs_batch_t *batch, uintptr_t addr,
+		     uint64_t size)
+{
+	batch->addr = addr;
+	batch->n_pages = 0;
+	batch->pages = NULL;
+
+	if (!IS_PAGE_ALIGNED(addr) || !IS_PAGE_ALIGNED(size) || size == 0)
+		return;
+
+	batch->pages = AllocateZeroPool(size / PAGE_SIZE);
+	if (!batch->pages) {
+		dprint(L"Could not allocate memory attribute batch, updating directly\n");
+		return;
+	}
+	batch->n_pages = size / PAGE_SIZE;
+}
+
+void
+mem_attrs_batch_free(mem_attrs_batch_t *batch)
+{
+	if (batch->pages)
+		FreePool(batch->pages);
+	batch->pages = NULL;
+	batch->n_pages = 0;
+}
+
+EFI_STATUS
+mem_attrs_batch_update(mem_attrs_batch_t *batch, uintptr_t addr,
+		       uint64_t size, uint64_t set_attrs,
+		       uint64_t clear_attrs)
+{
+	UINT8 set_bits, clear_bits;
+	UINTN first, n;
+
+	/*
+	 * Anything the batch can't hold, including everything when it
+	 * couldn't be allocated, goes straight to the firmware.
+	 */
+	if (!batch->pages || addr < batch->addr ||
+	    !IS_PAGE_ALIGNED(addr) || !IS_PAGE_ALIGNED(size) || size == 0)
+		return update_mem_attrs(addr, size, set_attrs, clear_attrs);
+
+	first = (addr - batch->addr) / PAGE_SIZE;
+	n = size / PAGE_SIZE;
+	if (first >= batch->n_pages || n > batch->n_pages - first)
+		return update_mem_attrs(addr, size, set_attrs, clear_attrs);
+
+	/*
+	 * Same as efi_update_mem_attrs(): set, then clear, so a bit in
+	 * both ends up cleared.
+	 */
+	set_bits = uefi_mem_attrs_to_batch_bits(
+			shim_mem_attrs_to_uefi_mem_attrs(set_attrs));
+	clear_bits = uefi_mem_attrs_to_batch_bits(
+			shim_mem_attrs_to_uefi_mem_attrs(clear_attrs));
+	set_bits &= ~clear_bits;
+
+	for (UINTN i = first; i < first + n; i++) {
+		UINT8 page_set = batch_set_bits(batch->pages[i]);
+		UINT8 page_clear = batch_clear_bits(batch->pages[i]);
+
+		page_set = (page_set & ~clear_bits) | set_bits;
+		page_clear = (page_clear & ~set_bits) | clear_bits;
+		batch->pages[i] = BATCH_TOUCHED | page_set |
+				  (page_clear << BATCH_CLEAR_SHIFT);
+	}
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * Without the EFI protocol, hand each run of identical pages to the DXE
+ * services the way update_mem_attrs() would.
+ */
+static EFI_STATUS
+dxe_apply_mem_attrs_batch(mem_attrs_batch_t *batch)
+{
+	EFI_STATUS efi_status = EFI_SUCCESS;
+	UINTN i, j;
+
+	for (i = 0; i < batch->n_pages; i = j) {
+		UINT8 page = batch->pages[i];
+
+		for (j = i + 1; j < batch->n_pages && batch->pages[j] == page; j++)
+			;
+		if (!(page & BATCH_TOUCHED))
+			continue;
+
+		efi_status = dxe_update_mem_attrs(batch->addr + i * PAGE_SIZE,
+			(j - i) * PAGE_SIZE,
+			uefi_mem_attrs_to_shim_mem_attrs(
+				batch_bits_to_uefi_mem_attrs(batch_set_bits(page))),
+			uefi_mem_attrs_to_shim_mem_attrs(
+				batch_bits_to_uefi_mem_attrs(batch_clear_bits(page))));
+		if (EFI_ERROR(efi_status))
+			break;
+	}
+
+	return efi_status;
+}
+
+/*
+ * Apply everything in the batch and free it.  Sets and clears are
+ * merged separately, so each is one SetMemoryAttributes() or
+ * ClearMemoryAttributes() call per run of adjacent pages that want the
+ * same bits changed, however many updates covered them.
+ */
+EFI_STATUS
+mem_attrs_batch_apply(mem_attrs_batch_t *batch)
+{
+	EFI_MEMORY_ATTRIBUTE_PROTOCOL *proto = NULL;
+	EFI_STATUS efi_status = EFI_SUCCESS;
+	UINTN i, j;
+
+	if (!batch->pages)
+		return EFI_SUCCESS;
+
+	get_efi_mem_attr_protocol(&proto);
+	if (!proto) {
+		efi_status = dxe_apply_mem_attrs_batch(batch);
+		goto out;
+	}
+
+	for (i = 0; i < batch->n_pages; i = j) {
+		UINT8 bits = batch_set_bits(batch->pages[i]);
+
+		for (j = i + 1; j < batch->n_pages &&
+				batch_set_bits(batch->pages[j]) == bits; j++)
+			;
+		if (!bits)
+			continue;
+
+		efi_status = proto->SetMemoryAttributes(proto,
+				batch->addr + i * PAGE_SIZE,
+				(j - i) * PAGE_SIZE,
+				batch_bits_to_uefi_mem_attrs(bits));
+		if (EFI_ERROR(efi_status)) {
+			dprint(L"Failed to set memory attrs:0x%0x physaddr:0x%llx size:0x%0lx status:%r\n",
+			       batch_bits_to_uefi_mem_attrs(bits),
+			       batch->addr + i * PAGE_SIZE,
+			       (j - i) * PAGE_SIZE, efi_status);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < batch->n_pages; i = j) {
+		UINT8 bits = batch_clear_bits(batch->pages[i]);
+
+		for (j = i + 1; j < batch->n_pages &&
+				batch_clear_bits(batch->pages[j]) == bits; j++)
+			;
+		if (!bits)
+			continue;
+
+		efi_status = proto->ClearMemoryAttributes(proto,
+				batch->addr + i * PAGE_SIZE,
+				(j - i) * PAGE_SIZE,
+				batch_bits_to_uefi_mem_attrs(bits));
+		if (EFI_ERROR(efi_status)) {
+			dprint(L"Failed to clear memory attrs:0x%0x physaddr:0x%llx size:0x%0lx status:%r\n",
+			       batch_bits_to_uefi_mem_attrs(bits),
+			       batch->addr + i * PAGE_SIZE,
+			       (j - i) * PAGE_SIZE, efi_status);
+			goto out;
+		}
+	}
+
+out:
+	mem_attrs_batch_free(batch);
+	return efi_status;
+}
+
 EFI_STATUS
 get_mem_attrs(uintptr_t addr, size_t size, uint64_t *attrs)
 {
@@ -71,6 +71,7 @@ static BOOLEAN check_var(CHAR16 *varname)
 #define SetVariable(name, guid, attrs, varsz, var)                                  \
 	({                                                                          \
 		EFI_STATUS efi_status_;                                             \
+		variable_write_generation++;                                        \
 		efi_status_ = RT->SetVariable(name, guid, attrs, varsz, var);       \
 		dprint_(L"%a:%d:%a() SetVariable(\"%s\", ... varsz=0x%llx) = %r\n", \
 		        __FILE__, __LINE__ - 5, __func__, name, varsz,              \
@@ -595,6 +596,58 @@ static const uint8_t null_sha256[32] = { 0, };
 
 typedef UINTN SIZE_T;
 
+/*
+ * QueryVariableInfo() is slow on machines where variable services live
+ * in SMM, and mirroring a large MokList asks for every chunk in both
+ * passes.  While import_mok_state() is running, we only ask once per
+ * set of attributes, and keep count of what we've written since.  A
+ * delete or a failed write means we don't know any more, so we ask again.
+ */
+static struct {
+	BOOLEAN enabled;
+	BOOLEAN valid;
+	BOOLEAN tracked;	/* from QueryVariableInfo(), not a guess */
+	UINT32 attrs;
+	EFI_STATUS status;
+	uint64_t remaining_sz;
+	uint64_t max_var_sz;
+} var_space;
+
+static inline void
+forget_var_space(void)
+{
+	var_space.valid = FALSE;
+}
+
+/*
+ * What a variable costs in the store beyond its name and data: EDK2
+ * keeps a 60 byte authenticated variable header and pads each part to 4
+ * bytes.  We round both up, since other implementations may be a little
+ * worse.
+ */
+#define VAR_STORE_HEADER_SZ	64
+#define VAR_STORE_ALIGN		8
+
+/*
+ * A new variable takes up its name and a header as well as its data.
+ * This is only ever an estimate, so once what's left could limit the
+ * size of the next variable, we go back to asking.
+ */
+static void
+note_var_space_used(CHAR16 *name, UINT32 attrs, UINTN size)
+{
+	uint64_t used = VAR_STORE_HEADER_SZ +
+			ALIGN_VALUE(StrSize(name), VAR_STORE_ALIGN) +
+			ALIGN_VALUE(size, VAR_STORE_ALIGN);
+
+	if (!var_space.enabled || !var_space.valid || !var_space.tracked ||
+	    var_space.attrs != attrs)
+		return;
+	var_space.remaining_sz -= MIN(var_space.remaining_sz, used);
+	if (var_space.remaining_sz <= var_space.max_var_sz)
+		forget_var_space();
+}
+
 static EFI_STATUS
 get_max_var_sz(UINT32 attrs, SIZE_T *max_var_szp)
 {
@@ -602,8 +655,19 @@ get_max_var_sz(UINT32 attrs, SIZE_T *max_var_szp)
 	uint64_t max_storage_sz = 0;
 	uint64_t remaining_sz = 0;
 	uint64_t max_var_sz = 0;
+	BOOLEAN tracked = FALSE;
 
 	*max_var_szp = 0;
+	if (var_space.enabled && var_space.valid && var_space.attrs == attrs) {
+		if (EFI_ERROR(var_space.status))
+			return var_space.status;
+		*max_var_szp = MIN(var_space.max_var_sz,
+				   var_space.remaining_sz);
+		dprint(L"max_var_sz:%lx remaining_sz:%lx (counted)\n",
+		       var_space.max_var_sz, var_space.remaining_sz);
+		return EFI_SUCCESS;
+	}
+
 	if (EFI_MAJOR_VERSION(RT) < 2 || is_apple_firmware_vendor()) {
 		dprint(L"EFI %d.%d; no RT->QueryVariableInfo()%a.  Using 1024!\n",
 		       EFI_MAJOR_VERSION(RT), EFI_MINOR_VERSION(RT),
@@ -615,11 +679,22 @@ get_max_var_sz(UINT32 attrs, SIZE_T *max_var_szp)
 		       RT->QueryVariableInfo);
 		efi_status = RT->QueryVariableInfo(attrs, &max_storage_sz,
 						   &remaining_sz, &max_var_sz);
-		if (EFI_ERROR(efi_status)) {
-			perror(L"Could not get variable storage info: %r\n",
-			       efi_status);
-			return efi_status;
-		}
+		tracked = TRUE;
+	}
+
+	if (var_space.enabled) {
+		var_space.valid = TRUE;
+		var_space.tracked = tracked;
+		var_space.attrs = attrs;
+		var_space.status = efi_status;
+		var_space.remaining_sz = remaining_sz;
+		var_space.max_var_sz = max_var_sz;
+	}
+
+	if (EFI_ERROR(efi_status)) {
+		perror(L"Could not get variable storage info: %r\n",
+		       efi_status);
+		return efi_status;
 	}
 
 	/*
@@ -632,6 +707,108 @@ get_max_var_sz(UINT32 attrs, SIZE_T *max_var_szp)
 	return efi_status;
 }
 
+static void
+delete_mirror_variable(CHAR16 *name, EFI_GUID *guid)
+{
+	EFI_STATUS efi_status;
+
+	dprint(L"deleting \"%s\"\n", name);
+	efi_status = LibDeleteVariable(name, guid);
+	dprint(L"LibDeleteVariable(\"%s\",...) => %r\n", name, efi_status);
+	if (!EFI_ERROR(efi_status))
+		forget_var_space();
+}
+
+/*
+ * The mirrors are volatile, so unless another shim has already run during
+ * this boot, none of them exist yet and reading them back first would
+ * only cost us a GetVariable() each.  Any shim that wrote them also
+ * installed the MoK configuration table, so import_mok_state() looks for
+ * that before it installs its own.
+ */
+static BOOLEAN mirrors_may_exist;
+
+static BOOLEAN
+mok_config_table_installed(void)
+{
+	for (UINTN i = 0; i < ST->NumberOfTableEntries; i++) {
+		EFI_CONFIGURATION_TABLE *CT = &ST->ConfigurationTable[i];
+
+		if (CompareGuid(&MOK_VARIABLE_STORE, &CT->VendorGuid))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Check if a runtime variable we mirror is already there with exactly
+ * these attributes and contents.  We only offer a buffer of the size we
+ * expect, so if the size is different we never read the data at all.
+ */
+static BOOLEAN
+mirror_is_current(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
+		  UINTN size, void *data, BOOLEAN *exists)
+{
+	EFI_STATUS efi_status;
+	UINT32 cur_attrs = 0;
+	UINTN cur_size = size;
+	UINT8 *buf;
+	BOOLEAN current = FALSE;
+
+	*exists = FALSE;
+	if (!mirrors_may_exist || !size || !data)
+		return FALSE;
+
+	buf = AllocatePool(size);
+	if (!buf)
+		return FALSE;
+
+	efi_status = RT->GetVariable(name, guid, &cur_attrs, &cur_size, buf);
+	if (!EFI_ERROR(efi_status) || efi_status == EFI_BUFFER_TOO_SMALL)
+		*exists = TRUE;
+	if (!EFI_ERROR(efi_status) && cur_attrs == attrs &&
+	    cur_size == size && CompareMem(buf, data, size) == 0)
+		current = TRUE;
+
+	FreePool(buf);
+	return current;
+}
+
+/*
+ * Write one runtime variable, unless it's already what we'd write.  If
+ * delete_first is set and *delete_first is TRUE, any other variable with
+ * this name is deleted before we create ours, and *delete_first is
+ * cleared so our caller knows it's been dealt with.
+ */
+static EFI_STATUS
+set_mirror_variable(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
+		    UINTN size, void *data, BOOLEAN *delete_first)
+{
+	EFI_STATUS efi_status;
+	BOOLEAN delete = FALSE;
+	BOOLEAN exists = FALSE;
+
+	if (delete_first) {
+		delete = *delete_first;
+		*delete_first = FALSE;
+	}
+
+	if (mirror_is_current(name, guid, attrs, size, data, &exists)) {
+		dprint(L"\"%s\" is unchanged, not writing it\n", name);
+		return EFI_SUCCESS;
+	}
+
+	if (delete)
+		delete_mirror_variable(name, guid);
+
+	efi_status = SetVariable(name, guid, attrs, size, data);
+	if (EFI_ERROR(efi_status) || exists)
+		forget_var_space();
+	else
+		note_var_space_used(name, attrs, size);
+	return efi_status;
+}
+
 /*
  * If any entries fit in < maxsz, and nothing goes wrong, create a variable
  * of the given name and guid with as many esd entries as possible in it,
@@ -645,7 +822,7 @@ get_max_var_sz(UINT32 attrs, SIZE_T *max_var_szp)
 static EFI_STATUS
 mirror_one_esl(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 	       EFI_SIGNATURE_LIST *esl, EFI_SIGNATURE_DATA *esd,
-	       SIZE_T howmany)
+	       SIZE_T howmany, BOOLEAN *delete_first)
 {
 	EFI_STATUS efi_status;
 	SIZE_T varsz = 0;
@@ -677,7 +854,8 @@ mirror_one_esl(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 	dprint(L"new esl:\n");
 	dhexdumpat(var, varsz, 0);
 
-	efi_status = SetVariable(name, guid, attrs, varsz, var);
+	efi_status = set_mirror_variable(name, guid, attrs, varsz, var,
+					 delete_first);
 	FreePool(var);
 	if (EFI_ERROR(efi_status)) {
 		LogError(L"Couldn't create mok variable \"%s\": %r\n",
@@ -690,7 +868,8 @@ mirror_one_esl(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 
 static EFI_STATUS
 mirror_mok_db(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
-	      UINT8 *FullData, SIZE_T FullDataSize, BOOLEAN only_first)
+	      UINT8 *FullData, SIZE_T FullDataSize, BOOLEAN only_first,
+	      BOOLEAN *delete_first)
 {
 	EFI_STATUS efi_status = EFI_SUCCESS;
 	SIZE_T max_var_sz;
@@ -709,8 +888,9 @@ mirror_mok_db(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 	if (FullDataSize <= max_var_sz || efi_status == EFI_UNSUPPORTED) {
 		efi_status = EFI_SUCCESS;
 		if (only_first)
-			efi_status = SetVariable(name, guid, attrs,
-						 FullDataSize, FullData);
+			efi_status = set_mirror_variable(name, guid, attrs,
+							 FullDataSize, FullData,
+							 delete_first);
 
 		return efi_status;
 	}
@@ -775,7 +955,8 @@ mirror_mok_db(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 
 		/*
 		 * In case max_var_sz is computed dynamically, refresh the
-		 * value here.
+		 * value here.  During import_mok_state() this is counted
+		 * down as we write rather than asked for again.
 		 */
 		efi_status = get_max_var_sz(attrs, &max_var_sz);
 		if (EFI_ERROR(efi_status)) {
@@ -822,7 +1003,7 @@ mirror_mok_db(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 		}
 
 		efi_status = mirror_one_esl(namen, guid, attrs,
-					    esl, esd, howmany);
+					    esl, esd, howmany, delete_first);
 		dprint(L"esd:0x%llx adj:0x%llx\n", esd, adj);
 		if (EFI_ERROR(efi_status)) {
 			LogError(L"Could not mirror mok variable \"%s\": %r\n",
@@ -865,10 +1046,10 @@ mirror_mok_db(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 		 * doesn't.
 		 */
 		if (!EFI_ERROR(efi_status) && var && varsz) {
-			efi_status = SetVariable(name, guid,
+			efi_status = set_mirror_variable(name, guid,
 				    EFI_VARIABLE_BOOTSERVICE_ACCESS
 				    | EFI_VARIABLE_RUNTIME_ACCESS,
-				    varsz, var);
+				    varsz, var, delete_first);
 			FreePool(var);
 		}
 	}
@@ -878,7 +1059,7 @@ mirror_mok_db(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
 
 static EFI_STATUS NONNULL(1)
 mirror_one_mok_variable(struct mok_state_variable *v,
-			BOOLEAN only_first)
+			BOOLEAN only_first, BOOLEAN *delete_first)
 {
 	EFI_STATUS efi_status = EFI_SUCCESS;
 	uint8_t *FullData = NULL;
@@ -1144,13 +1325,14 @@ mirror_one_mok_variable(struct mok_state_variable *v,
 		       v->rtname, FullDataSize);
 		efi_status = mirror_mok_db(v->rtname, v->guid,
 					   attrs, FullData, FullDataSize,
-					   only_first);
+					   only_first, delete_first);
 		dprint(L"mirror_mok_db(\"%s\",  datasz=%lu) returned %r\n",
 		       v->rtname, FullDataSize, efi_status);
 	} else if (FullDataSize && only_first &&
 		   !(v->flags & MOK_VARIABLE_CONFIG_ONLY)) {
-		efi_status = SetVariable(v->rtname, v->guid, attrs,
-					 FullDataSize, FullData);
+		efi_status = set_mirror_variable(v->rtname, v->guid, attrs,
+						 FullDataSize, FullData,
+						 delete_first);
 	}
 	if (FullDataSize && only_first) {
 		if (measure) {
@@ -1211,19 +1393,29 @@ maybe_mirror_one_mok_variable(struct mok_state_variable *v,
 	BOOLEAN present = FALSE;
 
 	if (v->rtname) {
-		if (only_first && (v->flags & MOK_MIRROR_DELETE_FIRST)) {
-			dprint(L"deleting \"%s\"\n", v->rtname);
-			efi_status = LibDeleteVariable(v->rtname, v->guid);
-			dprint(L"LibDeleteVariable(\"%s\",...) => %r\n", v->rtname, efi_status);
-		}
+		/*
+		 * The old variable gets deleted right before we write the
+		 * new one, and only if it isn't already what we'd write.
+		 */
+		BOOLEAN delete_first =
+			(only_first && (v->flags & MOK_MIRROR_DELETE_FIRST))
+			? TRUE : FALSE;
 
-		efi_status = mirror_one_mok_variable(v, only_first);
+		efi_status = mirror_one_mok_variable(v, only_first,
+						     &delete_first);
 		if (EFI_ERROR(efi_status)) {
 			if (ret != EFI_SECURITY_VIOLATION)
 				ret = efi_status;
 			perror(L"Could not create %s: %r\n", v->rtname,
 			       efi_status);
 		}
+
+		/*
+		 * If we didn't write it at all, there still mustn't be a
+		 * stale one left behind.
+		 */
+		if (delete_first)
+			delete_mirror_variable(v->rtname, v->guid);
 	}
 
 	present = (v->data && v->data_size) ? TRUE : FALSE;
@@ -1327,6 +1519,8 @@ EFI_STATUS import_one_mok_state(struct mok_state_variable *v,
 		if (EFI_ERROR(efi_status)) {
 			perror(L"Failed to erase %s\n", v->name);
 			ret = EFI_SECURITY_VIOLATION;
+		} else {
+			forget_var_space();
 		}
 		FreePool(v->data);
 		v->data = NULL;
@@ -1365,12 +1559,17 @@ EFI_STATUS import_mok_state(EFI_HANDLE image_handle)
 	user_insecure_mode = 0;
 	ignore_db = 0;
 	trust_mok_list = 0;
+	policy_generation++;
 
 	UINT64 config_sz = 0;
 	UINT8 *config_table = NULL;
 	size_t npages = 0;
 	struct mok_variable_config_entry config_template;
 
+	var_space.enabled = TRUE;
+	forget_var_space();
+	mirrors_may_exist = mok_config_table_installed();
+
 	dprint(L"importing minimal mok state variables\n");
 	for (i = 0; mok_state_variables[i].name != NULL; i++) {
 		struct mok_state_variable *v = &mok_state_variables[i];
@@ -1455,6 +1654,12 @@ EFI_STATUS import_mok_state(EFI_HANDLE image_handle)
 		import_one_mok_state(v, FALSE);
 	}
 
+	/*
+	 * MokManager may change things, so don't keep counting past here.
+	 */
+	var_space.enabled = FALSE;
+	forget_var_space();
+
 	/*
 	 * Enter MokManager if necessary.  Any actual *changes* here will
 	 * cause MokManager to demand a machine reboot, so this is safe to
@@ -25,6 +25,22 @@
 #define TFTP_ERROR_UNKNOWN_ID   5  /* Unknown transfer ID. */
 #define TFTP_ERROR_EXISTS       6  /* File already exists. */
 #define TFTP_ERROR_NO_USER      7  /* No such user. */
+#define TFTP_ERROR_OPTION       8  /* Option negotiation failed (RFC 2347). */
+
+/*
+ * TFTP block sizes to ask the server for, in the order we try them.  A
+ * bigger block means fewer round trips per image, but some servers and
+ * relays mishandle the blksize option, so if a transfer fails in a way a
+ * smaller block might fix, we move on to the next one.  Build with
+ * NETBOOT_TFTP_BLOCK_SIZES=... to change the list.
+ */
+#ifndef NETBOOT_TFTP_BLOCK_SIZES
+#define NETBOOT_TFTP_BLOCK_SIZES 1468, 1024, 512
+#endif
+static const UINTN tftp_block_sizes[] = { NETBOOT_TFTP_BLOCK_SIZES };
+
+/* How much to start with if the server won't tell us the file size */
+#define TFTP_DEFAULT_BUFFER_SIZE (4096 * 1024)
 
 /* Fuzzing harness needs access to some variables that are normally static */
 #ifdef SHIM_ENABLE_LIBFUZZER
@@ -398,35 +414,108 @@ status_from_error(UINT8 error_code)
 	}
 }
 
+/*
+ * Whether a failed transfer might work with a smaller block size: the
+ * server said it couldn't do our options, or what we heard back from it
+ * didn't make sense.  Anything else the server told us, like "file not
+ * found", it will tell us again, and a server that didn't answer at all
+ * won't start because we ask for smaller blocks.
+ */
+static BOOLEAN
+tftp_blksize_may_help(EFI_STATUS efi_status)
+{
+	if (efi_status == EFI_OUT_OF_RESOURCES ||
+	    efi_status == EFI_TIMEOUT)
+		return FALSE;
+	if (pxe->Mode->TftpErrorReceived)
+		return pxe->Mode->TftpError.ErrorCode == TFTP_ERROR_OPTION;
+
+	return efi_status == EFI_TFTP_ERROR ||
+	       efi_status == EFI_ICMP_ERROR ||
+	       efi_status == EFI_PROTOCOL_ERROR;
+}
+
+/*
+ * Fetch full_path with one block size.  We ask the server for the file
+ * size first, so the buffer can be allocated once and the file
+ * downloaded once.  Only if the server won't say (or says wrong) do we
+ * fall back to growing the buffer and downloading it again.
+ */
+static EFI_STATUS
+tftp_fetch(UINTN blksz, VOID **buffer, UINT64 *bufsiz)
+{
+	EFI_STATUS efi_status;
+	UINT64 size = 0;
+
+	efi_status = pxe->Mtftp(pxe, EFI_PXE_BASE_CODE_TFTP_GET_FILE_SIZE,
+				NULL, FALSE, &size, &blksz, &tftp_addr,
+				(UINT8 *)full_path, NULL, FALSE);
+	if (!EFI_ERROR(efi_status) && size > 0) {
+		dprint(L"TFTP file size %lu, block size %lu\n", size, blksz);
+		if (*buffer && *bufsiz < size) {
+			FreePool(*buffer);
+			*buffer = NULL;
+		}
+		if (!*buffer)
+			*bufsiz = size;
+	} else if (efi_status == EFI_TIMEOUT) {
+		/* nobody answered, and they won't for the download either */
+		return efi_status;
+	} else if (pxe->Mode->TftpErrorReceived &&
+		   pxe->Mode->TftpError.ErrorCode != TFTP_ERROR_OPTION) {
+		/* the server answered, and it wasn't about our options */
+		return efi_status;
+	} else if (!*buffer) {
+		/*
+		 * Servers without the tsize option just start sending the
+		 * file, which firmware reports as one error or another, so
+		 * try reading it the old way.
+		 */
+		*bufsiz = TFTP_DEFAULT_BUFFER_SIZE;
+	}
+
+	for (;;) {
+		if (!*buffer) {
+			*buffer = AllocatePool(*bufsiz);
+			if (!*buffer)
+				return EFI_OUT_OF_RESOURCES;
+		}
+
+		size = *bufsiz;
+		efi_status = pxe->Mtftp(pxe, EFI_PXE_BASE_CODE_TFTP_READ_FILE,
+					*buffer, FALSE, &size, &blksz,
+					&tftp_addr, (UINT8 *)full_path, NULL,
+					FALSE);
+		if (efi_status != EFI_BUFFER_TOO_SMALL)
+			break;
+
+		/* try again, doubling buf size, or to what it says it needs */
+		*bufsiz = MAX(*bufsiz * 2, size);
+		FreePool(*buffer);
+		*buffer = NULL;
+	}
+
+	if (!EFI_ERROR(efi_status))
+		*bufsiz = size;
+	return efi_status;
+}
+
 EFI_STATUS FetchNetbootimage(EFI_HANDLE image_handle UNUSED, VOID **buffer,
 	UINT64 *bufsiz, int flags)
 {
-	EFI_STATUS efi_status;
-	EFI_PXE_BASE_CODE_TFTP_OPCODE read = EFI_PXE_BASE_CODE_TFTP_READ_FILE;
-	BOOLEAN overwrite = FALSE;
-	BOOLEAN nobuffer = FALSE;
-	UINTN blksz = 512;
+	EFI_STATUS efi_status = EFI_NOT_FOUND;
+	UINTN i;
 
 	if (~flags & SUPPRESS_NETBOOT_OPEN_FAILURE_NOISE)
 		console_print(L"Fetching Netboot Image %a\n", full_path);
-	if (*buffer == NULL) {
-		*buffer = AllocatePool(4096 * 1024);
-		if (!*buffer)
-			return EFI_OUT_OF_RESOURCES;
-		*bufsiz = 4096 * 1024;
-	}
 
-try_again:
-	efi_status = pxe->Mtftp(pxe, read, *buffer, overwrite, bufsiz, &blksz,
-			      &tftp_addr, (UINT8 *)full_path, NULL, nobuffer);
-	if (efi_status == EFI_BUFFER_TOO_SMALL) {
-		/* try again, doubling buf size */
-		*bufsiz *= 2;
-		FreePool(*buffer);
-		*buffer = AllocatePool(*bufsiz);
-		if (!*buffer)
-			return EFI_OUT_OF_RESOURCES;
-		goto try_again;
+	for (i = 0; i < sizeof(tftp_block_sizes) / sizeof(tftp_block_sizes[0]); i++) {
+		efi_status = tftp_fetch(tftp_block_sizes[i], buffer, bufsiz);
+		if (!EFI_ERROR(efi_status) ||
+		    !tftp_blksize_may_help(efi_status))
+			break;
+		dprint(L"TFTP transfer with block size %lu failed: %r\n",
+		       tftp_block_sizes[i], efi_status);
 	}
 
 	if (EFI_ERROR(efi_status)) {
@@ -453,6 +542,7 @@ try_again:
 
 		if (*buffer) {
 			FreePool(*buffer);
+			*buffer = NULL;
 		}
 	}
 	return efi_status;
@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * pe-hash.c - Authenticode hashing of PE images
+ * Copyright Peter Jones <pjones@redhat.com>
+ */
+
+#include "shim.h"
+
+#include <Library/BaseCryptLib.h>
+
+/*
+ * A multi-digest hashing context.  Every region handed to
+ * multi_hash_update() is fed to each of the requested digests one
+ * cache-sized block at a time, so each byte of the image only has to be
+ * pulled through the cache once no matter how many digests we compute.
+ */
+#define MULTI_HASH_BLOCK_SIZE	(32 * 1024)
+
+typedef struct {
+	UINT32 algorithms;
+	void *sha1ctx;
+	void *sha256ctx;
+	void *sha384ctx;
+} multi_hash_ctx_t;
+
+static void
+multi_hash_free(multi_hash_ctx_t *ctx)
+{
+	if (ctx->sha1ctx)
+		FreePool(ctx->sha1ctx);
+	if (ctx->sha256ctx)
+		FreePool(ctx->sha256ctx);
+	if (ctx->sha384ctx)
+		FreePool(ctx->sha384ctx);
+	ZeroMem(ctx, sizeof(*ctx));
+}
+
+static EFI_STATUS
+multi_hash_init(multi_hash_ctx_t *ctx, UINT32 algorithms)
+{
+	ZeroMem(ctx, sizeof(*ctx));
+	ctx->algorithms = algorithms;
+
+	if (algorithms & SHIM_HASH_SHA1) {
+		ctx->sha1ctx = AllocatePool(Sha1GetContextSize());
+		if (!ctx->sha1ctx)
+			goto oom;
+	}
+	if (algorithms & SHIM_HASH_SHA256) {
+		ctx->sha256ctx = AllocatePool(Sha256GetContextSize());
+		if (!ctx->sha256ctx)
+			goto oom;
+	}
+	if (algorithms & SHIM_HASH_SHA384) {
+		ctx->sha384ctx = AllocatePool(Sha384GetContextSize());
+		if (!ctx->sha384ctx)
+			goto oom;
+	}
+
+	if ((ctx->sha1ctx && !Sha1Init(ctx->sha1ctx)) ||
+	    (ctx->sha256ctx && !Sha256Init(ctx->sha256ctx)) ||
+	    (ctx->sha384ctx && !Sha384Init(ctx->sha384ctx))) {
+		perror(L"Unable to initialise hash\n");
+		multi_hash_free(ctx);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	return EFI_SUCCESS;
+oom:
+	perror(L"Unable to allocate memory for hash context\n");
+	multi_hash_free(ctx);
+	return EFI_OUT_OF_RESOURCES;
+}
+
+static BOOLEAN
+multi_hash_update(multi_hash_ctx_t *ctx, void *base, UINTN size)
+{
+	UINT8 *block = base;
+
+	while (size > 0) {
+		UINTN blocksz = MIN(size, MULTI_HASH_BLOCK_SIZE);
+
+		if (ctx->sha1ctx && !Sha1Update(ctx->sha1ctx, block, blocksz))
+			return FALSE;
+		if (ctx->sha256ctx &&
+		    !Sha256Update(ctx->sha256ctx, block, blocksz))
+			return FALSE;
+		if (ctx->sha384ctx &&
+		    !Sha384Update(ctx->sha384ctx, block, blocksz))
+			return FALSE;
+
+		block += blocksz;
+		size -= blocksz;
+	}
+
+	return TRUE;
+}
+
+static BOOLEAN
+multi_hash_final(multi_hash_ctx_t *ctx, authenticode_digests_t *digests)
+{
+	/* leave nothing behind for digests we weren't asked for */
+	ZeroMem(digests, sizeof(*digests));
+
+	if (ctx->sha1ctx && !Sha1Final(ctx->sha1ctx, digests->sha1))
+		return FALSE;
+	if (ctx->sha256ctx && !Sha256Final(ctx->sha256ctx, digests->sha256))
+		return FALSE;
+	if (ctx->sha384ctx && !Sha384Final(ctx->sha384ctx, digests->sha384))
+		return FALSE;
+
+	digests->algorithms = ctx->algorithms;
+	return TRUE;
+}
+
+/*
+ * Pad the hash out to a multiple of 8 bytes, finalise it, and log the
+ * results.
+ */
+static EFI_STATUS
+finish_hashes(multi_hash_ctx_t *hashctx, UINTN padding,
+	      authenticode_digests_t *digests)
+{
+	char padbuf[8];
+
+	ZeroMem(padbuf, 8);
+	if (padding && !multi_hash_update(hashctx, padbuf, padding)) {
+		perror(L"Unable to generate hash\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	if (!multi_hash_final(hashctx, digests)) {
+		perror(L"Unable to finalise hash\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	if (digests->algorithms & SHIM_HASH_SHA1) {
+		dprint(L"sha1 authenticode hash:\n");
+		dhexdumpat(digests->sha1, SHA1_DIGEST_SIZE, 0);
+	}
+	if (digests->algorithms & SHIM_HASH_SHA256) {
+		dprint(L"sha256 authenticode hash:\n");
+		dhexdumpat(digests->sha256, SHA256_DIGEST_SIZE, 0);
+	}
+	if (digests->algorithms & SHIM_HASH_SHA384) {
+		dprint(L"sha384 authenticode hash:\n");
+		dhexdumpat(digests->sha384, SHA384_DIGEST_SIZE, 0);
+	}
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * Calculate the requested Authenticode hashes of a binary in a single
+ * pass over the image.
+ */
+EFI_STATUS
+generate_hashes(char *data, unsigned int datasize,
+		PE_COFF_LOADER_IMAGE_CONTEXT *context,
+		UINT32 algorithms, authenticode_digests_t *digests)
+{
+	multi_hash_ctx_t hashctx;
+	authenticode_layout_t *layout = NULL;
+	EFI_STATUS efi_status;
+
+	digests->algorithms = 0;
+
+	efi_status = get_authenticode_layout(data, datasize, context, &layout);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+
+	efi_status = multi_hash_init(&hashctx, algorithms);
+	if (EFI_ERROR(efi_status))
+		goto done;
+
+	for (UINTN i = 0; i < layout->n_regions; i++) {
+		authenticode_region_t *region = &layout->regions[i];
+
+		if (!multi_hash_update(&hashctx, data + region->offset,
+				       region->size)) {
+			perror(L"Unable to generate hash\n");
+			efi_status = EFI_OUT_OF_RESOURCES;
+			goto done_hash;
+		}
+	}
+
+	efi_status = finish_hashes(&hashctx, layout->padding, digests);
+
+done_hash:
+	multi_hash_free(&hashctx);
+done:
+	FreePool(layout);
+	return efi_status;
+}
+
+BOOLEAN
+stream_hash_update(void *ctx, void *base, UINTN size)
+{
+	return multi_hash_update(ctx, base, size);
+}
+
+/*
+ * A hash context for image_stream_init() and stream_image() that
+ * computes the authenticode_algorithms() hashes, or NULL if one
+ * can't be set up, in which case the image just isn't hashed as it
+ * arrives.  Hand it back with finish_stream_hashes().
+ */
+void *
+new_stream_hashes(void)
+{
+	multi_hash_ctx_t *hashctx;
+
+	hashctx = AllocatePool(sizeof(*hashctx));
+	if (!hashctx)
+		return NULL;
+	if (EFI_ERROR(multi_hash_init(hashctx, authenticode_algorithms()))) {
+		FreePool(hashctx);
+		return NULL;
+	}
+	return hashctx;
+}
+
+/*
+ * Finalise the hashes of a streamed image into digests, if layout says
+ * the whole image was hashed, and free the context.  Otherwise
+ * digests->algorithms is left 0 and verify_buffer() will hash the
+ * buffer itself.
+ */
+void
+finish_stream_hashes(void *ctx, authenticode_layout_t *layout,
+		     authenticode_digests_t *digests)
+{
+	digests->algorithms = 0;
+	if (!ctx)
+		return;
+
+	if (layout && EFI_ERROR(finish_hashes(ctx, layout->padding, digests)))
+		digests->algorithms = 0;
+
+	multi_hash_free(ctx);
+	FreePool(ctx);
+}
+
+/*
+ * Calculate the SHA1 and SHA256 hashes of a binary
+ */
+EFI_STATUS
+generate_hash(char *data, unsigned int datasize,
+	      PE_COFF_LOADER_IMAGE_CONTEXT *context, UINT8 *sha256hash,
+	      UINT8 *sha1hash)
+{
+	authenticode_digests_t digests;
+	EFI_STATUS efi_status;
+
+	efi_status = generate_hashes(data, datasize, context,
+				     SHIM_HASH_SHA1 | SHIM_HASH_SHA256,
+				     &digests);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+
+	CopyMem(sha256hash, digests.sha256, SHA256_DIGEST_SIZE);
+	CopyMem(sha1hash, digests.sha1, SHA1_DIGEST_SIZE);
+	return EFI_SUCCESS;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -691,6 +691,7 @@ set_shim_nx_policy(void)
 	    hsi_api_is_present())
 	{
 		mok_policy |= MOK_POLICY_REQUIRE_NX;
+		policy_generation++;
 		dprint("Enforcing NX policy for all images\n");
 	}
 }
@@ -19,460 +19,78 @@
 #include <openssl/rsa.h>
 #include <openssl/dso.h>
 
-#include <Library/BaseCryptLib.h>
-
-#define check_size_line(data, datasize_in, hashbase, hashsize, l) ({	\
-	if ((unsigned long)hashbase >					\
-			(unsigned long)data + datasize_in) {		\
-		efi_status = EFI_INVALID_PARAMETER;			\
-		perror(L"shim.c:%d Invalid hash base 0x%016x\n", l,	\
-			hashbase);					\
-		goto done;						\
-	}								\
-	if ((unsigned long)hashbase + hashsize >			\
-			(unsigned long)data + datasize_in) {		\
-		efi_status = EFI_INVALID_PARAMETER;			\
-		perror(L"shim.c:%d Invalid hash size 0x%016x\n", l,	\
-			hashsize);					\
-		goto done;						\
-	}								\
-})
-#define check_size(d, ds, h, hs) check_size_line(d, ds, h, hs, __LINE__)
-
-static EFI_STATUS
-_do_sha256_sum(void *addr, UINTN size, UINT8 *digest)
-{
-	unsigned int sha256ctxsize;
-	void *sha256ctx = NULL;
-
-	sha256ctxsize = Sha256GetContextSize();
-	sha256ctx = AllocateZeroPool(sha256ctxsize);
-	if (sha256ctx == NULL)
-		return EFI_OUT_OF_RESOURCES;
-
-	if (!Sha256Init(sha256ctx))
-		return EFI_OUT_OF_RESOURCES;
-
-	if (!Sha256Update(sha256ctx, addr, size))
-		return EFI_OUT_OF_RESOURCES;
-
-	if (!Sha256Final(sha256ctx, digest))
-		return EFI_OUT_OF_RESOURCES;
-
-	FreePool(sha256ctx);
-	return EFI_SUCCESS;
-}
-
-struct shim_section_cache_entry {
-	EFI_HANDLE parent_image_handle;
-	UINT8 section_name[9];
-	UINTN size;
-	/*
-	 * Since this is all internal and there's no API access to it, this is
-	 * currently always sha256 and can be updated as needed.
-	 */
-	UINT8 digest[32];
-};
-
-static struct shim_section_cache_entry *section_cache = NULL;
-static UINTN num_section_cache_entries = 0;
-
-static EFI_STATUS
-cache_section(EFI_HANDLE parent_image_handle, UINT8 section_name[8],
-	      void *addr, UINTN size)
-{
-	struct shim_section_cache_entry *new_section_cache = NULL;
-	struct shim_section_cache_entry *entry = NULL;
-	size_t oscsz = num_section_cache_entries * sizeof (*new_section_cache);
-	size_t nscsz = oscsz + sizeof (*new_section_cache);
-	EFI_STATUS efi_status;
-
-	new_section_cache = AllocateZeroPool(nscsz);
-	if (!new_section_cache)
-		return EFI_OUT_OF_RESOURCES;
-
-	if (section_cache) {
-		CopyMem(new_section_cache, section_cache, oscsz);
-		FreePool(section_cache);
-	}
-	section_cache = new_section_cache;
-	entry = &section_cache[num_section_cache_entries];
-
-	entry->parent_image_handle = parent_image_handle;
-	CopyMem(entry->section_name, section_name, sizeof(entry->section_name)-1);
-	entry->size = size;
-
-	efi_status = _do_sha256_sum(addr, size, entry->digest);
-	if (EFI_ERROR(efi_status)) {
-		ZeroMem(entry, sizeof (*entry));
-		return efi_status;
-	}
-	num_section_cache_entries += 1;
-	return EFI_SUCCESS;
-}
-
-EFI_STATUS
-validate_cached_section(EFI_HANDLE parent_image_handle,
-			void *addr, UINTN size)
-{
-	struct shim_section_cache_entry *section = NULL;
-	EFI_STATUS efi_status;
-
-	for (UINTN i = 0; i < num_section_cache_entries; i++) {
-		struct shim_section_cache_entry *this_entry = &section_cache[i];
-		UINT8 digest[32];
-
-		dprint(L"Handles: 0x%016llx 0x%016llx section: '%a'\n",
-		       (unsigned long long)(uintptr_t)this_entry->parent_image_handle,
-		       (unsigned long long)(uintptr_t)parent_image_handle,
-		       this_entry->section_name);
-
-		if (this_entry->size != size)
-			continue;
-		if (this_entry->parent_image_handle != parent_image_handle)
-			continue;
-
-		ZeroMem(digest, sizeof(digest));
-
-		efi_status = _do_sha256_sum(addr, size, digest);
-		if (EFI_ERROR(efi_status))
-			return efi_status;
-
-		if (CompareMem(digest, this_entry->digest, sizeof(digest)) != 0)
-			continue;
-
-		section = this_entry;
-		break;
-	}
-	if (section == NULL)
-		return EFI_NOT_FOUND;
-
-	return EFI_SUCCESS;
-}
-
-void
-flush_cached_sections(EFI_HANDLE parent_image_handle)
-{
-	UINTN reduction = 0;
-	for (UINTN i = 0; i < num_section_cache_entries; i++) {
-		struct shim_section_cache_entry *this_entry = &section_cache[i];
-
-		if (this_entry->parent_image_handle != parent_image_handle)
-			continue;
-
-		reduction += 1;
-		CopyMem(&this_entry[1], &this_entry[0], sizeof(*this_entry) * (num_section_cache_entries - i - 1));
-	}
-
-	ZeroMem(&section_cache[num_section_cache_entries - reduction],
-		sizeof(section_cache[0]) * reduction);
-
-	num_section_cache_entries -= reduction;
-}
-
 /*
- * Calculate the SHA1 and SHA256 hashes of a binary
+ * Read an image from a file into a newly allocated buffer, computing its
+ * SHA-1 and SHA-256 Authenticode hashes as it comes in.  If the image
+ * can't be hashed that way, digests->algorithms is left 0 and
+ * verify_buffer() will hash the buffer itself.
+ *
+ * If pagesp is set, the buffer is allocated as whole pages of loader
+ * code, so that handle_image() can load the image where it lies, and
+ * *pagesp is how many.  Either way, the caller must release *datap with
+ * free_image_buffer().
  */
-
 EFI_STATUS
-generate_hash(char *data, unsigned int datasize,
-	      PE_COFF_LOADER_IMAGE_CONTEXT *context, UINT8 *sha256hash,
-	      UINT8 *sha1hash)
+read_image_file(EFI_FILE_HANDLE file, UINTN filesize, void **datap,
+		UINTN *datasizep, UINTN *pagesp,
+		authenticode_digests_t *digests)
 {
-	unsigned int sha256ctxsize, sha1ctxsize;
-	void *sha256ctx = NULL, *sha1ctx = NULL;
-	char *hashbase;
-	unsigned int hashsize;
-	unsigned int SumOfBytesHashed, SumOfSectionBytes;
-	unsigned int index, pos;
-	EFI_IMAGE_SECTION_HEADER *Section;
-	EFI_IMAGE_SECTION_HEADER *SectionHeader = NULL;
-	EFI_STATUS efi_status = EFI_SUCCESS;
-	EFI_IMAGE_DOS_HEADER *DosHdr = (void *)data;
-	unsigned int PEHdr_offset = 0;
-
-	if (datasize <= sizeof (*DosHdr) ||
-	    DosHdr->e_magic != EFI_IMAGE_DOS_SIGNATURE) {
-		perror(L"Invalid signature\n");
-		return EFI_INVALID_PARAMETER;
-	}
-	PEHdr_offset = DosHdr->e_lfanew;
-
-	sha256ctxsize = Sha256GetContextSize();
-	sha256ctx = AllocatePool(sha256ctxsize);
-
-	sha1ctxsize = Sha1GetContextSize();
-	sha1ctx = AllocatePool(sha1ctxsize);
-
-	if (!sha256ctx || !sha1ctx) {
-		perror(L"Unable to allocate memory for hash context\n");
-		return EFI_OUT_OF_RESOURCES;
-	}
-
-	if (!Sha256Init(sha256ctx) || !Sha1Init(sha1ctx)) {
-		perror(L"Unable to initialise hash\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
-		goto done;
-	}
-
-	/* Hash start to checksum */
-	hashbase = data;
-	hashsize = (char *)&context->PEHdr->Pe32.OptionalHeader.CheckSum -
-		hashbase;
-	check_size(data, datasize, hashbase, hashsize);
-
-	if (!(Sha256Update(sha256ctx, hashbase, hashsize)) ||
-	    !(Sha1Update(sha1ctx, hashbase, hashsize))) {
-		perror(L"Unable to generate hash\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
-		goto done;
-	}
-
-	/* Hash post-checksum to start of certificate table */
-	hashbase = (char *)&context->PEHdr->Pe32.OptionalHeader.CheckSum +
-		sizeof (int);
-	hashsize = (char *)context->SecDir - hashbase;
-	check_size(data, datasize, hashbase, hashsize);
-
-	if (!(Sha256Update(sha256ctx, hashbase, hashsize)) ||
-	    !(Sha1Update(sha1ctx, hashbase, hashsize))) {
-		perror(L"Unable to generate hash\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
-		goto done;
-	}
-
-	/* Hash end of certificate table to end of image header */
-	EFI_IMAGE_DATA_DIRECTORY *dd = context->SecDir + 1;
-	hashbase = (char *)dd;
-	hashsize = context->SizeOfHeaders - (unsigned long)((char *)dd - data);
-	if (hashsize > datasize) {
-		perror(L"Data Directory size %d is invalid\n", hashsize);
-		efi_status = EFI_INVALID_PARAMETER;
-		goto done;
-	}
-	check_size(data, datasize, hashbase, hashsize);
-
-	if (!(Sha256Update(sha256ctx, hashbase, hashsize)) ||
-	    !(Sha1Update(sha1ctx, hashbase, hashsize))) {
-		perror(L"Unable to generate hash\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
-		goto done;
-	}
-
-	/* Sort sections */
-	SumOfBytesHashed = context->SizeOfHeaders;
-
-	/*
-	 * XXX Do we need this here, or is it already done in all cases?
-	 */
-	if (context->NumberOfSections == 0 ||
-	    context->FirstSection == NULL) {
-		uint16_t opthdrsz;
-		uint64_t addr;
-		uint16_t nsections;
-		EFI_IMAGE_SECTION_HEADER *section0, *sectionN;
-
-		nsections = context->PEHdr->Pe32.FileHeader.NumberOfSections;
-		opthdrsz = context->PEHdr->Pe32.FileHeader.SizeOfOptionalHeader;
-
-		/* Validate section0 is within image */
-		addr = PEHdr_offset + sizeof(UINT32)
-			+ sizeof(EFI_IMAGE_FILE_HEADER)
-			+ opthdrsz;
-		section0 = ImageAddress(data, datasize, addr);
-		if (!section0) {
-			perror(L"Malformed file header.\n");
-			perror(L"Image address for Section Header 0 is 0x%016llx\n",
-			       addr);
-			perror(L"File size is 0x%016llx\n", datasize);
-			efi_status = EFI_INVALID_PARAMETER;
-			goto done;
-		}
-
-		/* Validate sectionN is within image */
-		addr += (uint64_t)(intptr_t)&section0[nsections-1] -
-			(uint64_t)(intptr_t)section0;
-		sectionN = ImageAddress(data, datasize, addr);
-		if (!sectionN) {
-			perror(L"Malformed file header.\n");
-			perror(L"Image address for Section Header %d is 0x%016llx\n",
-			       nsections - 1, addr);
-			perror(L"File size is 0x%016llx\n", datasize);
-			efi_status = EFI_INVALID_PARAMETER;
-			goto done;
-		}
-
-		context->NumberOfSections = nsections;
-		context->FirstSection = section0;
-	}
-
-	/*
-	 * Allocate a new section table so we can sort them without
-	 * modifying the image.
-	 */
-	SectionHeader = AllocateZeroPool (sizeof (EFI_IMAGE_SECTION_HEADER)
-					  * context->NumberOfSections);
-	if (SectionHeader == NULL) {
-		perror(L"Unable to allocate section header\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
-		goto done;
-	}
-
-	/*
-	 * Validate section locations and sizes, and sort the table into
-	 * our newly allocated header table
-	 */
-	SumOfSectionBytes = 0;
-	Section = context->FirstSection;
-	for (index = 0; index < context->NumberOfSections; index++) {
-		EFI_IMAGE_SECTION_HEADER *SectionPtr;
-		char *base;
-		size_t size;
-
-		efi_status = get_section_vma(index, data, datasize, context,
-					     &base, &size, &SectionPtr);
-		if (efi_status == EFI_NOT_FOUND)
-			break;
-		if (EFI_ERROR(efi_status)) {
-			perror(L"Malformed section header\n");
-			goto done;
-		}
-
-		/* Validate section size is within image. */
-		if (SectionPtr->SizeOfRawData >
-		    datasize - SumOfBytesHashed - SumOfSectionBytes) {
-			perror(L"Malformed section %d size\n", index);
-			efi_status = EFI_INVALID_PARAMETER;
-			goto done;
-		}
-		SumOfSectionBytes += SectionPtr->SizeOfRawData;
+	void *hashctx;
+	authenticode_layout_t *layout = NULL;
+	EFI_PHYSICAL_ADDRESS addr = 0;
+	UINTN pages = 0;
+	EFI_STATUS efi_status;
+	void *data;
 
-		pos = index;
-		while ((pos > 0) && (Section->PointerToRawData < SectionHeader[pos - 1].PointerToRawData)) {
-			CopyMem (&SectionHeader[pos], &SectionHeader[pos - 1], sizeof (EFI_IMAGE_SECTION_HEADER));
-			pos--;
-		}
-		CopyMem (&SectionHeader[pos], Section, sizeof (EFI_IMAGE_SECTION_HEADER));
-		Section += 1;
+	digests->algorithms = 0;
 
+	if (pagesp) {
+		pages = ALIGN_VALUE(MAX(filesize, 1), PAGE_SIZE) / PAGE_SIZE;
+		efi_status = BS->AllocatePages(AllocateAnyPages, EfiLoaderCode,
+					       pages, &addr);
+		data = EFI_ERROR(efi_status) ? NULL : (void *)(uintptr_t)addr;
+	} else {
+		data = AllocatePool(filesize);
 	}
-
-	/* Hash the sections */
-	for (index = 0; index < context->NumberOfSections; index++) {
-		Section = &SectionHeader[index];
-		if (Section->SizeOfRawData == 0) {
-			continue;
-		}
-
-		hashbase  = ImageAddress(data, datasize,
-					 Section->PointerToRawData);
-		if (!hashbase) {
-			perror(L"Malformed section header\n");
-			efi_status = EFI_INVALID_PARAMETER;
-			goto done;
-		}
-
-		/* Verify hashsize within image. */
-		if (Section->SizeOfRawData >
-		    datasize - Section->PointerToRawData) {
-			perror(L"Malformed section raw size %d\n", index);
-			efi_status = EFI_INVALID_PARAMETER;
-			goto done;
-		}
-		hashsize  = (unsigned int) Section->SizeOfRawData;
-		check_size(data, datasize, hashbase, hashsize);
-
-		if (!(Sha256Update(sha256ctx, hashbase, hashsize)) ||
-		    !(Sha1Update(sha1ctx, hashbase, hashsize))) {
-			perror(L"Unable to generate hash\n");
-			efi_status = EFI_OUT_OF_RESOURCES;
-			goto done;
-		}
-		SumOfBytesHashed += Section->SizeOfRawData;
-	}
-
-	/* Hash all remaining data up to SecDir if SecDir->Size is not 0 */
-	if (datasize > SumOfBytesHashed && context->SecDir->Size) {
-		hashbase = data + SumOfBytesHashed;
-		hashsize = datasize - context->SecDir->Size - SumOfBytesHashed;
-
-		if ((datasize - SumOfBytesHashed < context->SecDir->Size) ||
-		    (SumOfBytesHashed + hashsize != context->SecDir->VirtualAddress)) {
-			perror(L"Malformed binary after Attribute Certificate Table\n");
-			console_print(L"datasize: %u SumOfBytesHashed: %u SecDir->Size: %lu\n",
-				      datasize, SumOfBytesHashed, context->SecDir->Size);
-			console_print(L"hashsize: %u SecDir->VirtualAddress: 0x%08lx\n",
-				      hashsize, context->SecDir->VirtualAddress);
-			efi_status = EFI_INVALID_PARAMETER;
-			goto done;
-		}
-		check_size(data, datasize, hashbase, hashsize);
-
-		if (!(Sha256Update(sha256ctx, hashbase, hashsize)) ||
-		    !(Sha1Update(sha1ctx, hashbase, hashsize))) {
-			perror(L"Unable to generate hash\n");
-			efi_status = EFI_OUT_OF_RESOURCES;
-			goto done;
-		}
-
-		SumOfBytesHashed += hashsize;
+	if (!data) {
+		perror(L"Unable to allocate file buffer\n");
+		return EFI_OUT_OF_RESOURCES;
 	}
 
-	/* Hash all remaining data. If SecDir->Size is > 0 this code should not
-	 * be entered.  If it is, there are still things to hash.  For a file
-	 * without a SecDir, we need to hash what remains. */
-	if (datasize > SumOfBytesHashed + context->SecDir->Size) {
-		char padbuf[8];
-		ZeroMem(padbuf, 8);
-
-		hashbase = data + SumOfBytesHashed;
-		hashsize = datasize - SumOfBytesHashed;
-
-		check_size(data, datasize, hashbase, hashsize);
-
-		if (!(Sha256Update(sha256ctx, hashbase, hashsize)) ||
-		    !(Sha1Update(sha1ctx, hashbase, hashsize))) {
-			perror(L"Unable to generate hash\n");
-			efi_status = EFI_OUT_OF_RESOURCES;
-			goto done;
-		}
-
-		SumOfBytesHashed += hashsize;
-		hashsize = ALIGN_VALUE(SumOfBytesHashed, 8) - SumOfBytesHashed;
+	hashctx = new_stream_hashes();
 
-		if (hashsize) {
-			if (!(Sha256Update(sha256ctx, padbuf, hashsize)) ||
-			    !(Sha1Update(sha1ctx, padbuf, hashsize))) {
-				perror(L"Unable to generate hash\n");
-				efi_status = EFI_OUT_OF_RESOURCES;
-				goto done;
-			}
-		}
-	}
-
-	if (!(Sha256Final(sha256ctx, sha256hash)) ||
-	    !(Sha1Final(sha1ctx, sha1hash))) {
-		perror(L"Unable to finalise hash\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
+	*datasizep = filesize;
+	efi_status = stream_image(file, data, datasizep,
+				  hashctx ? stream_hash_update : NULL,
+				  hashctx, &layout);
+	if (EFI_ERROR(efi_status)) {
+		perror(L"Unexpected return from initial read: %r, buffersize %x\n",
+		       efi_status, filesize);
+		free_image_buffer(data, pages);
 		goto done;
 	}
 
-	dprint(L"sha1 authenticode hash:\n");
-	dhexdumpat(sha1hash, SHA1_DIGEST_SIZE, 0);
-	dprint(L"sha256 authenticode hash:\n");
-	dhexdumpat(sha256hash, SHA256_DIGEST_SIZE, 0);
-
+	*datap = data;
+	if (pagesp)
+		*pagesp = pages;
 done:
-	if (SectionHeader)
-		FreePool(SectionHeader);
-	if (sha1ctx)
-		FreePool(sha1ctx);
-	if (sha256ctx)
-		FreePool(sha256ctx);
-
+	finish_stream_hashes(hashctx, layout, digests);
+	if (layout)
+		FreePool(layout);
 	return efi_status;
 }
 
+void
+free_image_buffer(void *data, UINTN pages)
+{
+	if (!data)
+		return;
+	if (pages)
+		BS->FreePages((EFI_PHYSICAL_ADDRESS)(uintptr_t)data, pages);
+	else
+		FreePool(data);
+}
+
 EFI_STATUS
 verify_sbat_section(char *SBATBase, size_t SBATSize)
 {
@@ -541,8 +159,7 @@ EFI_STATUS verify_image(void *data, unsigned int datasize,
 			PE_COFF_LOADER_IMAGE_CONTEXT *context)
 {
 	EFI_STATUS efi_status;
-	UINT8 sha1hash[SHA1_DIGEST_SIZE];
-	UINT8 sha256hash[SHA256_DIGEST_SIZE];
+	authenticode_digests_t digests = { .algorithms = 0 };
 
 	/*
 	 * The binary header contains relevant context and section pointers
@@ -559,8 +176,7 @@ EFI_STATUS verify_image(void *data, unsigned int datasize,
 	 */
 	if (secure_mode()) {
 		efi_status = verify_buffer(data, datasize,
-					   context, sha256hash, sha1hash,
-					   false);
+					   context, &digests, false);
 		if (EFI_ERROR(efi_status)) {
 			if (verbose)
 				console_print(L"Verification failed: %r\n", efi_status);
@@ -572,16 +188,16 @@ EFI_STATUS verify_image(void *data, unsigned int datasize,
 	}
 
 	/*
-	 * Calculate the hash for the TPM measurement.
-	 * XXX: We're computing these twice in secure boot mode when the
-	 *  buffers already contain the previously computed hashes. Also,
-	 *  this is only useful for the TPM1.2 case. We should try to fix
-	 *  this in a follow-up.
+	 * Calculate the hash for the TPM measurement, unless verification
+	 * already did it for us.
 	 */
-	efi_status = generate_hash(data, datasize, context, sha256hash,
-				   sha1hash);
-	if (EFI_ERROR(efi_status))
-		return efi_status;
+	if (!digests.algorithms) {
+		efi_status = generate_hashes(data, datasize, context,
+					     authenticode_algorithms(),
+					     &digests);
+		if (EFI_ERROR(efi_status))
+			return efi_status;
+	}
 
 	/* Measure the binary into the TPM */
 #ifdef REQUIRE_TPM
@@ -589,7 +205,7 @@ EFI_STATUS verify_image(void *data, unsigned int datasize,
 #endif
 	tpm_log_pe((EFI_PHYSICAL_ADDRESS)(UINTN)data, datasize,
 		   (EFI_PHYSICAL_ADDRESS)(UINTN)context->ImageAddress,
-		   li->FilePath, sha1hash, 4);
+		   li->FilePath, digests.sha1, 4);
 #ifdef REQUIRE_TPM
 	if (efi_status != EFI_SUCCESS) {
 		return efi_status;
@@ -602,13 +218,74 @@ EFI_STATUS verify_image(void *data, unsigned int datasize,
 /*
  * Once the image has been loaded it needs to be validated and relocated
  */
+/*
+ * Can the image be loaded where it lies in the caller's pages, without
+ * copying it?  That needs the pages to be big enough and aligned well
+ * enough, and every section's file offset to be its RVA, so the file is
+ * already laid out the way it will be in memory.
+ */
+static bool
+can_load_in_place(void *data, PE_COFF_LOADER_IMAGE_CONTEXT *context,
+		  EFI_PHYSICAL_ADDRESS source_address, UINTN source_pages,
+		  unsigned int alignment)
+{
+	EFI_IMAGE_SECTION_HEADER *Section;
+	UINT64 end = context->SizeOfHeaders;
+	int i;
+
+	if (!source_pages || source_address != (uintptr_t)data)
+		return false;
+	if (source_address % alignment)
+		return false;
+	if (context->ImageSize > source_pages * PAGE_SIZE)
+		return false;
+
+	Section = context->FirstSection;
+	for (i = 0; i < context->NumberOfSections; i++, Section++) {
+		if (!(Section->Characteristics & EFI_IMAGE_SCN_CNT_UNINITIALIZED_DATA) &&
+		    Section->SizeOfRawData &&
+		    Section->PointerToRawData != Section->VirtualAddress)
+			return false;
+		/*
+		 * Zeroing one section's tail mustn't clobber another's
+		 * contents, so they have to be in order and not overlap.
+		 */
+		if (Section->VirtualAddress < end)
+			return false;
+		end = (UINT64)Section->VirtualAddress + Section->Misc.VirtualSize;
+	}
+
+	return true;
+}
+
+/*
+ * Give back the pages handle_image() allocated.  If the image was loaded
+ * in place, the pages are still the caller's, and it frees them.
+ */
+static void
+free_image_pages(void *data, EFI_PHYSICAL_ADDRESS *alloc_address,
+		 UINTN *alloc_pages)
+{
+	if (*alloc_address && *alloc_address != (uintptr_t)data)
+		BS->FreePages(*alloc_address, *alloc_pages);
+	*alloc_address = 0;
+	*alloc_pages = 0;
+}
+
+/*
+ * Verify, measure, and load an image.  If *alloc_pages is nonzero on
+ * entry, data is a page allocation of that many pages at *alloc_address
+ * which the image may be loaded into without copying; on success,
+ * *alloc_address is then (uintptr_t)data, and the caller must not free
+ * data separately.  On failure *alloc_address and *alloc_pages are 0.
+ */
 EFI_STATUS
 handle_image (void *data, unsigned int datasize,
 	      EFI_LOADED_IMAGE *li, EFI_HANDLE image_handle,
 	      EFI_IMAGE_ENTRY_POINT *entry_point,
 	      EFI_PHYSICAL_ADDRESS *alloc_address,
 	      UINTN *alloc_pages, unsigned int *alloc_alignment,
-	      bool parent_verified)
+	      bool parent_verified, authenticode_digests_t *precomputed)
 {
 	EFI_STATUS efi_status;
 	char *buffer;
@@ -619,8 +296,13 @@ handle_image (void *data, unsigned int datasize,
 	PE_COFF_LOADER_IMAGE_CONTEXT context;
 	unsigned int alloc_size;
 	int found_entry_point = 0;
-	UINT8 sha1hash[SHA1_DIGEST_SIZE];
-	UINT8 sha256hash[SHA256_DIGEST_SIZE];
+	authenticode_digests_t digests = { .algorithms = 0 };
+	EFI_PHYSICAL_ADDRESS source_address = *alloc_address;
+	UINTN source_pages = *alloc_pages;
+	mem_attrs_batch_t attrs_batch;
+
+	*alloc_address = 0;
+	*alloc_pages = 0;
 
 	/*
 	 * The binary header contains relevant context and section pointers
@@ -631,13 +313,20 @@ handle_image (void *data, unsigned int datasize,
 		return efi_status;
 	}
 
+	/*
+	 * If the image was hashed while it was being read, there's no need
+	 * to do it again.
+	 */
+	if (precomputed)
+		CopyMem(&digests, precomputed, sizeof(digests));
+
 	/*
 	 * Perform the image verification before we start copying data around
 	 * in order to load it.
 	 */
 	if (secure_mode ()) {
-		efi_status = verify_buffer(data, datasize, &context, sha256hash,
-					   sha1hash, parent_verified);
+		efi_status = verify_buffer(data, datasize, &context, &digests,
+					   parent_verified);
 
 		if (EFI_ERROR(efi_status)) {
 			if (verbose || in_protocol)
@@ -659,16 +348,17 @@ handle_image (void *data, unsigned int datasize,
 	 */
 	if (!parent_verified) {
 		/*
-		 * Calculate the hash for the TPM measurement.
-		 * XXX: We're computing these twice in secure boot mode when the
-		 *  buffers already contain the previously computed hashes. Also,
-		 *  this is only useful for the TPM1.2 case. We should try to fix
-		 *  this in a follow-up.
+		 * Calculate the hash for the TPM measurement.  In secure
+		 * boot mode verify_buffer() has already computed it, so
+		 * we only have to hash the image here if it didn't.
 		 */
-		efi_status = generate_hash(data, datasize, &context, sha256hash,
-					   sha1hash);
-		if (EFI_ERROR(efi_status))
-			return efi_status;
+		if (!digests.algorithms) {
+			efi_status = generate_hashes(data, datasize, &context,
+						     authenticode_algorithms(),
+						     &digests);
+			if (EFI_ERROR(efi_status))
+				return efi_status;
+		}
 
 		/* Measure the binary into the TPM */
 #ifdef REQUIRE_TPM
@@ -676,7 +366,7 @@ handle_image (void *data, unsigned int datasize,
 #endif
 		tpm_log_pe((EFI_PHYSICAL_ADDRESS)(UINTN)data, datasize,
 			   (EFI_PHYSICAL_ADDRESS)(UINTN)context.ImageAddress,
-			   li->FilePath, sha1hash, 4);
+			   li->FilePath, digests.sha1, 4);
 #ifdef REQUIRE_TPM
 		if (efi_status != EFI_SUCCESS) {
 			return efi_status;
@@ -702,25 +392,44 @@ handle_image (void *data, unsigned int datasize,
 	if (!*alloc_alignment)
 		*alloc_alignment = 4096;
 
-	alloc_size = ALIGN_VALUE(context.ImageSize + context.SectionAlignment,
-				 PAGE_SIZE);
-	*alloc_pages = alloc_size / PAGE_SIZE;
+	if (can_load_in_place(data, &context, source_address, source_pages,
+			      *alloc_alignment)) {
+		/*
+		 * The file is already laid out the way the image will be
+		 * in memory, so just take over the caller's pages.
+		 */
+		*alloc_address = source_address;
+		*alloc_pages = source_pages;
+		alloc_size = source_pages * PAGE_SIZE;
+		buffer = data;
+		dprint(L"Loading 0x%llx bytes in place at 0x%llx\n",
+		       (unsigned long long)context.ImageSize,
+		       (unsigned long long)(uintptr_t)buffer);
+	} else {
+		alloc_size = ALIGN_VALUE(context.ImageSize +
+					 context.SectionAlignment, PAGE_SIZE);
+		*alloc_pages = alloc_size / PAGE_SIZE;
+
+		efi_status = BS->AllocatePages(AllocateAnyPages, EfiLoaderCode,
+					       *alloc_pages, alloc_address);
+		if (EFI_ERROR(efi_status)) {
+			perror(L"Failed to allocate image buffer\n");
+			*alloc_address = 0;
+			*alloc_pages = 0;
+			return EFI_OUT_OF_RESOURCES;
+		}
 
-	efi_status = BS->AllocatePages(AllocateAnyPages, EfiLoaderCode,
-				       *alloc_pages, alloc_address);
-	if (EFI_ERROR(efi_status)) {
-		perror(L"Failed to allocate image buffer\n");
-		return EFI_OUT_OF_RESOURCES;
+		buffer = (void *)ALIGN_VALUE((unsigned long)*alloc_address,
+					     *alloc_alignment);
+		dprint(L"Loading 0x%llx bytes at 0x%llx\n",
+		       (unsigned long long)context.ImageSize,
+		       (unsigned long long)(uintptr_t)buffer);
 	}
-
-	buffer = (void *)ALIGN_VALUE((unsigned long)*alloc_address, *alloc_alignment);
-	dprint(L"Loading 0x%llx bytes at 0x%llx\n",
-	       (unsigned long long)context.ImageSize,
-	       (unsigned long long)(uintptr_t)buffer);
 	update_mem_attrs((uintptr_t)buffer, alloc_size, MEM_ATTR_R|MEM_ATTR_W,
 			 MEM_ATTR_X);
 
-	CopyMem(buffer, data, context.SizeOfHeaders);
+	if (buffer != data)
+		CopyMem(buffer, data, context.SizeOfHeaders);
 
 	/* Flush the instruction cache for the region holding the image */
 	cache_invalidate(buffer, buffer + context.ImageSize);
@@ -728,7 +437,7 @@ handle_image (void *data, unsigned int datasize,
 	*entry_point = ImageAddress(buffer, context.ImageSize, context.EntryPoint);
 	if (!*entry_point) {
 		perror(L"Entry point is invalid\n");
-		BS->FreePages(*alloc_address, *alloc_pages);
+		free_image_pages(data, alloc_address, alloc_pages);
 		return EFI_UNSUPPORTED;
 	}
 
@@ -769,7 +478,7 @@ handle_image (void *data, unsigned int datasize,
 		    (Section->Characteristics & EFI_IMAGE_SCN_MEM_EXECUTE) &&
 		    (mok_policy & MOK_POLICY_REQUIRE_NX)) {
 			perror(L"Section %d is writable and executable\n", i);
-			BS->FreePages(*alloc_address, *alloc_pages);
+			free_image_pages(data, alloc_address, alloc_pages);
 			return EFI_UNSUPPORTED;
 		}
 
@@ -781,7 +490,7 @@ handle_image (void *data, unsigned int datasize,
 
 		if (end < base) {
 			perror(L"Section %d has negative size\n", i);
-			BS->FreePages(*alloc_address, *alloc_pages);
+			free_image_pages(data, alloc_address, alloc_pages);
 			return EFI_UNSUPPORTED;
 		}
 
@@ -795,7 +504,7 @@ handle_image (void *data, unsigned int datasize,
 		if (CompareMem(Section->Name, ".reloc\0\0", 8) == 0) {
 			if (RelocSection) {
 				perror(L"Image has multiple relocation sections\n");
-				BS->FreePages(*alloc_address, *alloc_pages);
+				free_image_pages(data, alloc_address, alloc_pages);
 				return EFI_UNSUPPORTED;
 			}
 			/* If it has nonzero sizes, and our bounds check
@@ -809,7 +518,7 @@ handle_image (void *data, unsigned int datasize,
 				RelocSection = Section;
 			} else {
 				perror(L"Relocation section is invalid \n");
-				BS->FreePages(*alloc_address, *alloc_pages);
+				free_image_pages(data, alloc_address, alloc_pages);
 				return EFI_UNSUPPORTED;
 			}
 		}
@@ -820,12 +529,12 @@ handle_image (void *data, unsigned int datasize,
 
 		if (!base) {
 			perror(L"Section %d has invalid base address\n", i);
-			BS->FreePages(*alloc_address, *alloc_pages);
+			free_image_pages(data, alloc_address, alloc_pages);
 			return EFI_UNSUPPORTED;
 		}
 		if (!end) {
 			perror(L"Section %d has zero size\n", i);
-			BS->FreePages(*alloc_address, *alloc_pages);
+			free_image_pages(data, alloc_address, alloc_pages);
 			return EFI_UNSUPPORTED;
 		}
 
@@ -833,7 +542,7 @@ handle_image (void *data, unsigned int datasize,
 		    (Section->VirtualAddress < context.SizeOfHeaders ||
 		     Section->PointerToRawData < context.SizeOfHeaders)) {
 			perror(L"Section %d is inside image headers\n", i);
-			BS->FreePages(*alloc_address, *alloc_pages);
+			free_image_pages(data, alloc_address, alloc_pages);
 			return EFI_UNSUPPORTED;
 		}
 
@@ -842,7 +551,7 @@ handle_image (void *data, unsigned int datasize,
 		} else {
 			if (Section->PointerToRawData < context.SizeOfHeaders) {
 				perror(L"Section %d is inside image headers\n", i);
-				BS->FreePages(*alloc_address, *alloc_pages);
+				free_image_pages(data, alloc_address, alloc_pages);
 				return EFI_UNSUPPORTED;
 			}
 
@@ -850,7 +559,7 @@ handle_image (void *data, unsigned int datasize,
 			if (size > Section->SizeOfRawData)
 				size = Section->SizeOfRawData;
 
-			if (size > 0)
+			if (size > 0 && buffer != data)
 				CopyMem(base, data + Section->PointerToRawData, size);
 
 			if (size < Section->Misc.VirtualSize)
@@ -860,7 +569,7 @@ handle_image (void *data, unsigned int datasize,
 
 	if (context.NumberOfRvaAndSizes <= EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC) {
 		perror(L"Image has no relocation entry\n");
-		BS->FreePages(*alloc_address, *alloc_pages);
+		free_image_pages(data, alloc_address, alloc_pages);
 		return EFI_UNSUPPORTED;
 	}
 
@@ -873,15 +582,18 @@ handle_image (void *data, unsigned int datasize,
 
 		if (EFI_ERROR(efi_status)) {
 			perror(L"Relocation failed: %r\n", efi_status);
-			BS->FreePages(*alloc_address, *alloc_pages);
+			free_image_pages(data, alloc_address, alloc_pages);
 			return efi_status;
 		}
 	}
 
 	/*
 	 * Now set the page permissions appropriately and cache appropriate
-	 * section sizes, and digests.
+	 * section sizes, and digests.  The permissions are collected for
+	 * the whole image and applied once all the sections are known, so
+	 * neighbouring sections that want the same thing share a call.
 	 */
+	mem_attrs_batch_init(&attrs_batch, (uintptr_t)buffer, alloc_size);
 	Section = context.FirstSection;
 	for (i = 0; i < context.NumberOfSections; i++, Section++) {
 		uint64_t set_attrs = MEM_ATTR_R;
@@ -925,7 +637,8 @@ handle_image (void *data, unsigned int datasize,
 			set_attrs |= MEM_ATTR_X;
 			clear_attrs &= ~MEM_ATTR_X;
 		}
-		update_mem_attrs(addr, length, set_attrs, clear_attrs);
+		mem_attrs_batch_update(&attrs_batch, addr, length, set_attrs,
+				       clear_attrs);
 
 		/*
 		 * We only cache CODE and INITIALIZED data sections that
@@ -939,7 +652,8 @@ handle_image (void *data, unsigned int datasize,
 			efi_status = cache_section(image_handle, Section->Name, base, raw_length);
 			if (EFI_ERROR(efi_status)) {
 				perror(L"Failed to cache section details\n");
-				BS->FreePages(*alloc_address, *alloc_pages);
+				mem_attrs_batch_free(&attrs_batch);
+				free_image_pages(data, alloc_address, alloc_pages);
 				return efi_status;
 			}
 			dprint(L"Cached section %d (%a) at 0x%016llx, size 0x%016llx\n",
@@ -948,6 +662,7 @@ handle_image (void *data, unsigned int datasize,
 			       (unsigned long long)raw_length);
 		}
 	}
+	mem_attrs_batch_apply(&attrs_batch);
 
 	/*
 	 * grub needs to know its location and size in memory, so fix up
@@ -963,13 +678,13 @@ handle_image (void *data, unsigned int datasize,
 	if (!found_entry_point) {
 		perror(L"Entry point is not within sections\n");
 		flush_cached_sections(image_handle);
-		BS->FreePages(*alloc_address, *alloc_pages);
+		free_image_pages(data, alloc_address, alloc_pages);
 		return EFI_UNSUPPORTED;
 	}
 	if (found_entry_point > 1) {
 		perror(L"%d sections contain entry point\n", found_entry_point);
 		flush_cached_sections(image_handle);
-		BS->FreePages(*alloc_address, *alloc_pages);
+		free_image_pages(data, alloc_address, alloc_pages);
 		return EFI_UNSUPPORTED;
 	}
 
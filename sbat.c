@@ -15,18 +15,20 @@ extern struct {
 static UINT8 sbat_policy = POLICY_NOTREAD;
 static UINT8 ssp_policy = POLICY_NOTREAD;
 
+/*
+ * The entries point into section_base, which parsing modifies, so it has
+ * to stay around until cleanup_sbat_section_entries().
+ */
 EFI_STATUS
 parse_sbat_section(char *section_base, size_t section_size,
 		   size_t *n_entries,
 		   struct sbat_section_entry ***entriesp)
 {
 	struct sbat_section_entry *entry = NULL, **entries = NULL;
+	struct csv_arena arena = { NULL, 0 };
 	EFI_STATUS efi_status = EFI_SUCCESS;
-	list_t csv, *pos = NULL;
 	char * end = section_base + section_size - 1;
-	size_t allocsz = 0;
-	size_t n;
-	char *strtab;
+	size_t n, i, j;
 
 	if (!section_base || !section_size || !n_entries || !entriesp) {
 		dprint(L"section_base:0x%lx section_size:0x%lx\n",
@@ -36,40 +38,30 @@ parse_sbat_section(char *section_base, size_t section_size,
 		return EFI_INVALID_PARAMETER;
 	}
 
-	INIT_LIST_HEAD(&csv);
-
-	efi_status =
-		parse_csv_data(section_base, end, SBAT_SECTION_COLUMNS, &csv);
+	efi_status = parse_csv_rows(section_base, end, SBAT_SECTION_COLUMNS,
+				    sizeof(*entry), &arena, &n);
 	if (EFI_ERROR(efi_status)) {
-		dprint(L"parse_csv_data failed: %r\n", efi_status);
-		return efi_status;
+		dprint(L"parse_csv_rows failed: %r\n", efi_status);
+		goto err;
 	}
 
-	n = 0;
-	list_for_each(pos, &csv) {
-		struct csv_row * row;
-		size_t i;
-
-		row = list_entry(pos, struct csv_row, list);
-
-		if (row->n_columns < SBAT_SECTION_COLUMNS) {
-			efi_status = EFI_INVALID_PARAMETER;
-			dprint(L"row->n_columns:%lu SBAT_SECTION_COLUMNS:%lu\n",
-			       row->n_columns, SBAT_SECTION_COLUMNS);
-			goto err;
-		}
+	entry = (struct sbat_section_entry *)arena.buf;
+	for (i = 0; i < n; i++) {
+		const CHAR8 **columns = (const CHAR8 **)&entry[i];
 
-		allocsz += sizeof(struct sbat_section_entry *);
-		allocsz += sizeof(struct sbat_section_entry);
-		for (i = 0; i < row->n_columns; i++) {
-			if (row->columns[i][0] == '\000') {
-				dprint(L"row[%lu].columns[%lu][0] == '\\000'\n", n, i);
+		for (j = 0; j < SBAT_SECTION_COLUMNS; j++) {
+			if (columns[j] == NULL) {
+				efi_status = EFI_INVALID_PARAMETER;
+				dprint(L"row[%lu] has %lu columns, SBAT_SECTION_COLUMNS:%lu\n",
+				       i, j, SBAT_SECTION_COLUMNS);
+				goto err;
+			}
+			if (columns[j][0] == '\000') {
+				dprint(L"row[%lu].columns[%lu][0] == '\\000'\n", i, j);
 				efi_status = EFI_INVALID_PARAMETER;
 				goto err;
 			}
-			allocsz += strlen(row->columns[i]) + 1;
 		}
-		n++;
 	}
 
 	/*
@@ -79,45 +71,25 @@ parse_sbat_section(char *section_base, size_t section_size,
 	if (n == 0)
 		goto out;
 
-	strtab = AllocateZeroPool(allocsz);
-	if (!strtab) {
-		efi_status = EFI_OUT_OF_RESOURCES;
+	/*
+	 * The rows are already the entries; make room for the array of
+	 * pointers to them in front, so it's all one allocation.
+	 */
+	efi_status = csv_arena_reserve(&arena, n * (sizeof(*entries) +
+						    sizeof(*entry)));
+	if (EFI_ERROR(efi_status))
 		goto err;
-	}
-
-	entries = (struct sbat_section_entry **)strtab;
-	strtab += sizeof(struct sbat_section_entry *) * n;
-	entry = (struct sbat_section_entry *)strtab;
-	strtab += sizeof(struct sbat_section_entry) * n;
-	n = 0;
-
-	list_for_each(pos, &csv) {
-		struct csv_row * row;
-		size_t i;
-		const char **ptrs[] = {
-			(const char **)&entry->component_name,
-			(const char **)&entry->component_generation,
-			(const char **)&entry->vendor_name,
-			(const char **)&entry->vendor_package_name,
-			(const char **)&entry->vendor_version,
-			(const char **)&entry->vendor_url,
-		};
-
-
-		row = list_entry(pos, struct csv_row, list);
-		for (i = 0; i < row->n_columns; i++) {
-			*(ptrs[i]) = strtab;
-			strtab = stpcpy(strtab, row->columns[i]) + 1;
-		}
-		entries[n] = entry;
-		entry++;
-		n++;
-	}
+	entries = (struct sbat_section_entry **)arena.buf;
+	entry = (struct sbat_section_entry *)(arena.buf + n * sizeof(*entries));
+	memmove(entry, arena.buf, n * sizeof(*entry));
+	for (i = 0; i < n; i++)
+		entries[i] = &entry[i];
+	arena.buf = NULL;
 out:
 	*entriesp = entries;
 	*n_entries = n;
 err:
-	free_csv_list(&csv);
+	csv_arena_free(&arena);
 	return efi_status;
 }
 
@@ -206,11 +178,170 @@ out:
 	return efi_status;
 }
 
+/*
+ * SbatLevel compiled down to an array sorted by component name, with the
+ * generations already converted, so checking an image's .sbat entries
+ * costs a binary search per entry rather than a walk of the whole list.
+ */
+struct sbat_var_table sbat_var_table = { 0, NULL };
+
+static bool
+find_sbat_var_table_entry(struct sbat_var_table_entry *entries, size_t n,
+			  const CHAR8 *component_name, size_t *idx)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp((const char *)component_name,
+				 (const char *)entries[mid].component_name);
+
+		if (cmp == 0) {
+			*idx = mid;
+			return true;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	*idx = lo;
+	return false;
+}
+
+/*
+ * The table points at the component names in entries, so it has to be
+ * cleaned up before they are.
+ */
+EFI_STATUS
+compile_sbat_var(list_t *entries, struct sbat_var_table *table)
+{
+	struct sbat_var_table_entry *sorted;
+	list_t *pos = NULL;
+	size_t n = 0;
+
+	if (!entries || !table)
+		return EFI_INVALID_PARAMETER;
+
+	table->n = 0;
+	table->entries = NULL;
+
+	list_for_each(pos, entries)
+		n++;
+	if (n == 0)
+		return EFI_SUCCESS;
+
+	sorted = AllocateZeroPool(n * sizeof(*sorted));
+	if (!sorted)
+		return EFI_OUT_OF_RESOURCES;
+
+	n = 0;
+	list_for_each(pos, entries) {
+		struct sbat_var_entry *entry;
+		size_t i;
+
+		entry = list_entry(pos, struct sbat_var_entry, list);
+
+		/*
+		 * verify_single_entry() stops at the first entry with a
+		 * matching name, so any later duplicate never applied.
+		 */
+		if (find_sbat_var_table_entry(sorted, n, entry->component_name,
+					      &i))
+			continue;
+
+		if (i < n)
+			CopyMem(&sorted[i + 1], &sorted[i],
+				(n - i) * sizeof(*sorted));
+		sorted[i].component_name = entry->component_name;
+		/* the same conversion verify_single_entry() does */
+		sorted[i].component_generation =
+			atoi(entry->component_generation);
+		n++;
+	}
+
+	table->n = n;
+	table->entries = sorted;
+	return EFI_SUCCESS;
+}
+
+void
+cleanup_sbat_var_table(struct sbat_var_table *table)
+{
+	if (table->entries)
+		FreePool(table->entries);
+	table->entries = NULL;
+	table->n = 0;
+}
+
+EFI_STATUS
+verify_sbat_table(struct sbat_var_table *table, size_t n,
+		  struct sbat_section_entry **entries)
+{
+	EFI_STATUS efi_status = EFI_SUCCESS;
+	UINT16 sbat_gen, sbat_var_gen;
+	size_t i, j;
+
+	if (table->n == 0) {
+		dprint(L"%s variable not present\n", SBAT_VAR_NAME);
+		return EFI_SUCCESS;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!find_sbat_var_table_entry(table->entries, table->n,
+					       entries[i]->component_name, &j))
+			continue;
+
+		dprint(L"component %a has a matching SBAT variable entry, verifying\n",
+			entries[i]->component_name);
+
+		sbat_gen = atoi(entries[i]->component_generation);
+		sbat_var_gen = table->entries[j].component_generation;
+
+		if (sbat_gen < sbat_var_gen) {
+			dprint(L"component %a, generation %d, was revoked by %s variable\n",
+			       entries[i]->component_name, sbat_gen, SBAT_VAR_NAME);
+			LogError(L"image did not pass SBAT verification\n");
+			efi_status = EFI_SECURITY_VIOLATION;
+			break;
+		}
+	}
+
+	dprint(L"finished verifying SBAT data: %r\n", efi_status);
+	return efi_status;
+}
+
+/*
+ * sbat_var has just been replaced.  If it had already been compiled, the
+ * table still describes the old level, so build it again; if that
+ * fails, verify_sbat() walks the list instead.  Either way, anything
+ * verified against the old level has to be checked again.
+ */
+static void
+recompile_sbat_var(void)
+{
+	if (sbat_var_table.entries) {
+		cleanup_sbat_var_table(&sbat_var_table);
+		if (EFI_ERROR(compile_sbat_var(&sbat_var, &sbat_var_table)))
+			dprint(L"Could not compile %s, using the list\n",
+			       SBAT_VAR_NAME);
+	}
+	policy_generation++;
+}
+
 EFI_STATUS
 verify_sbat(size_t n, struct sbat_section_entry **entries)
 {
 	EFI_STATUS efi_status;
 
+	/*
+	 * shim compiles the table as soon as it has read SbatLevel; anything
+	 * that fills in sbat_var by itself still gets the list walk.
+	 */
+	if (sbat_var_table.entries)
+		return verify_sbat_table(&sbat_var_table, n, entries);
+
 	efi_status = verify_sbat_helper(&sbat_var, n, entries);
 	return efi_status;
 }
@@ -218,86 +349,65 @@ verify_sbat(size_t n, struct sbat_section_entry **entries)
 EFI_STATUS
 parse_sbat_var_data(list_t *entry_list, UINT8 *data, UINTN datasize)
 {
-	struct sbat_var_entry *entry = NULL, **entries;
+	struct sbat_var_entry *entry = NULL;
+	struct csv_arena arena = { NULL, 0 };
 	EFI_STATUS efi_status = EFI_SUCCESS;
-	list_t csv, *pos = NULL;
 	char * start = (char *)data;
 	char * end = (char *)data + datasize - 1;
-	size_t allocsz = 0;
-	size_t n;
 	char *strtab;
+	size_t n, i, j;
 
 	if (!entry_list|| !data || datasize == 0)
 		return EFI_INVALID_PARAMETER;
 
-	INIT_LIST_HEAD(&csv);
-
-	efi_status = parse_csv_data(start, end, SBAT_VAR_COLUMNS, &csv);
-	if (EFI_ERROR(efi_status)) {
-		return efi_status;
-	}
-
-	n = 0;
-	list_for_each(pos, &csv) {
-		struct csv_row * row;
-		size_t i;
-
-		row = list_entry(pos, struct csv_row, list);
-
-		if (row->n_columns < SBAT_VAR_REQUIRED_COLUMNS) {
-			efi_status = EFI_INVALID_PARAMETER;
-			goto err;
-		}
+	efi_status = parse_csv_rows(start, end, SBAT_VAR_COLUMNS,
+				    sizeof(*entry), &arena, &n);
+	if (EFI_ERROR(efi_status))
+		goto err;
 
+	entry = (struct sbat_var_entry *)arena.buf;
+	for (i = 0; i < n; i++) {
+		const CHAR8 **columns = (const CHAR8 **)&entry[i];
 
-		allocsz += sizeof(struct sbat_var_entry *);
-		allocsz += sizeof(struct sbat_var_entry);
-		for (i = 0; i < row->n_columns; i++) {
-			if (!row->columns[i][0]) {
+		for (j = 0; j < SBAT_VAR_COLUMNS && columns[j]; j++) {
+			if (!columns[j][0]) {
 				efi_status = EFI_INVALID_PARAMETER;
 				goto err;
 			}
-			allocsz += strlen(row->columns[i]) + 1;
 		}
-		n++;
+		if (j < SBAT_VAR_REQUIRED_COLUMNS) {
+			efi_status = EFI_INVALID_PARAMETER;
+			goto err;
+		}
 	}
 
-	strtab = AllocateZeroPool(allocsz);
-	if (!strtab) {
-		efi_status = EFI_OUT_OF_RESOURCES;
+	INIT_LIST_HEAD(entry_list);
+	if (n == 0)
 		goto err;
-	}
 
-	INIT_LIST_HEAD(entry_list);
+	/*
+	 * The caller frees data, so the rows' strings get copied in after
+	 * them, leaving the entries and everything they point to in one
+	 * allocation that starts with the first entry.
+	 */
+	efi_status = csv_arena_reserve(&arena, n * sizeof(*entry) + datasize);
+	if (EFI_ERROR(efi_status))
+		goto err;
+	entry = (struct sbat_var_entry *)arena.buf;
+	strtab = (char *)arena.buf + n * sizeof(*entry);
+	CopyMem(strtab, data, datasize);
 
-	entry = (struct sbat_var_entry *)strtab;
-	strtab += sizeof(struct sbat_var_entry) * n;
-	entries = (struct sbat_var_entry **)strtab;
-	strtab += sizeof(struct sbat_var_entry *) * n;
-	n = 0;
+	for (i = 0; i < n; i++) {
+		const CHAR8 **columns = (const CHAR8 **)&entry[i];
 
-	list_for_each(pos, &csv) {
-		struct csv_row * row;
-		size_t i;
-		const char **ptrs[] = {
-			(const char **)&entry->component_name,
-			(const char **)&entry->component_generation,
-			(const char **)&entry->sbat_datestamp,
-		};
-
-		row = list_entry(pos, struct csv_row, list);
-		for (i = 0; i < row->n_columns; i++) {
-			*(ptrs[i]) = strtab;
-			strtab = stpcpy(strtab, row->columns[i]) + 1;
-		}
-		INIT_LIST_HEAD(&entry->list);
-		list_add_tail(&entry->list, entry_list);
-		entries[n] = entry;
-		entry++;
-		n++;
+		for (j = 0; j < SBAT_VAR_COLUMNS && columns[j]; j++)
+			columns[j] = strtab + (columns[j] - start);
+		INIT_LIST_HEAD(&entry[i].list);
+		list_add_tail(&entry[i].list, entry_list);
 	}
+	arena.buf = NULL;
 err:
-	free_csv_list(&csv);
+	csv_arena_free(&arena);
 	return efi_status;
 }
 
@@ -557,6 +667,7 @@ set_sbat_uefi_variable(char *sbat_var_automatic, char *sbat_var_latest)
 			dprint(L"proposed SbatLevel failed to parse\n");
 			return efi_status;
 		}
+		recompile_sbat_var();
 
 #ifndef SHIM_UNIT_TEST
 		char *sbat_start = (char *)&_sbat;
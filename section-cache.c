@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * section-cache.c - remember the sections of images we've verified, so
+ * that loading one of them later doesn't need another signature.
+ *
+ * systemd-stub and other UKI loaders call LoadImage() on their own
+ * embedded sections, sometimes many times, so lookups need to stay cheap
+ * as the number of cached sections grows.  Entries live in one growable
+ * array, chained into hash buckets keyed by (parent image handle, size).
+ */
+
+#include "shim.h"
+
+struct shim_section_cache_entry {
+	EFI_HANDLE parent_image_handle;
+	UINT8 section_name[9];
+	UINTN size;
+	/*
+	 * Since this is all internal and there's no API access to it, this is
+	 * currently always sha256 and can be updated as needed.
+	 */
+	UINT8 digest[32];
+	UINTN next;		/* index + 1 of the next entry in the bucket */
+};
+
+static struct shim_section_cache_entry *section_cache = NULL;
+static UINTN num_section_cache_entries = 0;
+static UINTN max_section_cache_entries = 0;
+/* index + 1 of the first entry in each bucket, or 0; one per entry slot */
+static UINTN *section_cache_buckets = NULL;
+
+#define SECTION_CACHE_MIN_ENTRIES	16
+
+static UINTN
+section_cache_bucket(EFI_HANDLE parent_image_handle, UINTN size)
+{
+	UINT64 key = (UINT64)(uintptr_t)parent_image_handle ^
+		     ((UINT64)size << 12);
+
+	key *= 0x9e3779b97f4a7c15ull;
+	key ^= key >> 32;
+
+	/* max_section_cache_entries is always a power of two */
+	return key & (max_section_cache_entries - 1);
+}
+
+static void
+section_cache_link(UINTN i)
+{
+	struct shim_section_cache_entry *entry = &section_cache[i];
+	UINTN bucket = section_cache_bucket(entry->parent_image_handle,
+					    entry->size);
+
+	entry->next = section_cache_buckets[bucket];
+	section_cache_buckets[bucket] = i + 1;
+}
+
+static void
+section_cache_rehash(void)
+{
+	ZeroMem(section_cache_buckets,
+		max_section_cache_entries * sizeof(section_cache_buckets[0]));
+	for (UINTN i = 0; i < num_section_cache_entries; i++)
+		section_cache_link(i);
+}
+
+static void
+section_cache_free(void)
+{
+	if (section_cache)
+		FreePool(section_cache);
+	section_cache = NULL;
+	if (section_cache_buckets)
+		FreePool(section_cache_buckets);
+	section_cache_buckets = NULL;
+	num_section_cache_entries = 0;
+	max_section_cache_entries = 0;
+}
+
+static EFI_STATUS
+section_cache_grow(void)
+{
+	struct shim_section_cache_entry *new_section_cache;
+	UINTN *new_buckets;
+	UINTN new_max;
+
+	new_max = max_section_cache_entries ? max_section_cache_entries * 2
+					    : SECTION_CACHE_MIN_ENTRIES;
+	if (new_max < max_section_cache_entries)
+		return EFI_OUT_OF_RESOURCES;
+
+	new_section_cache = AllocateZeroPool(new_max * sizeof(*new_section_cache));
+	if (!new_section_cache)
+		return EFI_OUT_OF_RESOURCES;
+
+	new_buckets = AllocateZeroPool(new_max * sizeof(*new_buckets));
+	if (!new_buckets) {
+		FreePool(new_section_cache);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	if (section_cache) {
+		CopyMem(new_section_cache, section_cache,
+			num_section_cache_entries * sizeof(*section_cache));
+		FreePool(section_cache);
+	}
+	if (section_cache_buckets)
+		FreePool(section_cache_buckets);
+
+	section_cache = new_section_cache;
+	section_cache_buckets = new_buckets;
+	max_section_cache_entries = new_max;
+	section_cache_rehash();
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS
+cache_section(EFI_HANDLE parent_image_handle, UINT8 section_name[8],
+	      void *addr, UINTN size)
+{
+	struct shim_section_cache_entry *entry = NULL;
+	EFI_STATUS efi_status;
+
+	if (num_section_cache_entries == max_section_cache_entries) {
+		efi_status = section_cache_grow();
+		if (EFI_ERROR(efi_status))
+			return efi_status;
+	}
+
+	entry = &section_cache[num_section_cache_entries];
+
+	entry->parent_image_handle = parent_image_handle;
+	CopyMem(entry->section_name, section_name, sizeof(entry->section_name)-1);
+	entry->size = size;
+
+	efi_status = sha256_sum(addr, size, entry->digest);
+	if (EFI_ERROR(efi_status)) {
+		ZeroMem(entry, sizeof (*entry));
+		return efi_status;
+	}
+	section_cache_link(num_section_cache_entries);
+	num_section_cache_entries += 1;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Find a section of parent_image_handle's with exactly this contents.
+ * The buffer is hashed at most once, and only if some section of that
+ * parent has the same size.
+ */
+EFI_STATUS
+validate_cached_section(EFI_HANDLE parent_image_handle,
+			void *addr, UINTN size)
+{
+	UINT8 digest[32];
+	BOOLEAN hashed = FALSE;
+	EFI_STATUS efi_status;
+	UINTN n;
+
+	if (num_section_cache_entries == 0)
+		return EFI_NOT_FOUND;
+
+	n = section_cache_buckets[section_cache_bucket(parent_image_handle, size)];
+	for (; n; n = section_cache[n - 1].next) {
+		struct shim_section_cache_entry *this_entry = &section_cache[n - 1];
+
+		if (this_entry->size != size)
+			continue;
+		if (this_entry->parent_image_handle != parent_image_handle)
+			continue;
+
+		if (!hashed) {
+			ZeroMem(digest, sizeof(digest));
+			efi_status = sha256_sum(addr, size, digest);
+			if (EFI_ERROR(efi_status))
+				return efi_status;
+			hashed = TRUE;
+		}
+
+		if (CompareMem(digest, this_entry->digest, sizeof(digest)) != 0)
+			continue;
+
+		dprint(L"Found cached section '%a' of 0x%016llx\n",
+		       this_entry->section_name,
+		       (unsigned long long)(uintptr_t)parent_image_handle);
+		return EFI_SUCCESS;
+	}
+
+	return EFI_NOT_FOUND;
+}
+
+void
+flush_cached_sections(EFI_HANDLE parent_image_handle)
+{
+	UINTN kept = 0;
+
+	for (UINTN i = 0; i < num_section_cache_entries; i++) {
+		if (section_cache[i].parent_image_handle == parent_image_handle)
+			continue;
+		if (kept != i)
+			CopyMem(&section_cache[kept], &section_cache[i],
+				sizeof(section_cache[0]));
+		kept += 1;
+	}
+
+	if (kept == num_section_cache_entries)
+		return;
+
+	if (kept == 0) {
+		section_cache_free();
+		return;
+	}
+
+	ZeroMem(&section_cache[kept],
+		sizeof(section_cache[0]) * (num_section_cache_entries - kept));
+	num_section_cache_entries = kept;
+	section_cache_rehash();
+}
+
+// vim:fenc=utf-8:tw=75:noet
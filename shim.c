@@ -139,7 +139,8 @@ error:
  * Open the second stage bootloader and read it into a buffer
  */
 static EFI_STATUS load_image (EFI_LOADED_IMAGE *li, void **data,
-			      int *datasize, CHAR16 *PathName)
+			      int *datasize, UINTN *data_pages,
+			      CHAR16 *PathName, authenticode_digests_t *digests)
 {
 	EFI_STATUS efi_status;
 	EFI_HANDLE device;
@@ -207,28 +208,13 @@ static EFI_STATUS load_image (EFI_LOADED_IMAGE *li, void **data,
 		goto error;
 	}
 
-	buffersize = fileinfo->FileSize;
-	*data = AllocatePool(buffersize);
-	if (!*data) {
-		perror(L"Unable to allocate file buffer\n");
-		efi_status = EFI_OUT_OF_RESOURCES;
-		goto error;
-	}
-
 	/*
-	 * Perform the actual read
+	 * Perform the actual read, hashing the image as it comes in
 	 */
-	efi_status = grub->Read(grub, &buffersize, *data);
-	if (efi_status == EFI_BUFFER_TOO_SMALL) {
-		FreePool(*data);
-		*data = AllocatePool(buffersize);
-		efi_status = grub->Read(grub, &buffersize, *data);
-	}
-	if (EFI_ERROR(efi_status)) {
-		perror(L"Unexpected return from initial read: %r, buffersize %x\n",
-		       efi_status, buffersize);
+	efi_status = read_image_file(grub, fileinfo->FileSize, data,
+				     &buffersize, data_pages, digests);
+	if (EFI_ERROR(efi_status))
 		goto error;
-	}
 
 	*datasize = buffersize;
 
@@ -280,12 +266,20 @@ str16_to_str8(CHAR16 *str16, CHAR8 **str8)
  */
 EFI_STATUS read_image(EFI_HANDLE image_handle, CHAR16 *ImagePath,
 		      CHAR16 **PathName, void **data, int *datasize,
+		      UINTN *data_pages, authenticode_digests_t *digests,
 		      int flags)
 {
 	EFI_STATUS efi_status;
 	void *sourcebuffer = NULL;
 	UINT64 sourcesize = 0;
 	CHAR8 *netbootname;
+	authenticode_digests_t unused;
+
+	if (!digests)
+		digests = &unused;
+	digests->algorithms = 0;
+	if (data_pages)
+		*data_pages = 0;
 
 	/*
 	 * We need to refer to the loaded image protocol on the running
@@ -327,11 +321,19 @@ EFI_STATUS read_image(EFI_HANDLE image_handle, CHAR16 *ImagePath,
 		*data = sourcebuffer;
 		*datasize = sourcesize;
 	} else if (find_httpboot(shim_li->DeviceHandle)) {
+		void *hashctx = new_stream_hashes();
+		authenticode_layout_t *layout = NULL;
+
 		str16_to_str8(ImagePath, &netbootname);
 		efi_status = httpboot_fetch_buffer (image_handle,
 						    &sourcebuffer,
 						    &sourcesize,
-						    netbootname);
+						    netbootname,
+						    hashctx ? stream_hash_update : NULL,
+						    hashctx, &layout);
+		finish_stream_hashes(hashctx, layout, digests);
+		if (layout)
+			FreePool(layout);
 		if (EFI_ERROR(efi_status)) {
 			if (~flags & SUPPRESS_NETBOOT_OPEN_FAILURE_NOISE)
 				perror(L"Unable to fetch HTTP image %a: %r\n",
@@ -345,7 +347,8 @@ EFI_STATUS read_image(EFI_HANDLE image_handle, CHAR16 *ImagePath,
 		/*
 		 * Read the new executable off disk
 		 */
-		efi_status = load_image(shim_li, data, datasize, *PathName);
+		efi_status = load_image(shim_li, data, datasize, data_pages,
+					*PathName, digests);
 		if (EFI_ERROR(efi_status)) {
 			perror(L"Failed to load image %s: %r\n",
 			       *PathName, efi_status);
@@ -368,15 +371,17 @@ EFI_STATUS start_image(EFI_HANDLE image_handle, CHAR16 *ImagePath)
 {
 	EFI_STATUS efi_status;
 	EFI_IMAGE_ENTRY_POINT entry_point;
-	EFI_PHYSICAL_ADDRESS alloc_address;
-	UINTN alloc_pages;
+	EFI_PHYSICAL_ADDRESS alloc_address = 0;
+	UINTN alloc_pages = 0;
 	CHAR16 *PathName = NULL;
 	void *data = NULL;
 	int datasize = 0;
+	UINTN data_pages = 0;
 	unsigned int alloc_alignment;
+	authenticode_digests_t digests;
 
 	efi_status = read_image(image_handle, ImagePath, &PathName, &data,
-				&datasize, 0);
+				&datasize, &data_pages, &digests, 0);
 	if (EFI_ERROR(efi_status))
 		goto done;
 
@@ -397,11 +402,14 @@ EFI_STATUS start_image(EFI_HANDLE image_handle, CHAR16 *ImagePath)
 	}
 
 	/*
-	 * Verify and, if appropriate, relocate and execute the executable
+	 * Verify and, if appropriate, relocate and execute the executable.
+	 * If we read it into pages, it may be loaded right where it is.
 	 */
+	alloc_address = (EFI_PHYSICAL_ADDRESS)(uintptr_t)data;
+	alloc_pages = data_pages;
 	efi_status = handle_image(data, datasize, shim_li, image_handle,
 				  &entry_point, &alloc_address, &alloc_pages,
-				  &alloc_alignment, false);
+				  &alloc_alignment, false, &digests);
 	if (EFI_ERROR(efi_status)) {
 		perror(L"Failed to load image: %r\n", efi_status);
 		PrintErrors();
@@ -424,8 +432,9 @@ done:
 	if (PathName)
 		FreePool(PathName);
 
-	if (data)
-		FreePool(data);
+	/* If the image was loaded in place, data is the loaded image now. */
+	if (alloc_address != (EFI_PHYSICAL_ADDRESS)(uintptr_t)data)
+		free_image_buffer(data, data_pages);
 
 	return efi_status;
 }
@@ -602,48 +611,16 @@ uninstall_shim_protocols(void)
 #endif
 }
 
-static void
-check_section_helper(char *section_name, int len, void **pointer,
-                     EFI_IMAGE_SECTION_HEADER *Section, void *data,
-                     int datasize, size_t minsize)
-{
-	if (CompareMem(Section->Name, section_name, len) == 0) {
-		*pointer = ImageAddress(data, datasize, Section->PointerToRawData);
-		if (Section->SizeOfRawData < minsize) {
-			dprint(L"found and rejected %.*a bad size\n", len, section_name);
-			dprint(L"minsize: %d\n", minsize);
-			dprint(L"rawsize: %d\n", Section->SizeOfRawData);
-			return ;
-		}
-		if (!*pointer) {
-			return ;
-		}
-		dprint(L"found %.*a\n", len, section_name);
-	}
-}
-
-#define check_section(section_name, pointer, section, data, datasize, minsize) \
-	check_section_helper(section_name, sizeof(section_name) - 1, pointer,  \
-	                     section, data, datasize, minsize)
-
 EFI_STATUS
 load_revocations_file(EFI_HANDLE image_handle, CHAR16 *FileName, CHAR16 *PathName)
 {
 	EFI_STATUS efi_status = EFI_SUCCESS;
 	PE_COFF_LOADER_IMAGE_CONTEXT context;
-	EFI_IMAGE_SECTION_HEADER *Section;
 	int datasize = 0;
 	void *data = NULL;
-	unsigned int i;
-	char *sbat_var_automatic = NULL;
-	char *sbat_var_latest = NULL;
-	uint8_t *ssps_automatic = NULL;
-	uint8_t *sspv_automatic = NULL;
-	uint8_t *ssps_latest = NULL;
-	uint8_t *sspv_latest = NULL;
 
 	efi_status = read_image(image_handle, FileName, &PathName,
-				&data, &datasize,
+				&data, &datasize, NULL, NULL,
 				SUPPRESS_NETBOOT_OPEN_FAILURE_NOISE);
 	if (!EFI_ERROR(efi_status))
 		efi_status = verify_image(data, datasize, shim_li, &context);
@@ -654,39 +631,7 @@ load_revocations_file(EFI_HANDLE image_handle, CHAR16 *FileName, CHAR16 *PathNam
 	}
 	dprint(L"verified revocations\n");
 
-	Section = context.FirstSection;
-	for (i = 0; i < context.NumberOfSections; i++, Section++) {
-		dprint(L"checking section \"%c%c%c%c%c%c%c%c\"\n", (char *)Section->Name);
-		check_section(".sbata\0\0", (void **)&sbat_var_automatic, Section,
-				data, datasize, sizeof(SBAT_VAR_ORIGINAL));
-		check_section(".sbatl\0\0", (void **)&sbat_var_latest, Section,
-				data, datasize, sizeof(SBAT_VAR_ORIGINAL));
-		check_section(".sspva\0\0", (void **)&sspv_automatic, Section,
-				data, datasize, SSPVER_SIZE);
-		check_section(".sspsa\0\0", (void **)&ssps_automatic, Section,
-				data, datasize, SSPSIG_SIZE);
-		check_section(".sspvl\0\0", (void **)&sspv_latest, Section,
-				data, datasize, SSPVER_SIZE);
-		check_section(".sspsl\0\0", (void **)&ssps_latest, Section,
-				data, datasize, SSPSIG_SIZE);
-	}
-
-	if (sbat_var_latest && sbat_var_automatic) {
-		dprint(L"attempting to update SBAT_LEVEL\n");
-		efi_status = set_sbat_uefi_variable(sbat_var_automatic,
-				sbat_var_latest);
-	} else {
-		dprint(L"no data for SBAT_LEVEL\n");
-	}
-
-	if ((sspv_automatic && ssps_automatic) || (sspv_latest && ssps_latest)) {
-		dprint(L"attempting to update SkuSiPolicy\n");
-		efi_status = set_ssp_uefi_variable(sspv_automatic, ssps_automatic,
-				sspv_latest, ssps_latest);
-
-	} else {
-		dprint(L"no data for SkuSiPolicy\n");
-	}
+	efi_status = apply_revocations(data, datasize, &context);
 
 	FreePool(data);
 	return efi_status;
@@ -698,67 +643,55 @@ load_cert_file(EFI_HANDLE image_handle, CHAR16 *filename, CHAR16 *PathName,
 {
 	EFI_STATUS efi_status;
 	PE_COFF_LOADER_IMAGE_CONTEXT context;
-	EFI_IMAGE_SECTION_HEADER *Section;
-	EFI_SIGNATURE_LIST *certlist;
-	void *pointer;
-	UINT32 original;
-	UINT32 offset;
 	int datasize = 0;
 	void *data = NULL;
-	int i;
 
 	efi_status = read_image(image_handle, filename, &PathName,
-				&data, &datasize, flags);
+				&data, &datasize, NULL, NULL, flags);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+
+	efi_status = verify_image(data, datasize, shim_li, &context);
+	if (!EFI_ERROR(efi_status))
+		efi_status = apply_cert_sections(data, datasize, &context);
+
+	FreePool(data);
+	return efi_status;
+}
+
+/*
+ * Read a single signed image carrying everything the separate
+ * revocations and certificate files would: .sbata/.sbatl and .ssp*
+ * sections with revocations, and any number of .db sections with
+ * certificates.  It's fetched once, and applied revocations first, the
+ * same order as the separate files.
+ */
+EFI_STATUS
+load_trust_bundle(EFI_HANDLE image_handle, CHAR16 *PathName)
+{
+	EFI_STATUS efi_status;
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+	int datasize = 0;
+	void *data = NULL;
+
+	efi_status = read_image(image_handle, TRUSTBUNDLEFILE, &PathName,
+				&data, &datasize, NULL, NULL,
+				SUPPRESS_NETBOOT_OPEN_FAILURE_NOISE);
 	if (EFI_ERROR(efi_status))
 		return efi_status;
 
 	efi_status = verify_image(data, datasize, shim_li, &context);
 	if (EFI_ERROR(efi_status)) {
+		dprint(L"trust bundle failed to verify\n");
 		FreePool(data);
 		return efi_status;
 	}
+	dprint(L"verified trust bundle\n");
 
-	Section = context.FirstSection;
-	for (i = 0; i < context.NumberOfSections; i++, Section++) {
-		UINT32 sec_size = MIN(Section->Misc.VirtualSize, Section->SizeOfRawData);
-
-		if (CompareMem(Section->Name, ".db\0\0\0\0\0", 8) == 0) {
-			offset = 0;
-			while ((sec_size - offset) >= sizeof(EFI_SIGNATURE_LIST)) {
-				UINT8 *tmp;
-
-				original = user_cert_size;
-				pointer = ImageAddress(data, datasize,
-						   Section->PointerToRawData + offset);
-				if (!pointer) {
-				    break;
-				}
-				certlist = pointer;
-
-				if (certlist->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) ||
-					checked_add(offset, certlist->SignatureListSize, &offset) ||
-					offset > sec_size ||
-					checked_add(user_cert_size, certlist->SignatureListSize,
-						    &user_cert_size)) {
-					break;
-				}
-
-				tmp = ReallocatePool(original,
-						     user_cert_size,
-						     user_cert);
-				if (!tmp) {
-					FreePool(data);
-					return EFI_OUT_OF_RESOURCES;
-				}
-				user_cert = tmp;
+	efi_status = apply_trust_bundle(data, datasize, shim_li, &context);
 
-				CopyMem(user_cert + original, pointer,
-				    certlist->SignatureListSize);
-			}
-		}
-	}
 	FreePool(data);
-	return EFI_SUCCESS;
+	return efi_status;
 }
 
 /*
@@ -799,11 +732,15 @@ load_unbundled_trust(EFI_HANDLE image_handle)
 		dprint(L"Failed to find fs on local drive (netboot?): %r \n",
 				efi_status);
 		/*
-		 * Network boot cases do not support reading a directory. Try
-		 * to read revocations to pull in any unbundled SBATLevel
-		 * updates unconditionally in those cases. This may produce
-		 * console noise when the file is not present.
+		 * Network boot cases do not support reading a directory.
+		 * If there's a trust bundle, that's one fetch instead of
+		 * one per file we might have; otherwise try to read
+		 * revocations to pull in any unbundled SBATLevel updates
+		 * unconditionally in those cases. This may produce console
+		 * noise when the file is not present.
 		 */
+		if (load_trust_bundle(image_handle, PathName) == EFI_SUCCESS)
+			goto done;
 		load_revocations_file(image_handle, SKUSIREVOCATIONFILE, PathName);
 		load_revocations_file(image_handle, SBATREVOCATIONFILE, PathName);
 		while (load_cert_file(image_handle, FileName, PathName,
@@ -1035,8 +972,11 @@ shim_init(void)
 void
 shim_fini(void)
 {
-	if (secure_mode())
+	if (secure_mode()) {
+		cleanup_sbat_var_table(&sbat_var_table);
 		cleanup_sbat_var(&sbat_var);
+		policy_generation++;
+	}
 
 	/*
 	 * Remove our protocols
@@ -1054,6 +994,8 @@ shim_fini(void)
 
 	unhook_exit();
 
+	free_sigdb_cache();
+
 	console_fini();
 }
 
@@ -1229,6 +1171,15 @@ efi_main (EFI_HANDLE passed_image_handle, EFI_SYSTEM_TABLE *passed_systab)
 			goto die;
 		}
 
+		efi_status = compile_sbat_var(&sbat_var, &sbat_var_table);
+		if (EFI_ERROR(efi_status)) {
+			perror(L"Compiling %s variable failed: %r\n",
+				SBAT_VAR_NAME, efi_status);
+			msg = IMPORT_SBAT;
+			goto die;
+		}
+		policy_generation++;
+
 		efi_status = verify_sbat_section(sbat_start, sbat_end - sbat_start - 1);
 		if (EFI_ERROR(efi_status)) {
 			perror(L"Verifying shim SBAT data failed: %r\n",
@@ -1239,7 +1190,6 @@ efi_main (EFI_HANDLE passed_image_handle, EFI_SYSTEM_TABLE *passed_systab)
 		dprint(L"SBAT self-check succeeded\n");
 	}
 
-	init_openssl();
 	get_hsi_mem_info();
 	set_shim_nx_policy();
 
@@ -1293,6 +1243,12 @@ die:
 		goto die;
 	}
 
+	/*
+	 * Work out now, with the databases and MoK state settled, whether
+	 * the images we load need SHA-1 digests as well as SHA-256 ones.
+	 */
+	(void) authenticode_algorithms();
+
 	/*
 	 * Tell the user that we're in insecure mode if necessary
 	 */
@@ -181,11 +181,11 @@
 #include "include/dp.h"
 #include "include/efiauthenticated.h"
 #include "include/errlog.h"
+#include "include/esl-index.h"
 #include "include/errors.h"
 #include "include/execute.h"
 #include "include/guid.h"
 #include "include/http.h"
-#include "include/httpboot.h"
 #include "include/ip4config2.h"
 #include "include/ip6config.h"
 #include "include/load-options.h"
@@ -195,9 +195,12 @@
 #include "include/netboot.h"
 #include "include/passwordcrypt.h"
 #include "include/peimage.h"
+#include "include/image-stream.h"
 #include "include/pe.h"
+#include "include/httpboot.h"
 #include "include/sbat.h"
 #include "include/sbat_var_defs.h"
+#include "include/section-cache.h"
 #include "include/ssp.h"
 #if defined(OVERRIDE_SECURITY_POLICY)
 #include "include/security_policy.h"
@@ -205,6 +208,7 @@
 #include "include/simple_file.h"
 #include "include/str.h"
 #include "include/time.h"
+#include "include/trust-bundle.h"
 #include "include/tpm.h"
 #include "include/utils.h"
 #include "include/cc.h"
@@ -282,6 +286,7 @@ extern UINT8 user_insecure_mode;
 extern UINT8 ignore_db;
 extern UINT8 trust_mok_list;
 extern UINT8 mok_policy;
+extern UINTN policy_generation;
 
 extern UINT8 in_protocol;
 extern void *load_options;
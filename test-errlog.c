@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-errlog.c - test the debug log save_logs() exports
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <stdio.h>
+
+/*
+ * How many CHAR16s fit in one of errlog.c's page-sized debug log chunks,
+ * after its list_t and its used and size counts.
+ */
+#define CHUNK_CHARS \
+	((EFI_PAGE_SIZE - sizeof(list_t) - 2 * sizeof(size_t)) / sizeof(CHAR16))
+
+/*
+ * What the debug log used to be: every message, with its NUL, one after
+ * the other in a single buffer.
+ */
+static UINT8 *expected;
+static size_t expected_sz;
+
+static VOID *installed_table;
+
+static EFI_STATUS EFIAPI
+record_config_table(EFI_GUID *guid, VOID *table)
+{
+	if (CompareGuid(guid, &MOK_VARIABLE_STORE))
+		installed_table = table;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Log a message of len copies of c, and add it to what we expect to see.
+ */
+static int
+log_message(UINTN len, CHAR16 c)
+{
+	CHAR16 *msg;
+	UINT8 *new_expected;
+	size_t msg_sz = (len + 1) * sizeof(CHAR16);
+	UINTN ret;
+	int rc = -1;
+
+	msg = AllocatePool(msg_sz);
+	new_expected = ReallocatePool(expected_sz, expected_sz + msg_sz,
+				      expected);
+	if (!msg || !new_expected) {
+		printf("Could not allocate a %zu byte message\n", msg_sz);
+		goto err;
+	}
+	expected = new_expected;
+
+	for (UINTN i = 0; i < len; i++)
+		msg[i] = c;
+	msg[len] = L'\0';
+
+	ret = log_debug_print(L"%s", msg);
+	assert_equal_goto(ret, len, err,
+			  "log_debug_print() returned %lu, not %lu\n");
+
+	CopyMem(&expected[expected_sz], msg, msg_sz);
+	expected_sz += msg_sz;
+	rc = 0;
+err:
+	if (msg)
+		FreePool(msg);
+	return rc;
+}
+
+/*
+ * Save the logs and check that shim-dbg.txt holds exactly what we've
+ * logged so far, in order.
+ */
+static int
+check_debug_log(void)
+{
+	struct mok_variable_config_entry *entry;
+	UINTN pos = 0;
+	int ret = -1;
+
+	installed_table = NULL;
+	save_logs();
+	assert_goto(installed_table != NULL, err,
+		    "no MoK variable store was installed\n");
+
+	entry = installed_table;
+	while (entry->name[0] != 0 &&
+	       strcmp((char *)entry->name, "shim-dbg.txt") != 0) {
+		pos += sizeof(*entry) + entry->data_size;
+		entry = (struct mok_variable_config_entry *)
+			((uintptr_t)installed_table + pos);
+	}
+	assert_goto(entry->name[0] != 0, err, "no shim-dbg.txt entry\n");
+
+	assert_equal_goto(entry->data_size, (UINT64)expected_sz, err,
+			  "shim-dbg.txt is %lu bytes, not %lu\n");
+	assert_zero_goto(CompareMem(entry->data, expected, expected_sz), err,
+			 "shim-dbg.txt differs from the messages logged: %ld\n");
+
+	ret = 0;
+err:
+	if (installed_table)
+		free(installed_table);
+	installed_table = NULL;
+	mok_config_table = 0;
+	mok_config_table_pages = 0;
+	return ret;
+}
+
+/*
+ * A message that exactly fills what's left of a chunk might have been
+ * truncated, so it's formatted again at the start of a fresh one.
+ */
+static int
+test_exact_fill_retried(void)
+{
+	if (log_message(9, L'a') < 0 ||
+	    log_message(CHUNK_CHARS - 10 - 1, L'b') < 0)
+		return -1;
+	return check_debug_log();
+}
+
+/*
+ * A message bigger than a whole chunk gets a chunk of its own, spliced
+ * in before the empty chunk made while trying to fit it, and whatever's
+ * logged next goes in that empty one.
+ */
+static int
+test_oversized_spliced(void)
+{
+	if (log_message(CHUNK_CHARS + 1000, L'c') < 0 ||
+	    log_message(20, L'd') < 0)
+		return -1;
+	return check_debug_log();
+}
+
+/*
+ * A message that would exactly fill an empty chunk can't be told apart
+ * from a truncated one either, so it's treated as oversized.  One with a
+ * CHAR16 to spare fits, and leaves too little room for anything after
+ * it.
+ */
+static int
+test_chunk_sized(void)
+{
+	if (log_message(CHUNK_CHARS - 1, L'e') < 0 ||
+	    log_message(5, L'f') < 0 ||
+	    log_message(CHUNK_CHARS - 2, L'g') < 0 ||
+	    log_message(1, L'h') < 0 ||
+	    log_message(0, L'i') < 0)
+		return -1;
+	return check_debug_log();
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	BS->InstallConfigurationTable = record_config_table;
+
+	test(test_exact_fill_retried);
+	test(test_oversized_spliced);
+	test(test_chunk_sized);
+
+	if (expected)
+		FreePool(expected);
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,437 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-esl-index.c - test the EFI_SIGNATURE_LIST digest index
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "mock-variables.h"
+
+#include <stdio.h>
+
+/*
+ * The same walk check_db_hash_in_ram() does, returning the first match.
+ */
+static EFI_SIGNATURE_DATA *
+linear_find(EFI_SIGNATURE_LIST *CertList, UINTN dbsize, const UINT8 *digest,
+	    UINTN digest_size, EFI_GUID type)
+{
+	EFI_SIGNATURE_DATA *Cert;
+	UINTN CertCount, Index;
+
+	while ((dbsize > 0) && (dbsize >= CertList->SignatureListSize)) {
+		if (CertList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST))
+			break;
+		if (CompareGuid(&CertList->SignatureType, &type) &&
+		    CertList->SignatureSize >= sizeof(EFI_GUID) + digest_size) {
+			Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)CertList + sizeof(EFI_SIGNATURE_LIST) + CertList->SignatureHeaderSize);
+			CertCount = (CertList->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) - CertList->SignatureHeaderSize) / CertList->SignatureSize;
+			for (Index = 0; Index < CertCount; Index++) {
+				if (CompareMem(Cert->SignatureData, digest, digest_size) == 0)
+					return Cert;
+				Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)Cert + CertList->SignatureSize);
+			}
+		}
+		dbsize -= CertList->SignatureListSize;
+		CertList = (EFI_SIGNATURE_LIST *)((UINT8 *)CertList + CertList->SignatureListSize);
+	}
+	return NULL;
+}
+
+static int
+test_esl_index_dbx(const char *dirname)
+{
+	const char *filters[] = { "dbx", NULL };
+	EFI_SIGNATURE_LIST *CertList;
+	EFI_SIGNATURE_DATA *Cert;
+	esl_index_t *index = NULL, *sha1_index = NULL;
+	UINT8 *data = NULL;
+	UINT8 digest[SHA256_DIGEST_SIZE];
+	UINTN size = 0, CertCount;
+	UINT32 sig_size;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	mock_load_variables(dirname, filters, false);
+
+	efi_status = get_variable(L"dbx", &data, &size, EFI_SECURE_BOOT_DB_GUID);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "get_variable(dbx) failed: 0x%lx != 0x%lx\n");
+
+	index = esl_index_new((EFI_SIGNATURE_LIST *)data, size,
+			      &EFI_CERT_SHA256_GUID, SHA256_DIGEST_SIZE);
+	assert_nonzero_goto(index, err, "esl_index_new() failed\n");
+	assert_nonzero_goto(index->n_entries, err,
+			    "dbx has no SHA-256 entries\n");
+
+	/*
+	 * Every digest in every list must be found, at the same entry the
+	 * linear scan finds, with its list's SignatureSize.
+	 */
+	CertList = (EFI_SIGNATURE_LIST *)data;
+	CertCount = (CertList->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) -
+		     CertList->SignatureHeaderSize) / CertList->SignatureSize;
+	assert_equal_goto(index->n_entries, CertCount, err,
+			  "n_entries %lu != %lu\n");
+	Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)CertList + sizeof(EFI_SIGNATURE_LIST) +
+				      CertList->SignatureHeaderSize);
+	for (UINTN i = 0; i < CertCount; i++) {
+		EFI_SIGNATURE_DATA *found;
+
+		found = esl_index_find(index, Cert->SignatureData, &sig_size);
+		assert_equal_goto(found,
+				  linear_find(CertList, size, Cert->SignatureData,
+					      SHA256_DIGEST_SIZE, EFI_CERT_SHA256_GUID),
+				  err, "entry %p != %p\n");
+		assert_equal_goto(sig_size, CertList->SignatureSize, err,
+				  "sig_size %u != %u\n");
+
+		/* the same digest with the last byte flipped isn't in dbx */
+		CopyMem(digest, Cert->SignatureData, sizeof(digest));
+		digest[sizeof(digest) - 1] ^= 0xff;
+		assert_equal_goto(esl_index_find(index, digest, NULL),
+				  linear_find(CertList, size, digest,
+					      SHA256_DIGEST_SIZE, EFI_CERT_SHA256_GUID),
+				  err, "altered digest %p != %p\n");
+
+		Cert = (EFI_SIGNATURE_DATA *)((UINT8 *)Cert + CertList->SignatureSize);
+	}
+
+	/* dbx has no SHA-1 entries, so there's nothing to find. */
+	sha1_index = esl_index_new((EFI_SIGNATURE_LIST *)data, size,
+				   &EFI_CERT_SHA1_GUID, SHA1_DIGEST_SIZE);
+	assert_nonzero_goto(sha1_index, err, "esl_index_new() failed\n");
+	assert_zero_goto(sha1_index->n_entries, err, "n_entries %lu != 0\n");
+	assert_zero_goto(esl_index_find(sha1_index, digest, NULL), err,
+			 "found a SHA-1 entry in an empty index\n");
+
+	ret = 0;
+err:
+	esl_index_free(sha1_index);
+	esl_index_free(index);
+	if (data)
+		FreePool(data);
+	mock_reset_variables();
+	return ret;
+}
+
+static int
+test_esl_index_dbx_0(void)
+{
+	return test_esl_index_dbx("test-data/efivars-0");
+}
+
+static int
+test_esl_index_dbx_1(void)
+{
+	return test_esl_index_dbx("test-data/efivars-1");
+}
+
+/*
+ * Neither machine's db or dbx has SHA-1 entries, so nothing there needs
+ * an image's SHA-1 digest until a SHA-1 list turns up.  A list after a
+ * broken one can't be found, just as check_db_hash() can't find it.
+ */
+static int
+test_sha1_lists(const char *dirname)
+{
+	const char *filters[] = { "db", "dbx", NULL };
+	struct {
+		EFI_SIGNATURE_LIST list;
+		EFI_GUID owner;
+		UINT8 digest[SHA1_DIGEST_SIZE];
+	} __attribute__((__packed__)) sha1_list;
+	EFI_SIGNATURE_LIST broken;
+	UINT8 *db = NULL, *dbx = NULL, *buf = NULL;
+	UINTN dbsize = 0, dbxsize = 0;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	mock_load_variables(dirname, filters, false);
+
+	efi_status = get_variable(L"db", &db, &dbsize, EFI_SECURE_BOOT_DB_GUID);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "get_variable(db) failed: 0x%lx != 0x%lx\n");
+	efi_status = get_variable(L"dbx", &dbx, &dbxsize, EFI_SECURE_BOOT_DB_GUID);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "get_variable(dbx) failed: 0x%lx != 0x%lx\n");
+
+	efi_status = find_type_in_esl(db, dbsize, &EFI_CERT_SHA1_GUID);
+	assert_equal_goto(efi_status, EFI_NOT_FOUND, err,
+			  "SHA-1 list in db: 0x%lx != 0x%lx\n");
+	efi_status = find_type_in_esl(dbx, dbxsize, &EFI_CERT_SHA1_GUID);
+	assert_equal_goto(efi_status, EFI_NOT_FOUND, err,
+			  "SHA-1 list in dbx: 0x%lx != 0x%lx\n");
+	efi_status = find_type_in_esl(db, dbsize, &X509_GUID);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "no X509 list in db: 0x%lx != 0x%lx\n");
+	efi_status = find_type_in_esl(dbx, dbxsize, &EFI_CERT_SHA256_GUID);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "no SHA-256 list in dbx: 0x%lx != 0x%lx\n");
+
+	SetMem(&sha1_list, sizeof(sha1_list), 0);
+	sha1_list.list.SignatureType = EFI_CERT_SHA1_GUID;
+	sha1_list.list.SignatureListSize = sizeof(sha1_list);
+	sha1_list.list.SignatureSize = sizeof(EFI_GUID) + SHA1_DIGEST_SIZE;
+	SetMem(&broken, sizeof(broken), 0);
+	broken.SignatureType = EFI_CERT_SHA256_GUID;
+
+	buf = AllocateZeroPool(dbxsize + sizeof(broken) + sizeof(sha1_list));
+	assert_nonzero_goto(buf, err, "allocation failed\n");
+	CopyMem(buf, dbx, dbxsize);
+	CopyMem(buf + dbxsize, &sha1_list, sizeof(sha1_list));
+	efi_status = find_type_in_esl(buf, dbxsize + sizeof(sha1_list),
+				      &EFI_CERT_SHA1_GUID);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "appended SHA-1 list not found: 0x%lx != 0x%lx\n");
+
+	CopyMem(buf + dbxsize, &broken, sizeof(broken));
+	CopyMem(buf + dbxsize + sizeof(broken), &sha1_list, sizeof(sha1_list));
+	efi_status = find_type_in_esl(buf, dbxsize + sizeof(broken) +
+					   sizeof(sha1_list),
+				      &EFI_CERT_SHA1_GUID);
+	assert_equal_goto(efi_status, EFI_NOT_FOUND, err,
+			  "SHA-1 list after a broken one: 0x%lx != 0x%lx\n");
+
+	ret = 0;
+err:
+	if (buf)
+		FreePool(buf);
+	if (dbx)
+		FreePool(dbx);
+	if (db)
+		FreePool(db);
+	mock_reset_variables();
+	return ret;
+}
+
+static int
+test_sha1_lists_0(void)
+{
+	return test_sha1_lists("test-data/efivars-0");
+}
+
+static int
+test_sha1_lists_1(void)
+{
+	return test_sha1_lists("test-data/efivars-1");
+}
+
+/*
+ * Two lists, where the second repeats a digest from the first and adds
+ * one that collides with it in the leading bytes, plus a list whose
+ * SignatureSize is too small to hold a digest at all.
+ */
+#define N_SIGS 3
+struct test_esl {
+	EFI_SIGNATURE_LIST list;
+	struct {
+		EFI_GUID owner;
+		UINT8 digest[SHA256_DIGEST_SIZE];
+	} __attribute__((__packed__)) sigs[N_SIGS];
+} __attribute__((__packed__));
+
+static int
+test_esl_index_order(void)
+{
+	struct test_esl esl[3];
+	EFI_SIGNATURE_DATA *found;
+	esl_index_t *index = NULL;
+	UINT8 digest[SHA256_DIGEST_SIZE];
+	UINT32 sig_size = 0;
+	int ret = -1;
+
+	SetMem(esl, sizeof(esl), 0);
+	for (int i = 0; i < 3; i++) {
+		esl[i].list.SignatureType = EFI_CERT_SHA256_GUID;
+		esl[i].list.SignatureListSize = sizeof(esl[i]);
+		esl[i].list.SignatureSize = sizeof(esl[i].sigs[0]);
+		for (int j = 0; j < N_SIGS; j++)
+			SetMem(esl[i].sigs[j].digest, SHA256_DIGEST_SIZE,
+			       0x10 * (i + 1) + j);
+	}
+	/* list 1, entry 0 duplicates list 0, entry 2 */
+	CopyMem(esl[1].sigs[0].digest, esl[0].sigs[2].digest, SHA256_DIGEST_SIZE);
+	/* list 1, entry 1 shares its leading bytes with list 0, entry 2 */
+	CopyMem(esl[1].sigs[1].digest, esl[0].sigs[2].digest, SHA256_DIGEST_SIZE);
+	esl[1].sigs[1].digest[SHA256_DIGEST_SIZE - 1] ^= 0xff;
+	/* list 2 is too short to hold SHA-256 digests */
+	esl[2].list.SignatureSize = sizeof(EFI_GUID) + SHA1_DIGEST_SIZE;
+	esl[2].list.SignatureListSize = sizeof(esl[2].list) +
+					N_SIGS * esl[2].list.SignatureSize;
+
+	index = esl_index_new(&esl[0].list, sizeof(esl[0]) + sizeof(esl[1]) +
+			      esl[2].list.SignatureListSize,
+			      &EFI_CERT_SHA256_GUID, SHA256_DIGEST_SIZE);
+	assert_nonzero_goto(index, err, "esl_index_new() failed\n");
+	assert_equal_goto(index->n_entries, (UINTN)(2 * N_SIGS), err,
+			  "n_entries %lu != %lu\n");
+
+	found = esl_index_find(index, esl[0].sigs[2].digest, &sig_size);
+	assert_equal_goto(found, (EFI_SIGNATURE_DATA *)&esl[0].sigs[2], err,
+			  "duplicate digest found at %p instead of %p\n");
+	assert_equal_goto(sig_size, sizeof(esl[0].sigs[0]), err,
+			  "sig_size %u != %lu\n");
+
+	found = esl_index_find(index, esl[1].sigs[1].digest, NULL);
+	assert_equal_goto(found, (EFI_SIGNATURE_DATA *)&esl[1].sigs[1], err,
+			  "colliding digest found at %p instead of %p\n");
+
+	SetMem(digest, sizeof(digest), 0x30);
+	assert_zero_goto(esl_index_find(index, digest, NULL), err,
+			 "found a digest from a short list\n");
+
+	ret = 0;
+err:
+	esl_index_free(index);
+	return ret;
+}
+
+static int
+test_esl_index_empty(void)
+{
+	UINT8 digest[SHA256_DIGEST_SIZE] = { 0, };
+	esl_index_t *index;
+	int ret = -1;
+
+	index = esl_index_new(NULL, 0, &EFI_CERT_SHA256_GUID,
+			      SHA256_DIGEST_SIZE);
+	assert_nonzero_goto(index, err, "esl_index_new() failed\n");
+	assert_zero_goto(esl_index_find(index, digest, NULL), err,
+			 "found a digest in an empty index\n");
+	assert_zero_goto(esl_index_find(NULL, digest, NULL), err,
+			 "found a digest in a NULL index\n");
+
+	ret = 0;
+err:
+	esl_index_free(index);
+	return ret;
+}
+
+/*
+ * Delete 500 digests, spread over two lists the way MokDel can have
+ * them, from a 10000 entry MokList, along with a few that aren't there.
+ */
+#define N_MOK 10000
+#define DEL_EVERY 20
+#define N_ABSENT 16
+static int
+test_esl_index_remove_bulk(void)
+{
+	const UINTN sig_size = sizeof(EFI_GUID) + SHA256_DIGEST_SIZE;
+	const UINTN n_del = N_MOK / DEL_EVERY + N_ABSENT;
+	const UINTN n_del0 = n_del / 2, n_del1 = n_del - n_del0;
+	EFI_SIGNATURE_LIST *del0, *del1;
+	EFI_SIGNATURE_DATA *sig;
+	esl_index_t *index = NULL;
+	UINT8 *mok = NULL, *delbuf = NULL, *pos;
+	UINTN delsize, kept, n = 0;
+	int ret = -1;
+
+	mok = AllocateZeroPool(N_MOK * sig_size);
+	delsize = 2 * sizeof(EFI_SIGNATURE_LIST) + n_del * sig_size;
+	delbuf = AllocateZeroPool(delsize);
+	assert_goto(mok && delbuf, err, "allocation failed\n");
+
+	/*
+	 * Entry i's digest is i written out big-endian, so the leading
+	 * bytes the index buckets on are mostly zero.
+	 */
+	for (UINTN i = 0; i < N_MOK; i++) {
+		sig = (EFI_SIGNATURE_DATA *)(mok + i * sig_size);
+		sig->SignatureOwner = SHIM_LOCK_GUID;
+		for (UINTN j = 0; j < sizeof(UINT32); j++)
+			sig->SignatureData[SHA256_DIGEST_SIZE - 1 - j] =
+				(i >> (8 * j)) & 0xff;
+	}
+
+	del0 = (EFI_SIGNATURE_LIST *)delbuf;
+	del0->SignatureType = EFI_CERT_SHA256_GUID;
+	del0->SignatureSize = sig_size;
+	del0->SignatureListSize = sizeof(*del0) + n_del0 * sig_size;
+	del1 = (EFI_SIGNATURE_LIST *)((UINT8 *)del0 + del0->SignatureListSize);
+	del1->SignatureType = EFI_CERT_SHA256_GUID;
+	del1->SignatureSize = sig_size;
+	del1->SignatureListSize = sizeof(*del1) + n_del1 * sig_size;
+
+	/*
+	 * Every DEL_EVERY'th entry, backwards, and then some digests that
+	 * aren't in the list at all.
+	 */
+	pos = (UINT8 *)(del0 + 1);
+	for (UINTN i = 0; i < n_del; i++) {
+		if (i == n_del0)
+			pos = (UINT8 *)(del1 + 1);
+		sig = (EFI_SIGNATURE_DATA *)pos;
+		if (i < N_MOK / DEL_EVERY) {
+			UINTN k = N_MOK - DEL_EVERY * (i + 1);
+
+			CopyMem(sig, mok + k * sig_size, sig_size);
+		} else {
+			SetMem(sig->SignatureData, SHA256_DIGEST_SIZE, 0xa0 + i);
+		}
+		pos += sig_size;
+	}
+
+	index = esl_index_new((EFI_SIGNATURE_LIST *)delbuf, delsize,
+			      &EFI_CERT_SHA256_GUID, SHA256_DIGEST_SIZE);
+	assert_nonzero_goto(index, err, "esl_index_new() failed\n");
+	assert_equal_goto(index->n_entries, n_del, err,
+			  "n_entries %lu != %lu\n");
+
+	kept = esl_index_remove(index, mok, N_MOK, sig_size);
+	assert_equal_goto(kept, (UINTN)(N_MOK - N_MOK / DEL_EVERY), err,
+			  "kept %lu entries, expected %lu\n");
+
+	/* what's left is everything else, still in order */
+	for (UINTN i = 0; i < N_MOK; i++) {
+		UINT8 digest[SHA256_DIGEST_SIZE] = { 0, };
+
+		if (i % DEL_EVERY == 0)
+			continue;
+		for (UINTN j = 0; j < sizeof(UINT32); j++)
+			digest[SHA256_DIGEST_SIZE - 1 - j] = (i >> (8 * j)) & 0xff;
+		sig = (EFI_SIGNATURE_DATA *)(mok + n * sig_size);
+		assert_goto(CompareMem(sig->SignatureData, digest,
+				       SHA256_DIGEST_SIZE) == 0, err,
+			    "entry %lu is wrong after deleting\n", n);
+		assert_goto(CompareGuid(&sig->SignatureOwner, &SHIM_LOCK_GUID),
+			    err, "entry %lu has the wrong owner\n", n);
+		n++;
+	}
+	assert_equal_goto(n, kept, err, "checked %lu entries of %lu\n");
+
+	/* and removing them again doesn't change anything */
+	n = esl_index_remove(index, mok, kept, sig_size);
+	assert_equal_goto(n, kept, err,
+			  "kept %lu entries the second time, not %lu\n");
+
+	ret = 0;
+err:
+	esl_index_free(index);
+	if (delbuf)
+		FreePool(delbuf);
+	if (mok)
+		FreePool(mok);
+	return ret;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	test(test_esl_index_empty);
+	test(test_esl_index_order);
+	test(test_esl_index_remove_bulk);
+	test(test_esl_index_dbx_0);
+	test(test_esl_index_dbx_1);
+	test(test_sha1_lists_0);
+	test(test_sha1_lists_1);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,461 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-httpboot.c - test receiving an image over HTTP while hashing it
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+/*
+ * An HTTP child serving one file.  The first Response() gets the status
+ * and headers and as much body as fits; each one after that gets at most
+ * max_body bytes, the way a real driver hands over whatever TCP has
+ * buffered.  Responses complete, and signal their event, from Poll().
+ * The headers are a Content-Length for each of lengths, which is just
+ * the size of the file unless a test says otherwise.
+ */
+typedef struct {
+	EFI_HTTP_PROTOCOL http;
+	EFI_HTTP_STATUS_CODE status;
+	UINT8 *contents;
+	UINTN size;
+	UINTN pos;
+	UINTN max_body;
+	UINTN n_lengths;
+	UINTN lengths[2];
+	EFI_HTTP_TOKEN *pending;
+	UINTN n_responses;
+	UINTN n_polls;
+	/* where the last body went, to check they're laid end to end */
+	UINT8 *last_body;
+	UINTN last_len;
+	UINTN n_scattered;
+	UINTN largest_request;
+} mock_http_t;
+
+typedef struct {
+	EFI_EVENT_NOTIFY notify;
+	VOID *context;
+} mock_event_t;
+
+static EFI_STATUS EFIAPI
+mock_create_event(UINT32 type, EFI_TPL tpl, EFI_EVENT_NOTIFY notify,
+		  VOID *context, EFI_EVENT *event)
+{
+	mock_event_t *ev;
+
+	ev = AllocateZeroPool(sizeof(*ev));
+	if (!ev)
+		return EFI_OUT_OF_RESOURCES;
+	ev->notify = notify;
+	ev->context = context;
+	*event = ev;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_close_event(EFI_EVENT event)
+{
+	FreePool(event);
+	return EFI_SUCCESS;
+}
+
+/*
+ * The header array and its strings in one allocation, since the caller
+ * only FreePool()s the array.
+ */
+static EFI_HTTP_HEADER *
+content_length_headers(UINTN *sizes, UINTN n)
+{
+	EFI_HTTP_HEADER *hdrs;
+	char *strings;
+
+	hdrs = AllocateZeroPool((sizeof(*hdrs) + 64) * MAX(n, 1));
+	if (!hdrs)
+		return NULL;
+	strings = (char *)(hdrs + MAX(n, 1));
+	for (UINTN i = 0; i < n; i++, strings += 64) {
+		strcpy(strings, "Content-Length");
+		snprintf(strings + 16, 48, "%lu", (unsigned long)sizes[i]);
+		hdrs[i].FieldName = (CHAR8 *)strings;
+		hdrs[i].FieldValue = (CHAR8 *)strings + 16;
+	}
+	return hdrs;
+}
+
+static EFI_STATUS EFIAPI
+mock_response(EFI_HTTP_PROTOCOL *http, EFI_HTTP_TOKEN *token)
+{
+	mock_http_t *mh = (mock_http_t *)http;
+	EFI_HTTP_MESSAGE *msg = token->Message;
+
+	if (mh->pending)
+		return EFI_ACCESS_DENIED;
+
+	if (mh->n_responses == 0) {
+		msg->Data.Response->StatusCode = mh->status;
+		msg->Headers = content_length_headers(mh->lengths,
+						      mh->n_lengths);
+		if (!msg->Headers)
+			return EFI_OUT_OF_RESOURCES;
+		msg->HeaderCount = mh->n_lengths;
+	} else {
+		if (mh->last_body &&
+		    (UINT8 *)msg->Body != mh->last_body + mh->last_len)
+			mh->n_scattered += 1;
+		mh->largest_request = MAX(mh->largest_request,
+					  msg->BodyLength);
+	}
+
+	mh->n_responses += 1;
+	mh->pending = token;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_poll(EFI_HTTP_PROTOCOL *http)
+{
+	mock_http_t *mh = (mock_http_t *)http;
+	EFI_HTTP_TOKEN *token = mh->pending;
+	EFI_HTTP_MESSAGE *msg;
+	mock_event_t *ev;
+	UINTN n;
+
+	mh->n_polls += 1;
+	if (!token)
+		return EFI_NOT_READY;
+	msg = token->Message;
+
+	n = MIN(msg->BodyLength, mh->size - mh->pos);
+	if (mh->n_responses > 1 && mh->max_body)
+		n = MIN(n, mh->max_body);
+	if (mh->status != HTTP_STATUS_200_OK)
+		n = 0;
+	CopyMem(msg->Body, mh->contents + mh->pos, n);
+	msg->BodyLength = n;
+	mh->pos += n;
+	if (mh->n_responses > 1) {
+		mh->last_body = msg->Body;
+		mh->last_len = n;
+	}
+
+	mh->pending = NULL;
+	token->Status = EFI_SUCCESS;
+	ev = token->Event;
+	ev->notify(token->Event, ev->context);
+	return EFI_SUCCESS;
+}
+
+static void
+mock_http_init(mock_http_t *mh, UINT8 *contents, UINTN size,
+	       UINTN max_body)
+{
+	SetMem(mh, sizeof(*mh), 0);
+	mh->http.Response = mock_response;
+	mh->http.Poll = mock_poll;
+	mh->status = HTTP_STATUS_200_OK;
+	mh->contents = contents;
+	mh->size = size;
+	mh->max_body = max_body;
+	mh->n_lengths = 1;
+	mh->lengths[0] = size;
+
+	BS->CreateEvent = mock_create_event;
+	BS->CloseEvent = mock_close_event;
+}
+
+static UINT8 *
+read_test_file(const char *name, UINTN *sizep)
+{
+	struct stat statbuf;
+	UINT8 *buf;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f)
+		err(2, "Could not open \"%s\"", name);
+	if (fstat(fileno(f), &statbuf) < 0)
+		err(2, "Could not stat \"%s\"", name);
+	buf = AllocatePool(statbuf.st_size);
+	if (!buf)
+		err(2, "Could not allocate %ld bytes", (long)statbuf.st_size);
+	if (fread(buf, 1, statbuf.st_size, f) != (size_t)statbuf.st_size)
+		errx(2, "Could not read \"%s\"", name);
+	fclose(f);
+
+	*sizep = statbuf.st_size;
+	return buf;
+}
+
+/*
+ * Collects everything that gets hashed, in order, so we can compare it
+ * with the layout of the whole file.
+ */
+typedef struct {
+	UINT8 *buf;
+	UINTN size;
+	UINTN n_calls;
+} hashed_t;
+
+static BOOLEAN
+collect(void *ctx, void *base, UINTN size)
+{
+	hashed_t *hashed = ctx;
+
+	CopyMem(hashed->buf + hashed->size, base, size);
+	hashed->size += size;
+	hashed->n_calls += 1;
+	return TRUE;
+}
+
+static int
+test_receive(const char *name, UINTN max_body)
+{
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+	authenticode_layout_t *expected = NULL, *layout = NULL;
+	hashed_t hashed = { NULL, 0, 0 };
+	mock_http_t mh;
+	UINT8 *contents;
+	VOID *buffer = NULL;
+	UINT64 buf_size = 0;
+	UINTN size, offset = 0;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	contents = read_test_file(name, &size);
+
+	SetMem(&context, sizeof(context), 0);
+	efi_status = read_header(contents, size, &context, true);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "read_header() failed: 0x%lx != 0x%lx\n");
+	efi_status = get_authenticode_layout((char *)contents, size,
+					     &context, &expected);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "get_authenticode_layout() failed: 0x%lx != 0x%lx\n");
+
+	hashed.buf = AllocatePool(size);
+	assert_nonzero_goto(hashed.buf, err, "allocation failed\n");
+
+	mock_http_init(&mh, contents, size, max_body);
+	efi_status = receive_http_response(&mh.http, &buffer, &buf_size,
+					   collect, &hashed, &layout);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "receive_http_response() failed: 0x%lx != 0x%lx\n");
+	assert_equal_goto(buf_size, size, err, "received %lu bytes of %lu\n");
+	assert_zero_goto(CompareMem(buffer, contents, size), err,
+			 "data doesn't match the file\n");
+	assert_nonzero_goto(layout, err, "image wasn't hashed\n");
+
+	/* the same layout, hashed in the same order, byte for byte */
+	assert_equal_goto(layout->n_regions, expected->n_regions, err,
+			  "%lu regions != %lu\n");
+	assert_equal_goto(layout->padding, expected->padding, err,
+			  "padding %lu != %lu\n");
+	for (UINTN i = 0; i < expected->n_regions; i++) {
+		authenticode_region_t *r = &expected->regions[i];
+
+		assert_goto(offset + r->size <= hashed.size, err,
+			    "region %lu wasn't hashed\n", i);
+		assert_goto(CompareMem(hashed.buf + offset,
+				       contents + r->offset, r->size) == 0,
+			    err, "region %lu hashed wrong bytes\n", i);
+		offset += r->size;
+	}
+	assert_equal_goto(hashed.size, offset, err,
+			  "hashed %lu bytes instead of %lu\n");
+
+	/*
+	 * Everything after the first response went straight into the
+	 * buffer, end to end, and each one asked for as much as was
+	 * left, up to a large window.
+	 */
+	assert_zero_goto(mh.n_scattered, err,
+			 "%lu bodies didn't follow the last one\n");
+	assert_goto(mh.last_body == (UINT8 *)buffer + size - mh.last_len,
+		    err, "the last body didn't land in the buffer\n");
+	assert_goto(mh.largest_request >= MIN(size - mh.last_len,
+					      IMAGE_STREAM_CHUNK_SIZE),
+		    err, "only asked for %lu bytes at a time\n",
+		    mh.largest_request);
+	if (!max_body)
+		assert_goto(mh.n_responses <= 2 + size / IMAGE_STREAM_CHUNK_SIZE,
+			    err, "%lu responses\n", mh.n_responses);
+	assert_goto(hashed.n_calls <= expected->n_regions + mh.n_responses,
+		    err, "%lu hash calls\n", hashed.n_calls);
+
+	ret = 0;
+err:
+	if (layout)
+		FreePool(layout);
+	if (expected)
+		FreePool(expected);
+	if (hashed.buf)
+		FreePool(hashed.buf);
+	if (buffer)
+		FreePool(buffer);
+	FreePool(contents);
+	reset_efi_system_table();
+	return ret;
+}
+
+static int
+test_receive_whole(void)
+{
+	return test_receive("test-data/grubx64.0.76.el7.efi", 0);
+}
+
+static int
+test_receive_segments(void)
+{
+	return test_receive("test-data/grubx64.0.80.el7.efi", 65536);
+}
+
+static int
+test_receive_packets(void)
+{
+	return test_receive("test-data/grubx64.0.76.el7.1.efi", 1448);
+}
+
+/*
+ * Something that isn't a PE image is still received, just not hashed.
+ */
+static int
+test_receive_not_pe(void)
+{
+	hashed_t hashed = { NULL, 0, 0 };
+	authenticode_layout_t *layout = NULL;
+	mock_http_t mh;
+	UINT8 contents[100000];
+	VOID *buffer = NULL;
+	UINT64 buf_size = 0;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	for (UINTN i = 0; i < sizeof(contents); i++)
+		contents[i] = i * 7;
+
+	mock_http_init(&mh, contents, sizeof(contents), 4096);
+	efi_status = receive_http_response(&mh.http, &buffer, &buf_size,
+					   collect, &hashed, &layout);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "receive_http_response() failed: 0x%lx != 0x%lx\n");
+	assert_equal_goto(buf_size, sizeof(contents), err,
+			  "received %lu bytes of %lu\n");
+	assert_zero_goto(CompareMem(buffer, contents, sizeof(contents)), err,
+			 "data doesn't match\n");
+	assert_zero_goto(layout, err, "got a layout for a non-PE file\n");
+	assert_zero_goto(hashed.n_calls, err, "hashed %lu times\n");
+
+	ret = 0;
+err:
+	if (layout)
+		FreePool(layout);
+	if (buffer)
+		FreePool(buffer);
+	reset_efi_system_table();
+	return ret;
+}
+
+/*
+ * An HTTP error leaves nothing behind.
+ */
+static int
+test_receive_not_found(void)
+{
+	hashed_t hashed = { NULL, 0, 0 };
+	authenticode_layout_t *layout = NULL;
+	mock_http_t mh;
+	UINT8 contents[16] = { 0, };
+	VOID *buffer = NULL;
+	UINT64 buf_size = 0;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	mock_http_init(&mh, contents, sizeof(contents), 0);
+	mh.status = HTTP_STATUS_404_NOT_FOUND;
+	efi_status = receive_http_response(&mh.http, &buffer, &buf_size,
+					   collect, &hashed, &layout);
+	assert_equal_goto(efi_status, EFI_NOT_FOUND, err,
+			  "receive_http_response() returned 0x%lx != 0x%lx\n");
+	assert_zero_goto(buffer, err, "buffer left allocated\n");
+	assert_zero_goto(layout, err, "layout left allocated\n");
+	assert_goto(mh.n_responses == 1, err, "%lu responses\n",
+		    mh.n_responses);
+
+	ret = 0;
+err:
+	reset_efi_system_table();
+	return ret;
+}
+
+/*
+ * A response we can't size the buffer from is an error, not a success
+ * with nothing in it.
+ */
+static int
+test_receive_bad_length(UINTN n_lengths, UINTN delta, EFI_STATUS expected)
+{
+	hashed_t hashed = { NULL, 0, 0 };
+	authenticode_layout_t *layout = NULL;
+	mock_http_t mh;
+	UINT8 contents[4096] = { 0, };
+	VOID *buffer = NULL;
+	UINT64 buf_size = 0;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	mock_http_init(&mh, contents, sizeof(contents), 0);
+	mh.n_lengths = n_lengths;
+	mh.lengths[0] = sizeof(contents);
+	mh.lengths[1] = sizeof(contents) + delta;
+	efi_status = receive_http_response(&mh.http, &buffer, &buf_size,
+					   collect, &hashed, &layout);
+	assert_equal_goto(efi_status, expected, err,
+			  "receive_http_response() returned 0x%lx != 0x%lx\n");
+	assert_zero_goto(buffer, err, "buffer left allocated\n");
+	assert_zero_goto(layout, err, "layout left allocated\n");
+	assert_zero_goto(hashed.n_calls, err, "hashed %lu times\n");
+
+	ret = 0;
+err:
+	if (buffer)
+		FreePool(buffer);
+	reset_efi_system_table();
+	return ret;
+}
+
+static int
+test_receive_no_length(void)
+{
+	return test_receive_bad_length(0, 0, EFI_NOT_FOUND);
+}
+
+static int
+test_receive_conflicting_lengths(void)
+{
+	return test_receive_bad_length(2, 1, EFI_PROTOCOL_ERROR);
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	test(test_receive_whole);
+	test(test_receive_segments);
+	test(test_receive_packets);
+	test(test_receive_not_pe);
+	test(test_receive_not_found);
+	test(test_receive_no_length);
+	test(test_receive_conflicting_lengths);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-image-stream.c - test reading an image while hashing it
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+/*
+ * A file handle backed by a buffer, which hands out at most max_read
+ * bytes per Read() call the way some firmware file systems do.
+ */
+typedef struct {
+	EFI_FILE file;
+	UINT8 *contents;
+	UINTN size;
+	UINTN pos;
+	UINTN max_read;
+	UINTN n_reads;
+} mock_file_t;
+
+static EFI_STATUS EFIAPI
+mock_file_read(EFI_FILE_HANDLE file, UINTN *size, VOID *buf)
+{
+	mock_file_t *mf = (mock_file_t *)file;
+	UINTN n = MIN(*size, mf->size - mf->pos);
+
+	if (mf->max_read)
+		n = MIN(n, mf->max_read);
+	CopyMem(buf, mf->contents + mf->pos, n);
+	mf->pos += n;
+	mf->n_reads += 1;
+	*size = n;
+	return EFI_SUCCESS;
+}
+
+static void
+mock_file_init(mock_file_t *mf, UINT8 *contents, UINTN size, UINTN max_read)
+{
+	SetMem(mf, sizeof(*mf), 0);
+	mf->file.Read = mock_file_read;
+	mf->contents = contents;
+	mf->size = size;
+	mf->max_read = max_read;
+}
+
+static UINT8 *
+read_test_file(const char *name, UINTN *sizep)
+{
+	struct stat statbuf;
+	UINT8 *buf;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f)
+		err(2, "Could not open \"%s\"", name);
+	if (fstat(fileno(f), &statbuf) < 0)
+		err(2, "Could not stat \"%s\"", name);
+	buf = AllocatePool(statbuf.st_size);
+	if (!buf)
+		err(2, "Could not allocate %ld bytes", (long)statbuf.st_size);
+	if (fread(buf, 1, statbuf.st_size, f) != (size_t)statbuf.st_size)
+		errx(2, "Could not read \"%s\"", name);
+	fclose(f);
+
+	*sizep = statbuf.st_size;
+	return buf;
+}
+
+/*
+ * Collects everything stream_image() hashes, in order, so we can compare
+ * it with the layout of the whole file.
+ */
+typedef struct {
+	UINT8 *buf;
+	UINTN size;
+	UINTN n_calls;
+} hashed_t;
+
+static BOOLEAN
+collect(void *ctx, void *base, UINTN size)
+{
+	hashed_t *hashed = ctx;
+
+	CopyMem(hashed->buf + hashed->size, base, size);
+	hashed->size += size;
+	hashed->n_calls += 1;
+	return TRUE;
+}
+
+static int
+test_stream_image(const char *name, UINTN max_read)
+{
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+	authenticode_layout_t *expected = NULL, *layout = NULL;
+	hashed_t hashed = { NULL, 0, 0 };
+	mock_file_t mf;
+	UINT8 *contents, *data = NULL;
+	UINTN size, datasize, offset = 0;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	contents = read_test_file(name, &size);
+
+	SetMem(&context, sizeof(context), 0);
+	efi_status = read_header(contents, size, &context, true);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "read_header() failed: 0x%lx != 0x%lx\n");
+	efi_status = get_authenticode_layout((char *)contents, size,
+					     &context, &expected);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "get_authenticode_layout() failed: 0x%lx != 0x%lx\n");
+
+	data = AllocatePool(size);
+	hashed.buf = AllocatePool(size);
+	assert_nonzero_goto(data && hashed.buf, err, "allocation failed\n");
+
+	mock_file_init(&mf, contents, size, max_read);
+	datasize = size;
+	efi_status = stream_image(&mf.file, (char *)data, &datasize, collect,
+				  &hashed, &layout);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "stream_image() failed: 0x%lx != 0x%lx\n");
+	assert_equal_goto(datasize, size, err, "read %lu bytes of %lu\n");
+	assert_zero_goto(CompareMem(data, contents, size), err,
+			 "data doesn't match the file\n");
+	assert_nonzero_goto(layout, err, "image wasn't hashed\n");
+
+	/* the same layout, hashed in the same order, byte for byte */
+	assert_equal_goto(layout->n_regions, expected->n_regions, err,
+			  "%lu regions != %lu\n");
+	assert_equal_goto(layout->padding, expected->padding, err,
+			  "padding %lu != %lu\n");
+	for (UINTN i = 0; i < expected->n_regions; i++) {
+		authenticode_region_t *r = &expected->regions[i];
+
+		assert_goto(offset + r->size <= hashed.size, err,
+			    "region %lu wasn't hashed\n", i);
+		assert_goto(CompareMem(hashed.buf + offset,
+				       contents + r->offset, r->size) == 0,
+			    err, "region %lu hashed wrong bytes\n", i);
+		offset += r->size;
+	}
+	assert_equal_goto(hashed.size, offset, err,
+			  "hashed %lu bytes instead of %lu\n");
+
+	/* each chunk is read once and handed to the hash at most once */
+	if (max_read)
+		assert_goto(mf.n_reads >= size / max_read, err,
+			    "only %lu reads\n", mf.n_reads);
+	else
+		assert_equal_goto(mf.n_reads,
+				  (size + IMAGE_STREAM_CHUNK_SIZE - 1) /
+				  IMAGE_STREAM_CHUNK_SIZE,
+				  err, "%lu reads != %lu\n");
+	assert_goto(hashed.n_calls <= expected->n_regions + mf.n_reads,
+		    err, "%lu hash calls\n", hashed.n_calls);
+
+	ret = 0;
+err:
+	if (layout)
+		FreePool(layout);
+	if (expected)
+		FreePool(expected);
+	if (hashed.buf)
+		FreePool(hashed.buf);
+	if (data)
+		FreePool(data);
+	FreePool(contents);
+	return ret;
+}
+
+static int
+test_stream_image_whole(void)
+{
+	return test_stream_image("test-data/grubx64.0.76.el7.efi", 0);
+}
+
+static int
+test_stream_image_short_reads(void)
+{
+	return test_stream_image("test-data/grubx64.0.80.el7.efi", 4093);
+}
+
+static int
+test_stream_image_tiny_reads(void)
+{
+	return test_stream_image("test-data/grubx64.0.76.el7.1.efi", 7);
+}
+
+/*
+ * Something that isn't a PE image is still read, just not hashed.
+ */
+static int
+test_stream_not_pe(void)
+{
+	UINT8 contents[8192], data[8192];
+	authenticode_layout_t *layout = NULL;
+	hashed_t hashed = { NULL, 0, 0 };
+	mock_file_t mf;
+	UINTN datasize = sizeof(data);
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	for (UINTN i = 0; i < sizeof(contents); i++)
+		contents[i] = i * 7;
+	mock_file_init(&mf, contents, sizeof(contents), 1000);
+
+	efi_status = stream_image(&mf.file, (char *)data, &datasize, collect,
+				  &hashed, &layout);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "stream_image() failed: 0x%lx != 0x%lx\n");
+	assert_equal_goto(datasize, sizeof(contents), err,
+			  "read %lu bytes of %lu\n");
+	assert_zero_goto(CompareMem(data, contents, sizeof(data)), err,
+			 "data doesn't match the file\n");
+	assert_zero_goto(layout, err, "got a layout for a non-PE file\n");
+	assert_zero_goto(hashed.n_calls, err, "hashed %lu times\n");
+
+	ret = 0;
+err:
+	if (layout)
+		FreePool(layout);
+	return ret;
+}
+
+/*
+ * If the file turns out to be shorter than we were told, the layout we
+ * worked out was for the wrong size, so we mustn't use it.
+ */
+static int
+test_stream_short_file(void)
+{
+	authenticode_layout_t *layout = NULL;
+	hashed_t hashed = { NULL, 0, 0 };
+	mock_file_t mf;
+	UINT8 *contents, *data = NULL;
+	UINTN size, datasize;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	contents = read_test_file("test-data/grubx64.0.76.el7.efi", &size);
+	data = AllocatePool(size);
+	hashed.buf = AllocatePool(size);
+	assert_nonzero_goto(data && hashed.buf, err, "allocation failed\n");
+
+	mock_file_init(&mf, contents, size - 4096, 65536);
+	datasize = size;
+	efi_status = stream_image(&mf.file, (char *)data, &datasize, collect,
+				  &hashed, &layout);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "stream_image() failed: 0x%lx != 0x%lx\n");
+	assert_equal_goto(datasize, size - 4096, err,
+			  "read %lu bytes instead of %lu\n");
+	assert_zero_goto(layout, err, "got a layout for a truncated file\n");
+
+	ret = 0;
+err:
+	if (layout)
+		FreePool(layout);
+	if (hashed.buf)
+		FreePool(hashed.buf);
+	if (data)
+		FreePool(data);
+	FreePool(contents);
+	return ret;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	test(test_stream_image_whole);
+	test(test_stream_image_short_reads);
+	test(test_stream_image_tiny_reads);
+	test(test_stream_not_pe);
+	test(test_stream_short_file);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
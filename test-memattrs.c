@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-memattrs.c - test batching memory attribute updates
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <stdio.h>
+
+#define MOCK_BASE 0x10000000ULL
+#define MOCK_PAGES 16
+
+/*
+ * A page table for MOCK_PAGES pages at MOCK_BASE, holding the UEFI
+ * attributes of each, and a count of how often it was walked.
+ */
+static UINT64 mock_pages[MOCK_PAGES];
+static UINTN n_get, n_set, n_clear;
+
+static bool
+mock_range(EFI_PHYSICAL_ADDRESS addr, UINT64 size, UINTN *first, UINTN *n)
+{
+	if (addr < MOCK_BASE || !IS_PAGE_ALIGNED(addr) ||
+	    !IS_PAGE_ALIGNED(size) || size == 0)
+		return false;
+	*first = (addr - MOCK_BASE) / PAGE_SIZE;
+	*n = size / PAGE_SIZE;
+	return *first + *n <= MOCK_PAGES;
+}
+
+static EFI_STATUS EFIAPI
+mock_get_memory_attributes(EFI_MEMORY_ATTRIBUTE_PROTOCOL *this,
+			   EFI_PHYSICAL_ADDRESS addr, UINT64 size,
+			   UINT64 *attrs)
+{
+	UINTN first, n;
+
+	n_get += 1;
+	if (!mock_range(addr, size, &first, &n))
+		return EFI_INVALID_PARAMETER;
+	*attrs = mock_pages[first];
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_set_memory_attributes(EFI_MEMORY_ATTRIBUTE_PROTOCOL *this,
+			   EFI_PHYSICAL_ADDRESS addr, UINT64 size,
+			   UINT64 attrs)
+{
+	UINTN first, n;
+
+	n_set += 1;
+	if (!mock_range(addr, size, &first, &n))
+		return EFI_INVALID_PARAMETER;
+	for (UINTN i = first; i < first + n; i++)
+		mock_pages[i] |= attrs;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_clear_memory_attributes(EFI_MEMORY_ATTRIBUTE_PROTOCOL *this,
+			     EFI_PHYSICAL_ADDRESS addr, UINT64 size,
+			     UINT64 attrs)
+{
+	UINTN first, n;
+
+	n_clear += 1;
+	if (!mock_range(addr, size, &first, &n))
+		return EFI_INVALID_PARAMETER;
+	for (UINTN i = first; i < first + n; i++)
+		mock_pages[i] &= ~attrs;
+	return EFI_SUCCESS;
+}
+
+static EFI_MEMORY_ATTRIBUTE_PROTOCOL mock_memattrs = {
+	.GetMemoryAttributes = mock_get_memory_attributes,
+	.SetMemoryAttributes = mock_set_memory_attributes,
+	.ClearMemoryAttributes = mock_clear_memory_attributes,
+};
+
+static EFI_HANDLE mock_memattrs_handle = (EFI_HANDLE)0x2000;
+
+static EFI_STATUS EFIAPI
+mock_locate_protocol(EFI_GUID *protocol, VOID *registration,
+		     VOID **interface)
+{
+	if (!CompareGuid(protocol, &EFI_MEMORY_ATTRIBUTE_PROTOCOL_GUID))
+		return EFI_NOT_FOUND;
+	*interface = &mock_memattrs;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_locate_handle(EFI_LOCATE_SEARCH_TYPE search_type, EFI_GUID *protocol,
+		   VOID *search_key, UINTN *buffer_size, EFI_HANDLE *buffer)
+{
+	if (search_type != ByProtocol ||
+	    !CompareGuid(protocol, &EFI_MEMORY_ATTRIBUTE_PROTOCOL_GUID))
+		return EFI_NOT_FOUND;
+	if (*buffer_size < sizeof(EFI_HANDLE)) {
+		*buffer_size = sizeof(EFI_HANDLE);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	*buffer_size = sizeof(EFI_HANDLE);
+	buffer[0] = mock_memattrs_handle;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_handle_protocol(EFI_HANDLE handle, EFI_GUID *protocol,
+		     VOID **interface)
+{
+	if (handle != mock_memattrs_handle ||
+	    !CompareGuid(protocol, &EFI_MEMORY_ATTRIBUTE_PROTOCOL_GUID))
+		return EFI_UNSUPPORTED;
+	*interface = &mock_memattrs;
+	return EFI_SUCCESS;
+}
+
+static void
+reset_mock_pages(void)
+{
+	SetMem(mock_pages, sizeof(mock_pages), 0);
+	n_get = n_set = n_clear = 0;
+}
+
+/*
+ * Sections the way handle_image() sees them: in pages, with the
+ * permissions it asks for.
+ */
+typedef struct {
+	UINTN first;
+	UINTN n;
+	uint64_t set_attrs;
+	uint64_t clear_attrs;
+} mock_section_t;
+
+#define R__ MEM_ATTR_R, MEM_ATTR_W|MEM_ATTR_X
+#define RW_ MEM_ATTR_R|MEM_ATTR_W, MEM_ATTR_X
+#define R_X MEM_ATTR_R|MEM_ATTR_X, MEM_ATTR_W
+
+static const mock_section_t image_sections[] = {
+	{ 1, 2, R_X },		/* .text */
+	{ 3, 1, R_X },		/* .text.unlikely */
+	{ 4, 2, R__ },		/* .rodata */
+	{ 6, 1, R__ },		/* .sbat */
+	{ 7, 1, R__ },		/* .sdmagic */
+	{ 8, 2, RW_ },		/* .data */
+	{ 10, 1, RW_ },		/* .bss */
+};
+
+/* two sections sharing pages, where the later one wins */
+static const mock_section_t overlapping_sections[] = {
+	{ 1, 4, RW_ },
+	{ 2, 2, R_X },
+	{ 3, 3, R__ },
+};
+
+static void
+apply_directly(const mock_section_t *sections, UINTN n_sections)
+{
+	for (UINTN i = 0; i < n_sections; i++)
+		update_mem_attrs(MOCK_BASE + sections[i].first * PAGE_SIZE,
+				 sections[i].n * PAGE_SIZE,
+				 sections[i].set_attrs,
+				 sections[i].clear_attrs);
+}
+
+static EFI_STATUS
+apply_batched(const mock_section_t *sections, UINTN n_sections)
+{
+	mem_attrs_batch_t batch;
+
+	mem_attrs_batch_init(&batch, MOCK_BASE, MOCK_PAGES * PAGE_SIZE);
+	for (UINTN i = 0; i < n_sections; i++)
+		mem_attrs_batch_update(&batch,
+				       MOCK_BASE + sections[i].first * PAGE_SIZE,
+				       sections[i].n * PAGE_SIZE,
+				       sections[i].set_attrs,
+				       sections[i].clear_attrs);
+	return mem_attrs_batch_apply(&batch);
+}
+
+/*
+ * The batch has to leave every page exactly the way the same updates
+ * made one at a time would, in exactly calls protocol calls.
+ */
+static int
+compare_batched(const mock_section_t *sections, UINTN n_sections,
+		UINTN calls)
+{
+	UINT64 expected[MOCK_PAGES];
+	UINTN direct_calls;
+	EFI_STATUS efi_status;
+
+	reset_mock_pages();
+	apply_directly(sections, n_sections);
+	CopyMem(expected, mock_pages, sizeof(expected));
+	direct_calls = n_set + n_clear;
+
+	reset_mock_pages();
+	efi_status = apply_batched(sections, n_sections);
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "mem_attrs_batch_apply() failed: 0x%lx != 0x%lx\n");
+	for (UINTN i = 0; i < MOCK_PAGES; i++)
+		assert_equal_return(mock_pages[i], expected[i], -1,
+				    "page attributes 0x%lx != 0x%lx\n");
+	assert_equal_return(n_set + n_clear, calls, -1,
+			    "%lu protocol calls instead of %lu\n");
+	assert_true_return(n_set + n_clear <= direct_calls, -1,
+			   "batching took %lu calls\n");
+	assert_zero_return(n_get, -1, "%lu GetMemoryAttributes() calls\n");
+	return 0;
+}
+
+static int
+test_batch_image(void)
+{
+	/*
+	 * .text and .text.unlikely, the three read-only sections, and
+	 * .data and .bss each merge into one run, so that's one set and
+	 * one clear per run.
+	 */
+	return compare_batched(image_sections,
+			       sizeof(image_sections) / sizeof(image_sections[0]),
+			       6);
+}
+
+static int
+test_batch_overlap(void)
+{
+	return compare_batched(overlapping_sections,
+			       sizeof(overlapping_sections) / sizeof(overlapping_sections[0]),
+			       6);
+}
+
+/*
+ * Updates the batch can't hold are made right away.
+ */
+static int
+test_batch_outside(void)
+{
+	mem_attrs_batch_t batch;
+	EFI_STATUS efi_status;
+
+	reset_mock_pages();
+	mem_attrs_batch_init(&batch, MOCK_BASE + 4 * PAGE_SIZE, 4 * PAGE_SIZE);
+
+	mem_attrs_batch_update(&batch, MOCK_BASE + 4 * PAGE_SIZE,
+			       2 * PAGE_SIZE, R_X);
+	assert_zero_return(n_set + n_clear, -1,
+			   "%lu protocol calls before applying\n");
+
+	mem_attrs_batch_update(&batch, MOCK_BASE + 6 * PAGE_SIZE,
+			       4 * PAGE_SIZE, R__);
+	assert_equal_return(n_set + n_clear, (UINTN)2, -1,
+			    "%lu protocol calls instead of %lu\n");
+	assert_equal_return(mock_pages[9], EFI_MEMORY_RO|EFI_MEMORY_XP, -1,
+			    "page attributes 0x%lx != 0x%lx\n");
+
+	efi_status = mem_attrs_batch_apply(&batch);
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "mem_attrs_batch_apply() failed: 0x%lx != 0x%lx\n");
+	assert_equal_return(n_set + n_clear, (UINTN)4, -1,
+			    "%lu protocol calls instead of %lu\n");
+	assert_equal_return(mock_pages[4], EFI_MEMORY_RO, -1,
+			    "page attributes 0x%lx != 0x%lx\n");
+	return 0;
+}
+
+/*
+ * The before and after attributes are only looked up for debug output.
+ */
+static int
+test_update_queries(void)
+{
+	UINT32 saved_verbose = verbose;
+
+	reset_mock_pages();
+	verbose = 0;
+	update_mem_attrs(MOCK_BASE, PAGE_SIZE, R__);
+	assert_zero_return(n_get, -1, "%lu GetMemoryAttributes() calls\n");
+
+	verbose = 1;
+	update_mem_attrs(MOCK_BASE, PAGE_SIZE, R__);
+	verbose = saved_verbose;
+	assert_equal_return(n_get, (UINTN)2, -1,
+			    "%lu GetMemoryAttributes() calls instead of %lu\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	BS->LocateProtocol = mock_locate_protocol;
+	BS->LocateHandle = mock_locate_handle;
+	BS->HandleProtocol = mock_handle_protocol;
+
+	test(test_batch_image);
+	test(test_batch_overlap);
+	test(test_batch_outside);
+	test(test_update_queries);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -268,6 +268,20 @@ err:
 	return EFI_INVALID_PARAMETER;
 }
 
+static void
+free_mok_state_data(void)
+{
+	for (UINTN k = 0; k < n_mok_state_variables; k++) {
+		struct mok_state_variable *v =
+			&mok_state_variables[k];
+		if (v->data_size && v->data) {
+			free(v->data);
+			v->data = NULL;
+			v->data_size = 0;
+		}
+	}
+}
+
 static int
 test_mok_mirror(struct test_var *vars,
 		struct mock_mok_variable_config_entry *configs,
@@ -307,15 +321,7 @@ test_mok_mirror(struct test_var *vars,
 
 	ret = 0;
 err:
-	for (UINTN k = 0; k < n_mok_state_variables; k++) {
-		struct mok_state_variable *v =
-			&mok_state_variables[k];
-		if (v->data_size && v->data) {
-			free(v->data);
-			v->data = NULL;
-			v->data_size = 0;
-		}
-	}
+	free_mok_state_data();
 
 	test_vars = NULL;
 
@@ -660,6 +666,89 @@ test_mok_mirror_setvar_out_of_resources(void)
 	return ret;
 }
 
+static UINTN rt_writes;
+static UINTN qvi_calls;
+
+static void
+count_rt_writes(CHAR16 *name, EFI_GUID *guid, UINT32 attrs,
+		UINTN size, VOID *data, EFI_STATUS *status,
+		mock_variable_op_t op, const char * const file,
+		const int line, const char * const func)
+{
+	/*
+	 * deleting something that isn't there doesn't change anything
+	 */
+	if (EFI_ERROR(*status))
+		return;
+
+	for (UINTN i = 0; i < n_mok_state_variables; i++) {
+		struct mok_state_variable *v = &mok_state_variables[i];
+
+		if (!v->rtname || (v->flags & MOK_VARIABLE_CONFIG_ONLY))
+			continue;
+		if (!CompareGuid(v->guid, guid) ||
+		    StrnCmp(name, v->rtname, StrLen(v->rtname)) != 0)
+			continue;
+		printf("%s:%d:%s(): wrote \"%s\" again\n",
+		       file, line, func, Str2str(name));
+		rt_writes += 1;
+		break;
+	}
+}
+
+static void
+count_qvi_calls(UINT32 attrs, UINT64 *max_var_storage,
+		UINT64 *remaining_var_storage, UINT64 *max_var_size,
+		EFI_STATUS *status, const char * const file,
+		const int line, const char * const func)
+{
+	qvi_calls += 1;
+}
+
+/*
+ * If shim runs a second time in the same boot, the runtime variables it
+ * mirrored the first time are all still there and correct, so it
+ * shouldn't write any of them again.
+ */
+static int
+test_mok_mirror_unchanged(void)
+{
+	const char *mok_rt_vars[n_mok_state_variables];
+	EFI_STATUS status;
+	int ret = -1;
+
+	for (size_t i = 0; i < n_mok_state_variables; i++) {
+		mok_rt_vars[i] = mok_state_variables[i].rtname8;
+	}
+
+	mock_load_variables("test-data/efivars-1", mok_rt_vars, true);
+
+	status = import_mok_state(NULL);
+	assert_equal_goto(status, EFI_SUCCESS, err,
+			  "got 0x%016lx, expected 0x%016lx\n");
+	free_mok_state_data();
+
+	rt_writes = 0;
+	qvi_calls = 0;
+	mock_set_variable_post_hook = count_rt_writes;
+	mock_query_variable_info_post_hook = count_qvi_calls;
+
+	status = import_mok_state(NULL);
+	assert_equal_goto(status, EFI_SUCCESS, err,
+			  "got 0x%016lx, expected 0x%016lx\n");
+	assert_zero_goto(rt_writes, err,
+			 "runtime variables were written %lu times\n");
+	assert_goto(qvi_calls <= 1, err,
+		    "QueryVariableInfo() was called %lu times\n", qvi_calls);
+
+	ret = 0;
+err:
+	mock_set_variable_post_hook = NULL;
+	mock_query_variable_info_post_hook = NULL;
+	free_mok_state_data();
+	return ret;
+}
+
 int
 main(void)
 {
@@ -714,6 +803,9 @@ main(void)
 		} while (++j);
 	}
 
+	test(test_mok_mirror_unchanged);
+	mock_finalize_vars_and_configs();
+
 	return status;
 }
 
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-pkcs7-anchors.c - check that Pkcs7VerifyAnchors() finds the same
+ *			  trusted certificate checking each one on its own
+ *			  would
+ *
+ * Usage: test-pkcs7-anchors
+ *
+ * Like bench-sha, this is a host tool: Cryptlib's PKCS#7 code is built
+ * against the host's libcrypto rather than linked into a unit test, and
+ * the certificates and signatures it checks are made up as it goes.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <err.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/pkcs7.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uintptr_t UINTN;
+typedef unsigned char BOOLEAN;
+#define VOID void
+#define CONST const
+#define STATIC static
+#define EFIAPI
+#define IN
+#define OUT
+#define OPTIONAL
+#define TRUE 1
+#define FALSE 0
+#define GLOBAL_REMOVE_IF_UNREFERENCED
+
+#define CompareMem memcmp
+#define CopyMem memcpy
+#define WriteUnaligned32(p, v) (*(p) = (v))
+
+/*
+ * The declarations InternalCryptLib.h would have provided, without the
+ * rest of the firmware headers it pulls in.
+ */
+#define __INTERNAL_CRYPT_LIB_H__
+BOOLEAN WrapPkcs7Data(CONST UINT8 *P7Data, UINTN P7Length, BOOLEAN *WrapFlag,
+		      UINT8 **WrapData, UINTN *WrapDataSize);
+BOOLEAN Pkcs7VerifySignerSignatures(VOID *Pkcs7, CONST UINT8 *InData,
+				    UINTN DataLength);
+BOOLEAN Pkcs7VerifyAnchors(VOID *Pkcs7, VOID *AnchorStore,
+			   VOID **TrustedX509s, UINTN Count, UINTN *Index);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-prototypes"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "Cryptlib/Pk/CryptPkcs7VerifyCommon.c"
+#pragma GCC diagnostic pop
+
+static const UINT8 content[] = "test-pkcs7-anchors signed content";
+
+static void
+add_ext(X509 *cert, X509 *issuer, int nid, const char *value)
+{
+	X509V3_CTX ctx;
+	X509_EXTENSION *ext;
+
+	X509V3_set_ctx(&ctx, issuer, cert, NULL, NULL, 0);
+	ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, value);
+	if (!ext || !X509_add_ext(cert, ext, -1))
+		errx(1, "could not add extension \"%s\"", value);
+	X509_EXTENSION_free(ext);
+}
+
+/*
+ * Make a certificate for key with the subject "/CN=cn", signed by
+ * issuer_key and naming issuer as its issuer, or self-signed if issuer is
+ * NULL.  Nothing says which key signed it but the signature: there's no
+ * authority key identifier, so a chain can only be built by name.
+ */
+static X509 *
+make_cert(const char *cn, long serial, EVP_PKEY *key, bool ca,
+	  X509 *issuer, EVP_PKEY *issuer_key)
+{
+	X509 *cert = X509_new();
+	X509_NAME *name;
+
+	if (!cert)
+		errx(1, "could not allocate certificate");
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+	X509_set_pubkey(cert, key);
+
+	name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+				   (const unsigned char *)cn, -1, -1, 0);
+	X509_set_issuer_name(cert, issuer ? X509_get_subject_name(issuer)
+					  : name);
+
+	add_ext(cert, issuer ? issuer : cert, NID_basic_constraints,
+		ca ? "critical,CA:TRUE" : "critical,CA:FALSE");
+	if (!X509_sign(cert, issuer ? issuer_key : key, EVP_sha256()))
+		errx(1, "could not sign certificate \"%s\"", cn);
+	return cert;
+}
+
+static PKCS7 *
+sign_content(X509 *signer, EVP_PKEY *key)
+{
+	PKCS7 *p7;
+	BIO *bio;
+
+	bio = BIO_new_mem_buf(content, sizeof(content));
+	if (!bio)
+		errx(1, "could not allocate BIO");
+	p7 = PKCS7_sign(signer, key, NULL, bio, PKCS7_BINARY);
+	BIO_free(bio);
+	if (!p7)
+		errx(1, "could not sign content");
+	return p7;
+}
+
+static int
+check(const char *name, PKCS7 *p7, X509 **anchors, UINTN count,
+      BOOLEAN expected, UINTN expected_index)
+{
+	VOID *store;
+	int ret = 0;
+
+	store = Pkcs7NewAnchorStore((VOID **)anchors, count);
+	if (!store)
+		errx(1, "could not make anchor store");
+
+	for (int prebuilt = 0; prebuilt < 2; prebuilt++) {
+		UINTN index = count;
+		BOOLEAN found;
+
+		found = Pkcs7VerifyAnchors(p7, prebuilt ? store : NULL,
+					   (VOID **)anchors, count, &index);
+		if (found != expected || (found && index != expected_index)) {
+			printf("%s%s: FAILED: got %s %lu, expected %s %lu\n",
+			       name, prebuilt ? " (prebuilt store)" : "",
+			       found ? "TRUE" : "FALSE", (unsigned long)index,
+			       expected ? "TRUE" : "FALSE",
+			       (unsigned long)expected_index);
+			ret = 1;
+		} else {
+			printf("%s%s: ok\n", name,
+			       prebuilt ? " (prebuilt store)" : "");
+		}
+	}
+
+	Pkcs7FreeAnchorStore(store);
+	return ret;
+}
+
+int
+main(void)
+{
+	EVP_PKEY *key_a, *key_b, *leaf_key;
+	X509 *root_a, *root_b, *leaf;
+	PKCS7 *p7;
+	int ret = 0;
+
+	key_a = EVP_EC_gen("P-256");
+	key_b = EVP_EC_gen("P-256");
+	leaf_key = EVP_EC_gen("P-256");
+	if (!key_a || !key_b || !leaf_key)
+		errx(1, "could not generate keys");
+
+	/*
+	 * Two roots with the same subject, where only the second one signed
+	 * the leaf.
+	 */
+	root_a = make_cert("root", 1, key_a, true, NULL, NULL);
+	root_b = make_cert("root", 2, key_b, true, NULL, NULL);
+	leaf = make_cert("leaf", 3, leaf_key, false, root_b, key_b);
+	p7 = sign_content(leaf, leaf_key);
+
+	if (!Pkcs7VerifySignerSignatures(p7, content, sizeof(content))) {
+		printf("signatures: FAILED\n");
+		ret = 1;
+	}
+
+	{
+		X509 *anchors[] = { root_a, root_b };
+		ret |= check("same subject, second signed", p7, anchors, 2,
+			     TRUE, 1);
+	}
+	{
+		X509 *anchors[] = { root_b, root_a };
+		ret |= check("same subject, first signed", p7, anchors, 2,
+			     TRUE, 0);
+	}
+	{
+		X509 *anchors[] = { NULL, root_a, NULL, root_b };
+		ret |= check("same subject, with gaps", p7, anchors, 4,
+			     TRUE, 3);
+	}
+	{
+		X509 *anchors[] = { root_a };
+		ret |= check("same subject, didn't sign", p7, anchors, 1,
+			     FALSE, 0);
+	}
+
+	PKCS7_free(p7);
+	X509_free(leaf);
+	X509_free(root_b);
+	X509_free(root_a);
+	EVP_PKEY_free(leaf_key);
+	EVP_PKEY_free(key_b);
+	EVP_PKEY_free(key_a);
+	return ret;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -985,6 +985,145 @@ err:
 	return rc;
 }
 
+/*
+ * The compiled SbatLevel table has to reach the same verdict as walking
+ * the list for every combination of these.
+ */
+static const char *sbat_var_table_levels[] = {
+	SBAT_VAR_ORIGINAL,
+	SBAT_VAR_AUTOMATIC,
+	SBAT_VAR_LATEST,
+	"sbat,1,2021030218\ntest1,5\nbar,2\n",
+	/* out of order, a duplicate, and a generation that isn't a number */
+	"sbat,1,2021030218\nzzz,1\ntest2,3\ntest1,2\naaa,4\ntest2,1\nshim,x\n",
+	/* too big for the UINT16 both sides are compared as */
+	"sbat,1,2021030218\nshim,70000\ngrub,65539\n",
+};
+
+static const char *sbat_var_table_sections[] = {
+	"test1,1,SBAT test1,acme1,1,testURL1\n"
+	"test2,2,SBAT test2,acme2,2,testURL2\n",
+	"test2,2,SBAT test2,acme2,2,testURL2\n",
+	"test1,5,SBAT test1,acme1,1,testURL1\n"
+	"test2,3,SBAT test2,acme2,2,testURL2\n"
+	"aaa,4,SBAT aaa,acme3,3,testURL3\n"
+	"zzz,0,SBAT zzz,acme4,4,testURL4\n",
+	"grub,3,Free Software Foundation,grub,2.06,https://www.gnu.org/software/grub/\n",
+	"grub,4,Free Software Foundation,grub,2.06,https://www.gnu.org/software/grub/\n"
+	"grub.rh,2,Red Hat,grub2,2.06-61.el9,mailto:secalert@redhat.com\n",
+	"grub,5,Free Software Foundation,grub,2.12,https://www.gnu.org/software/grub/\n"
+	"grub.peimage,1,Canonical,grub2,2.12,https://salsa.debian.org/grub-team/grub\n",
+	"shim,3,UEFI shim,shim,1,https://github.com/rhboot/shim\n",
+	"shim,4464,UEFI shim,shim,1,https://github.com/rhboot/shim\n",
+	"nothing,1,Nobody,nothing,1,https://example.com/\n",
+};
+
+static int
+compare_sbat_var_table(const char *level, char *section, size_t section_size,
+		       size_t *n_violations)
+{
+	struct sbat_section_entry **entries = NULL;
+	struct sbat_var_table table = { 0, NULL };
+	EFI_STATUS list_status, table_status;
+	size_t n_entries = 0;
+	size_t level_size = strlen(level) + 1;
+	char *level_copy, *section_copy;
+	list_t level_list;
+	int rc = -1;
+
+	INIT_LIST_HEAD(&level_list);
+	level_copy = calloc(1, level_size);
+	section_copy = calloc(1, section_size + 1);
+	if (!level_copy || !section_copy)
+		goto err;
+	memcpy(level_copy, level, level_size);
+	memcpy(section_copy, section, section_size);
+
+	list_status = parse_sbat_var_data(&level_list, (UINT8 *)level_copy,
+					  level_size);
+	assert_equal_goto(list_status, EFI_SUCCESS, err,
+			  "got %#lx expected %#lx\n");
+	list_status = parse_sbat_section(section_copy, section_size,
+					 &n_entries, &entries);
+	assert_equal_goto(list_status, EFI_SUCCESS, err,
+			  "got %#lx expected %#lx\n");
+	table_status = compile_sbat_var(&level_list, &table);
+	assert_equal_goto(table_status, EFI_SUCCESS, err,
+			  "got %#lx expected %#lx\n");
+
+	for (size_t i = 1; i < table.n; i++)
+		assert_goto(strcmp(table.entries[i - 1].component_name,
+				   table.entries[i].component_name) < 0, err,
+			    "table isn't sorted at %zu\n", i);
+
+	list_status = verify_sbat_helper(&level_list, n_entries, entries);
+	table_status = verify_sbat_table(&table, n_entries, entries);
+	assert_equal_goto(table_status, list_status, err,
+			  "table says %#lx but the list says %#lx\n");
+	if (list_status == EFI_SECURITY_VIOLATION)
+		*n_violations += 1;
+
+	rc = 0;
+err:
+	cleanup_sbat_var_table(&table);
+	cleanup_sbat_section_entries(n_entries, entries);
+	cleanup_sbat_var(&level_list);
+	free(section_copy);
+	free(level_copy);
+	if (rc < 0)
+		printf("level:\n%ssection:\n%s", level, section);
+	return rc;
+}
+
+int
+test_sbat_var_table(void)
+{
+	size_t n_levels = sizeof(sbat_var_table_levels) / sizeof(sbat_var_table_levels[0]);
+	size_t n_sections = sizeof(sbat_var_table_sections) / sizeof(sbat_var_table_sections[0]);
+	size_t n_violations = 0;
+	char *csv = NULL;
+	long csv_size;
+	FILE *f;
+	int rc = -1;
+
+	f = fopen("data/sbat.csv", "r");
+	if (!f)
+		return -1;
+	if (fseek(f, 0, SEEK_END) < 0 || (csv_size = ftell(f)) <= 0 ||
+	    fseek(f, 0, SEEK_SET) < 0)
+		goto err;
+	csv = calloc(1, csv_size + 1);
+	if (!csv || fread(csv, 1, csv_size, f) != (size_t)csv_size)
+		goto err;
+
+	for (size_t i = 0; i < n_levels; i++) {
+		if (compare_sbat_var_table(sbat_var_table_levels[i], csv,
+					   csv_size, &n_violations) < 0)
+			goto err;
+
+		for (size_t j = 0; j < n_sections; j++) {
+			const char *section = sbat_var_table_sections[j];
+
+			if (compare_sbat_var_table(sbat_var_table_levels[i],
+						   (char *)section,
+						   strlen(section),
+						   &n_violations) < 0)
+				goto err;
+		}
+	}
+
+	/* make sure we've seen both answers */
+	assert_nonzero_goto(n_violations, err, "%zu: nothing was revoked\n");
+	assert_goto(n_violations < n_levels * (n_sections + 1), err,
+		    "everything was revoked\n");
+
+	rc = 0;
+err:
+	free(csv);
+	fclose(f);
+	return rc;
+}
+
 int
 test_preserve_sbat_uefi_variable_good(void)
 {
@@ -1155,6 +1294,61 @@ test_sbat_var_asciz(void)
 	return 0;
 }
 
+/*
+ * A stricter SbatLevel applied after shim has compiled the old one has
+ * to take effect right away.
+ */
+static int
+test_sbat_var_table_reapplied(void)
+{
+	char automatic[] = "sbat,1,2021030218\ncomponent,1\n";
+	char latest[] = "sbat,1,2022050100\ncomponent,2\n";
+	char section[] = "component,1,SBAT component,acme,1,testURL\n";
+	struct sbat_section_entry **entries = NULL;
+	size_t n_entries = 0;
+	UINTN generation;
+	EFI_STATUS status;
+	int rc = -1;
+
+	INIT_LIST_HEAD(&sbat_var);
+
+	/* start from the older level already in the variable */
+	del_variable(SBAT_VAR_NAME, SHIM_LOCK_GUID);
+	status = set_sbat_uefi_variable(automatic, automatic);
+	assert_equal_goto(status, EFI_SUCCESS, err, "got %#lx expected %#lx\n");
+
+	status = parse_sbat_var(&sbat_var, NULL);
+	assert_equal_goto(status, EFI_SUCCESS, err, "got %#lx expected %#lx\n");
+	status = compile_sbat_var(&sbat_var, &sbat_var_table);
+	assert_equal_goto(status, EFI_SUCCESS, err, "got %#lx expected %#lx\n");
+
+	status = parse_sbat_section(section, sizeof(section) - 1, &n_entries,
+				    &entries);
+	assert_equal_goto(status, EFI_SUCCESS, err, "got %#lx expected %#lx\n");
+	status = verify_sbat(n_entries, entries);
+	assert_equal_goto(status, EFI_SUCCESS, err,
+			  "older level: got %#lx expected %#lx\n");
+
+	generation = policy_generation;
+	status = set_sbat_uefi_variable(latest, latest);
+	assert_equal_goto(status, EFI_SUCCESS, err, "got %#lx expected %#lx\n");
+	assert_goto(sbat_var_table.entries != NULL, err,
+		    "the new level wasn't compiled\n");
+	assert_goto(policy_generation != generation, err,
+		    "policy_generation wasn't bumped\n");
+
+	status = verify_sbat(n_entries, entries);
+	assert_equal_goto(status, EFI_SECURITY_VIOLATION, err,
+			  "newer level: got %#lx expected %#lx\n");
+
+	rc = 0;
+err:
+	cleanup_sbat_section_entries(n_entries, entries);
+	cleanup_sbat_var_table(&sbat_var_table);
+	cleanup_sbat_var(&sbat_var);
+	return rc;
+}
+
 int
 main(void)
 {
@@ -1193,6 +1387,7 @@ main(void)
 	test(test_verify_sbat_reject_diff_name_mixed);
 #endif
 	test(test_parse_and_verify);
+	test(test_sbat_var_table);
 
 	test(test_preserve_sbat_uefi_variable_good);
 	test(test_preserve_sbat_uefi_variable_newer);
@@ -1206,6 +1401,7 @@ main(void)
 	test(test_preserve_sbat_uefi_variable_version_olderlonger);
 
 	test(test_sbat_var_asciz);
+	test(test_sbat_var_table_reapplied);
 
 	return status;
 }
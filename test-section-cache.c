@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-section-cache.c - test the verified section cache
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <stdio.h>
+
+#define N_PARENTS 32
+#define N_SECTIONS 64
+/* eight sections of each size per parent */
+#define N_SIZES 8
+#define SECTION_SIZE(s) (64 + ((s) % N_SIZES) * 16)
+#define MAX_SECTION_SIZE SECTION_SIZE(N_SIZES - 1)
+
+static UINT8 sections[N_PARENTS][N_SECTIONS][MAX_SECTION_SIZE];
+static UINTN n_hashes;
+
+/*
+ * test.c's sha256_sum() stands in for lib/sha256.c's; counting its calls
+ * tells us how often we hash.
+ */
+static void
+count_hashes(void *addr, UINTN size)
+{
+	n_hashes += 1;
+}
+
+static EFI_HANDLE
+parent(UINTN p)
+{
+	return (EFI_HANDLE)(uintptr_t)(0x1000 * (p + 1));
+}
+
+static int
+cache_all_sections(void)
+{
+	UINT8 name[8] = ".data";
+	EFI_STATUS efi_status;
+
+	for (UINTN p = 0; p < N_PARENTS; p++) {
+		for (UINTN s = 0; s < N_SECTIONS; s++) {
+			for (UINTN i = 0; i < MAX_SECTION_SIZE; i++)
+				sections[p][s][i] = (p * 131 + s * 17 + i) & 0xff;
+			efi_status = cache_section(parent(p), name,
+						   sections[p][s],
+						   SECTION_SIZE(s));
+			assert_equal_return(efi_status, EFI_SUCCESS, -1,
+					    "cache_section() failed: 0x%lx != 0x%lx\n");
+		}
+	}
+	return 0;
+}
+
+/*
+ * Look up one buffer, checking both the result and that we hashed it at
+ * most once.
+ */
+static int
+check_lookup(UINTN p, void *addr, UINTN size, EFI_STATUS expected,
+	     UINTN expected_hashes)
+{
+	UINTN before = n_hashes;
+	EFI_STATUS efi_status;
+
+	efi_status = validate_cached_section(parent(p), addr, size);
+	assert_equal_return(efi_status, expected, -1,
+			    "validate_cached_section(): 0x%lx != 0x%lx\n");
+	assert_equal_return(n_hashes - before, expected_hashes, -1,
+			    "hashed %lu times instead of %lu\n");
+	return 0;
+}
+
+static int
+test_many_sections(void)
+{
+	UINT8 altered[MAX_SECTION_SIZE];
+	int ret = -1;
+
+	if (cache_all_sections() < 0)
+		goto err;
+
+	for (UINTN p = 0; p < N_PARENTS; p++) {
+		for (UINTN s = 0; s < N_SECTIONS; s++) {
+			UINTN size = SECTION_SIZE(s);
+
+			if (check_lookup(p, sections[p][s], size,
+					 EFI_SUCCESS, 1) < 0)
+				goto err;
+
+			CopyMem(altered, sections[p][s], size);
+			altered[size - 1] ^= 0xff;
+			if (check_lookup(p, altered, size, EFI_NOT_FOUND, 1) < 0)
+				goto err;
+		}
+
+		/* no section of this size, so nothing to hash */
+		if (check_lookup(p, sections[p][0], 8, EFI_NOT_FOUND, 0) < 0)
+			goto err;
+	}
+
+	/* another parent's section isn't ours */
+	if (check_lookup(1, sections[0][0], SECTION_SIZE(0),
+			 EFI_NOT_FOUND, 1) < 0)
+		goto err;
+	if (check_lookup(N_PARENTS, sections[0][0], SECTION_SIZE(0),
+			 EFI_NOT_FOUND, 0) < 0)
+		goto err;
+
+	ret = 0;
+err:
+	for (UINTN p = 0; p < N_PARENTS; p++)
+		flush_cached_sections(parent(p));
+	return ret;
+}
+
+static int
+test_flush_sections(void)
+{
+	int ret = -1;
+
+	if (cache_all_sections() < 0)
+		goto err;
+
+	/* flushing a parent we never cached anything for changes nothing */
+	flush_cached_sections(parent(N_PARENTS));
+
+	for (UINTN p = 0; p < N_PARENTS; p += 2)
+		flush_cached_sections(parent(p));
+
+	for (UINTN p = 0; p < N_PARENTS; p++) {
+		for (UINTN s = 0; s < N_SECTIONS; s++) {
+			bool flushed = (p % 2) == 0;
+
+			if (check_lookup(p, sections[p][s], SECTION_SIZE(s),
+					 flushed ? EFI_NOT_FOUND : EFI_SUCCESS,
+					 flushed ? 0 : 1) < 0)
+				goto err;
+		}
+	}
+
+	for (UINTN p = 1; p < N_PARENTS; p += 2)
+		flush_cached_sections(parent(p));
+
+	for (UINTN p = 0; p < N_PARENTS; p++) {
+		if (check_lookup(p, sections[p][0], SECTION_SIZE(0),
+				 EFI_NOT_FOUND, 0) < 0)
+			goto err;
+	}
+
+	/* and the cache still works after being emptied */
+	if (cache_all_sections() < 0)
+		goto err;
+	if (check_lookup(N_PARENTS - 1, sections[N_PARENTS - 1][N_SECTIONS - 1],
+			 SECTION_SIZE(N_SECTIONS - 1), EFI_SUCCESS, 1) < 0)
+		goto err;
+
+	ret = 0;
+err:
+	for (UINTN p = 0; p < N_PARENTS; p++)
+		flush_cached_sections(parent(p));
+	return ret;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	sha256_sum_hook = count_hashes;
+	test(test_many_sections);
+	test(test_flush_sections);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-tpm.c - test TPM measurement bookkeeping
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <stdio.h>
+
+#define N_VARIABLES 200
+
+static UINTN n_locates;
+static UINTN n_get_caps;
+static UINTN n_events;
+
+static EFI_STATUS EFIAPI
+mock_get_capability(efi_tpm2_protocol_t *this,
+		    EFI_TCG2_BOOT_SERVICE_CAPABILITY *caps)
+{
+	n_get_caps += 1;
+	SetMem(caps, sizeof(*caps), 0);
+	caps->Size = sizeof(*caps);
+	caps->StructureVersion.Major = 1;
+	caps->StructureVersion.Minor = 1;
+	caps->TPMPresentFlag = TRUE;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_hash_log_extend_event(efi_tpm2_protocol_t *this, uint64_t flags,
+			   EFI_PHYSICAL_ADDRESS data, uint64_t datalen,
+			   EFI_TCG2_EVENT *event)
+{
+	n_events += 1;
+	return EFI_SUCCESS;
+}
+
+static efi_tpm2_protocol_t mock_tpm2 = {
+	.get_capability = mock_get_capability,
+	.hash_log_extend_event = mock_hash_log_extend_event,
+};
+
+static EFI_HANDLE mock_tpm2_handle = (EFI_HANDLE)0x1000;
+
+/*
+ * LibLocateProtocol() may go through either LocateProtocol() or
+ * LocateHandle() and HandleProtocol(), so both have to find our TPM.
+ */
+static EFI_STATUS EFIAPI
+mock_locate_protocol(EFI_GUID *protocol, VOID *registration,
+		     VOID **interface)
+{
+	n_locates += 1;
+	if (!CompareGuid(protocol, &EFI_TPM2_GUID))
+		return EFI_NOT_FOUND;
+	*interface = &mock_tpm2;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_locate_handle(EFI_LOCATE_SEARCH_TYPE search_type, EFI_GUID *protocol,
+		   VOID *search_key, UINTN *buffer_size, EFI_HANDLE *buffer)
+{
+	n_locates += 1;
+	if (search_type != ByProtocol ||
+	    !CompareGuid(protocol, &EFI_TPM2_GUID))
+		return EFI_NOT_FOUND;
+	if (*buffer_size < sizeof(EFI_HANDLE)) {
+		*buffer_size = sizeof(EFI_HANDLE);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	*buffer_size = sizeof(EFI_HANDLE);
+	buffer[0] = mock_tpm2_handle;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+mock_handle_protocol(EFI_HANDLE handle, EFI_GUID *protocol,
+		     VOID **interface)
+{
+	if (handle != mock_tpm2_handle ||
+	    !CompareGuid(protocol, &EFI_TPM2_GUID))
+		return EFI_UNSUPPORTED;
+	*interface = &mock_tpm2;
+	return EFI_SUCCESS;
+}
+
+static void
+fill_variable(UINT8 *data, UINTN size, UINTN seed)
+{
+	for (UINTN i = 0; i < size; i++)
+		data[i] = (seed * 131 + i * 17) & 0xff;
+}
+
+static int
+measure(CHAR16 *name, EFI_GUID guid, UINT8 *data, UINTN size,
+	UINTN expected_events)
+{
+	UINTN before = n_events;
+	EFI_STATUS efi_status;
+
+	efi_status = tpm_measure_variable(name, guid, size, data);
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "tpm_measure_variable() failed: 0x%lx != 0x%lx\n");
+	assert_equal_return(n_events - before, expected_events, -1,
+			    "logged %lu events instead of %lu\n");
+	return 0;
+}
+
+static int
+test_measure_once(void)
+{
+	UINT8 data[64];
+	UINT8 other[64];
+
+	fill_variable(data, sizeof(data), 1);
+	CopyMem(other, data, sizeof(other));
+	other[sizeof(other) - 1] ^= 1;
+
+	if (measure(L"db", SECURE_BOOT_GUID, data, sizeof(data), 1) < 0 ||
+	    measure(L"db", SECURE_BOOT_GUID, data, sizeof(data), 0) < 0)
+		return -1;
+
+	/* anything different about it is a new measurement */
+	if (measure(L"db", SECURE_BOOT_GUID, other, sizeof(other), 1) < 0 ||
+	    measure(L"db", SECURE_BOOT_GUID, data, sizeof(data) - 1, 1) < 0 ||
+	    measure(L"dbx", SECURE_BOOT_GUID, data, sizeof(data), 1) < 0 ||
+	    measure(L"db", SHIM_LOCK_GUID, data, sizeof(data), 1) < 0)
+		return -1;
+
+	/* and all of those are remembered too */
+	if (measure(L"db", SECURE_BOOT_GUID, other, sizeof(other), 0) < 0 ||
+	    measure(L"db", SECURE_BOOT_GUID, data, sizeof(data) - 1, 0) < 0 ||
+	    measure(L"dbx", SECURE_BOOT_GUID, data, sizeof(data), 0) < 0 ||
+	    measure(L"db", SHIM_LOCK_GUID, data, sizeof(data), 0) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int
+test_measure_many(void)
+{
+	static UINT8 data[N_VARIABLES][48];
+
+	for (UINTN i = 0; i < N_VARIABLES; i++) {
+		fill_variable(data[i], sizeof(data[i]), i + 100);
+		if (measure(L"MokListRT", SHIM_LOCK_GUID, data[i],
+			    sizeof(data[i]), 1) < 0)
+			return -1;
+	}
+
+	for (UINTN i = 0; i < N_VARIABLES; i++) {
+		if (measure(L"MokListRT", SHIM_LOCK_GUID, data[i],
+			    sizeof(data[i]), 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Everything above ran with the same protocols; they should only have
+ * been looked for, and the TPM asked about its capabilities, once.
+ */
+static int
+test_locate_once(void)
+{
+	UINTN locates = n_locates;
+	UINTN get_caps = n_get_caps;
+	CHAR8 description[] = "test event";
+
+	assert_nonzero_return(locates, -1, "%lu: protocols were never located\n");
+	assert_equal_return(get_caps, (UINTN)1, -1,
+			    "get_capability() called %lu times instead of %lu\n");
+
+	for (UINTN i = 0; i < 16; i++) {
+		EFI_STATUS efi_status;
+
+		efi_status = tpm_log_event((EFI_PHYSICAL_ADDRESS)(uintptr_t)description,
+					   sizeof(description), 8, description);
+		assert_equal_return(efi_status, EFI_SUCCESS, -1,
+				    "tpm_log_event() failed: 0x%lx != 0x%lx\n");
+	}
+
+	assert_equal_return(n_locates, locates, -1,
+			    "protocols located %lu times instead of %lu\n");
+	assert_equal_return(n_get_caps, get_caps, -1,
+			    "get_capability() called %lu times instead of %lu\n");
+	return 0;
+}
+
+/*
+ * A TPM 2 hashes images itself, so it never needs our SHA-1 digest.
+ */
+static int
+test_wants_sha1(void)
+{
+	assert_false_return(tpm_wants_sha1(), -1,
+			    "tpm_wants_sha1() with a TPM 2: %d\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	BS->LocateProtocol = mock_locate_protocol;
+	BS->LocateHandle = mock_locate_handle;
+	BS->HandleProtocol = mock_handle_protocol;
+
+	test(test_measure_once);
+	test(test_measure_many);
+	test(test_locate_once);
+	test(test_wants_sha1);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
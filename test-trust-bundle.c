@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-trust-bundle.c - test applying a trust bundle's revocations and
+ * certificates
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <stdio.h>
+
+#define IMAGE_SIZE 4096
+#define SECTIONS_OFFSET 0x100
+#define SBATA_OFFSET 0x400
+#define SBATL_OFFSET 0x500
+#define DB_OFFSET 0x600
+#define SECTION_SIZE 0x100
+#define DB_LIST_SIZE (sizeof(EFI_SIGNATURE_LIST) + 16 + SHA256_DIGEST_SIZE)
+
+/*
+ * sbat.c and verify_image() are stand-ins here.  set_sbat_uefi_variable()
+ * counts its calls and returns sbat_status; verify_image() notes how many
+ * revocations had been applied and how many certificates were trusted
+ * when it was called, and once revocations have been applied it returns
+ * revoked_status, as though the bundle's own revocations covered it.
+ */
+static UINTN n_sbat_updates;
+static EFI_STATUS sbat_status;
+static char *sbat_automatic;
+static char *sbat_latest;
+
+static UINTN n_verify;
+static UINTN sbat_updates_when_verified;
+static UINT32 certs_when_verified;
+static EFI_STATUS revoked_status;
+
+EFI_STATUS
+set_sbat_uefi_variable(char *sbat_var_automatic, char *sbat_var_latest)
+{
+	n_sbat_updates += 1;
+	sbat_automatic = sbat_var_automatic;
+	sbat_latest = sbat_var_latest;
+	return sbat_status;
+}
+
+EFI_STATUS
+set_ssp_uefi_variable(uint8_t *ssp_ver_automatic, uint8_t *ssp_sig_automatic,
+		      uint8_t *ssp_ver_latest, uint8_t *ssp_sig_latest)
+{
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS
+verify_image(void *data, unsigned int datasize, EFI_LOADED_IMAGE *li,
+	     PE_COFF_LOADER_IMAGE_CONTEXT *context)
+{
+	n_verify += 1;
+	sbat_updates_when_verified = n_sbat_updates;
+	certs_when_verified = user_cert_size;
+	return n_sbat_updates ? revoked_status : EFI_SUCCESS;
+}
+
+/*
+ * A bundle with .sbata and .sbatl revocation sections and a .db section
+ * holding one EFI_SIGNATURE_LIST.
+ */
+typedef struct {
+	UINT8 data[IMAGE_SIZE];
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+} mock_bundle_t;
+
+static void
+mock_section(EFI_IMAGE_SECTION_HEADER *section, const char *name,
+	     UINT32 offset, UINT32 size)
+{
+	SetMem(section, sizeof(*section), 0);
+	CopyMem(section->Name, name, 8);
+	section->Misc.VirtualSize = size;
+	section->SizeOfRawData = SECTION_SIZE;
+	section->PointerToRawData = offset;
+}
+
+static void
+mock_bundle_init(mock_bundle_t *bundle)
+{
+	EFI_IMAGE_SECTION_HEADER *sections;
+	EFI_SIGNATURE_LIST *list;
+
+	SetMem(bundle, sizeof(*bundle), 0);
+	sections = (EFI_IMAGE_SECTION_HEADER *)&bundle->data[SECTIONS_OFFSET];
+
+	mock_section(&sections[0], ".sbata\0\0", SBATA_OFFSET,
+		     sizeof(SBAT_VAR_ORIGINAL));
+	CopyMem(&bundle->data[SBATA_OFFSET], SBAT_VAR_ORIGINAL,
+		sizeof(SBAT_VAR_ORIGINAL));
+	mock_section(&sections[1], ".sbatl\0\0", SBATL_OFFSET,
+		     sizeof(SBAT_VAR_ORIGINAL));
+	CopyMem(&bundle->data[SBATL_OFFSET], SBAT_VAR_ORIGINAL,
+		sizeof(SBAT_VAR_ORIGINAL));
+
+	mock_section(&sections[2], ".db\0\0\0\0\0", DB_OFFSET, DB_LIST_SIZE);
+	list = (EFI_SIGNATURE_LIST *)&bundle->data[DB_OFFSET];
+	list->SignatureType = EFI_CERT_SHA256_GUID;
+	list->SignatureListSize = DB_LIST_SIZE;
+	list->SignatureSize = 16 + SHA256_DIGEST_SIZE;
+	SetMem((UINT8 *)list + sizeof(*list), 16 + SHA256_DIGEST_SIZE, 0x5a);
+
+	bundle->context.FirstSection = sections;
+	bundle->context.NumberOfSections = 3;
+}
+
+static void
+reset_state(void)
+{
+	if (user_cert)
+		FreePool(user_cert);
+	user_cert = NULL;
+	user_cert_size = 0;
+
+	n_sbat_updates = 0;
+	sbat_status = EFI_SUCCESS;
+	sbat_automatic = NULL;
+	sbat_latest = NULL;
+	n_verify = 0;
+	sbat_updates_when_verified = 0;
+	certs_when_verified = 0;
+	revoked_status = EFI_SUCCESS;
+}
+
+/*
+ * The revocations are applied, then the bundle is checked again, and
+ * only then are its certificates trusted.
+ */
+static int
+test_bundle_revocations_then_certs(void)
+{
+	static mock_bundle_t bundle;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	reset_state();
+	mock_bundle_init(&bundle);
+
+	efi_status = apply_trust_bundle(bundle.data, IMAGE_SIZE, NULL,
+					&bundle.context);
+	assert_equal_goto(efi_status, EFI_SUCCESS, err,
+			  "apply_trust_bundle() failed: 0x%lx != 0x%lx\n");
+
+	assert_equal_goto(n_sbat_updates, (UINTN)1, err,
+			  "SbatLevel was updated %lu times, not %lu\n");
+	assert_goto(sbat_automatic == (char *)&bundle.data[SBATA_OFFSET], err,
+		    "wrong .sbata section\n");
+	assert_goto(sbat_latest == (char *)&bundle.data[SBATL_OFFSET], err,
+		    "wrong .sbatl section\n");
+
+	assert_equal_goto(n_verify, (UINTN)1, err,
+			  "bundle was verified %lu times, not %lu\n");
+	assert_equal_goto(sbat_updates_when_verified, (UINTN)1, err,
+			  "%lu revocations applied before verifying, not %lu\n");
+	assert_equal_goto(certs_when_verified, 0, err,
+			  "%u bytes of certificates trusted before verifying, not %u\n");
+
+	assert_equal_goto(user_cert_size, (UINT32)DB_LIST_SIZE, err,
+			  "user_cert_size is %u, not %u\n");
+	assert_zero_goto(CompareMem(user_cert, &bundle.data[DB_OFFSET],
+				    DB_LIST_SIZE), err,
+			 "user_cert differs from the .db section: %ld\n");
+
+	ret = 0;
+err:
+	reset_state();
+	return ret;
+}
+
+/*
+ * If the revocations can't be applied, none of the certificates are
+ * trusted.
+ */
+static int
+test_bundle_revocations_rejected(void)
+{
+	static mock_bundle_t bundle;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	reset_state();
+	mock_bundle_init(&bundle);
+	sbat_status = EFI_INVALID_PARAMETER;
+
+	efi_status = apply_trust_bundle(bundle.data, IMAGE_SIZE, NULL,
+					&bundle.context);
+	assert_equal_goto(efi_status, EFI_INVALID_PARAMETER, err,
+			  "apply_trust_bundle() returned 0x%lx, not 0x%lx\n");
+	assert_equal_goto(n_verify, (UINTN)0, err,
+			  "bundle was verified %lu times, not %lu\n");
+	assert_equal_goto(user_cert_size, 0, err,
+			  "user_cert_size is %u, not %u\n");
+
+	ret = 0;
+err:
+	reset_state();
+	return ret;
+}
+
+/*
+ * A bundle its own revocations cover doesn't get its certificates
+ * trusted either.
+ */
+static int
+test_bundle_revokes_itself(void)
+{
+	static mock_bundle_t bundle;
+	EFI_STATUS efi_status;
+	int ret = -1;
+
+	reset_state();
+	mock_bundle_init(&bundle);
+	revoked_status = EFI_SECURITY_VIOLATION;
+
+	efi_status = apply_trust_bundle(bundle.data, IMAGE_SIZE, NULL,
+					&bundle.context);
+	assert_equal_goto(efi_status, EFI_SECURITY_VIOLATION, err,
+			  "apply_trust_bundle() returned 0x%lx, not 0x%lx\n");
+	assert_equal_goto(n_sbat_updates, (UINTN)1, err,
+			  "SbatLevel was updated %lu times, not %lu\n");
+	assert_equal_goto(user_cert_size, 0, err,
+			  "user_cert_size is %u, not %u\n");
+
+	ret = 0;
+err:
+	reset_state();
+	return ret;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	test(test_bundle_revocations_then_certs);
+	test(test_bundle_revocations_rejected);
+	test(test_bundle_revokes_itself);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
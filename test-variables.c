@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-variables.c - test lib/variables.c
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+#include "mock-variables.h"
+
+#include <stdio.h>
+
+static UINTN secureboot_reads;
+static UINTN setupmode_reads;
+
+static void
+count_platform_reads(CHAR16 *name, EFI_GUID *guid, UINT32 *attrs,
+		     UINTN *size, VOID *data, EFI_STATUS *status,
+		     const char * const file, const int line,
+		     const char * const func)
+{
+	if (!CompareGuid(guid, &GV_GUID))
+		return;
+	if (StrCmp(name, L"SecureBoot") == 0)
+		secureboot_reads += 1;
+	else if (StrCmp(name, L"SetupMode") == 0)
+		setupmode_reads += 1;
+}
+
+/*
+ * secure_mode() asks about SecureBoot and SetupMode for every image, but
+ * however many images are loaded, the firmware should be asked about
+ * each of them once.  Only a write to a global variable means asking
+ * again.
+ */
+#define N_SECURE_MODE_CALLS 100
+static int
+test_platform_state_reads(void)
+{
+	const char *filters[] = { "SecureBoot", "SetupMode", NULL };
+	UINT8 value = 0;
+	EFI_STATUS status;
+	int ret = -1;
+
+	mock_load_variables("test-data/efivars-1", filters, false);
+	invalidate_platform_state();
+
+	secureboot_reads = 0;
+	setupmode_reads = 0;
+	mock_get_variable_post_hook = count_platform_reads;
+
+	for (UINTN i = 0; i < N_SECURE_MODE_CALLS; i++) {
+		assert_equal_goto(variable_is_secureboot(), 1, err,
+				  "SecureBoot is %d, not %d\n");
+		assert_equal_goto(variable_is_setupmode(0), 0, err,
+				  "SetupMode is %d, not %d\n");
+	}
+	assert_equal_goto(secureboot_reads, (UINTN)1, err,
+			  "SecureBoot was read %lu times, not %lu\n");
+	assert_equal_goto(setupmode_reads, (UINTN)1, err,
+			  "SetupMode was read %lu times, not %lu\n");
+
+	/* shim's own variables don't matter... */
+	status = set_variable(L"ShimTestState", SHIM_LOCK_GUID,
+			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			      EFI_VARIABLE_NON_VOLATILE,
+			      sizeof(value), &value);
+	assert_equal_goto(status, EFI_SUCCESS, err,
+			  "got 0x%016lx, expected 0x%016lx\n");
+	variable_is_secureboot();
+	variable_is_setupmode(0);
+	assert_equal_goto(secureboot_reads + setupmode_reads, (UINTN)2, err,
+			  "platform state was read %lu times, not %lu\n");
+
+	/* ...but a global variable could have changed them. */
+	status = set_variable(L"SetupMode", GV_GUID,
+			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			      EFI_VARIABLE_RUNTIME_ACCESS,
+			      sizeof(value), &value);
+	assert_equal_goto(status, EFI_SUCCESS, err,
+			  "got 0x%016lx, expected 0x%016lx\n");
+	for (UINTN i = 0; i < N_SECURE_MODE_CALLS; i++) {
+		variable_is_secureboot();
+		variable_is_setupmode(0);
+	}
+	assert_equal_goto(secureboot_reads + setupmode_reads, (UINTN)4, err,
+			  "platform state was read %lu times, not %lu\n");
+
+	ret = 0;
+err:
+	mock_get_variable_post_hook = NULL;
+	mock_reset_variables();
+	invalidate_platform_state();
+	return ret;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	test(test_platform_state_reads);
+	mock_finalize_vars_and_configs();
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * test-verify-buffer.c - test what verify_buffer() remembers between
+ * calls
+ */
+
+#ifndef SHIM_UNIT_TEST
+#define SHIM_UNIT_TEST
+#endif
+#include "shim.h"
+
+#include <stdio.h>
+
+#define IMAGE_SIZE 4096
+#define SECTIONS_OFFSET 0x100
+#define SECDIR_OFFSET 0x800
+#define SECDIR_SIZE 0x100
+
+/*
+ * verify.c and pe.c need Cryptlib, so the checks verify_buffer() makes
+ * are stand-ins here.  verify_buffer_authenticode() counts its calls and
+ * returns authenticode_status; verify_sbat_section() treats a missing
+ * .sbat section exactly the way pe.c's does, and accepts any other.
+ */
+static UINTN n_authenticode;
+static EFI_STATUS authenticode_status = EFI_SUCCESS;
+
+EFI_STATUS
+verify_buffer_authenticode (char *data, int datasize,
+			    PE_COFF_LOADER_IMAGE_CONTEXT *context,
+			    authenticode_digests_t *digests,
+			    bool parent_verified)
+{
+	n_authenticode += 1;
+	if (authenticode_status == EFI_SUCCESS)
+		verification_method = VERIFIED_BY_HASH;
+	return authenticode_status;
+}
+
+EFI_STATUS
+verify_sbat_section(char *SBATBase, size_t SBATSize)
+{
+	if (SBATBase == NULL || SBATSize == 0)
+		return in_protocol ? EFI_SUCCESS : EFI_SECURITY_VIOLATION;
+	return EFI_SUCCESS;
+}
+
+UINT32
+authenticode_algorithms(void)
+{
+	return SHIM_HASH_SHA256;
+}
+
+EFI_STATUS
+generate_hashes (char *data, unsigned int datasize,
+		 PE_COFF_LOADER_IMAGE_CONTEXT *context, UINT32 algorithms,
+		 authenticode_digests_t *digests)
+{
+	EFI_STATUS efi_status;
+
+	efi_status = sha256_sum(data, SECDIR_OFFSET, digests->sha256);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+	digests->algorithms = SHIM_HASH_SHA256;
+	return EFI_SUCCESS;
+}
+
+/*
+ * An image with one section, which can be named .sbat or not, and a
+ * certificate table at SECDIR_OFFSET.  seed makes its contents, and so
+ * its digests, different from every other test's.
+ */
+typedef struct {
+	UINT8 data[IMAGE_SIZE];
+	EFI_IMAGE_DATA_DIRECTORY secdir;
+	PE_COFF_LOADER_IMAGE_CONTEXT context;
+} mock_image_t;
+
+static void
+mock_image_init(mock_image_t *image, UINTN seed, BOOLEAN has_sbat)
+{
+	EFI_IMAGE_SECTION_HEADER *section;
+
+	SetMem(image, sizeof(*image), 0);
+	for (UINTN i = 0; i < IMAGE_SIZE; i++)
+		image->data[i] = (seed * 131 + i * 17) & 0xff;
+
+	section = (EFI_IMAGE_SECTION_HEADER *)&image->data[SECTIONS_OFFSET];
+	SetMem(section, sizeof(*section), 0);
+	CopyMem(section->Name, has_sbat ? ".sbat\0\0\0" : ".text\0\0\0", 8);
+	section->Misc.VirtualSize = 0x80;
+	section->SizeOfRawData = 0x200;
+	section->PointerToRawData = 0x400;
+
+	image->secdir.VirtualAddress = SECDIR_OFFSET;
+	image->secdir.Size = SECDIR_SIZE;
+	image->context.FirstSection = section;
+	image->context.NumberOfSections = 1;
+	image->context.SecDir = &image->secdir;
+}
+
+static EFI_STATUS
+verify_image(mock_image_t *image)
+{
+	authenticode_digests_t digests;
+
+	SetMem(&digests, sizeof(digests), 0);
+	return verify_buffer((char *)image->data, IMAGE_SIZE, &image->context,
+			     &digests, false);
+}
+
+/*
+ * The second time an image is checked, the signature checks are
+ * answered from the cache.
+ */
+static int
+test_cache_hit(void)
+{
+	static mock_image_t image;
+	EFI_STATUS efi_status;
+
+	mock_image_init(&image, 1, TRUE);
+	n_authenticode = 0;
+	in_protocol = 0;
+
+	for (UINTN i = 0; i < 4; i++) {
+		verification_method = VERIFIED_BY_NOTHING;
+		efi_status = verify_image(&image);
+		assert_equal_return(efi_status, EFI_SUCCESS, -1,
+				    "verify_buffer() failed: 0x%lx != 0x%lx\n");
+		assert_equal_return(verification_method, VERIFIED_BY_HASH, -1,
+				    "verification_method %d != %d\n");
+	}
+	assert_equal_return(n_authenticode, (UINTN)1, -1,
+			    "signatures checked %lu times instead of %lu\n");
+
+	/* a change of policy means asking again */
+	policy_generation += 1;
+	efi_status = verify_image(&image);
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "verify_buffer() failed: 0x%lx != 0x%lx\n");
+	assert_equal_return(n_authenticode, (UINTN)2, -1,
+			    "signatures checked %lu times instead of %lu\n");
+	return 0;
+}
+
+/*
+ * An image without a .sbat section may be verified through the protocol,
+ * but it mustn't be loaded by shim just because the protocol said yes to
+ * the same bytes earlier.
+ */
+static int
+test_sbat_not_cached(void)
+{
+	static mock_image_t image;
+	EFI_STATUS efi_status;
+
+	mock_image_init(&image, 2, FALSE);
+	n_authenticode = 0;
+
+	in_protocol = 1;
+	efi_status = verify_image(&image);
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "verify_buffer() in protocol: 0x%lx != 0x%lx\n");
+
+	in_protocol = 0;
+	efi_status = verify_image(&image);
+	assert_equal_return(efi_status, EFI_SECURITY_VIOLATION, -1,
+			    "verify_buffer() without SBAT: 0x%lx != 0x%lx\n");
+
+	in_protocol = 1;
+	efi_status = verify_image(&image);
+	in_protocol = 0;
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "verify_buffer() in protocol: 0x%lx != 0x%lx\n");
+
+	/* the signature checks were still only done once */
+	assert_equal_return(n_authenticode, (UINTN)1, -1,
+			    "signatures checked %lu times instead of %lu\n");
+	return 0;
+}
+
+/*
+ * Failures are cached too, and don't get as far as SBAT.
+ */
+static int
+test_failure_cached(void)
+{
+	static mock_image_t image;
+	EFI_STATUS efi_status;
+
+	mock_image_init(&image, 3, TRUE);
+	n_authenticode = 0;
+	authenticode_status = EFI_SECURITY_VIOLATION;
+
+	for (UINTN i = 0; i < 2; i++) {
+		efi_status = verify_image(&image);
+		if (efi_status != EFI_SECURITY_VIOLATION)
+			break;
+	}
+	authenticode_status = EFI_SUCCESS;
+	assert_equal_return(efi_status, EFI_SECURITY_VIOLATION, -1,
+			    "verify_buffer() of a bad image: 0x%lx != 0x%lx\n");
+	assert_equal_return(n_authenticode, (UINTN)1, -1,
+			    "signatures checked %lu times instead of %lu\n");
+
+	/* other signatures on the same code are a different question */
+	image.data[SECDIR_OFFSET] ^= 1;
+	efi_status = verify_image(&image);
+	assert_equal_return(efi_status, EFI_SUCCESS, -1,
+			    "verify_buffer() failed: 0x%lx != 0x%lx\n");
+	assert_equal_return(n_authenticode, (UINTN)2, -1,
+			    "signatures checked %lu times instead of %lu\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	int status = 0;
+
+	test(test_cache_hit);
+	test(test_sbat_not_cached);
+	test(test_failure_cached);
+
+	return status;
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -1,15 +1,39 @@
 // SPDX-License-Identifier: BSD-2-Clause-Patent
 #include "shim.h"
 
+/*
+ * Variables we've already measured, so the same contents aren't logged
+ * twice.  Only a digest of the data is kept; entries live in one growable
+ * array, chained into hash buckets keyed by that digest.
+ */
 typedef struct {
 	CHAR16 *VariableName;
-	EFI_GUID *VendorGuid;
-	VOID *Data;
+	EFI_GUID VendorGuid;
 	UINTN Size;
+	UINT8 Digest[SHA256_DIGEST_SIZE];
+	UINTN Next;		/* index + 1 of the next entry in the bucket */
 } VARIABLE_RECORD;
 
-UINTN measuredcount = 0;
-VARIABLE_RECORD *measureddata = NULL;
+#define MEASURED_MIN_ENTRIES	16
+
+static UINTN measuredcount = 0;
+static UINTN measuredmax = 0;	/* always a power of two */
+static VARIABLE_RECORD *measureddata = NULL;
+/* index + 1 of the first entry in each bucket, or 0; one per entry slot */
+static UINTN *measuredbuckets = NULL;
+
+/*
+ * The measurement protocols don't come and go once we're running, so
+ * find them (and whether there's really a TPM behind them) once.
+ */
+static struct {
+	BOOLEAN located;
+	efi_cc_protocol_t *cc;
+	efi_tpm_protocol_t *tpm;
+	efi_tpm2_protocol_t *tpm2;
+	EFI_STATUS tpm_status;
+} tpm_protocols;
+
 static BOOLEAN tpm_defective = FALSE;
 static BOOLEAN log_full_already_warned = FALSE;
 
@@ -109,6 +133,29 @@ static EFI_STATUS tpm_locate_protocol(efi_tpm_protocol_t **tpm,
 	return EFI_NOT_FOUND;
 }
 
+static void tpm_locate_protocols(void)
+{
+	EFI_STATUS efi_status;
+
+	if (tpm_protocols.located)
+		return;
+
+	efi_status = LibLocateProtocol(&EFI_CC_MEASUREMENT_PROTOCOL_GUID,
+				       (VOID **)&tpm_protocols.cc);
+	if (EFI_ERROR(efi_status))
+		tpm_protocols.cc = NULL;
+
+	tpm_protocols.tpm_status = tpm_locate_protocol(&tpm_protocols.tpm,
+						       &tpm_protocols.tpm2,
+						       NULL, NULL);
+	if (EFI_ERROR(tpm_protocols.tpm_status)) {
+		tpm_protocols.tpm = NULL;
+		tpm_protocols.tpm2 = NULL;
+	}
+
+	tpm_protocols.located = TRUE;
+}
+
 static void warn_first_log_full(void)
 {
 	if (!log_full_already_warned) {
@@ -129,9 +176,9 @@ static EFI_STATUS cc_log_event_raw(EFI_PHYSICAL_ADDRESS buf, UINTN size,
 	EFI_CC_MR_INDEX mr;
 	uint64_t flags = is_pe_image ? EFI_CC_FLAG_PE_COFF_IMAGE : 0;
 
-	efi_status = LibLocateProtocol(&EFI_CC_MEASUREMENT_PROTOCOL_GUID,
-				       (VOID **)&cc);
-	if (EFI_ERROR(efi_status) || !cc)
+	tpm_locate_protocols();
+	cc = tpm_protocols.cc;
+	if (!cc)
 		return EFI_SUCCESS;
 
 	efi_status = cc->map_pcr_to_mr_index(cc, pcr, &mr);
@@ -173,8 +220,6 @@ static EFI_STATUS tpm_log_event_raw(EFI_PHYSICAL_ADDRESS buf, UINTN size,
 	EFI_STATUS efi_status;
 	efi_tpm_protocol_t *tpm;
 	efi_tpm2_protocol_t *tpm2;
-	BOOLEAN old_caps;
-	EFI_TCG2_BOOT_SERVICE_CAPABILITY caps;
 
 	/* CC guest like TDX or SEV will measure the buffer and log the event,
 	   extend the result into a specific CC MR like TCG's PCR. It could
@@ -185,7 +230,10 @@ static EFI_STATUS tpm_log_event_raw(EFI_PHYSICAL_ADDRESS buf, UINTN size,
 	if (EFI_ERROR(efi_status))
 		return efi_status;
 
-	efi_status = tpm_locate_protocol(&tpm, &tpm2, &old_caps, &caps);
+	tpm_locate_protocols();
+	tpm = tpm_protocols.tpm;
+	tpm2 = tpm_protocols.tpm2;
+	efi_status = tpm_protocols.tpm_status;
 	if (EFI_ERROR(efi_status)) {
 #ifdef REQUIRE_TPM
 		perror(L"TPM logging failed: %r\n", efi_status);
@@ -241,11 +289,7 @@ static EFI_STATUS tpm_log_event_raw(EFI_PHYSICAL_ADDRESS buf, UINTN size,
 		UINT32 eventnum = 0;
 		EFI_PHYSICAL_ADDRESS lastevent;
 
-		efi_status = LibLocateProtocol(&EFI_TPM_GUID, (VOID **)&tpm);
-		if (EFI_ERROR(efi_status))
-			return EFI_SUCCESS;
-
-		if (!tpm_present(tpm))
+		if (tpm_defective)
 			return EFI_SUCCESS;
 
 		event = AllocatePool(sizeof(*event) + logsize);
@@ -299,6 +343,17 @@ EFI_STATUS tpm_log_event(EFI_PHYSICAL_ADDRESS buf, UINTN size, UINT8 pcr,
 				 strlen((char *)description) + 1, EV_IPL, NULL);
 }
 
+/*
+ * Only a TPM 1.2 has to be handed an image's SHA-1 Authenticode digest;
+ * TPM 2 and CC firmware hash the image themselves.
+ */
+BOOLEAN tpm_wants_sha1(void)
+{
+	tpm_locate_protocols();
+	return !EFI_ERROR(tpm_protocols.tpm_status) && !tpm_protocols.tpm2 &&
+	       tpm_protocols.tpm && !tpm_defective;
+}
+
 EFI_STATUS tpm_log_pe(EFI_PHYSICAL_ADDRESS buf, UINTN size,
 		      EFI_PHYSICAL_ADDRESS addr, EFI_DEVICE_PATH *path,
 		      UINT8 *sha1hash, UINT8 pcr)
@@ -342,49 +397,101 @@ typedef struct {
 	INT8 VariableData[1];
 } __attribute__ ((packed)) EFI_VARIABLE_DATA_TREE;
 
-static BOOLEAN tpm_data_measured(CHAR16 *VarName, EFI_GUID VendorGuid, UINTN VarSize, VOID *VarData)
+static UINTN tpm_measured_bucket(UINT8 *Digest)
 {
-	UINTN i;
+	UINT64 key;
 
-	for (i=0; i<measuredcount; i++) {
-		if ((StrCmp (VarName, measureddata[i].VariableName) == 0) &&
-		    (CompareGuid (&VendorGuid, measureddata[i].VendorGuid)) &&
-		    (VarSize == measureddata[i].Size) &&
-		    (CompareMem (VarData, measureddata[i].Data, VarSize) == 0)) {
-			return TRUE;
-		}
-	}
+	/* the digest is already as well mixed as anything we could do */
+	CopyMem(&key, Digest, sizeof(key));
+	return key & (measuredmax - 1);
+}
 
-	return FALSE;
+static void tpm_link_measurement(UINTN i)
+{
+	UINTN bucket = tpm_measured_bucket(measureddata[i].Digest);
+
+	measureddata[i].Next = measuredbuckets[bucket];
+	measuredbuckets[bucket] = i + 1;
 }
 
-static EFI_STATUS tpm_record_data_measurement(CHAR16 *VarName, EFI_GUID VendorGuid, UINTN VarSize, VOID *VarData)
+static EFI_STATUS tpm_grow_measurements(void)
 {
-	if (measureddata == NULL) {
-		measureddata = AllocatePool(sizeof(*measureddata));
-	} else {
-		measureddata = ReallocatePool(measuredcount * sizeof(*measureddata),
-					      (measuredcount + 1) * sizeof(*measureddata),
-					      measureddata);
-	}
+	VARIABLE_RECORD *new_data;
+	UINTN *new_buckets;
+	UINTN new_max;
 
-	if (measureddata == NULL)
+	new_max = measuredmax ? measuredmax * 2 : MEASURED_MIN_ENTRIES;
+	if (new_max < measuredmax)
 		return EFI_OUT_OF_RESOURCES;
 
-	measureddata[measuredcount].VariableName = AllocatePool(StrSize(VarName));
-	measureddata[measuredcount].VendorGuid = AllocatePool(sizeof(EFI_GUID));
-	measureddata[measuredcount].Data = AllocatePool(VarSize);
+	new_data = AllocateZeroPool(new_max * sizeof(*new_data));
+	if (!new_data)
+		return EFI_OUT_OF_RESOURCES;
 
-	if (measureddata[measuredcount].VariableName == NULL ||
-	    measureddata[measuredcount].VendorGuid == NULL ||
-	    measureddata[measuredcount].Data == NULL) {
+	new_buckets = AllocateZeroPool(new_max * sizeof(*new_buckets));
+	if (!new_buckets) {
+		FreePool(new_data);
 		return EFI_OUT_OF_RESOURCES;
 	}
 
-	StrCpy(measureddata[measuredcount].VariableName, VarName);
-	CopyMem(measureddata[measuredcount].VendorGuid, &VendorGuid, sizeof(EFI_GUID));
-	CopyMem(measureddata[measuredcount].Data, VarData, VarSize);
-	measureddata[measuredcount].Size = VarSize;
+	if (measureddata) {
+		CopyMem(new_data, measureddata,
+			measuredcount * sizeof(*measureddata));
+		FreePool(measureddata);
+	}
+	if (measuredbuckets)
+		FreePool(measuredbuckets);
+
+	measureddata = new_data;
+	measuredbuckets = new_buckets;
+	measuredmax = new_max;
+	for (UINTN i = 0; i < measuredcount; i++)
+		tpm_link_measurement(i);
+
+	return EFI_SUCCESS;
+}
+
+static BOOLEAN tpm_data_measured(CHAR16 *VarName, EFI_GUID VendorGuid, UINTN VarSize, UINT8 *Digest)
+{
+	UINTN n;
+
+	if (measuredcount == 0)
+		return FALSE;
+
+	n = measuredbuckets[tpm_measured_bucket(Digest)];
+	for (; n; n = measureddata[n - 1].Next) {
+		VARIABLE_RECORD *vr = &measureddata[n - 1];
+
+		if (VarSize == vr->Size &&
+		    CompareMem(Digest, vr->Digest, sizeof(vr->Digest)) == 0 &&
+		    CompareGuid(&VendorGuid, &vr->VendorGuid) &&
+		    StrCmp(VarName, vr->VariableName) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static EFI_STATUS tpm_record_data_measurement(CHAR16 *VarName, EFI_GUID VendorGuid, UINTN VarSize, UINT8 *Digest)
+{
+	VARIABLE_RECORD *vr;
+	EFI_STATUS efi_status;
+
+	if (measuredcount == measuredmax) {
+		efi_status = tpm_grow_measurements();
+		if (EFI_ERROR(efi_status))
+			return efi_status;
+	}
+
+	vr = &measureddata[measuredcount];
+	vr->VariableName = StrDuplicate(VarName);
+	if (vr->VariableName == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	CopyMem(&vr->VendorGuid, &VendorGuid, sizeof(EFI_GUID));
+	vr->Size = VarSize;
+	CopyMem(vr->Digest, Digest, sizeof(vr->Digest));
+	tpm_link_measurement(measuredcount);
 	measuredcount++;
 
 	return EFI_SUCCESS;
@@ -396,9 +503,14 @@ EFI_STATUS tpm_measure_variable(CHAR16 *VarName, EFI_GUID VendorGuid, UINTN VarS
 	UINTN VarNameLength;
 	EFI_VARIABLE_DATA_TREE *VarLog;
 	UINT32 VarLogSize;
+	UINT8 Digest[SHA256_DIGEST_SIZE];
+
+	efi_status = sha256_sum(VarData, VarSize, Digest);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
 
 	/* Don't measure something that we've already measured */
-	if (tpm_data_measured(VarName, VendorGuid, VarSize, VarData))
+	if (tpm_data_measured(VarName, VendorGuid, VarSize, Digest))
 		return EFI_SUCCESS;
 
 	VarNameLength = StrLen (VarName);
@@ -432,18 +544,14 @@ EFI_STATUS tpm_measure_variable(CHAR16 *VarName, EFI_GUID VendorGuid, UINTN VarS
 		return efi_status;
 
 	return tpm_record_data_measurement(VarName, VendorGuid, VarSize,
-					   VarData);
+					   Digest);
 }
 
 EFI_STATUS
 fallback_should_prefer_reset(void)
 {
-	EFI_STATUS efi_status;
-	efi_tpm_protocol_t *tpm;
-	efi_tpm2_protocol_t *tpm2;
-
-	efi_status = tpm_locate_protocol(&tpm, &tpm2, NULL, NULL);
-	if (EFI_ERROR(efi_status))
+	tpm_locate_protocols();
+	if (EFI_ERROR(tpm_protocols.tpm_status))
 		return EFI_NOT_FOUND;
 	return EFI_SUCCESS;
 }
@@ -453,19 +561,18 @@ static void DESTRUCTOR
 tpm_clean_up_measurements(void)
 {
 	for (UINTN i = 0; i < measuredcount; i++) {
-		VARIABLE_RECORD *vr = &measureddata[i];
-
-		if (vr->VariableName)
-			FreePool(vr->VariableName);
-		if (vr->VendorGuid)
-			FreePool(vr->VendorGuid);
-		if (vr->Data)
-			FreePool(vr->Data);
+		if (measureddata[i].VariableName)
+			FreePool(measureddata[i].VariableName);
 	}
 	if (measureddata)
 		FreePool(measureddata);
+	if (measuredbuckets)
+		FreePool(measuredbuckets);
 
 	measuredcount = 0;
+	measuredmax = 0;
 	measureddata = NULL;
+	measuredbuckets = NULL;
+	SetMem(&tpm_protocols, sizeof(tpm_protocols), 0);
 }
 #endif
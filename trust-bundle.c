@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * trust-bundle.c - apply the revocations and certificates carried in
+ * the sections of a verified revocations, certificate or trust bundle
+ * image
+ */
+
+#include "shim.h"
+
+static void
+check_section_helper(char *section_name, int len, void **pointer,
+                     EFI_IMAGE_SECTION_HEADER *Section, void *data,
+                     int datasize, size_t minsize)
+{
+	if (CompareMem(Section->Name, section_name, len) == 0) {
+		*pointer = ImageAddress(data, datasize, Section->PointerToRawData);
+		if (Section->SizeOfRawData < minsize) {
+			dprint(L"found and rejected %.*a bad size\n", len, section_name);
+			dprint(L"minsize: %d\n", minsize);
+			dprint(L"rawsize: %d\n", Section->SizeOfRawData);
+			return ;
+		}
+		if (!*pointer) {
+			return ;
+		}
+		dprint(L"found %.*a\n", len, section_name);
+	}
+}
+
+#define check_section(section_name, pointer, section, data, datasize, minsize) \
+	check_section_helper(section_name, sizeof(section_name) - 1, pointer,  \
+	                     section, data, datasize, minsize)
+
+/*
+ * Apply the SBAT level and SkuSiPolicy updates in the .sbat[al] and
+ * .ssp[vs][al] sections of a verified image.
+ */
+EFI_STATUS
+apply_revocations(void *data, int datasize,
+		  PE_COFF_LOADER_IMAGE_CONTEXT *context)
+{
+	EFI_STATUS efi_status = EFI_SUCCESS;
+	EFI_IMAGE_SECTION_HEADER *Section;
+	unsigned int i;
+	char *sbat_var_automatic = NULL;
+	char *sbat_var_latest = NULL;
+	uint8_t *ssps_automatic = NULL;
+	uint8_t *sspv_automatic = NULL;
+	uint8_t *ssps_latest = NULL;
+	uint8_t *sspv_latest = NULL;
+
+	Section = context->FirstSection;
+	for (i = 0; i < context->NumberOfSections; i++, Section++) {
+		dprint(L"checking section \"%c%c%c%c%c%c%c%c\"\n", (char *)Section->Name);
+		check_section(".sbata\0\0", (void **)&sbat_var_automatic, Section,
+				data, datasize, sizeof(SBAT_VAR_ORIGINAL));
+		check_section(".sbatl\0\0", (void **)&sbat_var_latest, Section,
+				data, datasize, sizeof(SBAT_VAR_ORIGINAL));
+		check_section(".sspva\0\0", (void **)&sspv_automatic, Section,
+				data, datasize, SSPVER_SIZE);
+		check_section(".sspsa\0\0", (void **)&ssps_automatic, Section,
+				data, datasize, SSPSIG_SIZE);
+		check_section(".sspvl\0\0", (void **)&sspv_latest, Section,
+				data, datasize, SSPVER_SIZE);
+		check_section(".sspsl\0\0", (void **)&ssps_latest, Section,
+				data, datasize, SSPSIG_SIZE);
+	}
+
+	if (sbat_var_latest && sbat_var_automatic) {
+		dprint(L"attempting to update SBAT_LEVEL\n");
+		efi_status = set_sbat_uefi_variable(sbat_var_automatic,
+				sbat_var_latest);
+	} else {
+		dprint(L"no data for SBAT_LEVEL\n");
+	}
+
+	if ((sspv_automatic && ssps_automatic) || (sspv_latest && ssps_latest)) {
+		dprint(L"attempting to update SkuSiPolicy\n");
+		efi_status = set_ssp_uefi_variable(sspv_automatic, ssps_automatic,
+				sspv_latest, ssps_latest);
+
+	} else {
+		dprint(L"no data for SkuSiPolicy\n");
+	}
+
+	return efi_status;
+}
+
+/*
+ * Append the EFI_SIGNATURE_LISTs in the .db sections of a verified image
+ * to user_cert.
+ */
+EFI_STATUS
+apply_cert_sections(void *data, int datasize,
+		    PE_COFF_LOADER_IMAGE_CONTEXT *context)
+{
+	EFI_IMAGE_SECTION_HEADER *Section;
+	EFI_SIGNATURE_LIST *certlist;
+	void *pointer;
+	UINT32 original;
+	UINT32 offset;
+	int i;
+
+	Section = context->FirstSection;
+	for (i = 0; i < context->NumberOfSections; i++, Section++) {
+		UINT32 sec_size = MIN(Section->Misc.VirtualSize, Section->SizeOfRawData);
+
+		if (CompareMem(Section->Name, ".db\0\0\0\0\0", 8) == 0) {
+			offset = 0;
+			while ((sec_size - offset) >= sizeof(EFI_SIGNATURE_LIST)) {
+				UINT8 *tmp;
+
+				original = user_cert_size;
+				pointer = ImageAddress(data, datasize,
+						   Section->PointerToRawData + offset);
+				if (!pointer) {
+				    break;
+				}
+				certlist = pointer;
+
+				if (certlist->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) ||
+					checked_add(offset, certlist->SignatureListSize, &offset) ||
+					offset > sec_size ||
+					checked_add(user_cert_size, certlist->SignatureListSize,
+						    &user_cert_size)) {
+					break;
+				}
+
+				tmp = ReallocatePool(original,
+						     user_cert_size,
+						     user_cert);
+				if (!tmp)
+					return EFI_OUT_OF_RESOURCES;
+				user_cert = tmp;
+				policy_generation++;
+
+				CopyMem(user_cert + original, pointer,
+				    certlist->SignatureListSize);
+			}
+		}
+	}
+	return EFI_SUCCESS;
+}
+
+/*
+ * Apply a verified trust bundle: its revocations first, then its
+ * certificates.  The bundle was verified under the SBAT level and
+ * SkuSiPolicy in force before its own revocations, so it's verified
+ * again under the new ones before any of its certificates are trusted,
+ * just as a separate certificate file would be.
+ */
+EFI_STATUS
+apply_trust_bundle(void *data, int datasize, EFI_LOADED_IMAGE *li,
+		   PE_COFF_LOADER_IMAGE_CONTEXT *context)
+{
+	EFI_STATUS efi_status;
+
+	efi_status = apply_revocations(data, datasize, context);
+	if (EFI_ERROR(efi_status)) {
+		LogError(L"trust bundle revocations were not applied: %r\n",
+			 efi_status);
+		return efi_status;
+	}
+
+	efi_status = verify_image(data, datasize, li, context);
+	if (EFI_ERROR(efi_status)) {
+		dprint(L"trust bundle failed to verify after its revocations\n");
+		return efi_status;
+	}
+
+	return apply_cert_sections(data, datasize, context);
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: BSD-2-Clause-Patent
+/*
+ * verify-buffer.c - verify_buffer(), and what it remembers about the
+ * images it has already checked
+ */
+
+#include "shim.h"
+
+/*
+ * Check that the binary is permitted to load by SBAT.
+ */
+static EFI_STATUS
+verify_buffer_sbat (char *data, int datasize,
+		    PE_COFF_LOADER_IMAGE_CONTEXT *context)
+{
+	int i;
+	EFI_IMAGE_SECTION_HEADER *Section;
+	char *SBATBase = NULL;
+	size_t SBATSize = 0;
+
+	Section = context->FirstSection;
+	for (i = 0; i < context->NumberOfSections; i++, Section++) {
+		if ((uint64_t)(uintptr_t)&Section[1]
+		    > (uintptr_t)(uintptr_t)data + datasize) {
+			perror(L"Section exceeds bounds of image\n");
+			return EFI_UNSUPPORTED;
+		}
+
+		if (CompareMem(Section->Name, ".sbat\0\0\0", 8) != 0)
+			continue;
+
+		if (SBATBase || SBATSize) {
+			perror(L"Image has multiple SBAT sections\n");
+			return EFI_UNSUPPORTED;
+		}
+
+		if (Section->NumberOfRelocations != 0 ||
+		    Section->PointerToRelocations != 0) {
+			perror(L"SBAT section has relocations\n");
+			return EFI_UNSUPPORTED;
+		}
+
+		/* The virtual size corresponds to the size of the SBAT
+		 * metadata and isn't necessarily a multiple of the file
+		 * alignment. The on-disk size is a multiple of the file
+		 * alignment and is zero padded. Make sure that the
+		 * on-disk size is at least as large as virtual size,
+		 * and ignore the section if it isn't. */
+		if (Section->SizeOfRawData &&
+		    Section->SizeOfRawData >= Section->Misc.VirtualSize) {
+			uint64_t boundary;
+			SBATBase = ImageAddress(data, datasize,
+						Section->PointerToRawData);
+			SBATSize = Section->SizeOfRawData;
+			dprint(L"sbat section base:0x%lx size:0x%lx\n",
+			       SBATBase, SBATSize);
+			if (checked_add((uint64_t)(uintptr_t)SBATBase, SBATSize, &boundary) ||
+			    (boundary > (uint64_t)(uintptr_t)data + datasize)) {
+				perror(L"Section exceeds bounds of image\n");
+				return EFI_UNSUPPORTED;
+			}
+		}
+	}
+
+	return verify_sbat_section(SBATBase, SBATSize);
+}
+
+/*
+ * What verify_buffer_authenticode() decided about the images it's
+ * already seen this boot, so a loader asking about the same kernel again
+ * doesn't repeat the denylist, allowlist and signature checks.  An image
+ * is known by its SHA-256 Authenticode digest, its size, and a digest of
+ * the signatures it carries, since those aren't covered by the
+ * Authenticode digest.  A result only counts while both the variables
+ * and the in-memory policy it was reached under are unchanged.
+ *
+ * The SBAT check isn't cached: it's cheap, and its answer for an image
+ * without a .sbat section depends on whether we're in the protocol.
+ */
+#define VERIFY_CACHE_ENTRIES 16
+
+typedef struct {
+	UINT8 sha256[SHA256_DIGEST_SIZE];
+	UINT8 secdir_sha256[SHA256_DIGEST_SIZE];
+	UINTN size;
+} verify_cache_key_t;
+
+typedef struct {
+	BOOLEAN valid;
+	verify_cache_key_t key;
+	UINTN variable_generation;
+	UINTN policy_generation;
+	EFI_STATUS status;
+	BOOLEAN sets_method;
+	verification_method_t method;
+} verify_cache_entry_t;
+
+static verify_cache_entry_t verify_cache[VERIFY_CACHE_ENTRIES];
+static UINTN verify_cache_next;
+
+/*
+ * Fill in the cache key for an image, computing its digests first if
+ * the caller hasn't.  Images whose certificate table doesn't fit in them
+ * aren't cached; checking them is what reports the problem.
+ */
+static BOOLEAN
+verify_cache_key(char *data, int datasize,
+		 PE_COFF_LOADER_IMAGE_CONTEXT *context,
+		 authenticode_digests_t *digests, verify_cache_key_t *key)
+{
+	UINT32 algorithms = authenticode_algorithms();
+	size_t end;
+
+	if (datasize < 0)
+		return FALSE;
+
+	if ((digests->algorithms & algorithms) != algorithms &&
+	    EFI_ERROR(generate_hashes(data, datasize, context, algorithms,
+				      digests)))
+		return FALSE;
+
+	if (checked_add(context->SecDir->Size, context->SecDir->VirtualAddress,
+			&end) ||
+	    end > (size_t)datasize)
+		return FALSE;
+
+	SetMem(key, sizeof(*key), 0);
+	CopyMem(key->sha256, digests->sha256, SHA256_DIGEST_SIZE);
+	key->size = datasize;
+	return !EFI_ERROR(sha256_sum(data + context->SecDir->VirtualAddress,
+				     context->SecDir->Size,
+				     key->secdir_sha256));
+}
+
+static verify_cache_entry_t *
+verify_cache_lookup(verify_cache_key_t *key)
+{
+	for (UINTN i = 0; i < VERIFY_CACHE_ENTRIES; i++) {
+		verify_cache_entry_t *entry = &verify_cache[i];
+
+		if (entry->valid &&
+		    entry->variable_generation == variable_write_generation &&
+		    entry->policy_generation == policy_generation &&
+		    CompareMem(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * Only answers that depend on nothing but the image and the policy are
+ * worth remembering; running out of memory or a database we couldn't
+ * read says nothing about the next attempt.
+ */
+static void
+verify_cache_insert(verify_cache_key_t *key, EFI_STATUS status,
+		    verification_method_t before)
+{
+	verify_cache_entry_t *entry;
+
+	if (status != EFI_SUCCESS &&
+	    status != EFI_SECURITY_VIOLATION &&
+	    status != EFI_ACCESS_DENIED)
+		return;
+
+	entry = verify_cache_lookup(key);
+	if (!entry) {
+		entry = &verify_cache[verify_cache_next];
+		verify_cache_next = (verify_cache_next + 1) % VERIFY_CACHE_ENTRIES;
+	}
+
+	entry->valid = TRUE;
+	CopyMem(&entry->key, key, sizeof(*key));
+	entry->variable_generation = variable_write_generation;
+	entry->policy_generation = policy_generation;
+	entry->status = status;
+	entry->sets_method = verification_method != before;
+	entry->method = verification_method;
+}
+
+static EFI_STATUS
+verify_buffer_authenticode_cached (char *data, int datasize,
+				   PE_COFF_LOADER_IMAGE_CONTEXT *context,
+				   authenticode_digests_t *digests,
+				   bool parent_verified)
+{
+	verification_method_t before = verification_method;
+	verify_cache_key_t key;
+	verify_cache_entry_t *entry;
+	EFI_STATUS efi_status;
+
+	/*
+	 * An image our parent already verified only gets the cheap dbx
+	 * digest check, so there's nothing to save there.
+	 */
+	if (parent_verified ||
+	    !verify_cache_key(data, datasize, context, digests, &key))
+		return verify_buffer_authenticode(data, datasize, context,
+						  digests, parent_verified);
+
+	entry = verify_cache_lookup(&key);
+	if (entry) {
+		dprint(L"using cached verification result: %r\n",
+		       entry->status);
+		if (entry->sets_method)
+			verification_method = entry->method;
+		return entry->status;
+	}
+
+	efi_status = verify_buffer_authenticode(data, datasize, context,
+						digests, false);
+	verify_cache_insert(&key, efi_status, before);
+	return efi_status;
+}
+
+/*
+ * Check that the signature is valid and matches the binary and that
+ * the binary is permitted to load by SBAT.
+ */
+EFI_STATUS
+verify_buffer (char *data, int datasize,
+	       PE_COFF_LOADER_IMAGE_CONTEXT *context,
+	       authenticode_digests_t *digests,
+	       bool parent_verified)
+{
+	EFI_STATUS efi_status;
+
+	efi_status = verify_buffer_authenticode_cached(data, datasize, context,
+						       digests,
+						       parent_verified);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+
+	return verify_buffer_sbat(data, datasize, context);
+}
+
+// vim:fenc=utf-8:tw=75:noet
@@ -38,17 +38,38 @@ typedef enum {
 	VAR_NOT_FOUND
 } CHECK_STATUS;
 
+static BOOLEAN openssl_initialized = FALSE;
+
+/*
+ * Loading OpenSSL's error strings is a noticeable part of our startup,
+ * and an image that's allowed by its hash never gets as far as parsing a
+ * certificate, so this happens the first time something is about to,
+ * not when shim starts.
+ */
 void
 init_openssl(void)
 {
+	if (openssl_initialized)
+		return;
+
 	OPENSSL_init();
 	ossl_err_load_crypto_strings();
+	openssl_initialized = TRUE;
 }
 
+/*
+ * Until init_openssl() has run nothing has used OpenSSL, so there's
+ * nothing in its error queue, and no reason to set the queue up just to
+ * find that out.
+ */
 static void
 drain_openssl_errors(void)
 {
 	unsigned long err = -1;
+
+	if (!openssl_initialized)
+		return;
+
 	while (err != 0)
 		err = ERR_get_error();
 }
@@ -85,104 +106,379 @@ verify_x509(UINT8 *Cert, UINTN CertSize)
 }
 
 static BOOLEAN
-verify_eku(UINT8 *Cert, UINTN CertSize)
+verify_eku(X509 *x509)
 {
-	X509 *x509;
-	CONST UINT8 *Temp = Cert;
+	static ASN1_OBJECT *module_signing;
 	EXTENDED_KEY_USAGE *eku;
-	ASN1_OBJECT *module_signing;
-
-        module_signing = OBJ_nid2obj(OBJ_create(OID_EKU_MODSIGN,
-                                                "modsign-eku",
-                                                "modsign-eku"));
+	BOOLEAN ret = TRUE;
 
-	x509 = d2i_X509 (NULL, &Temp, (long) CertSize);
-	if (x509 != NULL) {
-		eku = X509_get_ext_d2i(x509, NID_ext_key_usage, NULL, NULL);
+	if (!module_signing)
+		module_signing = OBJ_nid2obj(OBJ_create(OID_EKU_MODSIGN,
+							"modsign-eku",
+							"modsign-eku"));
 
-		if (eku) {
-			int i = 0;
-			for (i = 0; i < sk_ASN1_OBJECT_num(eku); i++) {
-				ASN1_OBJECT *key_usage = sk_ASN1_OBJECT_value(eku, i);
+	eku = X509_get_ext_d2i(x509, NID_ext_key_usage, NULL, NULL);
+	if (eku) {
+		int i = 0;
+		for (i = 0; i < sk_ASN1_OBJECT_num(eku); i++) {
+			ASN1_OBJECT *key_usage = sk_ASN1_OBJECT_value(eku, i);
 
-				if (OBJ_cmp(module_signing, key_usage) == 0)
-					return FALSE;
+			if (OBJ_cmp(module_signing, key_usage) == 0) {
+				ret = FALSE;
+				break;
 			}
-			EXTENDED_KEY_USAGE_free(eku);
 		}
+		EXTENDED_KEY_USAGE_free(eku);
+	}
 
+	return ret;
+}
+
+/*
+ * Decode a certificate we trust, or return NULL if it isn't a usable
+ * anchor.
+ */
+static X509 *
+decode_anchor(UINT8 *Cert, UINTN CertSize)
+{
+	CONST UINT8 *Temp = Cert;
+	X509 *x509;
+
+	init_openssl();
+	x509 = d2i_X509(NULL, &Temp, (long)CertSize);
+	if (x509 && !verify_eku(x509)) {
 		X509_free(x509);
+		x509 = NULL;
 	}
 
-	return TRUE;
+	return x509;
 }
 
-static CHECK_STATUS
-check_db_cert_in_ram(EFI_SIGNATURE_LIST *CertList, UINTN dbsize,
-                     WIN_CERTIFICATE_EFI_PKCS *data, UINT8 *hash,
-                     CHAR16 *dbname, EFI_GUID guid)
+/*
+ * The built-in certificates, decoded the first time they're needed.
+ * These have never been subject to the EKU check.
+ */
+static X509 *
+builtin_anchor(X509 **x509p, UINT8 *cert, UINTN cert_size)
 {
+	CONST UINT8 *Temp = cert;
+
+	if (!*x509p) {
+		init_openssl();
+		*x509p = d2i_X509(NULL, &Temp, (long)cert_size);
+	}
+	return *x509p;
+}
+
+/*
+ * The X509 certificates in a signature database, decoded and
+ * EKU-checked once instead of for every signature on every image, and
+ * the store every signature's chain is built against.  x509s[i] is the
+ * certificate in anchors[i], or NULL if it isn't usable as a trust
+ * anchor.
+ */
+typedef struct {
+	EFI_SIGNATURE_DATA *sig;
+	UINT32 sig_size;
+	UINTN list;
+} x509_anchor_t;
+
+typedef struct {
+	UINTN n_anchors;
+	X509 **x509s;
+	VOID *store;
+	x509_anchor_t anchors[];
+} x509_anchors_t;
+
+static void
+x509_anchors_free(x509_anchors_t *anchors)
+{
+	if (!anchors)
+		return;
+	Pkcs7FreeAnchorStore(anchors->store);
+	if (anchors->x509s) {
+		for (UINTN i = 0; i < anchors->n_anchors; i++)
+			X509_free(anchors->x509s[i]);
+		FreePool(anchors->x509s);
+	}
+	FreePool(anchors);
+}
+
+static x509_anchors_t *
+x509_anchors_new(EFI_SIGNATURE_LIST *CertList, UINTN dbsize, CHAR16 *dbname)
+{
+	EFI_SIGNATURE_LIST *List = CertList;
 	EFI_SIGNATURE_DATA *Cert;
-	UINTN CertSize;
-	BOOLEAN IsFound = FALSE;
-	int i = 0;
+	UINTN size = dbsize, n = 0, CertSize;
+	x509_anchors_t *anchors;
 
-	while ((dbsize > 0) && (dbsize >= CertList->SignatureListSize)) {
+	while ((size > 0) && (size >= List->SignatureListSize)) {
+		if (List->SignatureListSize < sizeof(EFI_SIGNATURE_LIST))
+			break;
+		if (CompareGuid (&List->SignatureType, &EFI_CERT_TYPE_X509_GUID))
+			n++;
+		size -= List->SignatureListSize;
+		List = (EFI_SIGNATURE_LIST *) ((UINT8 *) List + List->SignatureListSize);
+	}
+
+	anchors = AllocateZeroPool(sizeof(*anchors) + n * sizeof(x509_anchor_t));
+	if (!anchors)
+		return NULL;
+	if (n) {
+		anchors->x509s = AllocateZeroPool(n * sizeof(X509 *));
+		if (!anchors->x509s) {
+			FreePool(anchors);
+			return NULL;
+		}
+	}
+
+	for (UINTN i = 0; (dbsize > 0) && (dbsize >= CertList->SignatureListSize); i++) {
+		if (CertList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST))
+			break;
 		if (CompareGuid (&CertList->SignatureType, &EFI_CERT_TYPE_X509_GUID)) {
+			UINTN j = anchors->n_anchors++;
+			x509_anchor_t *anchor = &anchors->anchors[j];
+
 			Cert = (EFI_SIGNATURE_DATA *) ((UINT8 *) CertList + sizeof (EFI_SIGNATURE_LIST) + CertList->SignatureHeaderSize);
 			CertSize = CertList->SignatureSize - sizeof(EFI_GUID);
-			dprint(L"trying to verify cert %d (%s)\n", i, dbname);
+			anchor->sig = Cert;
+			anchor->sig_size = CertList->SignatureSize;
+			anchor->list = i;
 			if (verify_x509(Cert->SignatureData, CertSize)) {
-				if (verify_eku(Cert->SignatureData, CertSize)) {
-					drain_openssl_errors();
-					IsFound = AuthenticodeVerify (data->CertData,
-								      data->Hdr.dwLength - sizeof(data->Hdr),
-								      Cert->SignatureData,
-								      CertSize,
-								      hash, SHA256_DIGEST_SIZE);
-					if (IsFound) {
-						dprint(L"AuthenticodeVerify() succeeded: %d\n", IsFound);
-						tpm_measure_variable(dbname, guid, CertList->SignatureSize, Cert);
-						drain_openssl_errors();
-						return DATA_FOUND;
-					} else {
-						LogError(L"AuthenticodeVerify(): %d\n", IsFound);
-					}
-				}
+				anchors->x509s[j] = decode_anchor(Cert->SignatureData,
+								  CertSize);
 			} else if (verbose) {
 				console_print(L"Not a DER encoded x.509 Certificate");
-				dprint(L"cert:\n");
+				dprint(L"cert %ld (%s):\n", i, dbname);
 				dhexdumpat(Cert->SignatureData, CertSize, 0);
 			}
 		}
 
 		dbsize -= CertList->SignatureListSize;
 		CertList = (EFI_SIGNATURE_LIST *) ((UINT8 *) CertList + CertList->SignatureListSize);
-		i += 1;
 	}
 
-	return DATA_NOT_FOUND;
+	/*
+	 * If there's no memory for the store, AuthenticodeVerifyAnchors()
+	 * builds one for each call instead.
+	 */
+	anchors->store = Pkcs7NewAnchorStore((VOID **)anchors->x509s,
+					     anchors->n_anchors);
+
+	return anchors;
 }
 
+/*
+ * Check a signature from AuthenticodeParse() against the certificates in
+ * a buffer of EFI_SIGNATURE_LISTs, measuring the first one it chains to.
+ * If anchorsp is set, the decoded certificates are kept there for the
+ * next call; it's up to the caller to free them when the buffer goes
+ * away.
+ */
 static CHECK_STATUS
-check_db_cert(CHAR16 *dbname, EFI_GUID guid, WIN_CERTIFICATE_EFI_PKCS *data,
-              UINT8 *hash)
+check_db_cert_in_ram(EFI_SIGNATURE_LIST *CertList, UINTN dbsize,
+                     VOID *data, CHAR16 *dbname, EFI_GUID guid,
+                     x509_anchors_t **anchorsp)
+{
+	x509_anchors_t *anchors = anchorsp ? *anchorsp : NULL;
+	CHECK_STATUS rc = DATA_NOT_FOUND;
+	UINTN i = 0;
+
+	if (!anchors) {
+		anchors = x509_anchors_new(CertList, dbsize, dbname);
+		if (!anchors) {
+			LogError(L"Could not allocate %s certificates\n", dbname);
+			return DATA_NOT_FOUND;
+		}
+		if (anchorsp)
+			*anchorsp = anchors;
+	}
+
+	if (anchors->n_anchors) {
+		dprint(L"trying to verify %ld certs (%s)\n", anchors->n_anchors,
+		       dbname);
+		drain_openssl_errors();
+		if (AuthenticodeVerifyAnchors(data, anchors->store,
+					      (VOID **)anchors->x509s,
+					      anchors->n_anchors, &i)) {
+			x509_anchor_t *anchor = &anchors->anchors[i];
+
+			dprint(L"AuthenticodeVerify() succeeded with cert %ld\n",
+			       anchor->list);
+			tpm_measure_variable(dbname, guid, anchor->sig_size, anchor->sig);
+			drain_openssl_errors();
+			rc = DATA_FOUND;
+		} else {
+			LogError(L"AuthenticodeVerify(): %d\n", FALSE);
+		}
+	}
+
+	if (!anchorsp)
+		x509_anchors_free(anchors);
+
+	return rc;
+}
+
+/*
+ * The signature databases we check every image against.  Each one is
+ * read from firmware the first time it's needed and kept for the rest of
+ * the boot; any variable write shim makes bumps
+ * variable_write_generation, and the next lookup reads it again.
+ */
+typedef struct {
+	CHAR16 *name;
+	EFI_GUID *guid;
+	BOOLEAN valid;
+	UINTN generation;
+	EFI_STATUS status;
+	UINT8 *data;
+	UINTN size;
+	esl_index_t *sha256_index;
+	esl_index_t *sha1_index;
+	x509_anchors_t *anchors;
+} sigdb_cache_entry_t;
+
+static sigdb_cache_entry_t sigdb_cache[] = {
+	{ .name = L"db", .guid = &EFI_SECURE_BOOT_DB_GUID },
+	{ .name = L"dbx", .guid = &EFI_SECURE_BOOT_DB_GUID },
+	{ .name = L"MokListRT", .guid = &SHIM_LOCK_GUID },
+	{ .name = L"MokListX", .guid = &SHIM_LOCK_GUID },
+};
+static const UINTN n_sigdb_cache = sizeof(sigdb_cache) / sizeof(sigdb_cache[0]);
+
+/*
+ * Digest indexes and decoded certificates for the built-in lists, which
+ * never change.
+ */
+static esl_index_t *vendor_dbx_sha256_index;
+static esl_index_t *vendor_dbx_sha1_index;
+static x509_anchors_t *vendor_dbx_anchors;
+#if defined(VENDOR_DB_FILE)
+static esl_index_t *vendor_db_sha256_index;
+static x509_anchors_t *vendor_db_anchors;
+#endif
+#if defined(ENABLE_SHIM_CERT)
+static X509 *build_cert_x509;
+#endif
+#if defined(VENDOR_CERT_FILE)
+static X509 *vendor_cert_x509;
+#endif
+
+static void
+sigdb_cache_drop(sigdb_cache_entry_t *entry)
+{
+	esl_index_free(entry->sha256_index);
+	entry->sha256_index = NULL;
+	esl_index_free(entry->sha1_index);
+	entry->sha1_index = NULL;
+	x509_anchors_free(entry->anchors);
+	entry->anchors = NULL;
+	if (entry->data)
+		FreePool(entry->data);
+	entry->data = NULL;
+	entry->size = 0;
+	entry->valid = FALSE;
+}
+
+void
+free_sigdb_cache(void)
+{
+	for (UINTN i = 0; i < n_sigdb_cache; i++)
+		sigdb_cache_drop(&sigdb_cache[i]);
+
+	esl_index_free(vendor_dbx_sha256_index);
+	vendor_dbx_sha256_index = NULL;
+	esl_index_free(vendor_dbx_sha1_index);
+	vendor_dbx_sha1_index = NULL;
+	x509_anchors_free(vendor_dbx_anchors);
+	vendor_dbx_anchors = NULL;
+#if defined(VENDOR_DB_FILE)
+	esl_index_free(vendor_db_sha256_index);
+	vendor_db_sha256_index = NULL;
+	x509_anchors_free(vendor_db_anchors);
+	vendor_db_anchors = NULL;
+#endif
+#if defined(ENABLE_SHIM_CERT)
+	X509_free(build_cert_x509);
+	build_cert_x509 = NULL;
+#endif
+#if defined(VENDOR_CERT_FILE)
+	X509_free(vendor_cert_x509);
+	vendor_cert_x509 = NULL;
+#endif
+}
+
+/*
+ * Find the variable's contents, from the cache if we can.  If *cachedp
+ * is NULL on return the caller must FreePool() *data; otherwise it
+ * belongs to that cache entry.
+ */
+static EFI_STATUS
+get_sigdb(CHAR16 *dbname, EFI_GUID guid, UINT8 **data, UINTN *size,
+	  sigdb_cache_entry_t **cachedp)
+{
+	sigdb_cache_entry_t *entry = NULL;
+
+	for (UINTN i = 0; i < n_sigdb_cache; i++) {
+		if (CompareGuid(sigdb_cache[i].guid, &guid) &&
+		    StrCmp(sigdb_cache[i].name, dbname) == 0) {
+			entry = &sigdb_cache[i];
+			break;
+		}
+	}
+
+	*cachedp = entry;
+	if (!entry) {
+		*size = 0;
+		return get_variable(dbname, data, size, guid);
+	}
+
+	if (entry->valid && entry->generation != variable_write_generation)
+		sigdb_cache_drop(entry);
+
+	if (!entry->valid) {
+		entry->size = 0;
+		entry->status = get_variable(entry->name, &entry->data,
+					     &entry->size, *entry->guid);
+		if (EFI_ERROR(entry->status)) {
+			entry->data = NULL;
+			entry->size = 0;
+		}
+		/*
+		 * A variable that doesn't exist is as cacheable as one that
+		 * does, but anything else may be transient.
+		 */
+		entry->generation = variable_write_generation;
+		entry->valid = !EFI_ERROR(entry->status) ||
+			       entry->status == EFI_NOT_FOUND;
+	}
+
+	*data = entry->data;
+	*size = entry->size;
+	return entry->status;
+}
+
+static CHECK_STATUS
+check_db_cert(CHAR16 *dbname, EFI_GUID guid, VOID *data)
 {
 	CHECK_STATUS rc;
 	EFI_STATUS efi_status;
 	EFI_SIGNATURE_LIST *CertList;
 	UINTN dbsize = 0;
 	UINT8 *db;
+	sigdb_cache_entry_t *cached;
 
-	efi_status = get_variable(dbname, &db, &dbsize, guid);
+	efi_status = get_sigdb(dbname, guid, &db, &dbsize, &cached);
 	if (EFI_ERROR(efi_status))
 		return VAR_NOT_FOUND;
 
 	CertList = (EFI_SIGNATURE_LIST *)db;
 
-	rc = check_db_cert_in_ram(CertList, dbsize, data, hash, dbname, guid);
+	rc = check_db_cert_in_ram(CertList, dbsize, data, dbname, guid,
+				  cached ? &cached->anchors : NULL);
 
-	FreePool(db);
+	if (!cached)
+		FreePool(db);
 
 	return rc;
 }
@@ -230,6 +526,34 @@ check_db_hash_in_ram(EFI_SIGNATURE_LIST *CertList, UINTN dbsize, UINT8 *data,
 	return DATA_NOT_FOUND;
 }
 
+/*
+ * check_db_hash_in_ram(), but through a digest index which is built the
+ * first time the list is consulted and kept in *indexp.
+ */
+static CHECK_STATUS
+check_db_hash_indexed(esl_index_t **indexp, EFI_SIGNATURE_LIST *CertList,
+		      UINTN dbsize, UINT8 *data, int SignatureSize,
+		      EFI_GUID CertType, CHAR16 *dbname, EFI_GUID guid)
+{
+	EFI_SIGNATURE_DATA *Cert;
+	UINT32 CertSize = 0;
+
+	if (!*indexp)
+		*indexp = esl_index_new(CertList, dbsize, &CertType,
+					SignatureSize);
+	if (!*indexp)
+		return check_db_hash_in_ram(CertList, dbsize, data,
+					    SignatureSize, CertType,
+					    dbname, guid);
+
+	Cert = esl_index_find(*indexp, data, &CertSize);
+	if (!Cert)
+		return DATA_NOT_FOUND;
+
+	tpm_measure_variable(dbname, guid, CertSize, Cert);
+	return DATA_FOUND;
+}
+
 /*
  * Check a hash against an EFI_SIGNATURE_LIST in a UEFI variable
  */
@@ -241,46 +565,132 @@ check_db_hash(CHAR16 *dbname, EFI_GUID guid, UINT8 *data, int SignatureSize,
 	EFI_SIGNATURE_LIST *CertList;
 	UINTN dbsize = 0;
 	UINT8 *db;
+	sigdb_cache_entry_t *cached;
+	esl_index_t **indexp = NULL;
 
-	efi_status = get_variable(dbname, &db, &dbsize, guid);
+	efi_status = get_sigdb(dbname, guid, &db, &dbsize, &cached);
 	if (EFI_ERROR(efi_status)) {
 		return VAR_NOT_FOUND;
 	}
 
 	CertList = (EFI_SIGNATURE_LIST *)db;
 
+	if (cached && CompareGuid(&CertType, &EFI_CERT_SHA256_GUID))
+		indexp = &cached->sha256_index;
+	else if (cached && CompareGuid(&CertType, &EFI_CERT_SHA1_GUID))
+		indexp = &cached->sha1_index;
+
+	if (indexp)
+		return check_db_hash_indexed(indexp, CertList, dbsize, data,
+					     SignatureSize, CertType,
+					     dbname, guid);
+
 	CHECK_STATUS rc = check_db_hash_in_ram(CertList, dbsize, data,
 					       SignatureSize, CertType,
 					       dbname, guid);
-	FreePool(db);
+	if (!cached)
+		FreePool(db);
 	return rc;
 }
 
+/*
+ * Whether anything will look at an image's SHA-1 Authenticode digest:
+ * a SHA-1 list in dbx, db or the built-in denylist, or a TPM 1.2 to log
+ * it to.  Most machines have none of those, and then hashing the image
+ * only has to produce SHA-256.  The answer holds until a variable or the
+ * policy changes.
+ */
+static struct {
+	BOOLEAN valid;
+	UINTN variable_generation;
+	UINTN policy_generation;
+	BOOLEAN wanted;
+} sha1_consumers;
+
+static BOOLEAN
+sigdb_has_sha1(CHAR16 *dbname, EFI_GUID guid)
+{
+	EFI_STATUS efi_status;
+	UINTN dbsize = 0;
+	UINT8 *db = NULL;
+	sigdb_cache_entry_t *cached;
+	BOOLEAN found;
+
+	efi_status = get_sigdb(dbname, guid, &db, &dbsize, &cached);
+	if (efi_status == EFI_NOT_FOUND)
+		return FALSE;
+	/*
+	 * If we can't read it now we may be able to later, so assume
+	 * the worst.
+	 */
+	if (EFI_ERROR(efi_status))
+		return TRUE;
+
+	found = !EFI_ERROR(find_type_in_esl(db, dbsize, &EFI_CERT_SHA1_GUID));
+	if (!cached)
+		FreePool(db);
+	return found;
+}
+
+/*
+ * The Authenticode digests the image hashing paths should compute.
+ */
+UINT32
+authenticode_algorithms(void)
+{
+	if (!sha1_consumers.valid ||
+	    sha1_consumers.variable_generation != variable_write_generation ||
+	    sha1_consumers.policy_generation != policy_generation) {
+		sha1_consumers.wanted = tpm_wants_sha1();
+		if (!sha1_consumers.wanted && secure_mode()) {
+			sha1_consumers.wanted =
+				!EFI_ERROR(find_type_in_esl(vendor_deauthorized,
+							    vendor_deauthorized_size,
+							    &EFI_CERT_SHA1_GUID)) ||
+				sigdb_has_sha1(L"dbx", EFI_SECURE_BOOT_DB_GUID) ||
+				sigdb_has_sha1(L"db", EFI_SECURE_BOOT_DB_GUID);
+		}
+		dprint(L"SHA-1 Authenticode digests are %a\n",
+		       sha1_consumers.wanted ? "needed" : "not needed");
+		sha1_consumers.variable_generation = variable_write_generation;
+		sha1_consumers.policy_generation = policy_generation;
+		sha1_consumers.valid = TRUE;
+	}
+
+	if (sha1_consumers.wanted)
+		return SHIM_HASH_SHA1 | SHIM_HASH_SHA256;
+	return SHIM_HASH_SHA256;
+}
+
 /*
  * Check whether the binary signature or hash are present in dbx or the
- * built-in denylist
+ * built-in denylist.  cert is a signature from AuthenticodeParse(), or
+ * NULL to check only the hashes.
  */
 static EFI_STATUS
-check_denylist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
+check_denylist(VOID *cert, UINT8 *sha256hash,
                UINT8 *sha1hash)
 {
 	EFI_SIGNATURE_LIST *dbx = (EFI_SIGNATURE_LIST *)vendor_deauthorized;
 
-	if (check_db_hash_in_ram(dbx, vendor_deauthorized_size, sha256hash,
-			SHA256_DIGEST_SIZE, EFI_CERT_SHA256_GUID, L"dbx",
-			EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
+	if (check_db_hash_indexed(&vendor_dbx_sha256_index, dbx,
+				  vendor_deauthorized_size, sha256hash,
+				  SHA256_DIGEST_SIZE, EFI_CERT_SHA256_GUID,
+				  L"dbx", EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
 		LogError(L"binary sha256hash found in vendor dbx\n");
 		return EFI_SECURITY_VIOLATION;
 	}
-	if (check_db_hash_in_ram(dbx, vendor_deauthorized_size, sha1hash,
-				 SHA1_DIGEST_SIZE, EFI_CERT_SHA1_GUID, L"dbx",
-				 EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
+	if (check_db_hash_indexed(&vendor_dbx_sha1_index, dbx,
+				  vendor_deauthorized_size, sha1hash,
+				  SHA1_DIGEST_SIZE, EFI_CERT_SHA1_GUID,
+				  L"dbx", EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
 		LogError(L"binary sha1hash found in vendor dbx\n");
 		return EFI_SECURITY_VIOLATION;
 	}
 	if (cert &&
-	    check_db_cert_in_ram(dbx, vendor_deauthorized_size, cert, sha256hash, L"dbx",
-				 EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
+	    check_db_cert_in_ram(dbx, vendor_deauthorized_size, cert, L"dbx",
+				 EFI_SECURE_BOOT_DB_GUID,
+				 &vendor_dbx_anchors) == DATA_FOUND) {
 		LogError(L"cert sha256hash found in vendor dbx\n");
 		return EFI_SECURITY_VIOLATION;
 	}
@@ -296,7 +706,7 @@ check_denylist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 	}
 	if (cert &&
 	    check_db_cert(L"dbx", EFI_SECURE_BOOT_DB_GUID,
-			  cert, sha256hash) == DATA_FOUND) {
+			  cert) == DATA_FOUND) {
 		LogError(L"cert sha256hash found in system dbx\n");
 		return EFI_SECURITY_VIOLATION;
 	}
@@ -307,7 +717,7 @@ check_denylist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 	}
 	if (cert &&
 	    check_db_cert(L"MokListX", SHIM_LOCK_GUID,
-			  cert, sha256hash) == DATA_FOUND) {
+			  cert) == DATA_FOUND) {
 		LogError(L"cert sha256hash found in Mok dbx\n");
 		return EFI_SECURITY_VIOLATION;
 	}
@@ -324,10 +734,11 @@ update_verification_method(verification_method_t method)
 }
 
 /*
- * Check whether the binary signature or hash are present in db or MokList
+ * Check whether the binary signature or hash are present in db or MokList.
+ * cert is as for check_denylist().
  */
 static EFI_STATUS
-check_allowlist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
+check_allowlist(VOID *cert, UINT8 *sha256hash,
                 UINT8 *sha1hash)
 {
 	if (!ignore_db) {
@@ -346,7 +757,7 @@ check_allowlist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 		} else {
 			LogError(L"check_db_hash(db, sha1hash) != DATA_FOUND\n");
 		}
-		if (cert && check_db_cert(L"db", EFI_SECURE_BOOT_DB_GUID, cert, sha256hash)
+		if (cert && check_db_cert(L"db", EFI_SECURE_BOOT_DB_GUID, cert)
 					== DATA_FOUND) {
 			verification_method = VERIFIED_BY_CERT;
 			update_verification_method(VERIFIED_BY_CERT);
@@ -359,10 +770,10 @@ check_allowlist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 #if defined(VENDOR_DB_FILE)
 	EFI_SIGNATURE_LIST *db = (EFI_SIGNATURE_LIST *)vendor_db;
 
-	if (check_db_hash_in_ram(db, vendor_db_size,
-				 sha256hash, SHA256_DIGEST_SIZE,
-				 EFI_CERT_SHA256_GUID, L"vendor_db",
-				 EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
+	if (check_db_hash_indexed(&vendor_db_sha256_index, db, vendor_db_size,
+				  sha256hash, SHA256_DIGEST_SIZE,
+				  EFI_CERT_SHA256_GUID, L"vendor_db",
+				  EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
 		verification_method = VERIFIED_BY_HASH;
 		update_verification_method(VERIFIED_BY_HASH);
 		return EFI_SUCCESS;
@@ -371,8 +782,9 @@ check_allowlist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 	}
 	if (cert &&
 	    check_db_cert_in_ram(db, vendor_db_size,
-				 cert, sha256hash, L"vendor_db",
-				 EFI_SECURE_BOOT_DB_GUID) == DATA_FOUND) {
+				 cert, L"vendor_db",
+				 EFI_SECURE_BOOT_DB_GUID,
+				 &vendor_db_anchors) == DATA_FOUND) {
 		verification_method = VERIFIED_BY_CERT;
 		update_verification_method(VERIFIED_BY_CERT);
 		return EFI_SUCCESS;
@@ -390,7 +802,7 @@ check_allowlist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 	} else {
 		LogError(L"check_db_hash(MokListRT, sha256hash) != DATA_FOUND\n");
 	}
-	if (cert && check_db_cert(L"MokListRT", SHIM_LOCK_GUID, cert, sha256hash)
+	if (cert && check_db_cert(L"MokListRT", SHIM_LOCK_GUID, cert)
 			== DATA_FOUND) {
 		verification_method = VERIFIED_BY_CERT;
 		update_verification_method(VERIFIED_BY_CERT);
@@ -404,10 +816,12 @@ check_allowlist(WIN_CERTIFICATE_EFI_PKCS *cert, UINT8 *sha256hash,
 }
 
 static EFI_STATUS
-verify_one_signature(WIN_CERTIFICATE_EFI_PKCS *sig, UINT8 *sha256hash,
-                     UINT8 *sha1hash)
+verify_parsed_signature(VOID *sig, UINT8 *sha256hash, UINT8 *sha1hash)
 {
 	EFI_STATUS efi_status;
+#if defined(ENABLE_SHIM_CERT) || defined(VENDOR_CERT_FILE)
+	UINTN i = 0;
+#endif
 
 	/*
 	 * Ensure that the binary isn't forbidden
@@ -450,10 +864,9 @@ verify_one_signature(WIN_CERTIFICATE_EFI_PKCS *sig, UINT8 *sha256hash,
 		dprint("verifying against shim cert\n");
 	}
 	if (build_cert && build_cert_size &&
-	    AuthenticodeVerify(sig->CertData,
-		       sig->Hdr.dwLength - sizeof(sig->Hdr),
-		       build_cert, build_cert_size, sha256hash,
-		       SHA256_DIGEST_SIZE)) {
+	    builtin_anchor(&build_cert_x509, build_cert, build_cert_size) &&
+	    AuthenticodeVerifyAnchors(sig, NULL, (VOID **)&build_cert_x509,
+				      1, &i)) {
 		dprint(L"AuthenticodeVerify(shim_cert) succeeded\n");
 		update_verification_method(VERIFIED_BY_CERT);
 		tpm_measure_variable(L"Shim", SHIM_LOCK_GUID,
@@ -478,10 +891,9 @@ verify_one_signature(WIN_CERTIFICATE_EFI_PKCS *sig, UINT8 *sha256hash,
 		dprint("verifying against vendor_cert\n");
 	}
 	if (vendor_cert_size &&
-	    AuthenticodeVerify(sig->CertData,
-			       sig->Hdr.dwLength - sizeof(sig->Hdr),
-			       vendor_cert, vendor_cert_size,
-			       sha256hash, SHA256_DIGEST_SIZE)) {
+	    builtin_anchor(&vendor_cert_x509, vendor_cert, vendor_cert_size) &&
+	    AuthenticodeVerifyAnchors(sig, NULL, (VOID **)&vendor_cert_x509,
+				      1, &i)) {
 		dprint(L"AuthenticodeVerify(vendor_cert) succeeded\n");
 		update_verification_method(VERIFIED_BY_CERT);
 		tpm_measure_variable(L"Shim", SHIM_LOCK_GUID,
@@ -501,18 +913,54 @@ verify_one_signature(WIN_CERTIFICATE_EFI_PKCS *sig, UINT8 *sha256hash,
 }
 
 /*
- * Check that the signature is valid and matches the binary
+ * Parse the signature and check it against the image once; all that's
+ * left for each database after that is whether it chains to one of the
+ * certificates there.  The caller has already checked the image's hashes
+ * against every database, so if the signature itself doesn't hold up
+ * there's nothing else that could allow it.
  */
 static EFI_STATUS
+verify_one_signature(WIN_CERTIFICATE_EFI_PKCS *sig, UINT8 *sha256hash,
+                     UINT8 *sha1hash)
+{
+	EFI_STATUS efi_status;
+	VOID *parsed = NULL;
+
+	init_openssl();
+	drain_openssl_errors();
+	if (!AuthenticodeParse(sig->CertData,
+			       sig->Hdr.dwLength - sizeof(sig->Hdr),
+			       sha256hash, SHA256_DIGEST_SIZE, &parsed)) {
+		dprint(L"AuthenticodeParse() failed\n");
+		PrintErrors();
+		ClearErrors();
+		crypterr(EFI_NOT_FOUND);
+		return EFI_NOT_FOUND;
+	}
+
+	efi_status = verify_parsed_signature(parsed, sha256hash, sha1hash);
+	AuthenticodeFree(parsed);
+	return efi_status;
+}
+
+/*
+ * Check that the signature is valid and matches the binary.  If the
+ * caller has already computed the image's digests, they're used as-is;
+ * otherwise they're computed here and handed back in *digests.
+ */
+EFI_STATUS
 verify_buffer_authenticode (char *data, int datasize,
 			    PE_COFF_LOADER_IMAGE_CONTEXT *context,
-			    UINT8 *sha256hash, UINT8 *sha1hash,
+			    authenticode_digests_t *digests,
 			    bool parent_verified)
 {
 	EFI_STATUS ret_efi_status;
 	size_t size = datasize;
 	size_t offset = 0;
 	unsigned int i = 0;
+	UINT8 *sha256hash = digests->sha256;
+	UINT8 *sha1hash = digests->sha1;
+	UINT32 algorithms;
 
 	if (datasize < 0)
 		return EFI_INVALID_PARAMETER;
@@ -520,17 +968,23 @@ verify_buffer_authenticode (char *data, int datasize,
 	/*
 	 * Clear OpenSSL's error log, because we get some DSO unimplemented
 	 * errors during its intialization, and we don't want those to look
-	 * like they're the reason for validation failures.
+	 * like they're the reason for validation failures.  If nothing has
+	 * initialized it yet, this doesn't either; an image that's allowed
+	 * by its hash never needs OpenSSL at all.
 	 */
 	drain_openssl_errors();
 
-	ret_efi_status = generate_hash(data, datasize, context, sha256hash, sha1hash);
-	if (EFI_ERROR(ret_efi_status)) {
-		dprint(L"generate_hash: %r\n", ret_efi_status);
-		PrintErrors();
-		ClearErrors();
-		crypterr(ret_efi_status);
-		return ret_efi_status;
+	algorithms = authenticode_algorithms();
+	if ((digests->algorithms & algorithms) != algorithms) {
+		ret_efi_status = generate_hashes(data, datasize, context,
+						 algorithms, digests);
+		if (EFI_ERROR(ret_efi_status)) {
+			dprint(L"generate_hashes: %r\n", ret_efi_status);
+			PrintErrors();
+			ClearErrors();
+			crypterr(ret_efi_status);
+			return ret_efi_status;
+		}
 	}
 
 	/*
@@ -652,86 +1106,6 @@ verify_buffer_authenticode (char *data, int datasize,
 	return ret_efi_status;
 }
 
-/*
- * Check that the binary is permitted to load by SBAT.
- */
-static EFI_STATUS
-verify_buffer_sbat (char *data, int datasize,
-		    PE_COFF_LOADER_IMAGE_CONTEXT *context)
-{
-	int i;
-	EFI_IMAGE_SECTION_HEADER *Section;
-	char *SBATBase = NULL;
-	size_t SBATSize = 0;
-
-	Section = context->FirstSection;
-	for (i = 0; i < context->NumberOfSections; i++, Section++) {
-		if ((uint64_t)(uintptr_t)&Section[1]
-		    > (uintptr_t)(uintptr_t)data + datasize) {
-			perror(L"Section exceeds bounds of image\n");
-			return EFI_UNSUPPORTED;
-		}
-
-		if (CompareMem(Section->Name, ".sbat\0\0\0", 8) != 0)
-			continue;
-
-		if (SBATBase || SBATSize) {
-			perror(L"Image has multiple SBAT sections\n");
-			return EFI_UNSUPPORTED;
-		}
-
-		if (Section->NumberOfRelocations != 0 ||
-		    Section->PointerToRelocations != 0) {
-			perror(L"SBAT section has relocations\n");
-			return EFI_UNSUPPORTED;
-		}
-
-		/* The virtual size corresponds to the size of the SBAT
-		 * metadata and isn't necessarily a multiple of the file
-		 * alignment. The on-disk size is a multiple of the file
-		 * alignment and is zero padded. Make sure that the
-		 * on-disk size is at least as large as virtual size,
-		 * and ignore the section if it isn't. */
-		if (Section->SizeOfRawData &&
-		    Section->SizeOfRawData >= Section->Misc.VirtualSize) {
-			uint64_t boundary;
-			SBATBase = ImageAddress(data, datasize,
-						Section->PointerToRawData);
-			SBATSize = Section->SizeOfRawData;
-			dprint(L"sbat section base:0x%lx size:0x%lx\n",
-			       SBATBase, SBATSize);
-			if (checked_add((uint64_t)(uintptr_t)SBATBase, SBATSize, &boundary) ||
-			    (boundary > (uint64_t)(uintptr_t)data + datasize)) {
-				perror(L"Section exceeds bounds of image\n");
-				return EFI_UNSUPPORTED;
-			}
-		}
-	}
-
-	return verify_sbat_section(SBATBase, SBATSize);
-}
-
-/*
- * Check that the signature is valid and matches the binary and that
- * the binary is permitted to load by SBAT.
- */
-EFI_STATUS
-verify_buffer (char *data, int datasize,
-	       PE_COFF_LOADER_IMAGE_CONTEXT *context,
-	       UINT8 *sha256hash, UINT8 *sha1hash,
-	       bool parent_verified)
-{
-	EFI_STATUS efi_status;
-
-	efi_status = verify_buffer_authenticode(data, datasize, context,
-						sha256hash, sha1hash,
-						parent_verified);
-	if (EFI_ERROR(efi_status))
-		return efi_status;
-
-	return verify_buffer_sbat(data, datasize, context);
-}
-
 /*
  * Protocol entry point. If secure boot is enabled, verify that the provided
  * buffer is signed with a trusted key.
@@ -741,8 +1115,7 @@ shim_verify(void *buffer, UINT32 size)
 {
 	EFI_STATUS efi_status = EFI_SUCCESS;
 	PE_COFF_LOADER_IMAGE_CONTEXT context;
-	UINT8 sha1hash[SHA1_DIGEST_SIZE];
-	UINT8 sha256hash[SHA256_DIGEST_SIZE];
+	authenticode_digests_t digests;
 
 	if ((INT32)size < 0)
 		return EFI_INVALID_PARAMETER;
@@ -753,8 +1126,12 @@ shim_verify(void *buffer, UINT32 size)
 	if (EFI_ERROR(efi_status))
 		goto done;
 
-	efi_status = generate_hash(buffer, size, &context,
-				   sha256hash, sha1hash);
+	/*
+	 * These digests are used both for the TPM measurement and for
+	 * verify_buffer() below, so the image is only hashed once.
+	 */
+	efi_status = generate_hashes(buffer, size, &context,
+				     authenticode_algorithms(), &digests);
 	if (EFI_ERROR(efi_status))
 		goto done;
 
@@ -763,7 +1140,7 @@ shim_verify(void *buffer, UINT32 size)
 	efi_status =
 #endif
 	tpm_log_pe((EFI_PHYSICAL_ADDRESS)(UINTN)buffer, size, 0, NULL,
-		   sha1hash, 4);
+		   digests.sha1, 4);
 #ifdef REQUIRE_TPM
 	if (EFI_ERROR(efi_status))
 		goto done;
@@ -775,8 +1152,7 @@ shim_verify(void *buffer, UINT32 size)
 	}
 
 	efi_status = verify_buffer(buffer, size,
-				   &context, sha256hash, sha1hash,
-				   false);
+				   &context, &digests, false);
 done:
 	in_protocol = 0;
 	return efi_status;